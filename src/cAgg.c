@@ -0,0 +1,568 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cAgg.c
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-12
+ * Description  : DBF分组聚合实现
+     1.每块记录先逐行定位分组(相邻行分组键相同时不再查Hash表)，再逐个聚合项按列累加
+     2.分组状态从每个线程自己的内存池中分配，不逐个malloc
+     3.MIN、MAX保存原始字节，用CompareFieldBytes比较，不损失精度
+     4.结果在一次申请的内存中，FreeAggResult一次释放
+**********************************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cDBF.h"
+#include "cAgg.h"
+#include "cHash.h"
+#include "cField.h"
+#include "cScan.h"
+#include "cDBFInner.h"
+
+//分组表的初始桶个数
+#define AGG_BUCKETS 1024
+//内存池每次申请的字节数
+#define AGG_POOL_CHUNK (64 * 1024)
+
+//解析后的聚合项
+typedef struct TAggSpecDef
+{
+    DBFAggFunc Func;
+    DBFField *Field;            //COUNT时可以为NULL
+    int Offset;                 //列在记录中的偏移
+    int RawOffset;              //MIN、MAX在分组状态原始字节区中的偏移
+}AggSpecDef;
+
+//一个聚合项的累加状态
+typedef struct TAggAcc
+{
+    long long Count;
+    long long Sum;
+}AggAcc;
+
+//分组状态，后面紧跟specCount个AggAcc和MIN、MAX的原始字节区
+typedef struct TAggGroup
+{
+    AggAcc Accs[1];
+}AggGroup;
+
+//内存池的一块
+typedef struct TAggChunk
+{
+    struct TAggChunk *Next;
+    char Data[];
+}AggChunk;
+
+//每个线程的局部状态
+typedef struct TAggThread
+{
+    HashTable *Groups;          //分组键 -> AggGroup
+    AggChunk *Chunks;           //内存池
+    int ChunkUsed;              //当前块已用字节数
+    AggGroup **RowGroups;       //一块记录中每行所属的分组，已删除的行为NULL
+    long long *Values;          //一块记录中一列解析后的数值
+    unsigned char *Present;     //一块记录中一列是否有值
+    char *KeyBuf;
+}AggThread;
+
+//聚合上下文
+typedef struct TAggContext
+{
+    int RecSize;
+    int GroupCount;
+    DBFField *GroupFields[DBF_AGG_MAXSPECS];
+    int GroupOffsets[DBF_AGG_MAXSPECS];
+    int KeyLen;
+    int SpecCount;
+    AggSpecDef Specs[DBF_AGG_MAXSPECS];
+    int GroupSize;              //每个分组状态的字节数
+    int RawSize;                //MIN、MAX原始字节区的字节数
+    AggThread *Threads;
+}AggContext;
+
+int ResolveAgg(CDBF *cDBF, char **groupBy, int groupCount, DBFAggSpec *specs, int specCount, AggContext *ctx);
+int AggBlock(const char *records, int firstRow, int count, int threadNo, void *userData);
+int SameGroupKey(AggContext *ctx, const char *a, const char *b);
+AggGroup *NewGroup(AggContext *ctx, AggThread *thread);
+int MergeGroup(AggContext *ctx, AggGroup *dst, AggGroup *src);
+void AccMinMax(AggSpecDef *spec, AggAcc *acc, char *raw, const char *value);
+int CompareGroupKey(const void *a, const void *b, void *arg);
+DBFAggResult *BuildAggResult(AggContext *ctx, HashTable *groups);
+void FreeAggThread(AggThread *thread);
+
+
+/*******************************************************************************
+* Function   : AggregateDBF
+* Description: 分组聚合
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+    * groupBy, 分组列名，groupCount为0时可以为NULL，整个表作为一个分组
+    * groupCount, 分组列个数
+    * specs, 聚合项
+    * specCount, 聚合项个数，不超过DBF_AGG_MAXSPECS
+    * nThreads, 扫描线程数
+* Output     :
+* Return     : 聚合结果，使用FreeAggResult释放; 返回NULL表示聚合失败(包括记录数超过INT_MAX)
+* Others     :
+    * SUM、AVG只支持N、F列，列值放大后或精确和超出long long的范围时返回NULL
+    * 没有记录时，不分组返回一个分组，分组返回0个分组
+*******************************************************************************/
+DBFAggResult *AggregateDBF(CDBF *cDBF, char **groupBy, int groupCount, DBFAggSpec *specs, int specCount, int nThreads)
+{
+    AggContext ctx;
+    if(DBF_SUCCESS != ResolveAgg(cDBF, groupBy, groupCount, specs, specCount, &ctx)){
+        return NULL;
+    }
+    if(nThreads < 1){
+        nThreads = 1;
+    }
+    if(nThreads > DBF_SCAN_MAXTHREADS){
+        nThreads = DBF_SCAN_MAXTHREADS;
+    }
+    int blockRecs = DBF_SCAN_BLOCK / ctx.RecSize + 1;
+    DBFAggResult *result = NULL;
+    ctx.Threads = calloc(nThreads, sizeof(AggThread));
+    if(NULL == ctx.Threads){
+        return NULL;
+    }
+    int i = 0;
+    for(i=0; i<nThreads; i++){
+        AggThread *thread = &ctx.Threads[i];
+        thread->Groups = CreateHash(AGG_BUCKETS);
+        thread->RowGroups = malloc(sizeof(AggGroup *) * blockRecs);
+        thread->Values = malloc(sizeof(long long) * blockRecs);
+        thread->Present = malloc(blockRecs);
+        thread->KeyBuf = malloc(ctx.KeyLen + 1);
+        if((NULL == thread->Groups) || (NULL == thread->RowGroups) || (NULL == thread->Values) ||
+            (NULL == thread->Present) || (NULL == thread->KeyBuf)){
+            goto Done;
+        }
+    }
+    //不分组时即使没有记录也要有一个分组
+    if(0 == ctx.GroupCount){
+        void **slot = HashSlot(ctx.Threads[0].Groups, "", 0);
+        if(NULL == slot){
+            goto Done;
+        }
+        *slot = NewGroup(&ctx, &ctx.Threads[0]);
+        if(NULL == *slot){
+            goto Done;
+        }
+    }
+    if(DBF_SUCCESS != ScanBlocks(cDBF, 1, IntRecCount(cDBF), nThreads, AggBlock, &ctx)){
+        goto Done;
+    }
+    //各线程的分组合并到第0个线程，分组状态仍在原线程的内存池中
+    for(i=1; i<nThreads; i++){
+        HashNode *node = NULL;
+        while(NULL != (node = HashNext(ctx.Threads[i].Groups, node))){
+            void **slot = HashSlot(ctx.Threads[0].Groups, node->Key, node->KeyLen);
+            if(NULL == slot){
+                goto Done;
+            }
+            if(NULL == *slot){
+                *slot = node->Value;
+            }
+            else if(DBF_SUCCESS != MergeGroup(&ctx, *slot, node->Value)){
+                goto Done;
+            }
+        }
+    }
+    result = BuildAggResult(&ctx, ctx.Threads[0].Groups);
+
+Done:
+    for(i=0; i<nThreads; i++){
+        FreeAggThread(&ctx.Threads[i]);
+    }
+    free(ctx.Threads);
+    return result;
+}
+
+
+/*******************************************************************************
+* Function   : FreeAggResult
+* Description: 释放AggregateDBF返回的聚合结果
+* Input      :
+    * result, 聚合结果
+* Output     :
+* Return     :
+* Others     :
+*******************************************************************************/
+void FreeAggResult(DBFAggResult *result)
+{
+    free(result);
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : ResolveAgg
+* Description: 按列名找到分组列和聚合列，计算分组状态的大小
+----------------------------------------------------------------------------*/
+int ResolveAgg(CDBF *cDBF, char **groupBy, int groupCount, DBFAggSpec *specs, int specCount, AggContext *ctx)
+{
+    if((groupCount < 0) || (groupCount > DBF_AGG_MAXSPECS) || (specCount <= 0) || (specCount > DBF_AGG_MAXSPECS)){
+        return DBF_FAIL;
+    }
+    memset(ctx, '\0', sizeof(AggContext));
+    ctx->RecSize = cDBF->Head->RecSize;
+    ctx->GroupCount = groupCount;
+    ctx->SpecCount = specCount;
+    int i = 0;
+    for(i=0; i<groupCount; i++){
+        int index = GetIndexByName(cDBF, groupBy[i]);
+        if(index < 0){
+            #ifdef DEBUG
+            printf("Debug ResolveAgg FieldName Not Exists, FieldName = %s\n", groupBy[i]);
+            #endif
+            return DBF_FAIL;
+        }
+        ctx->GroupFields[i] = &cDBF->Fields[index];
+        ctx->GroupOffsets[i] = cDBF->FieldOffsets[index];
+        ctx->KeyLen = ctx->KeyLen + cDBF->Fields[index].Width;
+    }
+    for(i=0; i<specCount; i++){
+        AggSpecDef *spec = &ctx->Specs[i];
+        spec->Func = specs[i].Func;
+        if((aggCount == spec->Func) && (NULL == specs[i].FieldName)){
+            continue;
+        }
+        int index = GetIndexByName(cDBF, specs[i].FieldName);
+        if(index < 0){
+            #ifdef DEBUG
+            printf("Debug ResolveAgg FieldName Not Exists, FieldName = %s\n", specs[i].FieldName);
+            #endif
+            return DBF_FAIL;
+        }
+        spec->Field = &cDBF->Fields[index];
+        spec->Offset = cDBF->FieldOffsets[index];
+        char type = spec->Field->FieldType;
+        if(((aggSum == spec->Func) || (aggAvg == spec->Func)) && (TYPE_NUMERIC != type) && (TYPE_FLOAT != type)){
+            #ifdef DEBUG
+            printf("Debug ResolveAgg SUM/AVG On Non Numeric Field, FieldName = %s\n", specs[i].FieldName);
+            #endif
+            return DBF_FAIL;
+        }
+        if((aggMin == spec->Func) || (aggMax == spec->Func)){
+            spec->RawOffset = ctx->RawSize;
+            ctx->RawSize = ctx->RawSize + spec->Field->Width;
+        }
+    }
+    //原始字节区按8字节对齐，下一个分组状态的AggAcc仍然对齐
+    ctx->GroupSize = sizeof(AggAcc) * specCount + ((ctx->RawSize + 7) & ~7);
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : AggBlock
+* Description: ScanBlocks的块回调，先定位每行的分组，再按聚合项逐列累加
+----------------------------------------------------------------------------*/
+int AggBlock(const char *records, int firstRow, int count, int threadNo, void *userData)
+{
+    AggContext *ctx = (AggContext *)userData;
+    AggThread *thread = &ctx->Threads[threadNo];
+    int recSize = ctx->RecSize;
+    AggGroup *last = NULL;
+    const char *lastRec = NULL;
+    int i = 0;
+    int j = 0;
+    for(i=0; i<count; i++){
+        const char *rec = records + ((long)i * recSize);
+        if(DELETED == rec[0]){
+            thread->RowGroups[i] = NULL;
+            continue;
+        }
+        //相邻记录分组键相同时(例如按分组列排过序)直接复用，不查Hash表
+        if((NULL != last) && SameGroupKey(ctx, rec, lastRec)){
+            thread->RowGroups[i] = last;
+            continue;
+        }
+        char *key = thread->KeyBuf;
+        for(j=0; j<ctx->GroupCount; j++){
+            memcpy(key, rec + ctx->GroupOffsets[j], ctx->GroupFields[j]->Width);
+            key = key + ctx->GroupFields[j]->Width;
+        }
+        void **slot = HashSlot(thread->Groups, thread->KeyBuf, ctx->KeyLen);
+        if(NULL == slot){
+            return DBF_FAIL;
+        }
+        if(NULL == *slot){
+            *slot = NewGroup(ctx, thread);
+            if(NULL == *slot){
+                return DBF_FAIL;
+            }
+        }
+        last = *slot;
+        lastRec = rec;
+        thread->RowGroups[i] = last;
+    }
+    for(j=0; j<ctx->SpecCount; j++){
+        AggSpecDef *spec = &ctx->Specs[j];
+        if((aggSum == spec->Func) || (aggAvg == spec->Func)){
+            if(DBF_SUCCESS != DecodeScaledColumn(records, recSize, count, spec->Offset, spec->Field, thread->Values, thread->Present)){
+                #ifdef DEBUG
+                printf("Debug AggBlock DecodeScaledColumn overflow, firstRow = %d\n", firstRow);
+                #endif
+                return DBF_FAIL;
+            }
+            for(i=0; i<count; i++){
+                if((NULL != thread->RowGroups[i]) && thread->Present[i]){
+                    AggAcc *acc = &thread->RowGroups[i]->Accs[j];
+                    acc->Count ++;
+                    //精确和超出long long时失败，不返回回绕后的结果
+                    if(__builtin_add_overflow(acc->Sum, thread->Values[i], &acc->Sum)){
+                        #ifdef DEBUG
+                        printf("Debug AggBlock Sum overflow, row = %d\n", firstRow + i);
+                        #endif
+                        return DBF_FAIL;
+                    }
+                }
+            }
+        }
+        else if((aggMin == spec->Func) || (aggMax == spec->Func)){
+            for(i=0; i<count; i++){
+                AggGroup *group = thread->RowGroups[i];
+                const char *value = records + ((long)i * recSize) + spec->Offset;
+                if((NULL != group) && !IsBlankField(value, spec->Field->Width)){
+                    char *raw = (char *)&group->Accs[ctx->SpecCount] + spec->RawOffset;
+                    AccMinMax(spec, &group->Accs[j], raw, value);
+                }
+            }
+        }
+        else{
+            for(i=0; i<count; i++){
+                AggGroup *group = thread->RowGroups[i];
+                if((NULL != group) && ((NULL == spec->Field) ||
+                    !IsBlankField(records + ((long)i * recSize) + spec->Offset, spec->Field->Width))){
+                    group->Accs[j].Count ++;
+                }
+            }
+        }
+    }
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : SameGroupKey
+* Description: 两条记录的分组列是否完全相同
+----------------------------------------------------------------------------*/
+int SameGroupKey(AggContext *ctx, const char *a, const char *b)
+{
+    int i = 0;
+    for(i=0; i<ctx->GroupCount; i++){
+        int offset = ctx->GroupOffsets[i];
+        if(0 != memcmp(a + offset, b + offset, ctx->GroupFields[i]->Width)){
+            return DBF_FALSE;
+        }
+    }
+    return DBF_TRUE;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : NewGroup
+* Description: 从线程的内存池中分配一个清零的分组状态
+----------------------------------------------------------------------------*/
+AggGroup *NewGroup(AggContext *ctx, AggThread *thread)
+{
+    int size = ctx->GroupSize;
+    if((NULL == thread->Chunks) || (thread->ChunkUsed + size > AGG_POOL_CHUNK)){
+        int chunkSize = (size > AGG_POOL_CHUNK) ? size : AGG_POOL_CHUNK;
+        AggChunk *chunk = malloc(sizeof(AggChunk) + chunkSize);
+        if(NULL == chunk){
+            return NULL;
+        }
+        chunk->Next = thread->Chunks;
+        thread->Chunks = chunk;
+        thread->ChunkUsed = 0;
+    }
+    AggGroup *group = (AggGroup *)(thread->Chunks->Data + thread->ChunkUsed);
+    thread->ChunkUsed = thread->ChunkUsed + size;
+    memset(group, '\0', size);
+    return group;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : MergeGroup
+* Description: 把另一个线程同一分组的累加状态合并进来，精确和溢出时返回DBF_FAIL
+----------------------------------------------------------------------------*/
+int MergeGroup(AggContext *ctx, AggGroup *dst, AggGroup *src)
+{
+    int i = 0;
+    for(i=0; i<ctx->SpecCount; i++){
+        AggSpecDef *spec = &ctx->Specs[i];
+        AggAcc *from = &src->Accs[i];
+        if(0 == from->Count){
+            continue;
+        }
+        if((aggMin == spec->Func) || (aggMax == spec->Func)){
+            char *dstRaw = (char *)&dst->Accs[ctx->SpecCount] + spec->RawOffset;
+            char *srcRaw = (char *)&src->Accs[ctx->SpecCount] + spec->RawOffset;
+            long long count = dst->Accs[i].Count;
+            AccMinMax(spec, &dst->Accs[i], dstRaw, srcRaw);
+            dst->Accs[i].Count = count + from->Count;
+        }
+        else{
+            dst->Accs[i].Count = dst->Accs[i].Count + from->Count;
+            if(__builtin_add_overflow(dst->Accs[i].Sum, from->Sum, &dst->Accs[i].Sum)){
+                return DBF_FAIL;
+            }
+        }
+    }
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : AccMinMax
+* Description: 用一个非空值更新MIN、MAX
+----------------------------------------------------------------------------*/
+void AccMinMax(AggSpecDef *spec, AggAcc *acc, char *raw, const char *value)
+{
+    if(0 == acc->Count){
+        memcpy(raw, value, spec->Field->Width);
+    }
+    else{
+        int c = CompareFieldBytes(spec->Field, value, raw);
+        if(((aggMin == spec->Func) && (c < 0)) || ((aggMax == spec->Func) && (c > 0))){
+            memcpy(raw, value, spec->Field->Width);
+        }
+    }
+    acc->Count ++;
+}
+
+
+
+/*----------------------------------------------------------------------------
+* Function   : CompareGroupKey
+* Description: qsort_r的比较函数，按分组列依次比较分组键
+----------------------------------------------------------------------------*/
+int CompareGroupKey(const void *a, const void *b, void *arg)
+{
+    AggContext *ctx = (AggContext *)arg;
+    const char *x = ((const DBFAggRow *)a)->Key;
+    const char *y = ((const DBFAggRow *)b)->Key;
+    int i = 0;
+    for(i=0; i<ctx->GroupCount; i++){
+        int c = CompareFieldBytes(ctx->GroupFields[i], x, y);
+        if(0 != c){
+            return c;
+        }
+        x = x + ctx->GroupFields[i]->Width;
+        y = y + ctx->GroupFields[i]->Width;
+    }
+    return 0;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : BuildAggResult
+* Description: 把合并后的分组表转换成结果，结果和其中的字符串在一次申请的内存中
+----------------------------------------------------------------------------*/
+DBFAggResult *BuildAggResult(AggContext *ctx, HashTable *groups)
+{
+    int rowCount = groups->Count;
+    int specCount = ctx->SpecCount;
+    long size = sizeof(DBFAggResult) + (long)rowCount * (sizeof(DBFAggRow) + sizeof(DBFAggValue) * specCount);
+    size = size + (long)rowCount * (ctx->KeyLen + 1);
+    int i = 0;
+    for(i=0; i<specCount; i++){
+        if((aggMin == ctx->Specs[i].Func) || (aggMax == ctx->Specs[i].Func)){
+            size = size + (long)rowCount * (ctx->Specs[i].Field->Width + 1);
+        }
+    }
+    DBFAggResult *result = malloc(size);
+    if(NULL == result){
+        return NULL;
+    }
+    result->RowCount = rowCount;
+    result->KeyLen = ctx->KeyLen;
+    result->ValueCount = specCount;
+    result->Rows = (DBFAggRow *)(result + 1);
+    DBFAggValue *values = (DBFAggValue *)(result->Rows + rowCount);
+    char *text = (char *)(values + (long)rowCount * specCount);
+    HashNode *node = NULL;
+    int row = 0;
+    while(NULL != (node = HashNext(groups, node))){
+        AggGroup *group = node->Value;
+        DBFAggRow *out = &result->Rows[row];
+        out->Key = text;
+        memcpy(text, node->Key, ctx->KeyLen);
+        text[ctx->KeyLen] = '\0';
+        text = text + ctx->KeyLen + 1;
+        out->Values = values + ((long)row * specCount);
+        for(i=0; i<specCount; i++){
+            AggSpecDef *spec = &ctx->Specs[i];
+            AggAcc *acc = &group->Accs[i];
+            DBFAggValue *value = &out->Values[i];
+            memset(value, '\0', sizeof(DBFAggValue));
+            value->Count = acc->Count;
+            if((aggMin == spec->Func) || (aggMax == spec->Func)){
+                int width = spec->Field->Width;
+                if(acc->Count > 0){
+                    //去掉前后的空格
+                    char *raw = (char *)&group->Accs[specCount] + spec->RawOffset;
+                    int start = 0;
+                    while((start < width) && (SPACE == raw[start])){
+                        start ++;
+                    }
+                    int end = width;
+                    while((end > start) && (SPACE == raw[end - 1])){
+                        end --;
+                    }
+                    memcpy(text, raw + start, end - start);
+                    text[end - start] = '\0';
+                    value->Raw = text;
+                    if((TYPE_NUMERIC == spec->Field->FieldType) || (TYPE_FLOAT == spec->Field->FieldType)){
+                        value->Value = atof(text);
+                    }
+                }
+                text = text + width + 1;
+            }
+            else if((aggSum == spec->Func) || (aggAvg == spec->Func)){
+                value->Sum = acc->Sum;
+                value->Scale = spec->Field->Scale;
+                double scale = 1;
+                int k = 0;
+                for(k=0; k<value->Scale; k++){
+                    scale = scale * 10;
+                }
+                value->Value = (double)acc->Sum / scale;
+                if(aggAvg == spec->Func){
+                    value->Value = (acc->Count > 0) ? value->Value / acc->Count : 0;
+                }
+            }
+            else{
+                value->Value = (double)acc->Count;
+            }
+        }
+        row ++;
+    }
+    qsort_r(result->Rows, rowCount, sizeof(DBFAggRow), CompareGroupKey, ctx);
+    return result;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : FreeAggThread
+* Description: 释放线程的局部状态
+----------------------------------------------------------------------------*/
+void FreeAggThread(AggThread *thread)
+{
+    if(NULL != thread->Groups){
+        FreeHash(thread->Groups);
+    }
+    while(NULL != thread->Chunks){
+        AggChunk *next = thread->Chunks->Next;
+        free(thread->Chunks);
+        thread->Chunks = next;
+    }
+    free(thread->RowGroups);
+    free(thread->Values);
+    free(thread->Present);
+    free(thread->KeyBuf);
+}
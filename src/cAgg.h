@@ -0,0 +1,76 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cAgg.h
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-12
+ * Description  : DBF分组聚合
+     1.支持COUNT、SUM、MIN、MAX、AVG，可以按一个或多个列分组
+     2.按记录块扫描，一次解析一块记录中的一列，分组键直接使用原始字节
+     3.多线程扫描时每个线程有自己的分组表，扫描完再合并
+     4.SUM、AVG按列的Scale放大成整数精确求和，不受double累加误差影响，超出long long时聚合失败
+     5.已删除的记录不参与聚合，SUM、MIN、MAX、AVG忽略空值
+**********************************************************************************/
+#ifndef CAGG_H
+#define CAGG_H
+
+#include "cDBFStruct.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//聚合项个数上限
+#define DBF_AGG_MAXSPECS 32
+
+//聚合函数
+typedef enum TDBFAggFunc
+{
+    aggCount,                   //FieldName为NULL时是记录数，否则是该列非空值的个数
+    aggSum,                     //N、F列求和
+    aggMin,                     //最小值，N、F列按数值比较，其他列按字节比较
+    aggMax,                     //最大值
+    aggAvg                      //N、F列平均值
+}DBFAggFunc;
+
+//聚合项
+typedef struct TDBFAggSpec
+{
+    DBFAggFunc Func;
+    char *FieldName;
+}DBFAggSpec;
+
+//一个分组的一个聚合结果
+typedef struct TDBFAggValue
+{
+    long long Count;            //COUNT是记录数，其他是非空值的个数
+    long long Sum;              //SUM、AVG的精确和，放大了10^Scale倍
+    int Scale;                  //Sum的小数位数
+    double Value;               //结果值，COUNT、SUM、AVG、数值列的MIN和MAX
+    char *Raw;                  //MIN、MAX的原始列值，没有非空值时为NULL
+}DBFAggValue;
+
+//一个分组
+typedef struct TDBFAggRow
+{
+    char *Key;                  //分组列原始字节依次拼接，以'\0'结尾
+    DBFAggValue *Values;        //和聚合项一一对应
+}DBFAggRow;
+
+//聚合结果，按分组键升序排列
+typedef struct TDBFAggResult
+{
+    int RowCount;               //分组个数
+    int KeyLen;                 //分组键的字节数
+    int ValueCount;             //聚合项个数
+    DBFAggRow *Rows;
+}DBFAggResult;
+
+DBFAggResult *AggregateDBF(CDBF *cDBF, char **groupBy, int groupCount, DBFAggSpec *specs, int specCount, int nThreads);
+void FreeAggResult(DBFAggResult *result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
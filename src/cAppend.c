@@ -0,0 +1,295 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cAppend.c
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-15
+ * Description  : 多进程同时追加记录实现
+     1.分配位置时以预留计数和记录数中较大的一个为起点，兼容预留计数为0的旧文件
+     2.记录直接pwrite，不经过stdio缓存，发布记录数之前其他进程就能读到
+     3.写失败时先把预留的位置写成已删除的空记录再发布记录数，否则后面的追加方会一直等待；
+       空记录也写不进去时不发布，由后面的追加方超时后按已退出填补
+     4.分配位置和加位置锁之间异常退出的追加方，超时后也按已退出处理；
+       填补后才写完的追加方发现记录数已越过自己的位置，返回失败
+**********************************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "cDBF.h"
+#include "cAppend.h"
+#include "cStats.h"
+#include "cLog.h"
+#include "cDBFInner.h"
+
+int ReserveSlots(CDBF *cDBF, int count, int *slot);
+int PublishSlots(CDBF *cDBF, int slot, int count);
+int LockRange(CDBF *cDBF, int cmd, int type, long long start, long long len);
+int RecoverSlots(CDBF *cDBF, int slot);
+int FillSlots(CDBF *cDBF, unsigned int from, unsigned int to);
+
+
+/*******************************************************************************
+* Function   : SharedAppend
+* Description: 多进程追加count条记录
+* Input      :
+    * cDBF, 以DBF_OPEN_SHARED_APPEND打开的CDBF结构体指针
+    * records, count条记录的原始字节，每条Head->RecSize字节
+    * count, 记录条数
+* Output     :
+* Return     : 是否追加成功, -1:追加失败; 1:追加成功
+* Others     :
+    * Post和AppendRecords在DBF_OPEN_SHARED_APPEND时调用
+    * 返回后Head->RecCount是映射的文件头中的记录数，可能包含其他进程追加的记录
+*******************************************************************************/
+int SharedAppend(CDBF *cDBF, const char *records, int count)
+{
+    int slot = 0;
+    if(DBF_SUCCESS != ReserveSlots(cDBF, count, &slot)){
+        return DBF_FAIL;
+    }
+    //发布前持有位置锁，其他追加方据此判断本进程还在；加锁失败时只是超时后可能被当作已退出
+    LockRange(cDBF, F_OFD_SETLK, F_WRLCK, DBF_APPEND_SLOT_LOCK + slot, count);
+    long long size = (long long)cDBF->Head->RecSize * count;
+    long long offset = cDBF->Head->DataOffset + (long long)cDBF->Head->RecSize * slot;
+    //变更日志先于记录写出，只记录本句柄追加的记录
+    int ret = LogWrite(cDBF, offset, records, size);
+    if(DBF_SUCCESS == ret){
+        ret = FlushChangeLog(cDBF);
+    }
+    if(DBF_SUCCESS == ret){
+        ret = WriteFull(fileno(cDBF->FHandle), records, size, offset);
+        STATS_ADD(cDBF, siWriteCalls, 1);
+    }
+    if(DBF_SUCCESS == ret){
+        STATS_ADD(cDBF, siBytesWritten, size);
+    }
+    else{
+        #ifdef DEBUG
+        printf("Debug SharedAppend write Error, slot = %d\n", slot);
+        #endif
+        //不发布写了一半的记录，填成已删除的空记录后再发布
+        if(DBF_SUCCESS != FillSlots(cDBF, slot, slot + count)){
+            LockRange(cDBF, F_OFD_SETLK, F_UNLCK, DBF_APPEND_SLOT_LOCK + slot, count);
+            return DBF_FAIL;
+        }
+    }
+    //文件头在映射的页中修改，由内核写回，发布前先记录发布后的文件头
+    if(DBF_SUCCESS == ret){
+        SharedSyncHead(cDBF);
+        DBFHead head = *cDBF->Head;
+        head.RecCount = slot + count;
+        ret = LogWrite(cDBF, 0, &head, sizeof(DBFHead));
+        //发布后内核随时可能写回映射的文件头
+        if(DBF_SUCCESS == ret){
+            ret = FlushChangeLog(cDBF);
+        }
+    }
+    int published = PublishSlots(cDBF, slot, count);
+    LockRange(cDBF, F_OFD_SETLK, F_UNLCK, DBF_APPEND_SLOT_LOCK + slot, count);
+    if(DBF_SUCCESS != published){
+        return DBF_FAIL;
+    }
+    SharedSyncHead(cDBF);
+    return ret;
+}
+
+
+/*******************************************************************************
+* Function   : SharedSyncHead
+* Description: 更新映射的文件头中的日期，并把记录数同步到Head
+* Input      :
+    * cDBF, 以DBF_OPEN_SHARED_APPEND打开的CDBF结构体指针
+* Output     :
+* Return     :
+* Others     : 代替WriteHead，不通过stdio写文件头，避免覆盖其他进程发布的记录数
+*******************************************************************************/
+void SharedSyncHead(CDBF *cDBF)
+{
+    time_t timep;
+    time(&timep);
+    struct tm *p = gmtime(&timep);
+    cDBF->HeadMap->Year = (unsigned char)p->tm_year;
+    cDBF->HeadMap->Month = (unsigned char)p->tm_mon;
+    cDBF->HeadMap->Day = (unsigned char)p->tm_mday;
+    cDBF->Head->Year = cDBF->HeadMap->Year;
+    cDBF->Head->Month = cDBF->HeadMap->Month;
+    cDBF->Head->Day = cDBF->HeadMap->Day;
+    cDBF->Head->RecCount = __atomic_load_n(&cDBF->HeadMap->RecCount, __ATOMIC_ACQUIRE);
+}
+
+
+/*******************************************************************************
+* Function   : SharedReset
+* Description: 清空后把映射的文件头中的记录数和预留计数都改为0
+* Input      :
+    * cDBF, 以DBF_OPEN_SHARED_APPEND打开的CDBF结构体指针
+* Output     :
+* Return     :
+* Others     : Zap调用，清空时不能有其他进程正在追加
+*******************************************************************************/
+void SharedReset(CDBF *cDBF)
+{
+    unsigned int *reserved = (unsigned int *)((char *)cDBF->HeadMap + DBF_APPEND_OFFSET);
+    __atomic_store_n(reserved, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&cDBF->HeadMap->RecCount, 0, __ATOMIC_RELEASE);
+    SharedSyncHead(cDBF);
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : ReserveSlots
+* Description: 在预留计数上CAS分配count个记录位置，slot返回第一个位置(从0开始)
+----------------------------------------------------------------------------*/
+int ReserveSlots(CDBF *cDBF, int count, int *slot)
+{
+    unsigned int *reserved = (unsigned int *)((char *)cDBF->HeadMap + DBF_APPEND_OFFSET);
+    unsigned int cur = __atomic_load_n(reserved, __ATOMIC_ACQUIRE);
+    unsigned int base = 0;
+    do{
+        //普通句柄追加过或预留计数是旧文件中的0时，从记录数开始分配
+        unsigned int recCount = (unsigned int)__atomic_load_n(&cDBF->HeadMap->RecCount, __ATOMIC_ACQUIRE);
+        base = (cur > recCount) ? cur : recCount;
+        if(base + (unsigned int)count > (unsigned int)0x7FFFFFFF){
+            return DBF_FAIL;
+        }
+    }while(!__atomic_compare_exchange_n(reserved, &cur, base + count, DBF_FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    STATS_ADD(cDBF, siLockCount, 1);
+    *slot = (int)base;
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : PublishSlots
+* Description: 等记录数到达slot后改为slot+count，前面的位置都发布后才发布自己的；
+    每次等待超时检查前面的追加方是否已退出，记录数越过slot说明本次的位置被当作已退出填补
+----------------------------------------------------------------------------*/
+int PublishSlots(CDBF *cDBF, int slot, int count)
+{
+    STATS_BEGIN(start);
+    unsigned int *recCount = &cDBF->HeadMap->RecCount;
+    struct timespec begin, now;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    unsigned int cur = 0;
+    while((cur = __atomic_load_n(recCount, __ATOMIC_ACQUIRE)) != (unsigned int)slot){
+        if(cur > (unsigned int)slot){
+            #ifdef DEBUG
+            printf("Debug PublishSlots slots filled by another appender, slot = %d, reccount = %u\n", slot, cur);
+            #endif
+            return DBF_FAIL;
+        }
+        sched_yield();
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long ms = (now.tv_sec - begin.tv_sec) * 1000 + (now.tv_nsec - begin.tv_nsec) / 1000000;
+        if(ms > DBF_APPEND_TIMEOUT_MS){
+            #ifdef DEBUG
+            printf("Debug PublishSlots Timeout, slot = %d, reccount = %u\n", slot, cur);
+            #endif
+            if(DBF_SUCCESS != RecoverSlots(cDBF, slot)){
+                return DBF_FAIL;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &begin);
+        }
+    }
+    __atomic_store_n(recCount, slot + count, __ATOMIC_RELEASE);
+    STATS_ADD(cDBF, siLockWaitNs, StatsNow() - start);
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : LockRange
+* Description: 对[start, start+len)加OFD锁或解锁，cmd为F_OFD_SETLK或F_OFD_SETLKW
+----------------------------------------------------------------------------*/
+int LockRange(CDBF *cDBF, int cmd, int type, long long start, long long len)
+{
+    struct flock lock;
+    memset(&lock, '\0', sizeof(lock));
+    lock.l_type = type;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = start;
+    lock.l_len = len;
+    if(0 != fcntl(fileno(cDBF->FHandle), cmd, &lock)){
+        #ifdef DEBUG
+        printf("Debug LockRange fcntl Error, type = %d, start = %lld\n", type, start);
+        #endif
+        return DBF_FAIL;
+    }
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : RecoverSlots
+* Description: 在预留计数的OFD锁内检查[记录数, slot)的位置锁，
+    没有追加方持有时填补这些位置并把记录数改为slot；有追加方持有时继续等待
+----------------------------------------------------------------------------*/
+int RecoverSlots(CDBF *cDBF, int slot)
+{
+    if(DBF_SUCCESS != LockRange(cDBF, F_OFD_SETLKW, F_WRLCK, DBF_APPEND_OFFSET, sizeof(unsigned int))){
+        return DBF_FAIL;
+    }
+    int ret = DBF_SUCCESS;
+    unsigned int *recCount = &cDBF->HeadMap->RecCount;
+    unsigned int cur = __atomic_load_n(recCount, __ATOMIC_ACQUIRE);
+    if(cur < (unsigned int)slot){
+        struct flock lock;
+        memset(&lock, '\0', sizeof(lock));
+        lock.l_type = F_WRLCK;
+        lock.l_whence = SEEK_SET;
+        lock.l_start = DBF_APPEND_SLOT_LOCK + cur;
+        lock.l_len = slot - cur;
+        if(0 != fcntl(fileno(cDBF->FHandle), F_OFD_GETLK, &lock)){
+            ret = DBF_FAIL;
+        }
+        else if(F_UNLCK == lock.l_type){
+            //前面的追加方都已退出，填补后发布；期间有追加方自己发布了就不再修改记录数
+            ret = FillSlots(cDBF, cur, slot);
+            if(DBF_SUCCESS == ret){
+                __atomic_compare_exchange_n(recCount, &cur, (unsigned int)slot, DBF_FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+            }
+        }
+    }
+    LockRange(cDBF, F_OFD_SETLK, F_UNLCK, DBF_APPEND_OFFSET, sizeof(unsigned int));
+    return ret;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : FillSlots
+* Description: 把[from, to)位置写成已删除的空记录，并记入变更日志
+----------------------------------------------------------------------------*/
+int FillSlots(CDBF *cDBF, unsigned int from, unsigned int to)
+{
+    int recSize = cDBF->Head->RecSize;
+    int perChunk = (DBF_APPEND_FILL_CHUNK > recSize) ? DBF_APPEND_FILL_CHUNK / recSize : 1;
+    char *buf = malloc((long)perChunk * recSize);
+    if(NULL == buf){
+        return DBF_FAIL;
+    }
+    memset(buf, ' ', (long)perChunk * recSize);
+    int i = 0;
+    for(i=0; i<perChunk; i++){
+        buf[(long)i * recSize] = DELETED;
+    }
+    int ret = DBF_SUCCESS;
+    while((DBF_SUCCESS == ret) && (from < to)){
+        unsigned int n = (to - from > (unsigned int)perChunk) ? (unsigned int)perChunk : to - from;
+        long long offset = cDBF->Head->DataOffset + (long long)recSize * from;
+        ret = LogWrite(cDBF, offset, buf, recSize * n);
+        if(DBF_SUCCESS == ret){
+            ret = FlushChangeLog(cDBF);
+        }
+        if(DBF_SUCCESS == ret){
+            ret = WriteFull(fileno(cDBF->FHandle), buf, (long long)recSize * n, offset);
+        }
+        from = from + n;
+    }
+    free(buf);
+    return ret;
+}
@@ -0,0 +1,35 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cAppend.h
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-15
+ * Description  : 多进程同时追加记录
+     1.以DBF_OPEN_SHARED_APPEND打开时，文件头所在页mmap到内存，多个进程共享
+     2.追加前在文件头的预留计数(文件偏移20)上CAS分配N个记录位置，不加锁
+     3.记录在锁外直接pwrite到分配的位置，多个进程的写互不等待
+     4.写完后等前面分配的位置都发布了，再把文件头中的记录数改为本次的结束位置，
+       记录数只按分配顺序增长，读方看到的记录都是写完的
+     5.所有追加方都要以DBF_OPEN_SHARED_APPEND打开，普通句柄追加或写文件头会覆盖记录数
+     6.分配到的位置在发布前持有一段OFD写锁(不对应文件内容的虚拟偏移)，追加方退出时锁自动释放；
+       等待超时后在预留计数的OFD锁内检查前面未发布的位置，没有追加方持有时用已删除的空记录填满并发布
+**********************************************************************************/
+#ifndef CAPPEND_H
+#define CAPPEND_H
+
+#include "cDBFStruct.h"
+
+//预留计数在文件中的偏移，对应DBFHead.Reserved[8]
+#define DBF_APPEND_OFFSET 20
+//等待前面的追加方发布的时间，超过后检查对方是否已经异常退出
+#define DBF_APPEND_TIMEOUT_MS 5000
+//记录位置锁的虚拟偏移，第slot个位置对应DBF_APPEND_SLOT_LOCK + slot这个字节
+#define DBF_APPEND_SLOT_LOCK 0x4000000000000000LL
+//填补位置时一次写的最大字节数
+#define DBF_APPEND_FILL_CHUNK (64 * 1024)
+
+int SharedAppend(CDBF *cDBF, const char *records, int count);
+void SharedSyncHead(CDBF *cDBF);
+void SharedReset(CDBF *cDBF);
+
+#endif
@@ -0,0 +1,411 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cCache.c
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-09
+ * Description  : 进程级的DBF句柄缓存实现
+     1.命中时只需一次stat和一次Hash查找，有空闲句柄时不需要打开文件
+     2.没有空闲句柄时复用已解析的文件头和表结构，只需要fopen
+     3.缓存通过互斥锁保护，打开文件时不持有锁
+     4.已借出句柄的缓存项不会被淘汰，只淘汰其空闲句柄
+**********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "cDBF.h"
+#include "cCache.h"
+#include "cHash.h"
+#include "cSchema.h"
+#include "cDBFInner.h"
+
+static HashTable *CacheTable = NULL;
+static DBFCacheEntry *LRUHead = NULL;
+static DBFCacheEntry *LRUTail = NULL;
+static long CacheMemSize = 0;
+static long CacheLimit = DBF_CACHE_DEFLIMIT;
+static pthread_mutex_t CacheMutex = PTHREAD_MUTEX_INITIALIZER;
+
+DBFCacheEntry *CreateCacheEntry(char *filePath);
+void FreeCacheEntry(DBFCacheEntry *entry);
+void InvalidateCacheEntry(DBFCacheEntry *entry);
+void TouchCacheEntry(DBFCacheEntry *entry);
+void UpdateCacheMem(DBFCacheEntry *entry);
+void EvictCache(long limit);
+int SameFile(DBFCacheEntry *entry, struct stat *st);
+
+
+/*******************************************************************************
+* Function   : OpenCachedDBF
+* Description: 从句柄缓存获取DBF句柄，文件没有变化时复用已解析的信息和空闲句柄
+* Input      :
+    * filePath, DBF文件目录
+* Output     :
+* Return     : 紧凑方式打开的CDBF文件指针，定位在第一行; 返回NULL表示打开失败
+* Others     : 使用完后调用ReleaseCachedDBF归还
+*******************************************************************************/
+CDBF *OpenCachedDBF(char *filePath)
+{
+    struct stat st;
+    if(0 != stat(filePath, &st)){
+        return NULL;
+    }
+    CDBF *cDBF = NULL;
+    pthread_mutex_lock(&CacheMutex);
+    if(NULL == CacheTable){
+        CacheTable = CreateHash(64);
+        if(NULL == CacheTable){
+            pthread_mutex_unlock(&CacheMutex);
+            return NULL;
+        }
+    }
+    int pathLen = strlen(filePath);
+    DBFCacheEntry *entry = HashGet(CacheTable, filePath, pathLen);
+    if((NULL != entry) && (NULL != entry->Schema) && (DBF_TRUE != SameFile(entry, &st))){
+        InvalidateCacheEntry(entry);
+    }
+    //命中，优先使用空闲句柄
+    if((NULL != entry) && (NULL != entry->Schema)){
+        TouchCacheEntry(entry);
+        entry->Busy ++;
+        if(entry->IdleCount > 0){
+            entry->IdleCount --;
+            cDBF = entry->Idle[entry->IdleCount];
+            UpdateCacheMem(entry);
+            pthread_mutex_unlock(&CacheMutex);
+            //文件没有变化，停在第一行的句柄不需要重新读取
+            if((dsBrowse != cDBF->status) || (1 != cDBF->RecNo)){
+                cDBF->status = dsBrowse;
+                if((cDBF->Head->RecCount > 0) && (DBF_SUCCESS != Go(cDBF, 1))){
+                    cDBF->CacheGen = -1;
+                    ReleaseCachedDBF(cDBF);
+                    return NULL;
+                }
+            }
+            return cDBF;
+        }
+        //没有空闲句柄，复用已解析的文件头和表结构打开
+        DBFHead head = entry->Head;
+        DBFSchema *schema = entry->Schema;
+        int gen = entry->Gen;
+        RetainSchema(schema);
+        pthread_mutex_unlock(&CacheMutex);
+        cDBF = OpenSchemaDBF(filePath, DBF_OPEN_COMPACT, &head, schema);
+        ReleaseSchema(schema);
+        pthread_mutex_lock(&CacheMutex);
+        if(NULL == cDBF){
+            entry->Busy --;
+        }
+        else{
+            cDBF->CacheEntry = entry;
+            cDBF->CacheGen = gen;
+        }
+        pthread_mutex_unlock(&CacheMutex);
+        return cDBF;
+    }
+    //未命中，打开文件并登记解析结果
+    if(NULL == entry){
+        entry = CreateCacheEntry(filePath);
+        if(NULL == entry){
+            pthread_mutex_unlock(&CacheMutex);
+            return NULL;
+        }
+    }
+    TouchCacheEntry(entry);
+    entry->Busy ++;
+    int gen = entry->Gen;
+    pthread_mutex_unlock(&CacheMutex);
+    cDBF = OpenDBFEx(filePath, DBF_OPEN_COMPACT);
+    pthread_mutex_lock(&CacheMutex);
+    if(NULL == cDBF){
+        entry->Busy --;
+        EvictCache(CacheLimit);
+        pthread_mutex_unlock(&CacheMutex);
+        return NULL;
+    }
+    //stat在读取文件头之前，文件之后有变化时下次stat会不一致
+    if((gen == entry->Gen) && (NULL == entry->Schema)){
+        entry->Dev = st.st_dev;
+        entry->Ino = st.st_ino;
+        entry->Size = st.st_size;
+        entry->MTime = st.st_mtim;
+        entry->Head = *cDBF->Head;
+        entry->Schema = cDBF->Schema;
+        RetainSchema(entry->Schema);
+        UpdateCacheMem(entry);
+    }
+    cDBF->CacheEntry = entry;
+    cDBF->CacheGen = gen;
+    EvictCache(CacheLimit);
+    pthread_mutex_unlock(&CacheMutex);
+    return cDBF;
+}
+
+
+/*******************************************************************************
+* Function   : ReleaseCachedDBF
+* Description: 将OpenCachedDBF获取的句柄归还到缓存
+* Input      :
+    * cDBF, OpenCachedDBF返回的CDBF结构体指针
+* Output     :
+* Return     : -1:归还失败; 1:归还成功
+* Others     :
+    * 文件已变化或句柄处于编辑状态时直接关闭
+    * 不是从缓存获取的句柄直接调用CloseDBF
+*******************************************************************************/
+int ReleaseCachedDBF(CDBF *cDBF)
+{
+    if(NULL == cDBF){
+        return DBF_FAIL;
+    }
+    DBFCacheEntry *entry = cDBF->CacheEntry;
+    if(NULL == entry){
+        return CloseDBF(cDBF);
+    }
+    pthread_mutex_lock(&CacheMutex);
+    entry->Busy --;
+    if((cDBF->CacheGen != entry->Gen) || (NULL == entry->Schema) || (dsBrowse != cDBF->status)){
+        CloseDBF(cDBF);
+        EvictCache(CacheLimit);
+        pthread_mutex_unlock(&CacheMutex);
+        return DBF_SUCCESS;
+    }
+    if(entry->IdleCount >= entry->IdleCap){
+        int cap = (0 == entry->IdleCap) ? 4 : entry->IdleCap * 2;
+        CDBF **idle = realloc(entry->Idle, sizeof(CDBF *) * cap);
+        if(NULL == idle){
+            CloseDBF(cDBF);
+            pthread_mutex_unlock(&CacheMutex);
+            return DBF_SUCCESS;
+        }
+        entry->Idle = idle;
+        entry->IdleCap = cap;
+    }
+    entry->Idle[entry->IdleCount] = cDBF;
+    entry->IdleCount ++;
+    TouchCacheEntry(entry);
+    UpdateCacheMem(entry);
+    EvictCache(CacheLimit);
+    pthread_mutex_unlock(&CacheMutex);
+    return DBF_SUCCESS;
+}
+
+
+/*******************************************************************************
+* Function   : SetDBFCacheLimit
+* Description: 设置句柄缓存的内存上限，超过上限时立即淘汰
+* Input      :
+    * limit, 内存上限字节数
+* Output     :
+* Return     : -1:设置失败; 1:设置成功
+* Others     :
+*******************************************************************************/
+int SetDBFCacheLimit(long limit)
+{
+    if(limit < 0){
+        return DBF_FAIL;
+    }
+    pthread_mutex_lock(&CacheMutex);
+    CacheLimit = limit;
+    EvictCache(CacheLimit);
+    pthread_mutex_unlock(&CacheMutex);
+    return DBF_SUCCESS;
+}
+
+
+/*******************************************************************************
+* Function   : GetDBFCacheMemSize
+* Description: 获取句柄缓存当前占用的内存，不含已借出的句柄
+* Input      :
+* Output     :
+* Return     : 内存字节数
+* Others     :
+*******************************************************************************/
+long GetDBFCacheMemSize(void)
+{
+    pthread_mutex_lock(&CacheMutex);
+    long size = CacheMemSize;
+    pthread_mutex_unlock(&CacheMutex);
+    return size;
+}
+
+
+/*******************************************************************************
+* Function   : ClearDBFCache
+* Description: 关闭所有空闲句柄，释放没有借出句柄的缓存项
+* Input      :
+* Output     :
+* Return     : 1:清空成功
+* Others     :
+*******************************************************************************/
+int ClearDBFCache(void)
+{
+    pthread_mutex_lock(&CacheMutex);
+    EvictCache(0);
+    pthread_mutex_unlock(&CacheMutex);
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : CreateCacheEntry
+* Description: 新建缓存项，登记到Hash表和LRU链表头，调用方持有锁
+----------------------------------------------------------------------------*/
+DBFCacheEntry *CreateCacheEntry(char *filePath)
+{
+    DBFCacheEntry *entry = malloc(sizeof(DBFCacheEntry));
+    if(NULL == entry){
+        return NULL;
+    }
+    memset(entry, '\0', sizeof(DBFCacheEntry));
+    entry->Path = malloc(strlen(filePath) + 1);
+    if(NULL == entry->Path){
+        free(entry);
+        return NULL;
+    }
+    strcpy(entry->Path, filePath);
+    if(DBF_SUCCESS != HashPut(CacheTable, entry->Path, strlen(entry->Path), entry)){
+        free(entry->Path);
+        free(entry);
+        return NULL;
+    }
+    entry->Next = LRUHead;
+    if(NULL != LRUHead){
+        LRUHead->Prev = entry;
+    }
+    LRUHead = entry;
+    if(NULL == LRUTail){
+        LRUTail = entry;
+    }
+    UpdateCacheMem(entry);
+    return entry;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : FreeCacheEntry
+* Description: 从Hash表和LRU链表删除缓存项并释放，调用方持有锁且Busy为0
+----------------------------------------------------------------------------*/
+void FreeCacheEntry(DBFCacheEntry *entry)
+{
+    InvalidateCacheEntry(entry);
+    HashRemove(CacheTable, entry->Path, strlen(entry->Path));
+    if(NULL != entry->Prev){
+        entry->Prev->Next = entry->Next;
+    }
+    else{
+        LRUHead = entry->Next;
+    }
+    if(NULL != entry->Next){
+        entry->Next->Prev = entry->Prev;
+    }
+    else{
+        LRUTail = entry->Prev;
+    }
+    CacheMemSize -= entry->MemSize;
+    free(entry->Idle);
+    free(entry->Path);
+    free(entry);
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : InvalidateCacheEntry
+* Description: 文件变化后丢弃已解析的信息和空闲句柄，版本增加，调用方持有锁
+----------------------------------------------------------------------------*/
+void InvalidateCacheEntry(DBFCacheEntry *entry)
+{
+    int i = 0;
+    for(i=0; i<entry->IdleCount; i++){
+        CloseDBF(entry->Idle[i]);
+    }
+    entry->IdleCount = 0;
+    if(NULL != entry->Schema){
+        ReleaseSchema(entry->Schema);
+        entry->Schema = NULL;
+    }
+    entry->Gen ++;
+    UpdateCacheMem(entry);
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : TouchCacheEntry
+* Description: 将缓存项移到LRU链表头，调用方持有锁
+----------------------------------------------------------------------------*/
+void TouchCacheEntry(DBFCacheEntry *entry)
+{
+    if(LRUHead == entry){
+        return;
+    }
+    entry->Prev->Next = entry->Next;
+    if(NULL != entry->Next){
+        entry->Next->Prev = entry->Prev;
+    }
+    else{
+        LRUTail = entry->Prev;
+    }
+    entry->Prev = NULL;
+    entry->Next = LRUHead;
+    LRUHead->Prev = entry;
+    LRUHead = entry;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : UpdateCacheMem
+* Description: 重新计算缓存项占用的内存并更新总量，调用方持有锁
+----------------------------------------------------------------------------*/
+void UpdateCacheMem(DBFCacheEntry *entry)
+{
+    long size = sizeof(DBFCacheEntry) + strlen(entry->Path) + 1 + sizeof(CDBF *) * entry->IdleCap;
+    if(NULL != entry->Schema){
+        size = size + entry->Schema->Size;
+    }
+    int i = 0;
+    for(i=0; i<entry->IdleCount; i++){
+        size = size + GetDBFMemSize(entry->Idle[i]);
+    }
+    CacheMemSize = CacheMemSize - entry->MemSize + size;
+    entry->MemSize = size;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : EvictCache
+* Description: 从LRU链表尾开始淘汰，直到内存不超过limit，调用方持有锁
+    * 先关闭缓存项的空闲句柄，没有借出句柄的缓存项整个释放
+----------------------------------------------------------------------------*/
+void EvictCache(long limit)
+{
+    DBFCacheEntry *entry = LRUTail;
+    while((CacheMemSize > limit) && (NULL != entry)){
+        DBFCacheEntry *prev = entry->Prev;
+        if(0 == entry->Busy){
+            FreeCacheEntry(entry);
+        }
+        else if(entry->IdleCount > 0){
+            while((entry->IdleCount > 0) && (CacheMemSize > limit)){
+                entry->IdleCount --;
+                CloseDBF(entry->Idle[entry->IdleCount]);
+                UpdateCacheMem(entry);
+            }
+        }
+        entry = prev;
+    }
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : SameFile
+* Description: 判断文件的(dev, ino, size, mtime)和解析时是否一致
+----------------------------------------------------------------------------*/
+int SameFile(DBFCacheEntry *entry, struct stat *st)
+{
+    if((entry->Dev == st->st_dev) && (entry->Ino == st->st_ino) && (entry->Size == st->st_size)
+        && (entry->MTime.tv_sec == st->st_mtim.tv_sec) && (entry->MTime.tv_nsec == st->st_mtim.tv_nsec)){
+        return DBF_TRUE;
+    }
+    return DBF_FALSE;
+}
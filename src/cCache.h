@@ -0,0 +1,58 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cCache.h
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-09
+ * Description  : 进程级的DBF句柄缓存
+     1.按文件路径缓存已解析的文件头和表结构，以及空闲的紧凑句柄
+     2.文件的(dev, ino, size, mtime)不变时直接复用，变化后重新解析
+     3.空闲句柄和缓存项占用的内存超过上限时，按LRU淘汰
+     4.通过OpenCachedDBF获取的句柄必须调用ReleaseCachedDBF归还，不能调用CloseDBF
+**********************************************************************************/
+#ifndef CCACHE_H
+#define CCACHE_H
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "cDBFStruct.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//缺省的缓存内存上限
+#define DBF_CACHE_DEFLIMIT (64L * 1024 * 1024)
+
+//缓存项，一个文件路径对应一个缓存项
+typedef struct TDBFCacheEntry
+{
+    char *Path;                 //文件路径，也是Hash表的键
+    dev_t Dev;                  //解析时文件所在设备
+    ino_t Ino;                  //解析时文件的inode
+    off_t Size;                 //解析时文件大小
+    struct timespec MTime;      //解析时文件修改时间
+    int Gen;                    //版本，文件变化后增加，旧版本的句柄归还时直接关闭
+    DBFHead Head;               //已解析的文件头
+    DBFSchema *Schema;          //已解析的表结构
+    CDBF **Idle;                //空闲句柄池
+    int IdleCount;              //空闲句柄个数
+    int IdleCap;                //空闲句柄池容量
+    int Busy;                   //已借出的句柄个数
+    long MemSize;               //缓存项占用的内存，不含已借出的句柄
+    struct TDBFCacheEntry *Prev;    //LRU链表，表头是最近使用的
+    struct TDBFCacheEntry *Next;
+}DBFCacheEntry;
+
+CDBF *OpenCachedDBF(char *filePath);
+int ReleaseCachedDBF(CDBF *cDBF);
+int SetDBFCacheLimit(long limit);
+long GetDBFCacheMemSize(void);
+int ClearDBFCache(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
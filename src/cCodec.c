@@ -0,0 +1,553 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cCodec.c
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-18
+ * Description  : C列的GBK/GB18030和UTF-8互转实现
+     1.GBK双字节字符首字节0x81~0xFE，尾字节0x40~0xFE，码表按(首字节, 尾字节)直接下标
+     2.反向码表按Unicode码点(BMP)下标，值为GBK的两个字节，0表示码表中没有
+     3.码表生成后只读，多线程共享，用pthread_once保证只生成一次
+     4.支持SSE2时每次判断16个字节是否全是ASCII，否则每次判断8个字节
+     5.码表中没有的字符(GB18030四字节等)用iconv转换，iconv描述符不能多线程共用，
+       每个线程每个方向缓存一个，线程退出时关闭
+**********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iconv.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "cDBF.h"
+#include "cCodec.h"
+#include "cDBFInner.h"
+
+#define GBK_LEAD_MIN 0x81
+#define GBK_LEAD_MAX 0xFE
+#define GBK_TRAIL_MIN 0x40
+#define GBK_TRAIL_MAX 0xFE
+#define GBK_TRAILS (GBK_TRAIL_MAX - GBK_TRAIL_MIN + 1)
+
+//GBK双字节 -> Unicode码点
+static unsigned short *GBKTable = NULL;
+//Unicode码点 -> GBK双字节，高字节是首字节
+static unsigned short *UnicodeTable = NULL;
+static pthread_once_t CodecOnce = PTHREAD_ONCE_INIT;
+//各线程缓存的iconv描述符
+static pthread_key_t IconvKey;
+static int IconvKeyReady = DBF_FALSE;
+
+//iconv转换方向
+#define ICONV_TO_UTF8 0
+#define ICONV_FROM_UTF8 1
+
+//一个线程缓存的iconv描述符，下标为转换方向
+typedef struct TCodecIconv
+{
+    iconv_t Cd[2];
+}CodecIconv;
+
+void BuildCodecTables(void);
+void FreeCodecIconv(void *data);
+int IconvChar(int direction, const char *src, int len, char *dst, int dstSize);
+int PutUTF8(unsigned int cp, char *dst, int dstSize);
+int GetUTF8(const unsigned char *p, int len, unsigned int *cp);
+int TrimLen(const char *p, int width);
+
+
+/*******************************************************************************
+* Function   : IsGBKDBF
+* Description: 判断DBF的C列是否按GBK存储
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+* Output     :
+* Return     : DBF_TRUE:GBK; DBF_FALSE:不转换
+* Others     : 以DBF_OPEN_GBK打开，或文件头代码页字节为GBK、GB2312
+*******************************************************************************/
+int IsGBKDBF(CDBF *cDBF)
+{
+    if(DBF_OPEN_GBK & cDBF->OpenFlags){
+        return DBF_TRUE;
+    }
+    unsigned char codePage = ((unsigned char *)cDBF->Head)[DBF_CODEPAGE_OFFSET];
+    return ((DBF_CODEPAGE_GBK == codePage) || (DBF_CODEPAGE_GB2312 == codePage)) ? DBF_TRUE : DBF_FALSE;
+}
+
+
+/*******************************************************************************
+* Function   : GetFieldAsUTF8
+* Description: 获取当前行fieldName列的值，GBK的DBF转为UTF-8
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+    * fieldName, 列名
+* Output     :
+* Return     : 以'\0'结尾、去掉末尾空格的UTF-8字符串，列不存在时返回""
+* Others     :
+    * 返回的缓存在下一次调用GetFieldAsUTF8前有效
+    * 不是GBK的DBF同GetFieldAsString
+*******************************************************************************/
+char *GetFieldAsUTF8(CDBF *cDBF, char *fieldName)
+{
+    if(DBF_TRUE != IsGBKDBF(cDBF)){
+        return GetFieldAsString(cDBF, fieldName);
+    }
+    int index = GetIndexByName(cDBF, fieldName);
+    if(DBF_FAIL == index){
+        return "";
+    }
+    if(NULL == cDBF->Utf8Buf){
+        cDBF->Utf8Buf = malloc(DBF_UTF8_BUF_LEN + 1);
+        if(NULL == cDBF->Utf8Buf){
+            return "";
+        }
+    }
+    //直接从行缓存转换，不经过GetFieldAsString的解码缓存
+    const char *raw = cDBF->ValueBuf + cDBF->FieldOffsets[index];
+    int n = GBKToUTF8(raw, TrimLen(raw, cDBF->Fields[index].Width), cDBF->Utf8Buf, DBF_UTF8_BUF_LEN);
+    cDBF->Utf8Buf[(n < 0) ? 0 : n] = '\0';
+    return cDBF->Utf8Buf;
+}
+
+
+/*******************************************************************************
+* Function   : SetFieldAsUTF8
+* Description: 以UTF-8字符串设置当前行fieldName列的值，GBK的DBF转为GBK写入
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+    * fieldName, 列名
+    * value, UTF-8字符串
+* Output     :
+* Return     : 是否设置成功, -1:列不存在; 1:设置成功
+* Others     :
+    * 超长时在字符边界截断，不会留下半个汉字
+    * 不是GBK的DBF同SetFieldAsString
+*******************************************************************************/
+int SetFieldAsUTF8(CDBF *cDBF, char *fieldName, char *value)
+{
+    if(DBF_TRUE != IsGBKDBF(cDBF)){
+        return SetFieldAsString(cDBF, fieldName, value);
+    }
+    int index = GetIndexByName(cDBF, fieldName);
+    if(DBF_FAIL == index){
+        return DBF_FAIL;
+    }
+    char buf[VALUE_BUF_LEN + 1];
+    int n = UTF8ToGBK(value, strlen(value), buf, cDBF->Fields[index].Width);
+    buf[n] = '\0';
+    return SetFieldAsString(cDBF, fieldName, buf);
+}
+
+
+/*******************************************************************************
+* Function   : ColumnToUTF8
+* Description: 把一列的原始字节批量转为UTF-8字符串，写到调用方的内存中
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+    * values, count个列值的原始字节，每个width字节，例如ExtractColumn的结果
+    * count, 列值个数
+    * width, 列宽度
+    * arena, arenaSize, 存放结果的内存
+* Output     :
+    * out, count个指针，指向arena中以'\0'结尾、去掉末尾空格的字符串
+* Return     : arena中使用的字节数, -1:arena不够
+* Others     :
+    * 整列全是ASCII时直接拷贝，不逐个转换
+    * 有非ASCII值时，每个值按原始字节数的3倍预留arena
+*******************************************************************************/
+int ColumnToUTF8(CDBF *cDBF, const char *values, int count, int width, char *arena, int arenaSize, char **out)
+{
+    int ascii = (DBF_TRUE != IsGBKDBF(cDBF)) || IsAsciiBytes(values, count * width);
+    int used = 0;
+    int i = 0;
+    for(i=0; i<count; i++){
+        const char *p = values + (long)i * width;
+        int len = TrimLen(p, width);
+        int n = 0;
+        if(ascii || IsAsciiBytes(p, len)){
+            if(used + len + 1 > arenaSize){
+                return DBF_FAIL;
+            }
+            memcpy(arena + used, p, len);
+            n = len;
+        }
+        else{
+            n = GBKToUTF8(p, len, arena + used, arenaSize - used - 1);
+            if(n < 0){
+                return DBF_FAIL;
+            }
+        }
+        out[i] = arena + used;
+        arena[used + n] = '\0';
+        used = used + n + 1;
+    }
+    return used;
+}
+
+
+/*******************************************************************************
+* Function   : GBKToUTF8
+* Description: GBK/GB18030转UTF-8
+* Input      :
+    * src, len, GBK字节
+    * dstSize, dst的字节数
+* Output     :
+    * dst, UTF-8字节，不以'\0'结尾
+* Return     : 写入dst的字节数, -1:dst不够
+* Others     : 无法转换的字节写为'?'
+*******************************************************************************/
+int GBKToUTF8(const char *src, int len, char *dst, int dstSize)
+{
+    if(IsAsciiBytes(src, len)){
+        if(len > dstSize){
+            return DBF_FAIL;
+        }
+        memcpy(dst, src, len);
+        return len;
+    }
+    pthread_once(&CodecOnce, BuildCodecTables);
+    const unsigned char *p = (const unsigned char *)src;
+    int i = 0;
+    int o = 0;
+    while(i < len){
+        int n = 0;
+        if(p[i] < 0x80){
+            if(o >= dstSize){
+                return DBF_FAIL;
+            }
+            dst[o ++] = p[i ++];
+            continue;
+        }
+        if((i + 1 < len) && (p[i] >= GBK_LEAD_MIN) && (p[i] <= GBK_LEAD_MAX)){
+            //GB18030四字节字符，第二个字节是数字
+            if((p[i + 1] >= '0') && (p[i + 1] <= '9') && (i + 3 < len)){
+                n = IconvChar(ICONV_TO_UTF8, src + i, 4, dst + o, dstSize - o);
+                if(n > 0){
+                    o = o + n;
+                    i = i + 4;
+                    continue;
+                }
+            }
+            else if((p[i + 1] >= GBK_TRAIL_MIN) && (p[i + 1] <= GBK_TRAIL_MAX)){
+                unsigned int cp = (NULL == GBKTable) ? 0 : GBKTable[(p[i] - GBK_LEAD_MIN) * GBK_TRAILS + (p[i + 1] - GBK_TRAIL_MIN)];
+                if(0 != cp){
+                    n = PutUTF8(cp, dst + o, dstSize - o);
+                }
+                else{
+                    //GB18030比GBK多的双字节字符，如0xA2E3(€)
+                    n = IconvChar(ICONV_TO_UTF8, src + i, 2, dst + o, dstSize - o);
+                    if(n <= 0){
+                        n = 1;
+                        if(o >= dstSize){
+                            return DBF_FAIL;
+                        }
+                        dst[o] = '?';
+                    }
+                }
+                if(n < 0){
+                    return DBF_FAIL;
+                }
+                o = o + n;
+                i = i + 2;
+                continue;
+            }
+        }
+        if(o >= dstSize){
+            return DBF_FAIL;
+        }
+        dst[o ++] = '?';
+        i ++;
+    }
+    return o;
+}
+
+
+/*******************************************************************************
+* Function   : UTF8ToGBK
+* Description: UTF-8转GBK，码表中没有的字符转为GB18030四字节
+* Input      :
+    * src, len, UTF-8字节
+    * dstSize, dst的字节数
+* Output     :
+    * dst, GBK字节，不以'\0'结尾
+* Return     : 写入dst的字节数
+* Others     : dst不够时在字符边界截断；不合法的UTF-8字节、无法转换的字符写为'?'
+*******************************************************************************/
+int UTF8ToGBK(const char *src, int len, char *dst, int dstSize)
+{
+    if(IsAsciiBytes(src, len)){
+        int n = (len > dstSize) ? dstSize : len;
+        memcpy(dst, src, n);
+        return n;
+    }
+    pthread_once(&CodecOnce, BuildCodecTables);
+    const unsigned char *p = (const unsigned char *)src;
+    int i = 0;
+    int o = 0;
+    while((i < len) && (o < dstSize)){
+        if(p[i] < 0x80){
+            dst[o ++] = p[i ++];
+            continue;
+        }
+        unsigned int cp = 0;
+        int n = GetUTF8(p + i, len - i, &cp);
+        if(n <= 0){
+            dst[o ++] = '?';
+            i ++;
+            continue;
+        }
+        if((cp <= 0xFFFF) && (NULL != UnicodeTable) && (0 != UnicodeTable[cp])){
+            if(o + 2 > dstSize){
+                break;
+            }
+            dst[o ++] = (char)(UnicodeTable[cp] >> 8);
+            dst[o ++] = (char)(UnicodeTable[cp] & 0xFF);
+            i = i + n;
+            continue;
+        }
+        char buf[8];
+        int m = IconvChar(ICONV_FROM_UTF8, src + i, n, buf, sizeof(buf));
+        if(m <= 0){
+            buf[0] = '?';
+            m = 1;
+        }
+        if(o + m > dstSize){
+            break;
+        }
+        memcpy(dst + o, buf, m);
+        o = o + m;
+        i = i + n;
+    }
+    return o;
+}
+
+
+/*******************************************************************************
+* Function   : IsAsciiBytes
+* Description: 判断len个字节是否全是ASCII
+* Input      :
+    * p, len, 字节
+* Output     :
+* Return     : DBF_TRUE:全是ASCII; DBF_FALSE:有非ASCII字节
+* Others     :
+*******************************************************************************/
+int IsAsciiBytes(const char *p, int len)
+{
+    int i = 0;
+#ifdef __SSE2__
+    for(; i+16<=len; i+=16){
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        if(0 != _mm_movemask_epi8(v)){
+            return DBF_FALSE;
+        }
+    }
+#endif
+    for(; i+8<=len; i+=8){
+        unsigned long long word = 0;
+        memcpy(&word, p + i, 8);
+        if(0 != (word & 0x8080808080808080ULL)){
+            return DBF_FALSE;
+        }
+    }
+    for(; i<len; i++){
+        if(0 != (p[i] & 0x80)){
+            return DBF_FALSE;
+        }
+    }
+    return DBF_TRUE;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : BuildCodecTables
+* Description: 通过iconv逐个转换GBK双字节字符，生成正反两个码表
+----------------------------------------------------------------------------*/
+void BuildCodecTables(void)
+{
+    iconv_t cd = iconv_open("UTF-32LE", "GBK");
+    if((iconv_t)-1 == cd){
+        #ifdef DEBUG
+        printf("Debug BuildCodecTables iconv_open Error\n");
+        #endif
+        return;
+    }
+    unsigned short *gbk = calloc((GBK_LEAD_MAX - GBK_LEAD_MIN + 1) * GBK_TRAILS, sizeof(unsigned short));
+    unsigned short *unicode = calloc(0x10000, sizeof(unsigned short));
+    if((NULL == gbk) || (NULL == unicode)){
+        free(gbk);
+        free(unicode);
+        iconv_close(cd);
+        return;
+    }
+    int lead = 0;
+    int trail = 0;
+    for(lead=GBK_LEAD_MIN; lead<=GBK_LEAD_MAX; lead++){
+        for(trail=GBK_TRAIL_MIN; trail<=GBK_TRAIL_MAX; trail++){
+            char in[2] = {(char)lead, (char)trail};
+            unsigned char out[4];
+            char *inPtr = in;
+            char *outPtr = (char *)out;
+            size_t inLeft = 2;
+            size_t outLeft = 4;
+            if((size_t)-1 == iconv(cd, &inPtr, &inLeft, &outPtr, &outLeft)){
+                iconv(cd, NULL, NULL, NULL, NULL);
+                continue;
+            }
+            if(0 != outLeft){
+                continue;
+            }
+            unsigned int cp = out[0] | (out[1] << 8) | (out[2] << 16) | ((unsigned int)out[3] << 24);
+            if((cp < 0x80) || (cp > 0xFFFF)){
+                continue;
+            }
+            gbk[(lead - GBK_LEAD_MIN) * GBK_TRAILS + (trail - GBK_TRAIL_MIN)] = (unsigned short)cp;
+            if(0 == unicode[cp]){
+                unicode[cp] = (unsigned short)((lead << 8) | trail);
+            }
+        }
+    }
+    iconv_close(cd);
+    GBKTable = gbk;
+    UnicodeTable = unicode;
+    IconvKeyReady = (0 == pthread_key_create(&IconvKey, FreeCodecIconv));
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : FreeCodecIconv
+* Description: 线程退出时关闭该线程缓存的iconv描述符
+----------------------------------------------------------------------------*/
+void FreeCodecIconv(void *data)
+{
+    CodecIconv *codec = (CodecIconv *)data;
+    int i = 0;
+    for(i=0; i<2; i++){
+        if((iconv_t)-1 != codec->Cd[i]){
+            iconv_close(codec->Cd[i]);
+        }
+    }
+    free(codec);
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : IconvChar
+* Description: 用当前线程缓存的iconv描述符转换一个字符，返回写入的字节数，失败返回-1；
+    direction为ICONV_TO_UTF8(GB18030 -> UTF-8)或ICONV_FROM_UTF8，调用前已执行CodecOnce
+----------------------------------------------------------------------------*/
+int IconvChar(int direction, const char *src, int len, char *dst, int dstSize)
+{
+    if(DBF_TRUE != IconvKeyReady){
+        return DBF_FAIL;
+    }
+    CodecIconv *codec = pthread_getspecific(IconvKey);
+    if(NULL == codec){
+        codec = malloc(sizeof(CodecIconv));
+        if(NULL == codec){
+            return DBF_FAIL;
+        }
+        codec->Cd[ICONV_TO_UTF8] = (iconv_t)-1;
+        codec->Cd[ICONV_FROM_UTF8] = (iconv_t)-1;
+        if(0 != pthread_setspecific(IconvKey, codec)){
+            free(codec);
+            return DBF_FAIL;
+        }
+    }
+    if((iconv_t)-1 == codec->Cd[direction]){
+        codec->Cd[direction] = (ICONV_TO_UTF8 == direction) ? iconv_open("UTF-8", "GB18030") : iconv_open("GB18030", "UTF-8");
+        if((iconv_t)-1 == codec->Cd[direction]){
+            #ifdef DEBUG
+            printf("Debug IconvChar iconv_open Error, direction = %d\n", direction);
+            #endif
+            return DBF_FAIL;
+        }
+    }
+    iconv_t cd = codec->Cd[direction];
+    char *inPtr = (char *)src;
+    char *outPtr = dst;
+    size_t inLeft = len;
+    size_t outLeft = dstSize;
+    size_t ret = iconv(cd, &inPtr, &inLeft, &outPtr, &outLeft);
+    if(((size_t)-1 == ret) || (0 != inLeft)){
+        //描述符继续使用，失败后恢复初始状态
+        iconv(cd, NULL, NULL, NULL, NULL);
+        return DBF_FAIL;
+    }
+    return dstSize - outLeft;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : PutUTF8
+* Description: 把BMP码点写成UTF-8，返回写入的字节数，dst不够时返回-1
+----------------------------------------------------------------------------*/
+int PutUTF8(unsigned int cp, char *dst, int dstSize)
+{
+    if(cp < 0x800){
+        if(dstSize < 2){
+            return DBF_FAIL;
+        }
+        dst[0] = (char)(0xC0 | (cp >> 6));
+        dst[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if(dstSize < 3){
+        return DBF_FAIL;
+    }
+    dst[0] = (char)(0xE0 | (cp >> 12));
+    dst[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    dst[2] = (char)(0x80 | (cp & 0x3F));
+    return 3;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : GetUTF8
+* Description: 解析一个非ASCII的UTF-8字符，返回字节数，不合法时返回0
+----------------------------------------------------------------------------*/
+int GetUTF8(const unsigned char *p, int len, unsigned int *cp)
+{
+    int n = 0;
+    unsigned int c = 0;
+    if((p[0] >= 0xC2) && (p[0] <= 0xDF)){
+        n = 2;
+        c = p[0] & 0x1F;
+    }
+    else if((p[0] >= 0xE0) && (p[0] <= 0xEF)){
+        n = 3;
+        c = p[0] & 0x0F;
+    }
+    else if((p[0] >= 0xF0) && (p[0] <= 0xF4)){
+        n = 4;
+        c = p[0] & 0x07;
+    }
+    else{
+        return 0;
+    }
+    if(n > len){
+        return 0;
+    }
+    int i = 0;
+    for(i=1; i<n; i++){
+        if(0x80 != (p[i] & 0xC0)){
+            return 0;
+        }
+        c = (c << 6) | (p[i] & 0x3F);
+    }
+    *cp = c;
+    return n;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : TrimLen
+* Description: 去掉末尾空格后的长度
+----------------------------------------------------------------------------*/
+int TrimLen(const char *p, int width)
+{
+    while((width > 0) && (SPACE == p[width - 1])){
+        width --;
+    }
+    return width;
+}
@@ -0,0 +1,43 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cCodec.h
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-18
+ * Description  : C列的GBK/GB18030和UTF-8互转
+     1.文件头代码页字节(文件偏移29)为0x7A(GBK)、0x4D(GB2312)，或以DBF_OPEN_GBK打开时，
+       C列按GBK存储，GetFieldAsUTF8、SetFieldAsUTF8自动转换；否则不转换
+     2.双字节字符查表转换，码表在第一次使用时通过iconv生成，之后不再调用iconv
+     3.全是ASCII的值(大部分代码、数字列)整块判断后直接拷贝，不逐字节转换
+     4.GB18030的四字节字符和码表中没有的字符逐个调用iconv，无法转换的字符写为'?'
+**********************************************************************************/
+#ifndef CCODEC_H
+#define CCODEC_H
+
+#include "cDBFStruct.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//文件头中代码页字节的偏移，对应DBFHead.Reserved[17]
+#define DBF_CODEPAGE_OFFSET 29
+//GBK、GB2312的代码页标记
+#define DBF_CODEPAGE_GBK 0x7A
+#define DBF_CODEPAGE_GB2312 0x4D
+//GetFieldAsUTF8的缓存长度，一个GBK字节最多转为3个UTF-8字节
+#define DBF_UTF8_BUF_LEN (VALUE_BUF_LEN * 3)
+
+int IsGBKDBF(CDBF *cDBF);
+char *GetFieldAsUTF8(CDBF *cDBF, char *fieldName);
+int SetFieldAsUTF8(CDBF *cDBF, char *fieldName, char *value);
+int ColumnToUTF8(CDBF *cDBF, const char *values, int count, int width, char *arena, int arenaSize, char **out);
+int GBKToUTF8(const char *src, int len, char *dst, int dstSize);
+int UTF8ToGBK(const char *src, int len, char *dst, int dstSize);
+int IsAsciiBytes(const char *p, int len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -23,15 +23,35 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <time.h>
+#include <limits.h>
 #include "cDBF.h"
 #include "cHash.h"
+#include "cStats.h"
+#include "cSchema.h"
+#include "cSeqLock.h"
+#include "cAppend.h"
+#include "cZone.h"
+#include "cStream.h"
+#include "cShm.h"
+#include "cLog.h"
+#include "cDBFInner.h"
+
+//AppendRecords每次写入的最大字节数
+#define APPEND_CHUNK (16 * 1024 * 1024)
 
 int ReadHead(CDBF *cDBF);
 int WriteHead(CDBF *cDBF);
+int PostRecord(CDBF *cDBF);
+int WriteDirty(CDBF *cDBF, off_t offset);
+int SeqReadRecord(CDBF *cDBF, off_t offset);
 int ReadFields(CDBF *cDBF);
-int LockRow(CDBF *cDBF, int rowNo);
-int UnLockRow(CDBF *cDBF, int rowNo);
-int GetIndexByName(CDBF *cDBF, char *FieldName);
+int LockRow(CDBF *cDBF, unsigned int rowNo);
+int UnLockRow(CDBF *cDBF, unsigned int rowNo);
+char *GetFieldValue(CDBF *cDBF, int index);
+int RowResult(CDBF *cDBF, int ret);
+int PutFieldValue(CDBF *cDBF, int index, char *value, int len);
+CDBF *OpenCompactDBF(char *filePath, int flags);
+CDBF *BuildCompactDBF(char *filePath, int flags, FILE *fh, DBFHead *head, DBFSchema *schema);
 
 /*******************************************************************************
 * Function   : OpenDBF
@@ -44,6 +64,27 @@ int GetIndexByName(CDBF *cDBF, char *FieldName);
 *******************************************************************************/  
 CDBF *OpenDBF(char *filePath)
 {
+    return OpenDBFEx(filePath, DBF_OPEN_DEFAULT);
+}
+
+
+/*******************************************************************************
+* Function   : OpenDBFEx
+* Description: 按打开选项打开DBF文件; 供外部调用的Public方法
+* Input      :
+    * filePath, DBF文件目录
+    * flags, 打开选项，DBF_OPEN_*按位组合
+* Output     :
+* Return     : 该DBF文件对应的CDBF文件指针; 返回NULL表示打开失败
+* Others     :
+    * DBF_OPEN_COMPACT打开的句柄没有cDBF->Values，不能调用FetchValues、StoreValues
+    * DBF_OPEN_COMPACT打开的句柄GetFieldAsString返回的字符串在下一次Get之前有效
+*******************************************************************************/
+CDBF *OpenDBFEx(char *filePath, int flags)
+{
+    if(DBF_OPEN_COMPACT & flags){
+        return OpenCompactDBF(filePath, flags);
+    }
     //为cDBF申请内存
     CDBF *cDBF = malloc(sizeof(CDBF));
     if (NULL == cDBF){
@@ -51,6 +92,15 @@ CDBF *OpenDBF(char *filePath)
     }
     memset(cDBF, '\0', sizeof(CDBF));
     cDBF->status = dsBrowse;
+    cDBF->OpenFlags = flags;
+    #ifndef DBF_NO_STATS
+    //申请统计计数的内存
+    cDBF->Stats = CreateStats();
+    if (NULL == cDBF->Stats){
+        CloseDBF(cDBF);
+        return NULL;
+    }
+    #endif
     //读写二进制文件方式打开DBF文件
     cDBF->FHandle = fopen(filePath, "rb+");
     if (NULL == cDBF->FHandle){
@@ -99,6 +149,16 @@ CDBF *OpenDBF(char *filePath)
     if (DBF_FAIL == ReadFields(cDBF)){
         CloseDBF(cDBF);
         return NULL;
+    }
+    //计算各列在记录中的偏移，各列宽度之和不能超过记录长度
+    cDBF->FieldOffsets = malloc(sizeof(int) * cDBF->FieldCount);
+    if (NULL == cDBF->FieldOffsets){
+        CloseDBF(cDBF);
+        return NULL;
+    }
+    if(DBF_SUCCESS != BuildFieldOffsets(cDBF->Fields, cDBF->FieldCount, cDBF->Head->RecSize, cDBF->FieldOffsets)){
+        CloseDBF(cDBF);
+        return NULL;
     }
 	//申请列值信息的存储空间
 	cDBF->Values = malloc(sizeof(DBFValue) * cDBF->FieldCount);
@@ -106,6 +166,18 @@ CDBF *OpenDBF(char *filePath)
         CloseDBF(cDBF);
         return NULL;
     }
+    //将列值和列信息建立关系
+    int i = 0;
+    for(i=0; i<cDBF->FieldCount; i++){
+        cDBF->Values[i].Field = &cDBF->Fields[i];
+    }
+    //乐观读、多进程追加
+    if(((DBF_OPEN_OPTIMISTIC | DBF_OPEN_SHARED_APPEND) & flags) && (DBF_SUCCESS != OpenHeadMap(cDBF))){
+        CloseDBF(cDBF);
+        return NULL;
+    }
+    //有区块索引时加载，没有或不一致时忽略
+    LoadZoneMap(cDBF);
     //定位到第一行
     cDBF->RecNo = 0;
     if (cDBF->Head->RecCount > 0){
@@ -131,6 +203,29 @@ CDBF *OpenDBF(char *filePath)
 int CloseDBF(CDBF *cDBF)
 {
     if (NULL != cDBF){
+        //批量追加后未写的文件头先写到磁盘
+        if(DBF_SUCCESS != FlushDBF(cDBF)){
+            #ifdef DEBUG
+            printf("Debug CloseDBF FlushDBF Error\n");
+            #endif
+        }
+        CloseHeadMap(cDBF);
+        CloseZoneMap(cDBF);
+        CloseStream(cDBF);
+        CloseShared(cDBF);
+        CloseChangeLog(cDBF);
+        if(NULL != cDBF->Utf8Buf){
+            free(cDBF->Utf8Buf);
+        }
+        //紧凑句柄只有一块内存，表结构是共享的
+        if(DBF_OPEN_COMPACT & cDBF->OpenFlags){
+            if(NULL != cDBF->FHandle){
+                fclose(cDBF->FHandle);
+            }
+            ReleaseSchema(cDBF->Schema);
+            free(cDBF);
+            return DBF_SUCCESS;
+        }
         //OpenDBF中逐层申请内存，在Close中逐层释放内存、释放文件句柄
         if(NULL != cDBF->Path){
             free(cDBF->Path);
@@ -150,6 +245,10 @@ int CloseDBF(CDBF *cDBF)
         if(NULL != cDBF->Values){
             free(cDBF->Values);
         }
+        if(NULL != cDBF->FieldOffsets){
+            free(cDBF->FieldOffsets);
+        }
+        FreeStats(cDBF->Stats);
         free(cDBF);
         cDBF = NULL;
         return DBF_SUCCESS;
@@ -169,7 +268,7 @@ int CloseDBF(CDBF *cDBF)
 *******************************************************************************/ 
 int First(CDBF *cDBF)
 {
-    if(cDBF->Head->RecCount <= 0){
+    if(0 == cDBF->Head->RecCount){
         return DBF_NONE;
     }
     return Go(cDBF, 1);
@@ -183,14 +282,17 @@ int First(CDBF *cDBF)
     * cDBF, OpenDBF返回的CDBF结构体指针  
 * Output     :
 * Return     : 当前指向记录的序号, -1:切换失败; 0:DBF中没有记录，无法切换到第一条; >0:最后一条记录的序号 
-* Others     : 
+* Others     : 序号超过INT_MAX时int返回值放不下，不切换并返回-1，通过GoRow切换
 *******************************************************************************/ 
 int Last(CDBF *cDBF)
 {
-    if(cDBF->Head->RecCount <= 0){
+    if(0 == cDBF->Head->RecCount){
         return DBF_EOF;
     }
-	return Go(cDBF, cDBF->Head->RecCount);
+    if(cDBF->Head->RecCount > INT_MAX){
+        return DBF_FAIL;
+    }
+    return RowResult(cDBF, GoRow(cDBF, cDBF->Head->RecCount));
 }
 
 
@@ -201,14 +303,18 @@ int Last(CDBF *cDBF)
     * cDBF, OpenDBF返回的CDBF结构体指针  
 * Output     :
 * Return     : 当前指向记录的序号, -1:切换失败; 0:下一条是Eof，无法切换到第一条; >0:切换成功，返回切换后的序号
-* Others     : 
+* Others     : 序号超过INT_MAX时int返回值放不下，不切换并返回-1，通过GoRow切换
 *******************************************************************************/
 int Next(CDBF *cDBF)
 {
     if(cDBF->RecNo > cDBF->Head->RecCount){
         return DBF_EOF;
     }
-	return Go(cDBF, cDBF->RecNo + 1);
+    //已是int行号的最后一行
+    if(cDBF->RecNo >= INT_MAX){
+        return DBF_FAIL;
+    }
+    return RowResult(cDBF, GoRow(cDBF, cDBF->RecNo + 1));
 }
 
 
@@ -219,14 +325,17 @@ int Next(CDBF *cDBF)
     * cDBF, OpenDBF返回的CDBF结构体指针  
 * Output     :
 * Return     : 当前指向记录的序号, -1:切换失败; 0:当前已是第一条，无法向上; >0:切换成功，返回切换后的序号
-* Others     : 
+* Others     : 序号超过INT_MAX时int返回值放不下，不切换并返回-1，通过GoRow切换
 *******************************************************************************/
 int Prior(CDBF *cDBF)
 {
-    if((cDBF->Head->RecCount <= 0) || (cDBF->RecNo <= 1)){
+    if((0 == cDBF->Head->RecCount) || (cDBF->RecNo <= 1)){
         return DBF_NONE;
     }
-    return Go(cDBF, cDBF->RecNo - 1);
+    if(cDBF->RecNo - 1 > INT_MAX){
+        return DBF_FAIL;
+    }
+    return RowResult(cDBF, GoRow(cDBF, cDBF->RecNo - 1));
 }
 
 
@@ -238,80 +347,157 @@ int Prior(CDBF *cDBF)
     * rowNo, 将要切换的记录的行号
 * Output     :
 * Return     : 当前指向记录的序号, -1:切换失败; >0:切换成功，返回切换后的序号
-* Others     : 
+* Others     : 行号超过INT_MAX的记录通过GoRow切换
 *******************************************************************************/
 int Go(CDBF *cDBF, int rowNo)
 {
-    if((rowNo <=0) || (rowNo > cDBF->Head->RecCount)){
+    if(rowNo <= 0){
+        return DBF_FAIL;
+    }
+    return RowResult(cDBF, GoRow(cDBF, rowNo));
+}
+
+
+/*******************************************************************************
+* Function   : GoRow
+* Description: 切换到DBF文件的第rowNo条记录，行号可以到文件格式的上限
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+    * rowNo, 将要切换的记录的行号，1~Head->RecCount
+* Output     :
+* Return     : 是否切换成功, -1:切换失败; 1:切换成功，当前行号通过GetRecNo获取
+* Others     :
+    * 文件头中的记录数是无符号32位，行号超过INT_MAX时Go、Next、Prior、Last失败，只能通过本方法切换
+    * 记录偏移按off_t计算，超过2GB、4GB的文件照常定位
+*******************************************************************************/
+int GoRow(CDBF *cDBF, unsigned int rowNo)
+{
+    if((0 == rowNo) || (rowNo > cDBF->Head->RecCount)){
         return DBF_FAIL;
     }
+    //流句柄只能向前逐行读
+    if(NULL != cDBF->Stream){
+        if((rowNo > INT_MAX) || (DBF_FAIL == StreamGo(cDBF, rowNo))){
+            return DBF_FAIL;
+        }
+        return DBF_SUCCESS;
+    }
+    //共享内存句柄直接从映射拷贝，没有系统调用
+    if(NULL != cDBF->Shm){
+        if(DBF_FAIL == SharedGo(cDBF, rowNo)){
+            return DBF_FAIL;
+        }
+        return DBF_SUCCESS;
+    }
+    STATS_BEGIN(start);
     //加锁
     if(DBF_SUCCESS != LockRow(cDBF, rowNo)){
         #ifdef DEBUG
-        printf("Debug Go LockRow Error, rowNo = %d\n", rowNo);
+        printf("Debug Go LockRow Error, rowNo = %u\n", rowNo);
         #endif
         return DBF_FAIL;
     }
     //偏移：文件头偏移 + 该行前面的数据偏移
-    int Offset = cDBF->Head->DataOffset + (cDBF->Head->RecSize * (rowNo - 1));
-    //修改文件指针到对应的记录位置。1.文件指针，2.指针的偏移量，3.指针偏移起始位置
-    if(0 != fseek(cDBF->FHandle, Offset, SEEK_SET)){
-        #ifdef DEBUG
-        printf("Debug Go fseek Error, rowNo = %d\n", rowNo);
-        #endif
-        return DBF_FAIL;
+    off_t Offset = cDBF->Head->DataOffset + (off_t)cDBF->Head->RecSize * (rowNo - 1);
+    //一次读入整条记录，各列在第一次访问时再解码
+    //乐观读时不经过stdio缓存直接pread，序号校验不通过就重读；自己正在写时按普通方式读
+    int ret = DBF_SUCCESS;
+    if((NULL != cDBF->Seq) && (0 == cDBF->WriteDepth)){
+        ret = SeqReadRecord(cDBF, Offset);
     }
-    //先读删除标记
-    int readCount = 0;
-    readCount = fread(&cDBF->deleted, 1, 1, cDBF->FHandle);
-    if (1 != readCount){
+    else{
+        ret = ReadAt(cDBF, Offset, cDBF->ValueBuf, cDBF->Head->RecSize);
+    }
+    if(DBF_SUCCESS != ret){
         #ifdef DEBUG
-        printf("Debug Go fread Error, readCount = %d\n", readCount);
+        printf("Debug Go ReadAt Error, rowNo = %u\n", rowNo);
         #endif
+        UnLockRow(cDBF, rowNo);
         return DBF_FAIL;
     }
-    //然后将DBF文件中该列的数据读到内存中
-    int i=0;
-    int Width = 0;
-    for(i=0; i<cDBF->FieldCount; i++){
-        //将列值和列信息建立关系
-        cDBF->Values[i].Field = &cDBF->Fields[i];
-        //将磁盘中的各列读到对应内存列值中
-        Width = cDBF->Values[i].Field->Width;
-        readCount = fread(cDBF->Values[i].ValueBuf, Width, 1, cDBF->FHandle);
-        if (1 != readCount){
-            #ifdef DEBUG
-            printf("Debug Go fread Error, readCount = %d\n", readCount);
-            #endif
-            return DBF_FAIL;
-        }
-        //将字符串最后一位设置为NULL
-        cDBF->Values[i].ValueBuf[Width] = '\0';
-    }
+    cDBF->deleted = cDBF->ValueBuf[0];
+    memset(cDBF->Decoded, 0, sizeof(cDBF->Decoded));
+    memset(cDBF->Dirty, 0, sizeof(cDBF->Dirty));
     //解锁
     if(DBF_SUCCESS != UnLockRow(cDBF, rowNo)){
         #ifdef DEBUG
-        printf("Debug Go UnLockRow Error, rowNo = %d\n", rowNo);
+        printf("Debug Go UnLockRow Error, rowNo = %u\n", rowNo);
         #endif
         return DBF_FAIL;
     }
     //更新cDBF的记录信息
     cDBF->RecNo = rowNo;
+    STATS_ADD(cDBF, siRecordsRead, 1);
+    STATS_END(cDBF, hiGo, start);
+    return DBF_SUCCESS;
+}
+
+
+/*******************************************************************************
+* Function   : GetRecNo
+* Description: 获取CDBF当前指向的行号
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+* Output     :
+* Return     : 当前行号, 0:没有指向任何行
+* Others     :
+*******************************************************************************/
+unsigned int GetRecNo(CDBF *cDBF)
+{
     return cDBF->RecNo;
 }
 
 
+/*******************************************************************************
+* Function   : GetRecCount
+* Description: 获取DBF中的记录个数
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+* Output     :
+* Return     : 记录个数，文件头中的无符号32位值
+* Others     :
+*******************************************************************************/
+unsigned int GetRecCount(CDBF *cDBF)
+{
+    return cDBF->Head->RecCount;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : IntRecCount
+* Description: 
+    * 按int行号使用的记录数，ScanBlocks、区块索引、UpdateWhere等按int行号处理
+    * 该方法是cDBF的内部方法，在cDBFInner.h中声明，不提供接口给外部调用
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+* Output     :
+* Return     : 记录个数，超过INT_MAX时返回-1
+* Others     : 按int行号处理的方法在记录数超过INT_MAX时返回失败，不截断，只能通过GoRow逐行访问
+----------------------------------------------------------------------------*/
+int IntRecCount(CDBF *cDBF)
+{
+    if(cDBF->Head->RecCount > INT_MAX){
+        return DBF_FAIL;
+    }
+    return (int)cDBF->Head->RecCount;
+}
+
+
 /******************************************************************************* 
 * Function   : Edit
 * Description: 编译当前CDBF所指向的行
 * Input      :
     * cDBF, OpenDBF返回的CDBF结构体指针  
 * Output     :
-* Return     : 是否允许编辑, -1:不允许编辑; 1:允许编辑
+* Return     : 是否允许编辑, -1:不允许编辑(没有当前行); 1:允许编辑
 * Others     :  编辑成功后需调用Post方法从内存更新到磁盘
 *******************************************************************************/
 int Edit(CDBF *cDBF)
 {
+    //空文件、Eof时没有当前行
+    if((0 == cDBF->RecNo) || (cDBF->RecNo > cDBF->Head->RecCount)){
+        return DBF_FAIL;
+    }
     //直接返回，接下来在内存中编辑，然后调用Post才能更新到磁盘
     cDBF->status = dsEdit;
     return DBF_SUCCESS;
@@ -330,11 +516,17 @@ int Edit(CDBF *cDBF)
 int Append(CDBF *cDBF)
 {
     cDBF->status = dsAppend;
-    //先将列的内存值清为空格
+    //先将行缓存清为空格
     cDBF->deleted = ' ';
-    int i = 0;
-    for(i=0; i<cDBF->FieldCount; i++){
-        memset(cDBF->Values[i].ValueBuf, ' ', sizeof(cDBF->Values[i].ValueBuf));
+    memset(cDBF->ValueBuf, ' ', cDBF->Head->RecSize);
+    memset(cDBF->Decoded, 0, sizeof(cDBF->Decoded));
+    memset(cDBF->Dirty, 0, sizeof(cDBF->Dirty));
+    //各列的值也清为空格并标记为已解码，直接修改Values的老代码不会带上前一行的值
+    if(NULL != cDBF->Values){
+        int i = 0;
+        for(i=0; i<cDBF->FieldCount; i++){
+            GetFieldValue(cDBF, i);
+        }
     }
     return DBF_SUCCESS;
 }
@@ -346,13 +538,18 @@ int Append(CDBF *cDBF)
 * Input      :
     * cDBF, OpenDBF返回的CDBF结构体指针  
 * Output     :
-* Return     : 是否删除成功, -1:删除失败; 1:删除成功
+* Return     : 是否删除成功, -1:删除失败(没有当前行); 1:删除成功
 * Others     : 删除成功后需调用Post方法从内存更新到磁盘
 *******************************************************************************/
 int Delete(CDBF *cDBF)
 {
+    if((0 == cDBF->RecNo) || (cDBF->RecNo > cDBF->Head->RecCount)){
+        return DBF_FAIL;
+    }
     cDBF->status = dsEdit;
-    cDBF->deleted = '*';
+    cDBF->deleted = DELETED;
+    cDBF->ValueBuf[0] = DELETED;
+    cDBF->Dirty[0] |= 1;
     return DBF_SUCCESS;
 }
 
@@ -363,130 +560,436 @@ int Delete(CDBF *cDBF)
 * Input      :
     * cDBF, OpenDBF返回的CDBF结构体指针  
 * Output     :
-* Return     : 是否更新成功, -1:更新失败; 1:更新成功
+* Return     : 是否更新成功, -1:更新失败或没有调用Edit、Delete、Append; 1:更新成功
 * Others     : 
+    * 修改时只写Set方法修改过的列和删除标记，文件头中的日期在FlushDBF或CloseDBF时写入
+    * 追加时写整条记录并更新文件头中的记录数
 *******************************************************************************/
 int Post(CDBF *cDBF)
 {
-    //列数据先写入内存缓冲区
-    int i = 0;
-    void *RowData = cDBF->ValueBuf;
-    memcpy(RowData, &cDBF->deleted, 1);
-    RowData = RowData + 1;
-    for(i=0; i<cDBF->FieldCount; i++){
-        memcpy(RowData, cDBF->Values[i].ValueBuf, cDBF->Fields[i].Width);
-        RowData = RowData + cDBF->Fields[i].Width;
+    if((DBF_OPEN_STREAM | DBF_OPEN_SHM) & cDBF->OpenFlags){
+        return DBF_FAIL;
+    }
+    //乐观读时整个Post作为一批写，读方不会读到写了一半的记录
+    if(DBF_SUCCESS != BeginWriteBatch(cDBF)){
+        return DBF_FAIL;
+    }
+    int ret = PostRecord(cDBF);
+    if(DBF_SUCCESS != EndWriteBatch(cDBF)){
+        ret = DBF_FAIL;
+    }
+    return ret;
+}
+
+
+/*******************************************************************************
+* Function   : PostRecord
+* Description: 将行缓存写到磁盘，追加时并更新文件头
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+* Output     :
+* Return     : 是否更新成功, -1:更新失败; 1:更新成功
+* Others     : Post的实现，调用方负责BeginWriteBatch、EndWriteBatch
+*******************************************************************************/
+int PostRecord(CDBF *cDBF)
+{
+    STATS_BEGIN(start);
+    //没有Edit、Delete、Append时不知道写到哪一行，不能按偏移0写到文件头上
+    if((dsEdit != cDBF->status) && (dsAppend != cDBF->status)){
+        return DBF_FAIL;
     }
+    //Set方法已直接修改行缓存，这里只需同步删除标记
+    if(cDBF->ValueBuf[0] != cDBF->deleted){
+        cDBF->Dirty[0] |= 1;
+    }
+    cDBF->ValueBuf[0] = cDBF->deleted;
     //编辑结果保存到磁盘
-    int Offset = 0;
+    off_t Offset = 0;
     if(dsEdit == cDBF->status){
-        Offset = cDBF->Head->DataOffset + (cDBF->Head->RecSize * (cDBF->RecNo - 1));
+        //没有当前行时RecNo - 1会回绕成很大的偏移
+        if((0 == cDBF->RecNo) || (cDBF->RecNo > cDBF->Head->RecCount)){
+            return DBF_FAIL;
+        }
+        //修改只写Set过的列，文件头只有日期变化，推迟到FlushDBF、CloseDBF时写
+        Offset = cDBF->Head->DataOffset + (off_t)cDBF->Head->RecSize * (cDBF->RecNo - 1);
+        if(DBF_SUCCESS != WriteDirty(cDBF, Offset)){
+            #ifdef DEBUG
+            printf("Debug Post WriteDirty Error\n");
+            #endif
+            return DBF_FAIL;
+        }
+        STATS_ADD(cDBF, siRecordsWritten, 1);
+        if(cDBF->RecNo <= INT_MAX){
+            ZoneMapRecords(cDBF, cDBF->RecNo, cDBF->ValueBuf, 1);
+        }
+        memset(cDBF->Dirty, 0, sizeof(cDBF->Dirty));
+        cDBF->HeadDirty = DBF_TRUE;
+        cDBF->status = dsBrowse;
+        STATS_END(cDBF, hiPost, start);
+        return DBF_SUCCESS;
+    }
+    else if((dsAppend == cDBF->status) && (DBF_OPEN_SHARED_APPEND & cDBF->OpenFlags)){
+        //多进程追加时分配位置后直接写，记录数在映射的文件头中发布，不需要写文件头
+        if(DBF_SUCCESS != SharedAppend(cDBF, cDBF->ValueBuf, 1)){
+            return DBF_FAIL;
+        }
+        STATS_ADD(cDBF, siRecordsWritten, 1);
+        cDBF->status = dsBrowse;
+        STATS_END(cDBF, hiPost, start);
+        return DBF_SUCCESS;
     }
     else if(dsAppend == cDBF->status){
-        Offset = cDBF->Head->DataOffset + (cDBF->Head->RecSize * (cDBF->Head->RecCount));
+        //记录数已到文件格式的上限
+        if(0xFFFFFFFFU == cDBF->Head->RecCount){
+            return DBF_FAIL;
+        }
+        Offset = cDBF->Head->DataOffset + (off_t)cDBF->Head->RecSize * cDBF->Head->RecCount;
         cDBF->Head->RecCount ++;
     }
-    if(0 != fseek(cDBF->FHandle, Offset, SEEK_SET)){
+    if(DBF_SUCCESS != WriteAt(cDBF, Offset, cDBF->ValueBuf, cDBF->Head->RecSize)){
         #ifdef DEBUG
-        printf("Debug Post fseek Error\n");
+        printf("Debug Post WriteAt Error\n");
         #endif
         return DBF_FAIL;
     }
-    int writeCount = fwrite(cDBF->ValueBuf, cDBF->Head->RecSize, 1, cDBF->FHandle);
-    if(1 != writeCount){
-        #ifdef DEBUG
-        printf("Debug Post fwrite Error\n");
-        #endif
-        return DBF_FAIL;
+    STATS_ADD(cDBF, siRecordsWritten, 1);
+    //追加计入区块索引的最后一个区块；区块索引按int行号，只覆盖前INT_MAX行
+    if((dsAppend == cDBF->status) && (cDBF->Head->RecCount <= INT_MAX)){
+        ZoneMapRecords(cDBF, cDBF->Head->RecCount, cDBF->ValueBuf, 1);
     }
     //更新文件头中记录数信息
     if(DBF_FAIL == WriteHead(cDBF)){
         return DBF_FAIL;
     }
     //修改DBF文件编辑状态
+    memset(cDBF->Dirty, 0, sizeof(cDBF->Dirty));
     cDBF->status = dsBrowse;
+    STATS_END(cDBF, hiPost, start);
     return DBF_SUCCESS;
 }
 
 
+/*----------------------------------------------------------------------------
+* Function   : WriteDirty
+* Description: 
+    * 修改时只写Set方法修改过的字节，相邻的列合并为一次写
+    * 该方法是cDBF的私有方法，不提供接口给外部调用
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+    * offset, 当前行在文件中的偏移
+* Output     :
+* Return     :
+    * 是否写入成功, -1:写入失败; 1:写入成功
+* Others     : 没有经过Set方法修改时(例如直接改行缓存)写整条记录
+----------------------------------------------------------------------------*/
+int WriteDirty(CDBF *cDBF, off_t offset)
+{
+    int start = -1;
+    int end = 0;
+    int bit = 0;
+    for(bit=0; bit<=cDBF->FieldCount; bit++){
+        if(0 == (cDBF->Dirty[bit >> 3] & (1 << (bit & 7)))){
+            continue;
+        }
+        //第0位是删除标记，第i+1位是第i列
+        int from = (0 == bit) ? 0 : cDBF->FieldOffsets[bit - 1];
+        int to = (0 == bit) ? 1 : from + cDBF->Fields[bit - 1].Width;
+        if((start >= 0) && (from == end)){
+            end = to;
+            continue;
+        }
+        if((start >= 0) && (DBF_SUCCESS != WriteAt(cDBF, offset + start, cDBF->ValueBuf + start, end - start))){
+            return DBF_FAIL;
+        }
+        start = from;
+        end = to;
+    }
+    if(start < 0){
+        return WriteAt(cDBF, offset, cDBF->ValueBuf, cDBF->Head->RecSize);
+    }
+    return WriteAt(cDBF, offset + start, cDBF->ValueBuf + start, end - start);
+}
+
+
 /******************************************************************************* 
-* Function   : Zap
-* Description: 清空DBF中的数据
+* Function   : AppendRecords
+* Description: 批量追加记录，直接写入原始记录
 * Input      :
-    * cDBF, OpenDBF返回的CDBF结构体指针  
+    * cDBF, OpenDBF返回的CDBF结构体指针
+    * records, count条记录的原始字节，每条Head->RecSize字节，第0个字节是删除标记
+    * count, 记录条数
 * Output     :
-* Return     : 是否清空成功, -1:清空失败; 1:清空成功
+* Return     : 是否追加成功, -1:追加失败; 1:追加成功
 * Others     :
-    * OpenDBF成功后，就可以直接调用Zap清空DBF文件了 
+    * 只写记录，不写文件头，文件头中的记录数在FlushDBF或CloseDBF时写入
+    * 多次调用只需一次写文件头
+    * 以DBF_OPEN_SHARED_APPEND打开时，记录数在返回前发布，不需要写文件头
 *******************************************************************************/
-int Zap(CDBF *cDBF)
+int AppendRecords(CDBF *cDBF, const char *records, int count)
 {
-    //首先清空文件
-    //fileno通过fopen的文件描述符得到对应open的文件描述符
-    int fd = fileno(cDBF->FHandle);
-    if(0 != ftruncate(fd, cDBF->Head->DataOffset)){
+    if(count <= 0){
+        return DBF_SUCCESS;
+    }
+    if((DBF_OPEN_STREAM | DBF_OPEN_SHM) & cDBF->OpenFlags){
         return DBF_FAIL;
     }
-    //更新文件头中记录数信息
-    cDBF->Head->RecCount = 0;
-    if(DBF_FAIL == WriteHead(cDBF)){
+    if(DBF_OPEN_SHARED_APPEND & cDBF->OpenFlags){
+        if(DBF_SUCCESS != SharedAppend(cDBF, records, count)){
+            return DBF_FAIL;
+        }
+        STATS_ADD(cDBF, siRecordsWritten, count);
+        return DBF_SUCCESS;
+    }
+    //记录数不能超过文件格式的上限
+    if((unsigned int)count > 0xFFFFFFFFU - cDBF->Head->RecCount){
+        return DBF_FAIL;
+    }
+    if(DBF_SUCCESS != BeginWriteBatch(cDBF)){
+        return DBF_FAIL;
+    }
+    off_t Offset = cDBF->Head->DataOffset + (off_t)cDBF->Head->RecSize * cDBF->Head->RecCount;
+    off_t total = (off_t)cDBF->Head->RecSize * count;
+    off_t done = 0;
+    //分块写，每次写不超过ReadAt/WriteAt的int长度
+    while(done < total){
+        int size = (total - done > APPEND_CHUNK) ? APPEND_CHUNK : (int)(total - done);
+        if(DBF_SUCCESS != WriteAt(cDBF, Offset + done, (void *)(records + done), size)){
+            #ifdef DEBUG
+            printf("Debug AppendRecords WriteAt Error\n");
+            #endif
+            EndWriteBatch(cDBF);
+            return DBF_FAIL;
+        }
+        done = done + size;
+    }
+    if(DBF_SUCCESS != EndWriteBatch(cDBF)){
         return DBF_FAIL;
     }
+    if(cDBF->Head->RecCount < INT_MAX){
+        ZoneMapRecords(cDBF, cDBF->Head->RecCount + 1, records, count);
+    }
+    cDBF->Head->RecCount = cDBF->Head->RecCount + count;
+    cDBF->HeadDirty = DBF_TRUE;
+    STATS_ADD(cDBF, siRecordsWritten, count);
     return DBF_SUCCESS;
 }
 
 
 /******************************************************************************* 
-* Function   : Fresh
-* Description: 将DBF信息从磁盘更新到内存，刷新记录数等信息
+* Function   : FlushDBF
+* Description: 将内存中未写的文件头写到磁盘，并刷新stdio缓存
 * Input      :
-    * cDBF, OpenDBF返回的CDBF结构体指针  
+    * cDBF, OpenDBF返回的CDBF结构体指针
 * Output     :
-* Return     : 是否刷新成功, -1:刷新失败; 1:刷新成功
-* Others     :
+* Return     : 是否写入成功, -1:写入失败; 1:写入成功
+* Others     : 
 *******************************************************************************/
-int Fresh(CDBF *cDBF)
+int FlushDBF(CDBF *cDBF)
 {
-    return ReadHead(cDBF);
+    if(DBF_TRUE == cDBF->HeadDirty){
+        if(DBF_SUCCESS != BeginWriteBatch(cDBF)){
+            return DBF_FAIL;
+        }
+        int ret = WriteHead(cDBF);
+        if(DBF_SUCCESS != EndWriteBatch(cDBF)){
+            ret = DBF_FAIL;
+        }
+        if(DBF_SUCCESS != ret){
+            return DBF_FAIL;
+        }
+        cDBF->HeadDirty = DBF_FALSE;
+    }
+    //变更日志先于记录写出，区块索引在记录写到文件后写
+    if(DBF_SUCCESS != FlushChangeLog(cDBF)){
+        return DBF_FAIL;
+    }
+    if((NULL != cDBF->FHandle) && (0 != fflush(cDBF->FHandle))){
+        return DBF_FAIL;
+    }
+    return FlushZoneMap(cDBF);
 }
 
 
 /******************************************************************************* 
-* Function   : GetFieldAsBoolean
-* Description: 获取cDBF指向的当前行的fieldName列的值，并作为布尔值返回
+* Function   : CreateDBFLike
+* Description: 按cDBF的文件头和列信息新建一个没有记录的DBF文件
 * Input      :
     * cDBF, OpenDBF返回的CDBF结构体指针
-    * fieldName, 列名
+    * filePath, 新建的DBF文件目录，已存在时覆盖
 * Output     :
-* Return     : 布尔值, 0-False; 1-True
-* Others     :
+* Return     : 是否新建成功, -1:新建失败; 1:新建成功
+* Others     : 新文件的DataOffset、RecSize和cDBF相同，记录可以直接按原始字节拷贝
 *******************************************************************************/
-unsigned char GetFieldAsBoolean(CDBF *cDBF, char *fieldName)
+int CreateDBFLike(CDBF *cDBF, char *filePath)
 {
-    int index = GetIndexByName(cDBF, fieldName);
-    if(DBF_FAIL == index){
-        return DBF_FALSE;
+    int size = cDBF->Head->DataOffset;
+    char *buf = malloc(size);
+    if(NULL == buf){
+        return DBF_FAIL;
     }
-    if(('L' == cDBF->Fields[index].FieldType) && ('T' == cDBF->Values[index].ValueBuf[0])){
-        return DBF_TRUE;
+    //文件头、列信息、头结束标记，DataOffset剩余的部分补0
+    memset(buf, '\0', size);
+    DBFHead *head = (DBFHead *)buf;
+    memcpy(head, cDBF->Head, sizeof(DBFHead));
+    head->RecCount = 0;
+    time_t timep;
+    time(&timep);
+    struct tm *p = gmtime(&timep);
+    head->Year = (unsigned char)p->tm_year;
+    head->Month = (unsigned char)p->tm_mon;
+    head->Day = (unsigned char)p->tm_mday;
+    int fieldsSize = sizeof(DBFField) * cDBF->FieldCount;
+    memcpy(buf + sizeof(DBFHead), cDBF->Fields, fieldsSize);
+    if(sizeof(DBFHead) + fieldsSize < size){
+        buf[sizeof(DBFHead) + fieldsSize] = HDREND;
     }
-    else{
-        return DBF_FALSE;
+    FILE *fh = fopen(filePath, "wb");
+    if(NULL == fh){
+        free(buf);
+        return DBF_FAIL;
+    }
+    int writeCount = fwrite(buf, size, 1, fh);
+    free(buf);
+    if(0 != fclose(fh)){
+        return DBF_FAIL;
     }
+    if(1 != writeCount){
+        return DBF_FAIL;
+    }
+    //同名文件原来的区块索引已经无效
+    char zonePath[strlen(filePath) + 8];
+    snprintf(zonePath, sizeof(zonePath), "%s.zmp", filePath);
+    unlink(zonePath);
+    return DBF_SUCCESS;
 }
 
 
 /******************************************************************************* 
-* Function   : GetFieldAsInteger
-* Description: 获取cDBF指向的当前行的fieldName列的值，并作为整型值返回
+* Function   : Zap
+* Description: 清空DBF中的数据
 * Input      :
-    * cDBF, OpenDBF返回的CDBF结构体指针
-    * fieldName, 列名
+    * cDBF, OpenDBF返回的CDBF结构体指针  
 * Output     :
-* Return     : 返回的整型值
+* Return     : 是否清空成功, -1:清空失败; 1:清空成功
 * Others     :
+    * OpenDBF成功后，就可以直接调用Zap清空DBF文件了 
 *******************************************************************************/
-int GetFieldAsInteger(CDBF *cDBF, char *fieldName)
+int Zap(CDBF *cDBF)
+{
+    if((DBF_OPEN_STREAM | DBF_OPEN_SHM) & cDBF->OpenFlags){
+        return DBF_FAIL;
+    }
+    //首先清空文件
+    //fileno通过fopen的文件描述符得到对应open的文件描述符
+    if(DBF_SUCCESS != BeginWriteBatch(cDBF)){
+        return DBF_FAIL;
+    }
+    //先写出stdio中未写的记录，否则截断后才写到文件，文件又变长
+    int fd = fileno(cDBF->FHandle);
+    if((0 != fflush(cDBF->FHandle)) || (DBF_SUCCESS != LogTruncate(cDBF, 0)) || (DBF_SUCCESS != FlushChangeLog(cDBF))
+        || (0 != ftruncate(fd, cDBF->Head->DataOffset))){
+        EndWriteBatch(cDBF);
+        return DBF_FAIL;
+    }
+    //更新文件头中记录数信息
+    cDBF->Head->RecCount = 0;
+    ZoneMapReset(cDBF);
+    if(DBF_OPEN_SHARED_APPEND & cDBF->OpenFlags){
+        SharedReset(cDBF);
+    }
+    int ret = WriteHead(cDBF);
+    if(DBF_SUCCESS != EndWriteBatch(cDBF)){
+        ret = DBF_FAIL;
+    }
+    return ret;
+}
+
+
+/******************************************************************************* 
+* Function   : Fresh
+* Description: 将DBF信息从磁盘更新到内存，刷新记录数等信息
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针  
+* Output     :
+* Return     : 是否刷新成功, -1:刷新失败; 1:刷新成功
+* Others     :
+*******************************************************************************/
+int Fresh(CDBF *cDBF)
+{
+    if(DBF_OPEN_STREAM & cDBF->OpenFlags){
+        return DBF_FAIL;
+    }
+    //共享内存句柄切换到最新发布的版本
+    if(DBF_OPEN_SHM & cDBF->OpenFlags){
+        return SharedFresh(cDBF);
+    }
+    STATS_BEGIN(start);
+    int ret = DBF_SUCCESS;
+    //丢弃stdio的读缓存，否则fseek到缓存范围内时读到的是其他进程写之前的旧数据
+    fflush(cDBF->FHandle);
+    if((NULL != cDBF->Seq) && (0 == cDBF->WriteDepth)){
+        //乐观读时直接从映射的文件头读取，不需要系统调用
+        unsigned int seq = 0;
+        do{
+            if(DBF_SUCCESS != SeqReadBegin(cDBF, &seq)){
+                return DBF_FAIL;
+            }
+            memcpy(cDBF->Head, cDBF->HeadMap, sizeof(DBFHead));
+        }while(SeqReadRetry(cDBF, seq));
+    }
+    else if(NULL != cDBF->HeadMap){
+        //多进程追加时记录数在映射的文件头中发布
+        memcpy(cDBF->Head, cDBF->HeadMap, sizeof(DBFHead));
+    }
+    else{
+        ret = ReadHead(cDBF);
+    }
+    //其他句柄可能已写回了扩大的区块范围
+    if(DBF_SUCCESS == ret){
+        ZoneMapRefresh(cDBF, DBF_TRUE);
+    }
+    STATS_END(cDBF, hiFresh, start);
+    return ret;
+}
+
+
+/******************************************************************************* 
+* Function   : GetFieldAsBoolean
+* Description: 获取cDBF指向的当前行的fieldName列的值，并作为布尔值返回
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+    * fieldName, 列名
+* Output     :
+* Return     : 布尔值, 0-False; 1-True
+* Others     :
+*******************************************************************************/
+unsigned char GetFieldAsBoolean(CDBF *cDBF, char *fieldName)
+{
+    int index = GetIndexByName(cDBF, fieldName);
+    if(DBF_FAIL == index){
+        return DBF_FALSE;
+    }
+    //布尔值只有一个字节，直接读行缓存，不需要解码
+    if(('L' == cDBF->Fields[index].FieldType) && ('T' == cDBF->ValueBuf[cDBF->FieldOffsets[index]])){
+        return DBF_TRUE;
+    }
+    else{
+        return DBF_FALSE;
+    }
+}
+
+
+/******************************************************************************* 
+* Function   : GetFieldAsInteger
+* Description: 获取cDBF指向的当前行的fieldName列的值，并作为整型值返回
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+    * fieldName, 列名
+* Output     :
+* Return     : 返回的整型值
+* Others     :
+*******************************************************************************/
+int GetFieldAsInteger(CDBF *cDBF, char *fieldName)
 {
     char *str = GetFieldAsString(cDBF, fieldName);
     return atoi(str);
@@ -535,14 +1038,15 @@ char *GetFieldAsString(CDBF *cDBF, char *fieldName)
     
     //字符串类型后面会用空格补齐，需要去除空格
     //int、float在前面补空格，可以不去除这种空格，不影响atoi、atof的转换
+    char *value = GetFieldValue(cDBF, index);
     int i = 0;
     for(i=cDBF->Fields[index].Width-1; i>=0; i--){
-        if(' ' != cDBF->Values[index].ValueBuf[i]){
+        if(' ' != value[i]){
             break;
         }
     }
-    cDBF->Values[index].ValueBuf[i+1] = '\0';
-    return cDBF->Values[index].ValueBuf;
+    value[i+1] = '\0';
+    return value;
 }
 
 
@@ -570,8 +1074,7 @@ int SetFieldAsBoolean(CDBF *cDBF, char *fieldName, unsigned char value)
     else{
         boolValue = 'F';
     }
-    cDBF->Values[index].ValueBuf[0] = boolValue;
-    return DBF_SUCCESS;
+    return PutFieldValue(cDBF, index, &boolValue, 1);
 }
 
 
@@ -594,10 +1097,10 @@ int SetFieldAsInteger(CDBF *cDBF, char *fieldName, int value)
     }
     //int转成string，按DBF格式要求前面不足的位补空格
     //sprintf(s, "%*d", 2, 100);并不会截位，还是100，所以需要考虑设置值超长的问题！
-    //这里不考虑截位，ValueBuf是256位，int转成string后，不会超过256位
-    //后续将Values的ValueBuf拷贝到行缓存中，会按照Width拷贝，会自动截位！
-    sprintf(cDBF->Values[index].ValueBuf, "%*d", cDBF->Fields[index].Width, value);
-    return DBF_SUCCESS;
+    //PutFieldValue按照Width拷贝到行缓存中，会自动截位！
+    char buf[256];
+    int len = snprintf(buf, sizeof(buf), "%*d", cDBF->Fields[index].Width, value);
+    return PutFieldValue(cDBF, index, buf, len);
 }
 
 
@@ -619,10 +1122,10 @@ int SetFieldAsFloat(CDBF *cDBF, char *fieldName, double value)
         return DBF_FAIL;
     }
     //float转成string，按DBF格式要求前面不足的位补空格
-    //这里不考虑截位，ValueBuf是256位，int转成string后，不会超过256位
-    //后续将Values的ValueBuf拷贝到行缓存中，会按照Width拷贝，会自动截位！
-    sprintf(cDBF->Values[index].ValueBuf, "%*.*f", cDBF->Fields[index].Width, cDBF->Fields[index].Scale, value);
-    return DBF_SUCCESS;
+    //PutFieldValue按照Width拷贝到行缓存中，会自动截位！
+    char buf[256];
+    int len = snprintf(buf, sizeof(buf), "%*.*f", cDBF->Fields[index].Width, cDBF->Fields[index].Scale, value);
+    return PutFieldValue(cDBF, index, buf, len);
 }
 
 
@@ -645,22 +1148,89 @@ int SetFieldAsString(CDBF *cDBF, char *fieldName, char *value)
     }
     //string类型写到DBF中要求后面补空格，且不用'\0'结尾
     //比如5位，写入"123"，不应该是'1','2','3','\0'，而应该是'1','2','3',' ',' '
-    if(strlen(value) >= cDBF->Fields[index].Width){
-        //如果value超长，会在这里自动截位
-        memcpy(cDBF->Values[index].ValueBuf, value, cDBF->Fields[index].Width);
+    return PutFieldValue(cDBF, index, value, strlen(value));
+}
+
+
+/******************************************************************************* 
+* Function   : FetchValues
+* Description: 将当前行的所有列解码到cDBF->Values中
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+* Output     :
+* Return     : -1:解码失败; 1:解码成功
+* Others     :
+    * Go只读入原始记录，各列在Get时按需解码
+    * 需要直接访问cDBF->Values[i].ValueBuf的老代码，在Go之后调用该方法
+*******************************************************************************/
+int FetchValues(CDBF *cDBF)
+{
+    if(NULL == cDBF->Values){
+        return DBF_FAIL;
     }
-    else{
-        memcpy(cDBF->Values[index].ValueBuf, value, strlen(value));
-        int i = 0;
-        //字符串不足的，后面补空格
-        for(i=strlen(value); i<cDBF->Fields[index].Width; i++){
-            cDBF->Values[index].ValueBuf[i] = ' ';
+    int i = 0;
+    for(i=0; i<cDBF->FieldCount; i++){
+        GetFieldValue(cDBF, i);
+    }
+    return DBF_SUCCESS;
+}
+
+
+/******************************************************************************* 
+* Function   : StoreValues
+* Description: 将cDBF->Values中的各列值写回行缓存
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+* Output     :
+* Return     : -1:写回失败; 1:写回成功
+* Others     :
+    * Post直接将行缓存写到磁盘，不再读取cDBF->Values
+    * 直接修改cDBF->Values[i].ValueBuf的老代码，在Post之前调用该方法
+    * 各列值按字符串处理，遇到'\0'后面补空格
+    * 只写回已解码(FetchValues、Get、Append之后)的列，SetFieldAs*修改过的列以行缓存为准
+*******************************************************************************/
+int StoreValues(CDBF *cDBF)
+{
+    if(NULL == cDBF->Values){
+        return DBF_FAIL;
+    }
+    int i = 0;
+    for(i=0; i<cDBF->FieldCount; i++){
+        if(0 == (cDBF->Decoded[i >> 3] & (1 << (i & 7)))){
+            continue;
         }
+        char *value = cDBF->Values[i].ValueBuf;
+        PutFieldValue(cDBF, i, value, strnlen(value, cDBF->Fields[i].Width));
     }
     return DBF_SUCCESS;
 }
 
 
+/******************************************************************************* 
+* Function   : GetDBFMemSize
+* Description: 获取句柄占用的内存字节数
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+* Output     :
+* Return     : 句柄占用的内存字节数
+* Others     :
+    * 紧凑句柄共享的表结构不计算在内，见cDBF->Schema->Size
+    * 不包括FILE结构体及其缓存
+*******************************************************************************/
+int GetDBFMemSize(CDBF *cDBF)
+{
+    int size = sizeof(CDBF) + strlen(cDBF->Path) + 1 + sizeof(DBFHead) + cDBF->Head->RecSize;
+    if(DBF_OPEN_COMPACT & cDBF->OpenFlags){
+        return size + VALUE_BUF_LEN;
+    }
+    size = size + (sizeof(DBFField) + sizeof(int) + sizeof(DBFValue)) * cDBF->FieldCount;
+    #ifndef DBF_NO_STATS
+    size = size + sizeof(DBFStatsBlock);
+    #endif
+    return size;
+}
+
+
 /*----------------------------------------------------------------------------
 * Function   : ReadHead
 * Description: 读DBF文件的文件头，OpenDBF、Fresh时调用
@@ -675,23 +1245,15 @@ int ReadHead(CDBF *cDBF)
 {
     /*先实现功能，这里需要加锁，后续实现！*/
     
-    //先定位到文件头
-    if(0 != fseek(cDBF->FHandle, 0, SEEK_SET)){
-        #ifdef DEBUG
-        printf("Debug ReadHead fseek Error\n");
-        #endif
-        return DBF_FAIL;
-    }
-    //fread从cDBF->FHandle读1个sizeof(DBFHead)字节的数据放到cDBF->Head中，fread会自动移动文件指针
-    int readCount = fread(cDBF->Head, sizeof(DBFHead), 1, cDBF->FHandle);
-    if (1 != readCount){
+    //读取文件头
+    if(DBF_SUCCESS != ReadAt(cDBF, 0, cDBF->Head, sizeof(DBFHead))){
         #ifdef DEBUG
-        printf("Debug ReadHead fread Error, readCount = %d\n", readCount);
+        printf("Debug ReadHead ReadAt Error\n");
         #endif
         return DBF_FAIL;
     }
     #ifdef DEBUG
-    printf("Debug ReadHead RecCount = %d\n", cDBF->Head->RecCount);
+    printf("Debug ReadHead RecCount = %u\n", cDBF->Head->RecCount);
     #endif
     return DBF_SUCCESS;
 }
@@ -708,12 +1270,11 @@ int ReadHead(CDBF *cDBF)
 ----------------------------------------------------------------------------*/
 int WriteHead(CDBF *cDBF)
 {
-    //先定位到文件头
-    if(0 != fseek(cDBF->FHandle, 0, SEEK_SET)){
-        #ifdef DEBUG
-        printf("Debug WriteHead fseek Error\n");
-        #endif
-        return DBF_FAIL;
+    //多进程追加时只改映射的文件头，写整个文件头会覆盖其他进程发布的记录数
+    if(DBF_OPEN_SHARED_APPEND & cDBF->OpenFlags){
+        SharedSyncHead(cDBF);
+        STATS_ADD(cDBF, siHeadWrites, 1);
+        return DBF_SUCCESS;
     }
     //获取年月日信息
     time_t timep;
@@ -724,14 +1285,16 @@ int WriteHead(CDBF *cDBF)
     cDBF->Head->Year = (unsigned char)p->tm_year;  //当前年-1990
     cDBF->Head->Month = (unsigned char)p->tm_mon;  //0~11
     cDBF->Head->Day = (unsigned char)p->tm_mday;   //1-31
+    //乐观读时不能覆盖文件头中的序号
+    SeqSyncHead(cDBF);
     //头数据写到磁盘中
-    int writeCount = fwrite(cDBF->Head, sizeof(DBFHead), 1, cDBF->FHandle);
-    if(1 != writeCount){
+    if(DBF_SUCCESS != WriteAt(cDBF, 0, cDBF->Head, sizeof(DBFHead))){
         #ifdef DEBUG
-        printf("Debug WriteHead fwrite Error");
+        printf("Debug WriteHead WriteAt Error");
         #endif
         return DBF_FAIL;
     }
+    STATS_ADD(cDBF, siHeadWrites, 1);
     return DBF_SUCCESS; 
 }
 
@@ -748,18 +1311,10 @@ int WriteHead(CDBF *cDBF)
 ----------------------------------------------------------------------------*/
 int ReadFields(CDBF *cDBF)
 {
-    //先定位到列信息偏移地址
-    if(0 != fseek(cDBF->FHandle, sizeof(DBFHead), SEEK_SET)){
-        #ifdef DEBUG
-        printf("Debug ReadFields fseek Error\n");
-        #endif
-        return DBF_FAIL;
-    }
     //将列信息从磁盘读取到内存
-    int readCount = fread(cDBF->Fields, sizeof(DBFField), cDBF->FieldCount, cDBF->FHandle);
-    if (readCount != cDBF->FieldCount){
+    if(DBF_SUCCESS != ReadAt(cDBF, sizeof(DBFHead), cDBF->Fields, sizeof(DBFField) * cDBF->FieldCount)){
         #ifdef DEBUG
-        printf("Debug ReadFields fread Error, readCount = %d, FieldCount = %d\n", readCount, cDBF->FieldCount);
+        printf("Debug ReadFields ReadAt Error, FieldCount = %d\n", cDBF->FieldCount);
         #endif
         return DBF_FAIL;
     }
@@ -789,7 +1344,7 @@ int ReadFields(CDBF *cDBF)
     * 是否锁定成功, -1:锁定失败; 1:锁定成功
 * Others     :
 ----------------------------------------------------------------------------*/
-int LockRow(CDBF *cDBF, int rowNo)
+int LockRow(CDBF *cDBF, unsigned int rowNo)
 {
     return DBF_SUCCESS;
 }
@@ -808,7 +1363,7 @@ int LockRow(CDBF *cDBF, int rowNo)
     * 是否解锁成功, -1:解锁失败; 1:解锁成功
 * Others     :
 ----------------------------------------------------------------------------*/
-int UnLockRow(CDBF *cDBF, int rowNo)
+int UnLockRow(CDBF *cDBF, unsigned int rowNo)
 {
     return DBF_SUCCESS;
 }
@@ -839,3 +1394,410 @@ int GetIndexByName(CDBF *cDBF, char *FieldName)
     }
     return DBF_FAIL;    
 }
+
+
+/*----------------------------------------------------------------------------
+* Function   : OpenCompactDBF
+* Description: 
+    * 以紧凑方式打开DBF文件，OpenDBFEx指定DBF_OPEN_COMPACT时调用
+    * 句柄、文件头、行缓存、列值解码缓存、文件路径在一次申请的内存中
+    * 列信息和列偏移在结构相同的句柄间共享
+    * 该方法是cDBF的私有方法，不提供接口给外部调用
+* Input      :
+    * filePath, DBF文件目录
+    * flags, 打开选项
+* Output     :
+* Return     : 该DBF文件对应的CDBF文件指针; 返回NULL表示打开失败
+* Others     :
+----------------------------------------------------------------------------*/
+CDBF *OpenCompactDBF(char *filePath, int flags)
+{
+    //先用栈上的临时句柄读取文件头和列信息
+    CDBF probe;
+    DBFHead head;
+    DBFField fields[MAX_FIELD_COUNT];
+    memset(&probe, '\0', sizeof(CDBF));
+    probe.FHandle = fopen(filePath, "rb+");
+    if(NULL == probe.FHandle){
+        return NULL;
+    }
+    //Go每次整条读取记录，不需要stdio缓存，省去每个句柄的缓存内存
+    setvbuf(probe.FHandle, NULL, _IONBF, 0);
+    if(DBF_SUCCESS != ReadAt(&probe, 0, &head, sizeof(DBFHead))){
+        fclose(probe.FHandle);
+        return NULL;
+    }
+    int FieldCount = (head.DataOffset - sizeof(DBFHead)) / sizeof(DBFField);
+    if((FieldCount < MIN_FIELD_COUNT) || (FieldCount > MAX_FIELD_COUNT)){
+        fclose(probe.FHandle);
+        return NULL;
+    }
+    if(DBF_SUCCESS != ReadAt(&probe, sizeof(DBFHead), fields, sizeof(DBFField) * FieldCount)){
+        fclose(probe.FHandle);
+        return NULL;
+    }
+    DBFSchema *schema = AcquireSchema(&head, fields, FieldCount);
+    if(NULL == schema){
+        fclose(probe.FHandle);
+        return NULL;
+    }
+    return BuildCompactDBF(filePath, flags, probe.FHandle, &head, schema);
+}
+
+
+/*******************************************************************************
+* Function   : OpenSchemaDBF
+* Description: 使用已解析的文件头和表结构，以紧凑方式打开DBF文件
+* Input      :
+    * filePath, DBF文件目录
+    * flags, 打开选项
+    * head, 已读取的文件头
+    * schema, 已解析的表结构
+* Output     :
+* Return     : 该DBF文件对应的CDBF文件指针; 返回NULL表示打开失败
+* Others     :
+    * 不读取文件头和列信息，由调用方保证文件没有变化，供句柄缓存使用
+    * 句柄会增加schema的引用计数
+*******************************************************************************/
+CDBF *OpenSchemaDBF(char *filePath, int flags, DBFHead *head, DBFSchema *schema)
+{
+    FILE *fh = fopen(filePath, "rb+");
+    if(NULL == fh){
+        return NULL;
+    }
+    setvbuf(fh, NULL, _IONBF, 0);
+    RetainSchema(schema);
+    return BuildCompactDBF(filePath, flags | DBF_OPEN_COMPACT, fh, head, schema);
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : BuildCompactDBF
+* Description: 
+    * 申请紧凑句柄的内存并初始化，定位到第一行
+    * 句柄、文件头、行缓存、列值解码缓存、文件路径一次申请
+    * 该方法是cDBF的私有方法，不提供接口给外部调用
+* Input      :
+    * filePath, DBF文件目录
+    * flags, 打开选项
+    * fh, 已打开的文件，失败时关闭
+    * head, 文件头
+    * schema, 表结构，失败时释放引用
+* Output     :
+* Return     : 该DBF文件对应的CDBF文件指针; 返回NULL表示打开失败
+* Others     :
+----------------------------------------------------------------------------*/
+CDBF *BuildCompactDBF(char *filePath, int flags, FILE *fh, DBFHead *head, DBFSchema *schema)
+{
+    int size = sizeof(CDBF) + sizeof(DBFHead) + head->RecSize + VALUE_BUF_LEN + strlen(filePath) + 1;
+    char *arena = malloc(size);
+    if(NULL == arena){
+        ReleaseSchema(schema);
+        fclose(fh);
+        return NULL;
+    }
+    CDBF *cDBF = (CDBF *)arena;
+    memset(cDBF, '\0', sizeof(CDBF));
+    cDBF->OpenFlags = flags;
+    cDBF->status = dsBrowse;
+    cDBF->FHandle = fh;
+    cDBF->Schema = schema;
+    cDBF->Fields = schema->Fields;
+    cDBF->FieldOffsets = schema->FieldOffsets;
+    cDBF->FieldCount = schema->FieldCount;
+    cDBF->Head = (DBFHead *)(arena + sizeof(CDBF));
+    memcpy(cDBF->Head, head, sizeof(DBFHead));
+    cDBF->ValueBuf = (char *)(cDBF->Head + 1);
+    memset(cDBF->ValueBuf, '\0', head->RecSize);
+    cDBF->FieldBuf = cDBF->ValueBuf + head->RecSize;
+    cDBF->Path = cDBF->FieldBuf + VALUE_BUF_LEN;
+    strcpy(cDBF->Path, filePath);
+    cDBF->deleted = ' ';
+    if(((DBF_OPEN_OPTIMISTIC | DBF_OPEN_SHARED_APPEND) & flags) && (DBF_SUCCESS != OpenHeadMap(cDBF))){
+        CloseDBF(cDBF);
+        return NULL;
+    }
+    //有区块索引时加载，没有或不一致时忽略
+    LoadZoneMap(cDBF);
+    //定位到第一行
+    cDBF->RecNo = 0;
+    if(cDBF->Head->RecCount > 0){
+        if(DBF_SUCCESS != Go(cDBF, 1)){
+            CloseDBF(cDBF);
+            return NULL;
+        }
+    }
+    return cDBF;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : ReadAt
+* Description: 
+    * 从文件的offset位置读取size字节，所有读文件操作都通过该方法
+    * 该方法是cDBF的内部方法，在cDBFInner.h中声明，不提供接口给外部调用
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+    * offset, 文件偏移
+    * buf, 读取到的内存
+    * size, 读取的字节数
+* Output     :
+* Return     :
+    * 是否读取成功, -1:读取失败; 1:读取成功
+* Others     :
+----------------------------------------------------------------------------*/
+int ReadAt(CDBF *cDBF, off_t offset, void *buf, int size)
+{
+    if(0 != fseeko(cDBF->FHandle, offset, SEEK_SET)){
+        return DBF_FAIL;
+    }
+    STATS_ADD(cDBF, siSeeks, 1);
+    int readCount = fread(buf, size, 1, cDBF->FHandle);
+    STATS_ADD(cDBF, siReadCalls, 1);
+    if(1 != readCount){
+        return DBF_FAIL;
+    }
+    STATS_ADD(cDBF, siBytesRead, size);
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : WriteAt
+* Description: 
+    * 将size字节写到文件的offset位置，所有写文件操作都通过该方法，开启变更日志时同时记录日志
+    * 该方法是cDBF的内部方法，在cDBFInner.h中声明，不提供接口给外部调用
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+    * offset, 文件偏移
+    * buf, 要写入的内存
+    * size, 写入的字节数
+* Output     :
+* Return     :
+    * 是否写入成功, -1:写入失败; 1:写入成功
+* Others     :
+----------------------------------------------------------------------------*/
+int WriteAt(CDBF *cDBF, off_t offset, void *buf, int size)
+{
+    //开启变更日志时先记录这次写；stdio在fseeko、fwrite时随时可能把数据写到文件，日志先写出
+    if((DBF_SUCCESS != LogWrite(cDBF, offset, buf, size)) || (DBF_SUCCESS != FlushChangeLog(cDBF))){
+        return DBF_FAIL;
+    }
+    if(0 != fseeko(cDBF->FHandle, offset, SEEK_SET)){
+        return DBF_FAIL;
+    }
+    STATS_ADD(cDBF, siSeeks, 1);
+    int writeCount = fwrite(buf, size, 1, cDBF->FHandle);
+    STATS_ADD(cDBF, siWriteCalls, 1);
+    if(1 != writeCount){
+        return DBF_FAIL;
+    }
+    STATS_ADD(cDBF, siBytesWritten, size);
+    return DBF_SUCCESS;
+}
+
+
+/*******************************************************************************
+* Function   : SeqReadRecord
+* Description: 乐观读一条记录到ValueBuf
+* Input      :
+    * cDBF, 以DBF_OPEN_OPTIMISTIC打开的CDBF结构体指针
+    * offset, 记录在文件中的偏移
+* Output     :
+* Return     : 是否读取成功, -1:读取失败; 1:读取成功
+* Others     :
+    * 不经过stdio缓存，直接pread，避免读到stdio缓存中其他进程写之前的旧数据
+    * 读之前和读之后序号不同时重读，读的过程中没有加锁的系统调用
+*******************************************************************************/
+int SeqReadRecord(CDBF *cDBF, off_t offset)
+{
+    int fd = fileno(cDBF->FHandle);
+    int size = cDBF->Head->RecSize;
+    while(DBF_TRUE){
+        unsigned int seq = 0;
+        if(DBF_SUCCESS != SeqReadBegin(cDBF, &seq)){
+            return DBF_FAIL;
+        }
+        ssize_t n = pread(fd, cDBF->ValueBuf, size, offset);
+        STATS_ADD(cDBF, siReadCalls, 1);
+        if(DBF_TRUE != SeqReadRetry(cDBF, seq)){
+            if(n != size){
+                return DBF_FAIL;
+            }
+            break;
+        }
+        //读的过程中有写(包括Zap截断文件)，重读
+        STATS_ADD(cDBF, siSeqRetries, 1);
+    }
+    STATS_ADD(cDBF, siBytesRead, size);
+    return DBF_SUCCESS;
+}
+
+
+/*******************************************************************************
+* Function   : ReadFull
+* Description: pread直到读满size字节
+* Input      :
+    * fd, 文件描述符
+    * buf, 读入的内存
+    * size, 字节数
+    * offset, 文件偏移
+* Output     :
+* Return     : 是否读满, -1:读失败或文件不够长; 1:读满
+* Others     : 该方法是cDBF的内部方法，在cDBFInner.h中声明，用于临时文件等不经过stdio的读写
+*******************************************************************************/
+int ReadFull(int fd, char *buf, long long size, long long offset)
+{
+    while(size > 0){
+        ssize_t n = pread(fd, buf, size, offset);
+        if(n <= 0){
+            return DBF_FAIL;
+        }
+        buf = buf + n;
+        size = size - n;
+        offset = offset + n;
+    }
+    return DBF_SUCCESS;
+}
+
+
+/*******************************************************************************
+* Function   : WriteFull
+* Description: pwrite直到写完size字节
+* Input      :
+    * fd, 文件描述符
+    * buf, 写出的内存
+    * size, 字节数
+    * offset, 文件偏移
+* Output     :
+* Return     : 是否写完, -1:写失败; 1:写完
+* Others     : 该方法是cDBF的内部方法，在cDBFInner.h中声明
+*******************************************************************************/
+int WriteFull(int fd, const char *buf, long long size, long long offset)
+{
+    while(size > 0){
+        ssize_t n = pwrite(fd, buf, size, offset);
+        if(n <= 0){
+            return DBF_FAIL;
+        }
+        buf = buf + n;
+        size = size - n;
+        offset = offset + n;
+    }
+    return DBF_SUCCESS;
+}
+
+
+/*******************************************************************************
+* Function   : CreateTempFile
+* Description: 在path所在目录创建临时文件，创建后立即unlink
+* Input      :
+    * path, 临时文件名以path加后缀生成
+* Output     :
+* Return     : 临时文件的文件描述符, -1表示创建失败
+* Others     :
+    * 该方法是cDBF的内部方法，在cDBFInner.h中声明
+    * 文件已经unlink，close后或进程退出时自动回收
+*******************************************************************************/
+int CreateTempFile(char *path)
+{
+    int len = strlen(path);
+    char tmpPath[len + 16];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmpXXXXXX", path);
+    int fd = mkstemp(tmpPath);
+    if(fd < 0){
+        return -1;
+    }
+    unlink(tmpPath);
+    return fd;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : GetFieldValue
+* Description: 
+    * 获取当前行第index列的值，第一次访问时从行缓存解码到cDBF->Values
+    * 该方法是cDBF的私有方法，不提供接口给外部调用
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+    * index, 列的序号
+* Output     :
+* Return     :
+    * 以'\0'结尾的列值
+* Others     :
+----------------------------------------------------------------------------*/
+char *GetFieldValue(CDBF *cDBF, int index)
+{
+    //紧凑句柄没有各列的值缓存，每次解码到同一个缓存中
+    if(NULL == cDBF->Values){
+        int Width = cDBF->Fields[index].Width;
+        memcpy(cDBF->FieldBuf, cDBF->ValueBuf + cDBF->FieldOffsets[index], Width);
+        cDBF->FieldBuf[Width] = '\0';
+        return cDBF->FieldBuf;
+    }
+    char *value = cDBF->Values[index].ValueBuf;
+    if(0 == (cDBF->Decoded[index >> 3] & (1 << (index & 7)))){
+        int Width = cDBF->Fields[index].Width;
+        memcpy(value, cDBF->ValueBuf + cDBF->FieldOffsets[index], Width);
+        //将字符串最后一位设置为NULL
+        value[Width] = '\0';
+        cDBF->Decoded[index >> 3] |= (1 << (index & 7));
+    }
+    return value;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : PutFieldValue
+* Description: 
+    * 将值写到行缓存中第index列的位置，超长截位，不足的后面补空格
+    * 该方法是cDBF的私有方法，不提供接口给外部调用
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+    * index, 列的序号
+    * value, 列值
+    * len, 列值的长度
+* Output     :
+* Return     :
+    * 是否设置成功, -1:设置失败; 1:设置成功
+* Others     :
+----------------------------------------------------------------------------*/
+int PutFieldValue(CDBF *cDBF, int index, char *value, int len)
+{
+    int Width = cDBF->Fields[index].Width;
+    char *dest = cDBF->ValueBuf + cDBF->FieldOffsets[index];
+    if(len >= Width){
+        //如果value超长，会在这里自动截位
+        memcpy(dest, value, Width);
+    }
+    else{
+        memcpy(dest, value, len);
+        memset(dest + len, ' ', Width - len);
+    }
+    //行缓存已修改，下次Get时重新解码，Post时写这一列
+    cDBF->Decoded[index >> 3] &= ~(1 << (index & 7));
+    cDBF->Dirty[(index + 1) >> 3] |= (1 << ((index + 1) & 7));
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : RowResult
+* Description: 
+    * 把GoRow的结果转换为Go、Next、Prior、Last的int返回值
+    * 该方法是cDBF的私有方法，不提供接口给外部调用
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+    * ret, GoRow的返回值
+* Output     :
+* Return     :
+    * -1:切换失败; >0:当前行号
+* Others     : 调用方保证行号不超过INT_MAX
+----------------------------------------------------------------------------*/
+int RowResult(CDBF *cDBF, int ret)
+{
+    if(DBF_SUCCESS != ret){
+        return DBF_FAIL;
+    }
+    return (int)cDBF->RecNo;
+}
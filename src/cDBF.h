@@ -15,20 +15,33 @@
 
 #include "cDBFStruct.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 CDBF *OpenDBF(char *filePath);
+CDBF *OpenDBFEx(char *filePath, int flags);
 int CloseDBF(CDBF *cDBF);
 int First(CDBF *cDBF);
 int Last(CDBF *cDBF);
 int Next(CDBF *cDBF);
 int Prior(CDBF *cDBF);
 int Go(CDBF *cDBF, int rowNo);
+int GoRow(CDBF *cDBF, unsigned int rowNo);
 int Edit(CDBF *cDBF);
 int Append(CDBF *cDBF);
 int Delete(CDBF *cDBF);
 int Post(CDBF *cDBF);
 int Zap(CDBF *cDBF);
+int AppendRecords(CDBF *cDBF, const char *records, int count);
+int FlushDBF(CDBF *cDBF);
+int BeginWriteBatch(CDBF *cDBF);
+int EndWriteBatch(CDBF *cDBF);
+int CreateDBFLike(CDBF *cDBF, char *filePath);
 int Fresh(CDBF *cDBF);
-int GetRecNo(CDBF *cDBF);
+unsigned int GetRecNo(CDBF *cDBF);
+unsigned int GetRecCount(CDBF *cDBF);
+int GoMany(CDBF *cDBF, const int *rows, int n, DBFRecordCallback callback, void *userData);
 
 unsigned char GetFieldAsBoolean(CDBF *cDBF, char *fieldName);
 int GetFieldAsInteger(CDBF *cDBF, char *fieldName);
@@ -38,5 +51,15 @@ int SetFieldAsBoolean(CDBF *cDBF, char *fieldName, unsigned char value);
 int SetFieldAsInteger(CDBF *cDBF, char *fieldName, int value);
 int SetFieldAsFloat(CDBF *cDBF, char *fieldName, double value);
 int SetFieldAsString(CDBF *cDBF, char *fieldName, char *value);
+int FetchValues(CDBF *cDBF);
+int StoreValues(CDBF *cDBF);
+
+int GetDBFStats(CDBF *cDBF, DBFStats *stats);
+int ResetDBFStats(CDBF *cDBF);
+int GetDBFMemSize(CDBF *cDBF);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
@@ -0,0 +1,561 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cDBF.hpp
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-19
+ * Description  : C++编译期绑定表结构，只有头文件
+     1.每列用DBF_FIELD声明一次列名、类型、宽度、精度，Schema按文件中的顺序列出所有列
+     2.各列偏移、记录长度在编译期算出，读写列直接访问原始记录，不按列名查找
+     3.打开时按文件的列信息校验一次声明的表结构，之后不再检查宽度
+     4.N、F、D列按声明的宽度解析和格式化，宽度是模板参数，循环由编译器展开
+     5.Record是原始记录上的视图，可以用在ScanBlocks、NextStreamBatch的块上
+     6.需要C++11
+     例:
+        DBF_FIELD(Name, "name", 'C', 20, 0);
+        DBF_FIELD(Age, "age", 'N', 3, 0);
+        typedef cdbf::Schema<Name, Age> Person;
+        cdbf::Table<Person> table;
+        if(table.Open("./person.dbf")){
+            long long age = table.Get<Age>();
+        }
+**********************************************************************************/
+#ifndef CDBF_HPP
+#define CDBF_HPP
+
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <string>
+#include "cDBF.h"
+
+//声明一列，生成类型Tag，FieldName()返回列名
+#define DBF_FIELD(Tag, name, type, width, scale) \
+    struct Tag : public ::cdbf::FieldDef<(type), (width), (scale)> \
+    { \
+        static const char *FieldName() { return (name); } \
+    }
+
+namespace cdbf
+{
+
+//10的n次方，精度的放大倍数
+constexpr long long Pow10(int n)
+{
+    return (0 == n) ? 1 : 10 * Pow10(n - 1);
+}
+
+//整数、定点数的格式化，v是放大了10^Scale倍的值，右对齐左补空格，超长时返回false，不修改p
+template <int Width, int Scale>
+inline bool FormatScaled(char *p, long long v)
+{
+    static_assert((0 == Scale) || (Width > Scale + 1), "width too small for scale");
+    char buf[Width];
+    unsigned long long u = (v < 0) ? (0ULL - (unsigned long long)v) : (unsigned long long)v;
+    int i = Width;
+    for(int k=0; k<Scale; k++){
+        buf[--i] = '0' + (char)(u % 10);
+        u = u / 10;
+    }
+    if(Scale > 0){
+        buf[--i] = '.';
+    }
+    do{
+        if(0 == i){
+            return false;
+        }
+        buf[--i] = '0' + (char)(u % 10);
+        u = u / 10;
+    }while(0 != u);
+    if(v < 0){
+        if(0 == i){
+            return false;
+        }
+        buf[--i] = '-';
+    }
+    while(i > 0){
+        buf[--i] = ' ';
+    }
+    memcpy(p, buf, Width);
+    return true;
+}
+
+//整数、定点数的解析，v为放大了10^Scale倍的值，多出的小数位截掉，空值为0
+//宽度可到LIMLEN_NUMERIC，放大后超出long long时返回false，v为0
+template <int Width, int Scale>
+inline bool ParseScaled(const char *p, long long &v)
+{
+    int i = 0;
+    while((i < Width) && (' ' == p[i])){
+        i ++;
+    }
+    bool negative = false;
+    if((i < Width) && (('-' == p[i]) || ('+' == p[i]))){
+        negative = ('-' == p[i]);
+        i ++;
+    }
+    v = 0;
+    int frac = -1;
+    for(; i<Width; i++){
+        char c = p[i];
+        if((c >= '0') && (c <= '9')){
+            if(frac >= Scale){
+                continue;
+            }
+            if(__builtin_mul_overflow(v, 10LL, &v) || __builtin_add_overflow(v, (long long)(c - '0'), &v)){
+                v = 0;
+                return false;
+            }
+            if(frac >= 0){
+                frac ++;
+            }
+        }
+        else if(('.' == c) && (frac < 0)){
+            frac = 0;
+        }
+        else{
+            break;
+        }
+    }
+    for(frac = (frac < 0) ? 0 : frac; frac < Scale; frac++){
+        if(__builtin_mul_overflow(v, 10LL, &v)){
+            v = 0;
+            return false;
+        }
+    }
+    if(negative){
+        v = -v;
+    }
+    return true;
+}
+
+//按ParseScaled解析，超出long long时和空值一样返回0，需要区分时调用ParseScaled
+template <int Width, int Scale>
+inline long long ParseScaled(const char *p)
+{
+    long long v = 0;
+    ParseScaled<Width, Scale>(p, v);
+    return v;
+}
+
+//各类型列的解析和格式化，类型、宽度不支持时编译失败
+template <char Type, int Width, int Scale>
+struct Codec;
+
+//C列: 取值去掉右边的空格，设置时超长截位，不足右补空格
+template <int Width, int Scale>
+struct Codec<'C', Width, Scale>
+{
+    typedef std::string ValueType;
+    static std::string Get(const char *p)
+    {
+        int len = Width;
+        while((len > 0) && (' ' == p[len - 1])){
+            len --;
+        }
+        return std::string(p, len);
+    }
+    static bool Set(char *p, const char *value, size_t len)
+    {
+        if(len >= (size_t)Width){
+            memcpy(p, value, Width);
+        }
+        else{
+            memcpy(p, value, len);
+            memset(p + len, ' ', Width - len);
+        }
+        return true;
+    }
+    static bool Set(char *p, const char *value)
+    {
+        return Set(p, value, strlen(value));
+    }
+    static bool Set(char *p, const std::string &value)
+    {
+        return Set(p, value.data(), value.size());
+    }
+};
+
+//没有小数位的N列: 按long long读写
+template <int Width>
+struct Codec<'N', Width, 0>
+{
+    static_assert(Width <= LIMLEN_NUMERIC, "numeric width too large");
+    typedef long long ValueType;
+    static long long Get(const char *p)
+    {
+        return ParseScaled<Width, 0>(p);
+    }
+    static bool Set(char *p, long long value)
+    {
+        return FormatScaled<Width, 0>(p, value);
+    }
+};
+
+//有小数位的N列: 按double读写，GetScaled、SetScaled按放大的整数读写，没有浮点误差
+template <int Width, int Scale>
+struct Codec<'N', Width, Scale>
+{
+    static_assert(Width <= LIMLEN_NUMERIC, "numeric width too large");
+    typedef double ValueType;
+    static double Get(const char *p)
+    {
+        return (double)ParseScaled<Width, Scale>(p) / Pow10(Scale);
+    }
+    static bool Set(char *p, double value)
+    {
+        return FormatScaled<Width, Scale>(p, llround(value * Pow10(Scale)));
+    }
+    static long long GetScaled(const char *p)
+    {
+        return ParseScaled<Width, Scale>(p);
+    }
+    static bool SetScaled(char *p, long long value)
+    {
+        return FormatScaled<Width, Scale>(p, value);
+    }
+};
+
+//F列和N列的存储方式相同
+template <int Width, int Scale>
+struct Codec<'F', Width, Scale> : public Codec<'N', Width, Scale>
+{
+};
+
+//L列: 和GetFieldAsBoolean一样只有'T'是真
+template <>
+struct Codec<'L', 1, 0>
+{
+    typedef bool ValueType;
+    static bool Get(const char *p)
+    {
+        return 'T' == *p;
+    }
+    static bool Set(char *p, bool value)
+    {
+        *p = value ? 'T' : 'F';
+        return true;
+    }
+};
+
+//D列: 按整数YYYYMMDD读写，空值为0
+template <>
+struct Codec<'D', 8, 0>
+{
+    typedef int ValueType;
+    static int Get(const char *p)
+    {
+        int v = 0;
+        for(int i=0; i<8; i++){
+            if((p[i] < '0') || (p[i] > '9')){
+                return 0;
+            }
+            v = v * 10 + (p[i] - '0');
+        }
+        return v;
+    }
+    static bool Set(char *p, int value)
+    {
+        if(0 == value){
+            memset(p, ' ', 8);
+            return true;
+        }
+        if((value < 0) || (value > 99999999)){
+            return false;
+        }
+        for(int i=7; i>=0; i--){
+            p[i] = '0' + (char)(value % 10);
+            value = value / 10;
+        }
+        return true;
+    }
+};
+
+//一列的声明，DBF_FIELD生成的类型继承它
+template <char Type, int Width, int Scale>
+struct FieldDef
+{
+    static constexpr char FieldType = Type;
+    static constexpr int FieldWidth = Width;
+    static constexpr int FieldScale = Scale;
+    typedef Codec<Type, Width, Scale> FieldCodec;
+    typedef typename FieldCodec::ValueType ValueType;
+};
+
+//列在列表中的序号、之前各列的宽度之和，列不在表结构中时编译失败
+template <class F, class... Columns>
+struct FieldPos;
+
+template <class F>
+struct FieldPos<F>
+{
+    static_assert(sizeof(F) == 0, "field is not declared in schema");
+    static constexpr int Index = 0;
+    static constexpr int Offset = 0;
+};
+
+template <class F, class... Rest>
+struct FieldPos<F, F, Rest...>
+{
+    static constexpr int Index = 0;
+    static constexpr int Offset = 0;
+};
+
+template <class F, class First, class... Rest>
+struct FieldPos<F, First, Rest...>
+{
+    static constexpr int Index = 1 + FieldPos<F, Rest...>::Index;
+    static constexpr int Offset = First::FieldWidth + FieldPos<F, Rest...>::Offset;
+};
+
+//各列宽度之和
+template <class... Columns>
+struct SumWidth;
+
+template <>
+struct SumWidth<>
+{
+    static constexpr int Value = 0;
+};
+
+template <class First, class... Rest>
+struct SumWidth<First, Rest...>
+{
+    static constexpr int Value = First::FieldWidth + SumWidth<Rest...>::Value;
+};
+
+//表结构，按文件中的顺序列出所有列
+template <class... Columns>
+struct Schema
+{
+    static constexpr int FieldCount = sizeof...(Columns);
+    //第0个字节是删除标记
+    static constexpr int RecSize = 1 + SumWidth<Columns...>::Value;
+
+    template <class F>
+    struct Pos
+    {
+        static constexpr int Index = FieldPos<F, Columns...>::Index;
+        static constexpr int Offset = 1 + FieldPos<F, Columns...>::Offset;
+    };
+
+    //校验文件的列信息和声明是否一致: 列数、记录长度、各列的名称、类型、宽度、精度、偏移
+    static bool Matches(const CDBF *cDBF)
+    {
+        if((NULL == cDBF) || (FieldCount != cDBF->FieldCount) || (RecSize != cDBF->Head->RecSize)){
+            return false;
+        }
+        const bool matched[] = {FieldMatches<Columns>(cDBF)...};
+        for(int i=0; i<FieldCount; i++){
+            if(!matched[i]){
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    template <class F>
+    static bool FieldMatches(const CDBF *cDBF)
+    {
+        const int index = FieldPos<F, Columns...>::Index;
+        const DBFField *field = &cDBF->Fields[index];
+        char name[sizeof(field->FieldName) + 1];
+        memcpy(name, field->FieldName, sizeof(field->FieldName));
+        name[sizeof(field->FieldName)] = '\0';
+        return (0 == strcasecmp(F::FieldName(), name)) && (F::FieldType == field->FieldType)
+            && (F::FieldWidth == field->Width) && (F::FieldScale == field->Scale)
+            && (1 + FieldPos<F, Columns...>::Offset == cDBF->FieldOffsets[index]);
+    }
+};
+
+//原始记录上的视图，不拷贝记录
+template <class S>
+class Record
+{
+public:
+    explicit Record(char *raw) : Raw(raw) {}
+
+    bool Deleted() const
+    {
+        return DELETED == Raw[0];
+    }
+
+    template <class F>
+    typename F::ValueType Get() const
+    {
+        return F::FieldCodec::Get(Raw + S::template Pos<F>::Offset);
+    }
+
+    //值超出列宽度时返回false，列不变
+    template <class F, class V>
+    bool Set(const V &value)
+    {
+        return F::FieldCodec::Set(Raw + S::template Pos<F>::Offset, value);
+    }
+
+    //列的原始字节，长度F::FieldWidth，不以'\0'结尾
+    template <class F>
+    const char *Bytes() const
+    {
+        return Raw + S::template Pos<F>::Offset;
+    }
+
+    char *Data() const
+    {
+        return Raw;
+    }
+
+private:
+    char *Raw;
+};
+
+//只读的记录视图，用于块回调中的const记录
+template <class S>
+class ConstRecord
+{
+public:
+    explicit ConstRecord(const char *raw) : Raw(raw) {}
+
+    bool Deleted() const
+    {
+        return DELETED == Raw[0];
+    }
+
+    template <class F>
+    typename F::ValueType Get() const
+    {
+        return F::FieldCodec::Get(Raw + S::template Pos<F>::Offset);
+    }
+
+    template <class F>
+    const char *Bytes() const
+    {
+        return Raw + S::template Pos<F>::Offset;
+    }
+
+private:
+    const char *Raw;
+};
+
+//按表结构绑定的DBF句柄，析构时CloseDBF
+template <class S>
+class Table
+{
+public:
+    Table() : DBF(NULL) {}
+
+    ~Table()
+    {
+        Close();
+    }
+
+    //打开文件并校验表结构，不一致时关闭并返回false
+    bool Open(const char *filePath, int flags = DBF_OPEN_DEFAULT)
+    {
+        Close();
+        CDBF *cDBF = OpenDBFEx(const_cast<char *>(filePath), flags);
+        return Attach(cDBF);
+    }
+
+    //接管已打开的句柄，比如OpenDBFStream、AcquireDBF返回的句柄，不一致时关闭并返回false
+    bool Attach(CDBF *cDBF)
+    {
+        Close();
+        if(NULL == cDBF){
+            return false;
+        }
+        if(!S::Matches(cDBF)){
+            CloseDBF(cDBF);
+            return false;
+        }
+        DBF = cDBF;
+        return true;
+    }
+
+    //交出句柄，之后由调用方关闭
+    CDBF *Release()
+    {
+        CDBF *cDBF = DBF;
+        DBF = NULL;
+        return cDBF;
+    }
+
+    void Close()
+    {
+        if(NULL != DBF){
+            CloseDBF(DBF);
+            DBF = NULL;
+        }
+    }
+
+    CDBF *Handle() const
+    {
+        return DBF;
+    }
+
+    bool IsOpen() const
+    {
+        return NULL != DBF;
+    }
+
+    unsigned int RecCount() const
+    {
+        return ::GetRecCount(DBF);
+    }
+
+    unsigned int RecNo() const
+    {
+        return ::GetRecNo(DBF);
+    }
+
+    int First() { return ::First(DBF); }
+    int Next() { return ::Next(DBF); }
+    int Go(int rowNo) { return ::Go(DBF, rowNo); }
+    int GoRow(unsigned int rowNo) { return ::GoRow(DBF, rowNo); }
+    int Edit() { return ::Edit(DBF); }
+    int Append() { return ::Append(DBF); }
+    int Delete() { return ::Delete(DBF); }
+    int Post() { return ::Post(DBF); }
+    int Flush() { return ::FlushDBF(DBF); }
+
+    bool Deleted() const
+    {
+        return DELETED == DBF->deleted;
+    }
+
+    //当前行的列值
+    template <class F>
+    typename F::ValueType Get() const
+    {
+        return F::FieldCodec::Get(DBF->ValueBuf + S::template Pos<F>::Offset);
+    }
+
+    //修改当前行的列值，Post后写到磁盘
+    template <class F, class V>
+    bool Set(const V &value)
+    {
+        const int index = S::template Pos<F>::Index;
+        //GetFieldAs*按列缓存解码结果，直接改了行缓存要让该列重新解码
+        DBF->Decoded[index >> 3] &= (unsigned char)~(1 << (index & 7));
+        //和PutFieldValue一样标记该列修改过，Post时写回；第0位是删除标记
+        DBF->Dirty[(index + 1) >> 3] |= (unsigned char)(1 << ((index + 1) & 7));
+        return F::FieldCodec::Set(DBF->ValueBuf + S::template Pos<F>::Offset, value);
+    }
+
+    //当前行的原始记录
+    ConstRecord<S> Current() const
+    {
+        return ConstRecord<S>(DBF->ValueBuf);
+    }
+
+private:
+    Table(const Table &);
+    Table &operator=(const Table &);
+
+    CDBF *DBF;
+};
+
+}
+
+#endif
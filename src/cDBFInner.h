@@ -0,0 +1,26 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cDBFInner.h
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-09
+ * Description  : cDBF各模块之间共用的内部方法
+     1.只在src目录下的模块中包含，不提供接口给外部调用
+**********************************************************************************/
+#ifndef CDBFINNER_H
+#define CDBFINNER_H
+
+#include <stdio.h>
+#include <sys/types.h>
+#include "cDBFStruct.h"
+
+int ReadAt(CDBF *cDBF, off_t offset, void *buf, int size);
+int WriteAt(CDBF *cDBF, off_t offset, void *buf, int size);
+int ReadFull(int fd, char *buf, long long size, long long offset);
+int WriteFull(int fd, const char *buf, long long size, long long offset);
+int CreateTempFile(char *path);
+int GetIndexByName(CDBF *cDBF, char *FieldName);
+int IntRecCount(CDBF *cDBF);
+CDBF *OpenSchemaDBF(char *filePath, int flags, DBFHead *head, DBFSchema *schema);
+
+#endif
@@ -54,6 +54,9 @@
 #define MIN_FIELD_COUNT 1
 #define MAX_FIELD_COUNT 254
 
+//列值缓存的长度，Width最大255，再加上结尾的'\0'
+#define VALUE_BUF_LEN 256
+
 //C没有布尔类型，在这里定义
 #define DBF_TRUE 1
 #define DBF_FALSE 0
@@ -63,6 +66,18 @@
 #define DBF_SUCCESS 1
 #define DBF_FAIL -1
 
+//OpenDBFEx的打开选项，可以按位组合
+#define DBF_OPEN_DEFAULT 0x00   //缺省方式，同OpenDBF
+#define DBF_OPEN_COMPACT 0x01   //紧凑句柄：单次申请内存，不保留各列的值缓存，表结构在同结构的句柄间共享
+#define DBF_OPEN_OPTIMISTIC 0x02    //乐观读：读记录不加锁，通过文件头中的序号检测并重读写了一半的记录
+#define DBF_OPEN_SHARED_APPEND 0x04 //多进程追加：通过文件头中的预留计数原子地分配记录位置，按顺序发布记录数
+#define DBF_OPEN_GBK 0x08           //C列按GBK存储，文件头中没有代码页标记时使用，见cCodec.h
+#define DBF_OPEN_STREAM 0x10        //流句柄：OpenDBFStream从不能定位的输入流只读、只能向前地读，见cStream.h
+#define DBF_OPEN_SHM 0x20           //共享内存句柄：AttachSharedDBF只读映射发布到共享内存的DBF，见cShm.h
+
+//耗时直方图的桶个数，第i个桶统计耗时在[2^i, 2^(i+1))纳秒内的次数
+#define DBF_HIST_BUCKETS 32
+
 //定义DBF状态
 typedef enum TDBFStatus
 {
@@ -81,7 +96,7 @@ typedef struct TDBFHead
     unsigned char Year;         //保存时的年-1900
     unsigned char Month;        //保存时的月
     unsigned char Day;          //保存时的日
-    int RecCount;               //DBF中记录个数
+    unsigned int RecCount;      //DBF中记录个数，文件中是无符号32位
     unsigned short DataOffset;  //当前DBF文件头占用字节长度
     unsigned short RecSize;     //一条记录的字节长度，即每行数据所占长度
     char Reserved[20];          //保留字节
@@ -104,10 +119,43 @@ typedef struct TDBFField
 //DBF行每个列结构
 typedef struct FDBFValue
 {
-    char ValueBuf[256];         //存储对应的值
+    char ValueBuf[VALUE_BUF_LEN];   //存储对应的值
     DBFField *Field;            //存储对应的列头信息
 }DBFValue;
 
+//表结构，紧凑句柄打开结构相同的DBF时共享同一个表结构
+//表结构和列信息、列偏移在一次申请的内存中
+typedef struct TDBFSchema
+{
+    int RefCount;               //引用该表结构的句柄个数
+    int Size;                   //表结构占用的内存字节数
+    int FieldCount;             //列个数
+    unsigned short DataOffset;  //文件头占用字节长度
+    unsigned short RecSize;     //一条记录的字节长度
+    DBFField *Fields;           //列信息
+    int *FieldOffsets;          //各列在记录中的偏移
+}DBFSchema;
+
+//DBF句柄的统计信息，通过GetDBFStats获取
+typedef struct TDBFStats
+{
+    unsigned long long RecordsRead;                 //读取的记录数
+    unsigned long long RecordsWritten;              //写入的记录数
+    unsigned long long BytesRead;                   //读取的字节数
+    unsigned long long BytesWritten;                //写入的字节数
+    unsigned long long Seeks;                       //文件定位次数
+    unsigned long long ReadCalls;                   //读文件调用次数
+    unsigned long long WriteCalls;                  //写文件调用次数
+    unsigned long long HeadWrites;                  //重写文件头次数
+    unsigned long long LockCount;                   //加锁次数
+    unsigned long long LockWaitNs;                  //等待锁的总耗时(纳秒)
+    unsigned long long SeqRetries;                  //乐观读因写方在写而重读的次数
+    unsigned long long ZoneSkips;                   //按区块索引跳过的区块数
+    unsigned long long GoHist[DBF_HIST_BUCKETS];    //Go耗时直方图
+    unsigned long long PostHist[DBF_HIST_BUCKETS];  //Post耗时直方图
+    unsigned long long FreshHist[DBF_HIST_BUCKETS]; //Fresh耗时直方图
+}DBFStats;
+
 //CDBF对象，封装DBF的所有信息
 typedef struct TCDBF
 {
@@ -116,12 +164,33 @@ typedef struct TCDBF
     struct flock FLock;         //文件锁控制信息
     DBFHead *Head;              //文件头信息
     DBFField *Fields;           //根据DBF实际的列数，动态申请对应个数的DBFField结构体
-    DBFValue *Values;           //每一行的各个列的值
-    char *ValueBuf;             //每行数据的内存缓存
+    DBFValue *Values;           //各个列解码后的值，按需解码，见Decoded
+    char *ValueBuf;             //每行数据的内存缓存，Go读入的原始记录，Set直接修改这里
+    int *FieldOffsets;          //各列在记录中的偏移，第0个字节是删除标记
+    unsigned char Decoded[(MAX_FIELD_COUNT + 7) / 8];   //各列是否已解码到Values的位图
+    unsigned char Dirty[(MAX_FIELD_COUNT + 8) / 8];     //Set方法修改过的位图，第0位是删除标记，第i+1位是第i列
     char deleted;               //DBF每行第一个记录是删除标记
     int FieldCount;             //列个数
-    int RecNo;                  //CDBF当前指向的行号
+    unsigned int RecNo;         //CDBF当前指向的行号，0表示没有指向任何行
     DBFStatus status;           //DBF编辑状态
+    struct TDBFStatsBlock *Stats;   //统计计数，编译时定义DBF_NO_STATS或紧凑句柄则为NULL
+    int HeadDirty;              //内存中的文件头是否有未写到磁盘的修改，FlushDBF、CloseDBF时写入
+    int OpenFlags;              //OpenDBFEx的打开选项
+    DBFSchema *Schema;          //紧凑句柄共享的表结构，缺省方式打开时为NULL
+    char *FieldBuf;             //紧凑句柄解码列值的缓存，长度VALUE_BUF_LEN
+    struct TDBFCacheEntry *CacheEntry;  //从句柄缓存获取时所属的缓存项，否则为NULL
+    int CacheGen;               //获取时缓存项的版本，文件变化后版本增加
+    DBFHead *HeadMap;           //映射到内存的文件头页，没有开启乐观读、多进程追加时为NULL
+    unsigned int *Seq;          //乐观读的序号，在HeadMap的保留字节中，没有开启乐观读时为NULL
+    int WriteDepth;             //BeginWriteBatch的嵌套层数
+    struct TDBFZoneMap *ZoneMap;    //区块索引，没有"<文件名>.zmp"时为NULL
+    char *Utf8Buf;              //GetFieldAsUTF8的结果缓存，第一次调用时申请
+    struct TDBFStream *Stream;  //流句柄的预读状态，不是OpenDBFStream打开时为NULL
+    struct TDBFShm *Shm;        //共享内存句柄的映射状态，不是AttachSharedDBF打开时为NULL
+    struct TDBFLog *Log;        //变更日志，没有OpenChangeLog时为NULL
 }CDBF;
 
+//逐行回调，cDBF已切换到rowNo行，返回DBF_SUCCESS继续，否则停止
+typedef int (*DBFRecordCallback)(CDBF *cDBF, int rowNo, void *userData);
+
 #endif
@@ -0,0 +1,279 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cField.c
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-11
+ * Description  : 直接在记录的原始字节上比较列值的实现
+     1.数值列格式为右对齐、左补空格，可能有负号和小数点，例如"  -12.50"
+     2.比较时先比符号，再比整数部分的位数和数字，最后比小数部分
+**********************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include "cField.h"
+
+//解析后的数值，指向原始字节，不拷贝
+typedef struct TNumericView
+{
+    int Blank;                  //是否全是空格
+    int Negative;               //是否为负数
+    const char *Int;            //整数部分，已去掉前导0
+    int IntLen;
+    const char *Frac;           //小数部分，已去掉末尾的0
+    int FracLen;
+}NumericView;
+
+void ParseNumeric(const char *p, int width, NumericView *view);
+int CompareMagnitude(NumericView *x, NumericView *y);
+
+
+/*******************************************************************************
+* Function   : CompareNumeric
+* Description: 按数值比较两个数值列的原始字节
+* Input      :
+    * a, b, 列值的原始字节
+    * width, 列宽度
+* Output     :
+* Return     : <0:a小于b; 0:相等; >0:a大于b
+* Others     : 空值比任何数值都小，-0和0相等
+*******************************************************************************/
+int CompareNumeric(const char *a, const char *b, int width)
+{
+    NumericView x;
+    NumericView y;
+    ParseNumeric(a, width, &x);
+    ParseNumeric(b, width, &y);
+    if(x.Blank || y.Blank){
+        return y.Blank - x.Blank;
+    }
+    if(x.Negative != y.Negative){
+        return x.Negative ? -1 : 1;
+    }
+    int c = CompareMagnitude(&x, &y);
+    return x.Negative ? -c : c;
+}
+
+
+/*******************************************************************************
+* Function   : CompareFieldBytes
+* Description: 按列类型比较两个列值的原始字节
+* Input      :
+    * field, 列信息
+    * a, b, 列值的原始字节，长度为field->Width
+* Output     :
+* Return     : <0:a小于b; 0:相等; >0:a大于b
+* Others     :
+*******************************************************************************/
+int CompareFieldBytes(DBFField *field, const char *a, const char *b)
+{
+    if((TYPE_NUMERIC == field->FieldType) || (TYPE_FLOAT == field->FieldType)){
+        return CompareNumeric(a, b, field->Width);
+    }
+    return memcmp(a, b, field->Width);
+}
+
+
+/*******************************************************************************
+* Function   : DecodeScaled
+* Description: 把数值列的原始字节解析成放大10^scale倍的整数
+* Input      :
+    * p, 列值的原始字节
+    * width, 列宽度
+    * scale, 小数位数
+* Output     :
+    * value, 解析结果，例如scale为2时" -12.5"解析为-1250
+* Return     : DBF_TRUE:有值; DBF_FALSE:空值; DBF_FAIL:放大后超出long long
+* Others     : 超过scale的小数位截断，遇到非数字字符时结束解析
+*******************************************************************************/
+int DecodeScaled(const char *p, int width, int scale, long long *value)
+{
+    const char *end = p + width;
+    while((p < end) && (SPACE == *p)){
+        p ++;
+    }
+    if(p == end){
+        *value = 0;
+        return DBF_FALSE;
+    }
+    int negative = DBF_FALSE;
+    if(('-' == *p) || ('+' == *p)){
+        negative = ('-' == *p);
+        p ++;
+    }
+    //N(20,4)等宽列放大后可能超出long long，溢出时失败，不返回回绕后的值
+    long long v = 0;
+    while((p < end) && (*p >= '0') && (*p <= '9')){
+        if(__builtin_mul_overflow(v, 10, &v) || __builtin_add_overflow(v, *p - '0', &v)){
+            return DBF_FAIL;
+        }
+        p ++;
+    }
+    int digits = 0;
+    if((p < end) && ('.' == *p)){
+        p ++;
+        while((p < end) && (digits < scale) && (*p >= '0') && (*p <= '9')){
+            if(__builtin_mul_overflow(v, 10, &v) || __builtin_add_overflow(v, *p - '0', &v)){
+                return DBF_FAIL;
+            }
+            p ++;
+            digits ++;
+        }
+    }
+    for(; digits<scale; digits++){
+        if(__builtin_mul_overflow(v, 10, &v)){
+            return DBF_FAIL;
+        }
+    }
+    *value = negative ? -v : v;
+    return DBF_TRUE;
+}
+
+
+/*******************************************************************************
+* Function   : DecodeScaledColumn
+* Description: 批量解析一块记录中的一个数值列
+* Input      :
+    * records, count条连续的原始记录
+    * recSize, 每条记录的字节数
+    * count, 记录条数
+    * offset, 列在记录中的偏移
+    * field, 列信息，按field->Scale放大
+* Output     :
+    * values, count个解析结果
+    * present, count个标记，1:有值; 0:空值
+* Return     : 是否解析成功, -1:有值放大后超出long long; 1:成功
+* Others     : 一次处理一列，循环中只访问同一列，比逐条记录逐列解析更利于缓存
+*******************************************************************************/
+int DecodeScaledColumn(const char *records, int recSize, int count, int offset, DBFField *field,
+    long long *values, unsigned char *present)
+{
+    const char *p = records + offset;
+    int width = field->Width;
+    int scale = field->Scale;
+    int i = 0;
+    for(i=0; i<count; i++){
+        int ret = DecodeScaled(p, width, scale, &values[i]);
+        if(DBF_FAIL == ret){
+            return DBF_FAIL;
+        }
+        present[i] = ret;
+        p = p + recSize;
+    }
+    return DBF_SUCCESS;
+}
+
+
+/*******************************************************************************
+* Function   : EncodeFieldBytes
+* Description: 把字符串按列宽度写成列的原始字节
+* Input      :
+    * field, 列信息
+    * value, 字符串，NULL视为空字符串
+* Output     :
+    * dest, field->Width字节，不以'\0'结尾
+* Return     :
+* Others     : 和SetFieldAsString一样，超长截断，不足时后面补空格
+*******************************************************************************/
+void EncodeFieldBytes(DBFField *field, const char *value, char *dest)
+{
+    int width = field->Width;
+    int len = (NULL == value) ? 0 : strlen(value);
+    if(len >= width){
+        memcpy(dest, value, width);
+    }
+    else{
+        memcpy(dest, value, len);
+        memset(dest + len, SPACE, width - len);
+    }
+}
+
+
+/*******************************************************************************
+* Function   : IsBlankField
+* Description: 判断列值是否全是空格，即空值
+* Input      :
+    * p, 列值的原始字节
+    * width, 列宽度
+* Output     :
+* Return     : DBF_TRUE:空值; DBF_FALSE:有值
+* Others     :
+*******************************************************************************/
+int IsBlankField(const char *p, int width)
+{
+    int i = 0;
+    for(i=0; i<width; i++){
+        if(SPACE != p[i]){
+            return DBF_FALSE;
+        }
+    }
+    return DBF_TRUE;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : ParseNumeric
+* Description: 解析数值列的原始字节，只记录各部分的位置
+----------------------------------------------------------------------------*/
+void ParseNumeric(const char *p, int width, NumericView *view)
+{
+    const char *end = p + width;
+    memset(view, '\0', sizeof(NumericView));
+    while((p < end) && (SPACE == *p)){
+        p ++;
+    }
+    if(p == end){
+        view->Blank = DBF_TRUE;
+        return;
+    }
+    if(('-' == *p) || ('+' == *p)){
+        view->Negative = ('-' == *p);
+        p ++;
+    }
+    while((p < end) && ('0' == *p)){
+        p ++;
+    }
+    view->Int = p;
+    while((p < end) && (*p >= '0') && (*p <= '9')){
+        p ++;
+    }
+    view->IntLen = p - view->Int;
+    if((p < end) && ('.' == *p)){
+        p ++;
+        view->Frac = p;
+        while((p < end) && (*p >= '0') && (*p <= '9')){
+            p ++;
+        }
+        view->FracLen = p - view->Frac;
+        while((view->FracLen > 0) && ('0' == view->Frac[view->FracLen - 1])){
+            view->FracLen --;
+        }
+    }
+    //-0和0相等
+    if((0 == view->IntLen) && (0 == view->FracLen)){
+        view->Negative = DBF_FALSE;
+    }
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : CompareMagnitude
+* Description: 比较两个数值的绝对值
+----------------------------------------------------------------------------*/
+int CompareMagnitude(NumericView *x, NumericView *y)
+{
+    if(x->IntLen != y->IntLen){
+        return x->IntLen - y->IntLen;
+    }
+    int c = memcmp(x->Int, y->Int, x->IntLen);
+    if(0 != c){
+        return c;
+    }
+    int len = (x->FracLen < y->FracLen) ? x->FracLen : y->FracLen;
+    if(len > 0){
+        c = memcmp(x->Frac, y->Frac, len);
+        if(0 != c){
+            return c;
+        }
+    }
+    return x->FracLen - y->FracLen;
+}
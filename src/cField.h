@@ -0,0 +1,27 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cField.h
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-11
+ * Description  : 直接在记录的原始字节上比较列值
+     1.N、F列按数值比较，不转换成double，不损失精度
+     2.其他类型的列按原始字节比较，C列右补空格，D列是YYYYMMDD，按字节比较即有序
+     3.全是空格的数值列视为空值，比任何数值都小
+     4.数值列可以按Scale解析成放大的整数，求和时没有浮点误差
+     5.条件中的值先按列宽度写成原始字节，再和记录中的列比较
+**********************************************************************************/
+#ifndef CFIELD_H
+#define CFIELD_H
+
+#include "cDBFStruct.h"
+
+int CompareNumeric(const char *a, const char *b, int width);
+int CompareFieldBytes(DBFField *field, const char *a, const char *b);
+int DecodeScaled(const char *p, int width, int scale, long long *value);
+int DecodeScaledColumn(const char *records, int recSize, int count, int offset, DBFField *field,
+    long long *values, unsigned char *present);
+void EncodeFieldBytes(DBFField *field, const char *value, char *dest);
+int IsBlankField(const char *p, int width);
+
+#endif
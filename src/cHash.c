@@ -1,12 +1,282 @@
-/********************************************************************************* 
+/*********************************************************************************
  * Copyright(C), xumenger
  * FileName     : cHash.h
  * Author       : xumenger
- * Version      : V1.0.0 
+ * Version      : V1.0.0
  * Date         : 2018-10-03
  * Description  : Hash表接口定义
      1.在本项目中用于根据列名快速定位列的顺序号
      2.优秀的散列函数可实现O(1)时间复杂度的查询性能
+     3.散列函数使用FNV-1a，对短键(列名、证券代码)足够快且分布均匀
 **********************************************************************************/
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "cHash.h"
+#include "cDBFStruct.h"
+
+#define FNV_OFFSET 2166136261U
+#define FNV_PRIME 16777619U
+
+int GrowHash(HashTable *table);
+
+
+/*******************************************************************************
+* Function   : HashBytes
+* Description: 计算字节串的FNV-1a散列值
+* Input      :
+    * key, 键
+    * keyLen, 键的长度
+* Output     :
+* Return     : 散列值
+* Others     :
+*******************************************************************************/
+unsigned int HashBytes(const void *key, int keyLen)
+{
+    const unsigned char *p = key;
+    unsigned int hash = FNV_OFFSET;
+    int i = 0;
+    for(i=0; i<keyLen; i++){
+        hash ^= p[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+
+/*******************************************************************************
+* Function   : CreateHash
+* Description: 创建Hash表
+* Input      :
+    * bucketCount, 初始桶个数，向上取整到2的幂
+* Output     :
+* Return     : Hash表指针, NULL表示创建失败
+* Others     :
+*******************************************************************************/
+HashTable *CreateHash(int bucketCount)
+{
+    HashTable *table = malloc(sizeof(HashTable));
+    if(NULL == table){
+        return NULL;
+    }
+    table->BucketCount = 16;
+    while(table->BucketCount < bucketCount){
+        table->BucketCount = table->BucketCount * 2;
+    }
+    table->Count = 0;
+    table->Buckets = calloc(table->BucketCount, sizeof(HashNode *));
+    if(NULL == table->Buckets){
+        free(table);
+        return NULL;
+    }
+    return table;
+}
+
+
+/*******************************************************************************
+* Function   : FreeHash
+* Description: 释放Hash表及所有节点，值指向的内存由调用方释放
+* Input      :
+    * table, CreateHash返回的Hash表指针
+* Output     :
+* Return     :
+* Others     :
+*******************************************************************************/
+void FreeHash(HashTable *table)
+{
+    if(NULL == table){
+        return;
+    }
+    int i = 0;
+    for(i=0; i<table->BucketCount; i++){
+        HashNode *node = table->Buckets[i];
+        while(NULL != node){
+            HashNode *next = node->Next;
+            free(node);
+            node = next;
+        }
+    }
+    free(table->Buckets);
+    free(table);
+}
+
+
+/*******************************************************************************
+* Function   : HashGet
+* Description: 根据键查找值
+* Input      :
+    * table, Hash表指针
+    * key, 键
+    * keyLen, 键的长度
+* Output     :
+* Return     : 值, NULL表示没找到
+* Others     :
+*******************************************************************************/
+void *HashGet(HashTable *table, const void *key, int keyLen)
+{
+    unsigned int hash = HashBytes(key, keyLen);
+    HashNode *node = table->Buckets[hash & (table->BucketCount - 1)];
+    while(NULL != node){
+        if((node->Hash == hash) && (node->KeyLen == keyLen) && (0 == memcmp(node->Key, key, keyLen))){
+            return node->Value;
+        }
+        node = node->Next;
+    }
+    return NULL;
+}
+
+
+/*******************************************************************************
+* Function   : HashSlot
+* Description: 根据键查找值所在的位置，不存在时插入值为NULL的新节点
+* Input      :
+    * table, Hash表指针
+    * key, 键
+    * keyLen, 键的长度
+* Output     :
+* Return     : 值的地址, NULL表示插入失败
+* Others     : 调用方通过*slot是否为NULL判断是否新插入，查找和插入只计算一次散列
+*******************************************************************************/
+void **HashSlot(HashTable *table, const void *key, int keyLen)
+{
+    unsigned int hash = HashBytes(key, keyLen);
+    HashNode *node = table->Buckets[hash & (table->BucketCount - 1)];
+    while(NULL != node){
+        if((node->Hash == hash) && (node->KeyLen == keyLen) && (0 == memcmp(node->Key, key, keyLen))){
+            return &node->Value;
+        }
+        node = node->Next;
+    }
+    if(table->Count >= table->BucketCount){
+        if(DBF_SUCCESS != GrowHash(table)){
+            return NULL;
+        }
+    }
+    node = malloc(sizeof(HashNode) + keyLen);
+    if(NULL == node){
+        return NULL;
+    }
+    node->Hash = hash;
+    node->KeyLen = keyLen;
+    node->Value = NULL;
+    memcpy(node->Key, key, keyLen);
+    int index = hash & (table->BucketCount - 1);
+    node->Next = table->Buckets[index];
+    table->Buckets[index] = node;
+    table->Count ++;
+    return &node->Value;
+}
+
+
+/*******************************************************************************
+* Function   : HashPut
+* Description: 插入或替换键对应的值
+* Input      :
+    * table, Hash表指针
+    * key, 键
+    * keyLen, 键的长度
+    * value, 值
+* Output     :
+* Return     : -1:插入失败; 1:插入成功
+* Others     :
+*******************************************************************************/
+int HashPut(HashTable *table, const void *key, int keyLen, void *value)
+{
+    void **slot = HashSlot(table, key, keyLen);
+    if(NULL == slot){
+        return DBF_FAIL;
+    }
+    *slot = value;
+    return DBF_SUCCESS;
+}
+
+
+/*******************************************************************************
+* Function   : HashRemove
+* Description: 删除键对应的节点
+* Input      :
+    * table, Hash表指针
+    * key, 键
+    * keyLen, 键的长度
+* Output     :
+* Return     : -1:键不存在; 1:删除成功
+* Others     :
+*******************************************************************************/
+int HashRemove(HashTable *table, const void *key, int keyLen)
+{
+    unsigned int hash = HashBytes(key, keyLen);
+    HashNode **link = &table->Buckets[hash & (table->BucketCount - 1)];
+    while(NULL != *link){
+        HashNode *node = *link;
+        if((node->Hash == hash) && (node->KeyLen == keyLen) && (0 == memcmp(node->Key, key, keyLen))){
+            *link = node->Next;
+            free(node);
+            table->Count --;
+            return DBF_SUCCESS;
+        }
+        link = &node->Next;
+    }
+    return DBF_FAIL;
+}
+
+
+/*******************************************************************************
+* Function   : HashNext
+* Description: 遍历Hash表
+* Input      :
+    * table, Hash表指针
+    * node, 上一个节点，NULL表示从头开始
+* Output     :
+* Return     : 下一个节点, NULL表示遍历结束
+* Others     : 遍历期间不能插入或删除节点
+*******************************************************************************/
+HashNode *HashNext(HashTable *table, HashNode *node)
+{
+    int index = 0;
+    if(NULL != node){
+        if(NULL != node->Next){
+            return node->Next;
+        }
+        index = (node->Hash & (table->BucketCount - 1)) + 1;
+    }
+    for(; index<table->BucketCount; index++){
+        if(NULL != table->Buckets[index]){
+            return table->Buckets[index];
+        }
+    }
+    return NULL;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : GrowHash
+* Description: 桶个数翻倍，重新分布所有节点
+* Input      :
+    * table, Hash表指针
+* Output     :
+* Return     : -1:扩容失败; 1:扩容成功
+* Others     :
+----------------------------------------------------------------------------*/
+int GrowHash(HashTable *table)
+{
+    int bucketCount = table->BucketCount * 2;
+    HashNode **buckets = calloc(bucketCount, sizeof(HashNode *));
+    if(NULL == buckets){
+        return DBF_FAIL;
+    }
+    int i = 0;
+    for(i=0; i<table->BucketCount; i++){
+        HashNode *node = table->Buckets[i];
+        while(NULL != node){
+            HashNode *next = node->Next;
+            int index = node->Hash & (bucketCount - 1);
+            node->Next = buckets[index];
+            buckets[index] = node;
+            node = next;
+        }
+    }
+    free(table->Buckets);
+    table->Buckets = buckets;
+    table->BucketCount = bucketCount;
+    return DBF_SUCCESS;
+}
@@ -1,12 +1,42 @@
-/********************************************************************************* 
+/*********************************************************************************
  * Copyright(C), xumenger
  * FileName     : cHash.h
  * Author       : xumenger
- * Version      : V1.0.0 
+ * Version      : V1.0.0
  * Date         : 2018-10-03
  * Description  : Hash表接口实现
+     1.键是任意字节串，值是指针，键的内容拷贝到节点中
+     2.冲突使用链表解决，元素个数超过桶个数时桶个数翻倍
+     3.非线程安全，多线程使用时由调用方加锁
 **********************************************************************************/
 #ifndef CHASH_H
 #define CHASH_H
 
+//Hash表节点，键紧跟在节点后面
+typedef struct THashNode
+{
+    struct THashNode *Next;     //同一个桶中的下一个节点
+    unsigned int Hash;          //键的散列值
+    int KeyLen;                 //键的长度
+    void *Value;                //值
+    char Key[];                 //键的内容
+}HashNode;
+
+//Hash表
+typedef struct THashTable
+{
+    HashNode **Buckets;         //桶数组
+    int BucketCount;            //桶个数，2的幂
+    int Count;                  //元素个数
+}HashTable;
+
+unsigned int HashBytes(const void *key, int keyLen);
+HashTable *CreateHash(int bucketCount);
+void FreeHash(HashTable *table);
+void *HashGet(HashTable *table, const void *key, int keyLen);
+void **HashSlot(HashTable *table, const void *key, int keyLen);
+int HashPut(HashTable *table, const void *key, int keyLen, void *value);
+int HashRemove(HashTable *table, const void *key, int keyLen);
+HashNode *HashNext(HashTable *table, HashNode *node);
+
 #endif
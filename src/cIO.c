@@ -0,0 +1,624 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cIO.c
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-10
+ * Description  : 批量异步读写文件实现
+     1.io_uring的提交队列、完成队列通过mmap和内核共享，参考io_uring(7)
+     2.SubmitIOReq只把请求放入提交队列，WaitIOReq时一次io_uring_enter提交所有请求
+     3.io_uring_setup失败后记住不可用，之后直接使用preadv/pwritev
+     4.GoMany按行号排序，把相邻的行合并成一次大的读，读完一块就回调一块
+     5.乐观读的句柄GoMany提交每次读前取序号，完成后校验，读的过程中有写就重新提交这次读
+**********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "cDBF.h"
+#include "cIO.h"
+#include "cStats.h"
+#include "cSeqLock.h"
+#include "cDBFInner.h"
+
+#if defined(__linux__) && !defined(DBF_NO_IO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define DBF_HAVE_IO_URING
+#endif
+#endif
+
+#ifdef DBF_HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+//GoMany的队列深度
+#define GOMANY_DEPTH 32
+//GoMany一次读的最大字节数
+#define GOMANY_SPAN (64 * 1024)
+//两行之间的间隔不超过该字节数时合并成一次读
+#define GOMANY_GAP (16 * 1024)
+//io_uring_enter暂时失败(EAGAIN、EBUSY)时的重试次数，每次间隔1毫秒
+#define RING_RETRIES 1000
+
+//io_uring，和内核共享的提交队列、完成队列
+typedef struct TDBFRing
+{
+    int RingFd;
+    unsigned Entries;
+    unsigned *SqHead;
+    unsigned *SqTail;
+    unsigned *SqMask;
+    unsigned *SqArray;
+    unsigned *CqHead;
+    unsigned *CqTail;
+    unsigned *CqMask;
+    void *Cqes;
+    int Fd;                     //读写的文件，短读写时重新提交使用
+    void *SqPtr;
+    size_t SqSize;
+    void *CqPtr;
+    size_t CqSize;
+    void *Sqes;
+    size_t SqesSize;
+    unsigned ToSubmit;          //已放入提交队列还未提交给内核的个数
+}DBFRing;
+
+//GoMany中一次读对应的行
+typedef struct TGoManyGroup
+{
+    int FirstRow;               //读的第一行
+    int Start;                  //在排序后的行号数组中的起始位置
+    int Count;                  //包含的行个数
+    unsigned int Seq;           //乐观读时提交前取得的序号
+}GoManyGroup;
+
+//io_uring是否不可用，setup失败后不再尝试
+static int RingUnavailable = 0;
+
+DBFRing *CreateRing(int depth);
+void FreeRing(DBFRing *ring);
+void RingPush(DBFRing *ring, int fd, DBFIOReq *req);
+int RingWait(DBFRing *ring, DBFIOReq **done);
+void SyncExec(int fd, DBFIOReq *req);
+int CompareRow(const void *a, const void *b);
+
+
+/*******************************************************************************
+* Function   : OpenIOQueue
+* Description: 初始化读写队列
+* Input      :
+    * fd, 读写的文件描述符
+    * depth, 队列深度，最多同时提交的请求个数
+* Output     :
+    * queue, 初始化后的队列
+* Return     : -1:初始化失败; 1:初始化成功
+* Others     : io_uring不可用时仍然成功，使用preadv/pwritev
+*******************************************************************************/
+int OpenIOQueue(DBFIOQueue *queue, int fd, int depth)
+{
+    if((depth <= 0) || (depth > DBF_IO_MAXDEPTH)){
+        return DBF_FAIL;
+    }
+    memset(queue, '\0', sizeof(DBFIOQueue));
+    queue->Fd = fd;
+    queue->Depth = depth;
+    if(0 == __atomic_load_n(&RingUnavailable, __ATOMIC_RELAXED)){
+        queue->Ring = CreateRing(depth);
+        if(NULL == queue->Ring){
+            __atomic_store_n(&RingUnavailable, 1, __ATOMIC_RELAXED);
+        }
+        else{
+            queue->Ring->Fd = fd;
+        }
+    }
+    return DBF_SUCCESS;
+}
+
+
+/*******************************************************************************
+* Function   : SubmitIOReq
+* Description: 提交一个读写请求
+* Input      :
+    * queue, OpenIOQueue初始化的队列
+    * req, 读写请求，完成前不能释放
+* Output     :
+* Return     : -1:队列已满; 1:提交成功
+* Others     : 请求在下一次WaitIOReq时才真正提交给内核，多个请求一次提交
+*******************************************************************************/
+int SubmitIOReq(DBFIOQueue *queue, DBFIOReq *req)
+{
+    if(queue->Inflight >= queue->Depth){
+        return DBF_FAIL;
+    }
+    req->Done = 0;
+    req->Result = 0;
+    req->Link = NULL;
+    queue->Inflight ++;
+    if(NULL != queue->Ring){
+        RingPush(queue->Ring, queue->Fd, req);
+        return DBF_SUCCESS;
+    }
+    if(NULL == queue->SyncTail){
+        queue->SyncHead = req;
+    }
+    else{
+        queue->SyncTail->Link = req;
+    }
+    queue->SyncTail = req;
+    return DBF_SUCCESS;
+}
+
+
+/*******************************************************************************
+* Function   : WaitIOReq
+* Description: 等待一个请求完成
+* Input      :
+    * queue, OpenIOQueue初始化的队列
+* Output     :
+    * done, 完成的请求，结果见Result
+* Return     : -1:没有未完成的请求或等待失败; 1:有请求完成
+* Others     : io_uring方式下按完成顺序返回，preadv方式下按提交顺序返回
+*******************************************************************************/
+int WaitIOReq(DBFIOQueue *queue, DBFIOReq **done)
+{
+    if(0 == queue->Inflight){
+        return DBF_FAIL;
+    }
+    if(NULL != queue->Ring){
+        if(DBF_SUCCESS != RingWait(queue->Ring, done)){
+            return DBF_FAIL;
+        }
+        queue->Inflight --;
+        return DBF_SUCCESS;
+    }
+    DBFIOReq *req = queue->SyncHead;
+    queue->SyncHead = req->Link;
+    if(NULL == queue->SyncHead){
+        queue->SyncTail = NULL;
+    }
+    SyncExec(queue->Fd, req);
+    queue->Inflight --;
+    *done = req;
+    return DBF_SUCCESS;
+}
+
+
+/*******************************************************************************
+* Function   : CloseIOQueue
+* Description: 等待所有未完成的请求，然后释放队列
+* Input      :
+    * queue, OpenIOQueue初始化的队列
+* Output     :
+* Return     : -1:还有请求没有完成; 1:所有请求已完成，队列已释放
+* Others     :
+    * 返回-1时内核可能还在读写请求的内存，调用方不能释放请求和Buf
+    * 这时io_uring也不释放，关闭后内核仍可能异步写入，宁可泄漏也不能写坏内存
+*******************************************************************************/
+int CloseIOQueue(DBFIOQueue *queue)
+{
+    DBFIOReq *req = NULL;
+    while(queue->Inflight > 0){
+        if(DBF_SUCCESS != WaitIOReq(queue, &req)){
+            #ifdef DEBUG
+            printf("Debug CloseIOQueue WaitIOReq Error, inflight = %d\n", queue->Inflight);
+            #endif
+            return DBF_FAIL;
+        }
+    }
+    if(NULL != queue->Ring){
+        FreeRing(queue->Ring);
+        queue->Ring = NULL;
+    }
+    return DBF_SUCCESS;
+}
+
+
+/*******************************************************************************
+* Function   : GoMany
+* Description: 批量读取多行，每读到一行就切换到该行并回调
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+    * rows, 行号数组，可以无序
+    * n, 行号个数
+    * callback, 回调，cDBF已切换到该行，可以调用GetFieldAs*获取列值
+    * userData, 传给回调的数据
+* Output     :
+* Return     : 回调的行数, -1:读取失败、行号越界或记录数超过INT_MAX
+* Others     :
+    * 行号排序去重后，间隔小的相邻行合并成一次读，多个读一次提交
+    * 按读完成的顺序回调，不保证是rows中的顺序，重复的行号只回调一次
+    * 回调返回DBF_SUCCESS以外的值时停止，返回已回调的行数
+    * 结束后cDBF停在最后一次回调的行
+*******************************************************************************/
+int GoMany(CDBF *cDBF, const int *rows, int n, DBFRecordCallback callback, void *userData)
+{
+    if(n <= 0){
+        return 0;
+    }
+    //流句柄、共享内存句柄没有文件；行号按int传递，记录数超过INT_MAX时不截断，直接返回失败
+    if(((DBF_OPEN_STREAM | DBF_OPEN_SHM) & cDBF->OpenFlags) || (IntRecCount(cDBF) < 0)){
+        return DBF_FAIL;
+    }
+    int i = 0;
+    for(i=0; i<n; i++){
+        if((rows[i] <= 0) || (rows[i] > cDBF->Head->RecCount)){
+            return DBF_FAIL;
+        }
+    }
+    //排序去重
+    int *sorted = malloc(sizeof(int) * n);
+    if(NULL == sorted){
+        return DBF_FAIL;
+    }
+    memcpy(sorted, rows, sizeof(int) * n);
+    qsort(sorted, n, sizeof(int), CompareRow);
+    int m = 1;
+    for(i=1; i<n; i++){
+        if(sorted[i] != sorted[m - 1]){
+            sorted[m] = sorted[i];
+            m ++;
+        }
+    }
+    //直接读文件描述符，先把stdio中未写的数据刷到文件
+    fflush(cDBF->FHandle);
+    DBFIOQueue queue;
+    if(DBF_SUCCESS != OpenIOQueue(&queue, fileno(cDBF->FHandle), GOMANY_DEPTH)){
+        free(sorted);
+        return DBF_FAIL;
+    }
+    DBFIOReq reqs[GOMANY_DEPTH];
+    GoManyGroup groups[GOMANY_DEPTH];
+    DBFIOReq *freeList[GOMANY_DEPTH];
+    int freeCount = GOMANY_DEPTH;
+    memset(reqs, '\0', sizeof(reqs));
+    for(i=0; i<GOMANY_DEPTH; i++){
+        reqs[i].UserData = &groups[i];
+        freeList[i] = &reqs[GOMANY_DEPTH - 1 - i];
+    }
+    int RecSize = cDBF->Head->RecSize;
+    int optimistic = (NULL != cDBF->Seq) && (0 == cDBF->WriteDepth);
+    int next = 0;
+    int delivered = 0;
+    int stop = DBF_FALSE;
+    int ret = DBF_SUCCESS;
+    while(DBF_TRUE){
+        //把相邻的行合并成一次读，队列有空位就继续提交
+        while((DBF_FALSE == stop) && (next < m) && (freeCount > 0)){
+            DBFIOReq *req = freeList[freeCount - 1];
+            GoManyGroup *group = req->UserData;
+            if(NULL == req->Buf){
+                req->Buf = malloc(GOMANY_SPAN > RecSize ? GOMANY_SPAN : RecSize);
+                if(NULL == req->Buf){
+                    stop = DBF_TRUE;
+                    ret = DBF_FAIL;
+                    break;
+                }
+            }
+            int first = sorted[next];
+            int last = first;
+            int j = next + 1;
+            while((j < m) && ((long long)(sorted[j] - last - 1) * RecSize <= GOMANY_GAP)
+                && ((long long)(sorted[j] - first + 1) * RecSize <= GOMANY_SPAN)){
+                last = sorted[j];
+                j ++;
+            }
+            group->FirstRow = first;
+            group->Start = next;
+            group->Count = j - next;
+            next = j;
+            req->Write = 0;
+            req->Offset = cDBF->Head->DataOffset + (long long)RecSize * (first - 1);
+            req->Len = RecSize * (last - first + 1);
+            if(optimistic && (DBF_SUCCESS != SeqReadBegin(cDBF, &group->Seq))){
+                stop = DBF_TRUE;
+                ret = DBF_FAIL;
+                break;
+            }
+            SubmitIOReq(&queue, req);
+            freeCount --;
+            STATS_ADD(cDBF, siReadCalls, 1);
+        }
+        //全部完成时退出；还有请求时等待失败是io_uring出错
+        if(0 == queue.Inflight){
+            break;
+        }
+        DBFIOReq *req = NULL;
+        if(DBF_SUCCESS != WaitIOReq(&queue, &req)){
+            ret = DBF_FAIL;
+            break;
+        }
+        //和SeqReadRecord一样，读的过程中有写(包括Zap截断文件)时重读，短读也先按序号判断
+        GoManyGroup *group = req->UserData;
+        if((DBF_FALSE == stop) && optimistic && (DBF_TRUE == SeqReadRetry(cDBF, group->Seq))){
+            STATS_ADD(cDBF, siSeqRetries, 1);
+            if(DBF_SUCCESS == SeqReadBegin(cDBF, &group->Seq)){
+                SubmitIOReq(&queue, req);
+                STATS_ADD(cDBF, siReadCalls, 1);
+                continue;
+            }
+            stop = DBF_TRUE;
+            ret = DBF_FAIL;
+        }
+        freeList[freeCount] = req;
+        freeCount ++;
+        if(req->Result != req->Len){
+            #ifdef DEBUG
+            printf("Debug GoMany read Error, Result = %d, Len = %d\n", req->Result, req->Len);
+            #endif
+            stop = DBF_TRUE;
+            ret = DBF_FAIL;
+            continue;
+        }
+        STATS_ADD(cDBF, siBytesRead, req->Len);
+        if(DBF_TRUE == stop){
+            continue;
+        }
+        //逐行切换到该行并回调
+        for(i=group->Start; i<group->Start+group->Count; i++){
+            int rowNo = sorted[i];
+            memcpy(cDBF->ValueBuf, req->Buf + (long long)RecSize * (rowNo - group->FirstRow), RecSize);
+            cDBF->deleted = cDBF->ValueBuf[0];
+            memset(cDBF->Decoded, 0, sizeof(cDBF->Decoded));
+            memset(cDBF->Dirty, 0, sizeof(cDBF->Dirty));
+            cDBF->RecNo = rowNo;
+            cDBF->status = dsBrowse;
+            delivered ++;
+            STATS_ADD(cDBF, siRecordsRead, 1);
+            if(DBF_SUCCESS != callback(cDBF, rowNo, userData)){
+                stop = DBF_TRUE;
+                break;
+            }
+        }
+    }
+    if(DBF_SUCCESS != CloseIOQueue(&queue)){
+        //内核可能还在往读缓存里写，不能释放
+        free(sorted);
+        return DBF_FAIL;
+    }
+    for(i=0; i<GOMANY_DEPTH; i++){
+        if(NULL != reqs[i].Buf){
+            free(reqs[i].Buf);
+        }
+    }
+    free(sorted);
+    if(DBF_SUCCESS != ret){
+        return DBF_FAIL;
+    }
+    return delivered;
+}
+
+
+#ifdef DBF_HAVE_IO_URING
+
+/*----------------------------------------------------------------------------
+* Function   : CreateRing
+* Description: 创建io_uring，映射提交队列、完成队列、SQE数组
+* Input      :
+    * depth, 队列深度
+* Output     :
+* Return     : io_uring, NULL表示不可用
+----------------------------------------------------------------------------*/
+DBFRing *CreateRing(int depth)
+{
+    struct io_uring_params params;
+    memset(&params, '\0', sizeof(params));
+    int ringFd = syscall(__NR_io_uring_setup, depth, &params);
+    if(ringFd < 0){
+        return NULL;
+    }
+    DBFRing *ring = malloc(sizeof(DBFRing));
+    if(NULL == ring){
+        close(ringFd);
+        return NULL;
+    }
+    memset(ring, '\0', sizeof(DBFRing));
+    ring->RingFd = ringFd;
+    ring->Entries = params.sq_entries;
+    ring->SqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->CqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    //新内核的提交队列和完成队列可以一次映射
+    if(params.features & IORING_FEAT_SINGLE_MMAP){
+        if(ring->CqSize > ring->SqSize){
+            ring->SqSize = ring->CqSize;
+        }
+        ring->CqSize = ring->SqSize;
+    }
+    ring->SqPtr = mmap(NULL, ring->SqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if(MAP_FAILED == ring->SqPtr){
+        ring->SqPtr = NULL;
+        FreeRing(ring);
+        return NULL;
+    }
+    if(params.features & IORING_FEAT_SINGLE_MMAP){
+        ring->CqPtr = ring->SqPtr;
+    }
+    else{
+        ring->CqPtr = mmap(NULL, ring->CqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        if(MAP_FAILED == ring->CqPtr){
+            ring->CqPtr = NULL;
+            FreeRing(ring);
+            return NULL;
+        }
+    }
+    ring->SqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->Sqes = mmap(NULL, ring->SqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if(MAP_FAILED == ring->Sqes){
+        ring->Sqes = NULL;
+        FreeRing(ring);
+        return NULL;
+    }
+    char *sq = ring->SqPtr;
+    char *cq = ring->CqPtr;
+    ring->SqHead = (unsigned *)(sq + params.sq_off.head);
+    ring->SqTail = (unsigned *)(sq + params.sq_off.tail);
+    ring->SqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->SqArray = (unsigned *)(sq + params.sq_off.array);
+    ring->CqHead = (unsigned *)(cq + params.cq_off.head);
+    ring->CqTail = (unsigned *)(cq + params.cq_off.tail);
+    ring->CqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->Cqes = cq + params.cq_off.cqes;
+    return ring;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : FreeRing
+* Description: 解除映射并关闭io_uring
+----------------------------------------------------------------------------*/
+void FreeRing(DBFRing *ring)
+{
+    if(NULL != ring->Sqes){
+        munmap(ring->Sqes, ring->SqesSize);
+    }
+    if((NULL != ring->CqPtr) && (ring->CqPtr != ring->SqPtr)){
+        munmap(ring->CqPtr, ring->CqSize);
+    }
+    if(NULL != ring->SqPtr){
+        munmap(ring->SqPtr, ring->SqSize);
+    }
+    close(ring->RingFd);
+    free(ring);
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : RingPush
+* Description: 把请求(剩余未完成的部分)放入提交队列，不调用系统调用
+----------------------------------------------------------------------------*/
+void RingPush(DBFRing *ring, int fd, DBFIOReq *req)
+{
+    unsigned tail = *ring->SqTail;
+    unsigned index = tail & *ring->SqMask;
+    struct io_uring_sqe *sqe = (struct io_uring_sqe *)ring->Sqes + index;
+    memset(sqe, '\0', sizeof(struct io_uring_sqe));
+    req->Iov.iov_base = req->Buf + req->Done;
+    req->Iov.iov_len = req->Len - req->Done;
+    sqe->opcode = req->Write ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)&req->Iov;
+    sqe->len = 1;
+    sqe->off = req->Offset + req->Done;
+    sqe->user_data = (unsigned long)req;
+    ring->SqArray[index] = index;
+    __atomic_store_n(ring->SqTail, tail + 1, __ATOMIC_RELEASE);
+    ring->ToSubmit ++;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : RingWait
+* Description: 提交所有未提交的请求并等待一个请求完成，短读写时继续提交剩余部分
+----------------------------------------------------------------------------*/
+int RingWait(DBFRing *ring, DBFIOReq **done)
+{
+    int retries = 0;
+    while(DBF_TRUE){
+        unsigned head = *ring->CqHead;
+        unsigned tail = __atomic_load_n(ring->CqTail, __ATOMIC_ACQUIRE);
+        if(head != tail){
+            struct io_uring_cqe *cqe = (struct io_uring_cqe *)ring->Cqes + (head & *ring->CqMask);
+            DBFIOReq *req = (DBFIOReq *)(unsigned long)cqe->user_data;
+            int res = cqe->res;
+            __atomic_store_n(ring->CqHead, head + 1, __ATOMIC_RELEASE);
+            if(res < 0){
+                req->Result = res;
+            }
+            else{
+                req->Done = req->Done + res;
+                //短读写，剩余部分重新提交
+                if((res > 0) && (req->Done < req->Len)){
+                    RingPush(ring, ring->Fd, req);
+                    continue;
+                }
+                req->Result = req->Done;
+            }
+            *done = req;
+            return DBF_SUCCESS;
+        }
+        int ret = syscall(__NR_io_uring_enter, ring->RingFd, ring->ToSubmit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if(ret < 0){
+            if(EINTR == errno){
+                continue;
+            }
+            //内核暂时没有资源或完成队列溢出，收割完成事件后重试
+            if(((EAGAIN == errno) || (EBUSY == errno)) && (retries < RING_RETRIES)){
+                retries ++;
+                usleep(1000);
+                continue;
+            }
+            return DBF_FAIL;
+        }
+        retries = 0;
+        ring->ToSubmit = ring->ToSubmit - ret;
+    }
+}
+
+#else
+
+DBFRing *CreateRing(int depth)
+{
+    return NULL;
+}
+
+void FreeRing(DBFRing *ring)
+{
+}
+
+void RingPush(DBFRing *ring, int fd, DBFIOReq *req)
+{
+}
+
+int RingWait(DBFRing *ring, DBFIOReq **done)
+{
+    return DBF_FAIL;
+}
+
+#endif
+
+
+/*----------------------------------------------------------------------------
+* Function   : SyncExec
+* Description: io_uring不可用时，用preadv/pwritev同步执行请求
+----------------------------------------------------------------------------*/
+void SyncExec(int fd, DBFIOReq *req)
+{
+    while(req->Done < req->Len){
+        req->Iov.iov_base = req->Buf + req->Done;
+        req->Iov.iov_len = req->Len - req->Done;
+        ssize_t ret = 0;
+        if(req->Write){
+            ret = pwritev(fd, &req->Iov, 1, req->Offset + req->Done);
+        }
+        else{
+            ret = preadv(fd, &req->Iov, 1, req->Offset + req->Done);
+        }
+        if(ret < 0){
+            if(EINTR == errno){
+                continue;
+            }
+            req->Result = -errno;
+            return;
+        }
+        if(0 == ret){
+            break;
+        }
+        req->Done = req->Done + ret;
+    }
+    req->Result = req->Done;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : CompareRow
+* Description: qsort比较行号
+----------------------------------------------------------------------------*/
+int CompareRow(const void *a, const void *b)
+{
+    int x = *(const int *)a;
+    int y = *(const int *)b;
+    return (x > y) - (x < y);
+}
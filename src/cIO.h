@@ -0,0 +1,52 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cIO.h
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-10
+ * Description  : 批量异步读写文件
+     1.Linux上优先使用io_uring，一次提交多个读写请求，按完成顺序返回
+     2.io_uring不可用时(老内核、被禁用)退化为preadv/pwritev同步读写
+     3.直接调用系统调用，不依赖liburing
+     4.编译时定义DBF_NO_IO_URING可以强制使用preadv/pwritev
+**********************************************************************************/
+#ifndef CIO_H
+#define CIO_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+//队列深度上限
+#define DBF_IO_MAXDEPTH 256
+
+//一个读写请求
+typedef struct TDBFIOReq
+{
+    int Write;                  //0:读; 1:写
+    char *Buf;                  //读写的内存
+    int Len;                    //读写的字节数
+    long long Offset;           //文件偏移
+    int Done;                   //已完成的字节数，短读写时继续提交剩余部分
+    int Result;                 //完成后的结果, >=0:读写的字节数; <0:-errno
+    struct iovec Iov;           //提交给内核的iovec
+    void *UserData;             //调用方的数据
+    struct TDBFIOReq *Link;     //同步方式下的请求队列
+}DBFIOReq;
+
+//读写队列
+typedef struct TDBFIOQueue
+{
+    int Fd;                     //读写的文件
+    int Depth;                  //队列深度
+    int Inflight;               //已提交未完成的请求个数
+    struct TDBFRing *Ring;      //io_uring，NULL表示使用preadv/pwritev
+    DBFIOReq *SyncHead;         //同步方式下等待执行的请求
+    DBFIOReq *SyncTail;
+}DBFIOQueue;
+
+int OpenIOQueue(DBFIOQueue *queue, int fd, int depth);
+int SubmitIOReq(DBFIOQueue *queue, DBFIOReq *req);
+int WaitIOReq(DBFIOQueue *queue, DBFIOReq **done);
+int CloseIOQueue(DBFIOQueue *queue);
+
+#endif
@@ -0,0 +1,597 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cJoin.c
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-13
+ * Description  : 两个DBF按关联列做Hash连接实现
+     1.构建表的记录依次拷贝到一块连续内存，Hash表用数组下标串成链，不逐个malloc节点
+     2.关联列先规范化：N、F列解析成按两边较大Scale放大的整数，其他列去掉前后空格
+     3.探测时只在散列值相同时才规范化构建表的关联列并比较
+     4.分区模式下临时文件的每条记录是4字节行号加原始记录，先写完构建表再写探测表
+     5.分区按散列值的高位选择，Hash表桶按低位选择，同一分区内的键仍能均匀分桶
+**********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "cDBF.h"
+#include "cJoin.h"
+#include "cHash.h"
+#include "cField.h"
+#include "cScan.h"
+#include "cDBFInner.h"
+
+//分区个数上限
+#define JOIN_MAXPARTS 256
+//每个分区的写缓存字节数
+#define JOIN_PART_BUF (64 * 1024)
+//分区模式下每次从临时文件读入的字节数
+#define JOIN_READ_CHUNK (1024 * 1024)
+//构建表每条记录除原始记录外的字节数：行号、散列值、链表、桶
+#define JOIN_ENTRY_EXTRA (sizeof(int) * 4)
+//NormalizeKey的返回值：关联列为空值、数值列放大后超出long long
+#define JOIN_KEY_NULL (-1)
+#define JOIN_KEY_OVERFLOW (-2)
+
+//规范化后的关联列
+typedef struct TJoinKey
+{
+    DBFField *Field;
+    int Offset;                 //列在记录中的偏移
+    int Numeric;                //是否按数值比较
+    int Scale;                  //按数值比较时放大的小数位数
+}JoinKey;
+
+//构建表的Hash表
+typedef struct TJoinTable
+{
+    int RecSize;
+    int Count;
+    int Cap;
+    char *Records;              //Count条原始记录
+    int *Rows;                  //每条记录在构建表中的行号
+    unsigned int *Hashes;       //每条记录关联列的散列值
+    int *Next;                  //同一个桶中的下一条记录，-1表示结束
+    int *Buckets;               //每个桶的第一条记录，-1表示空桶
+    unsigned int Mask;
+}JoinTable;
+
+//一个分区的两个临时文件
+typedef struct TJoinPart
+{
+    int Fd[2];                  //0:构建表; 1:探测表
+    long long Size[2];          //已写入的字节数
+    char *Buf;                  //写缓存
+    int BufLen;
+}JoinPart;
+
+//连接上下文
+typedef struct TJoinContext
+{
+    JoinKey Keys[2];            //0:构建表; 1:探测表
+    int RecSize[2];
+    DBFJoinMode Mode;
+    JoinTable Table;
+    pthread_mutex_t Mutex;      //回调串行执行
+    DBFJoinCallback Callback;
+    void *UserData;
+    int PartCount;
+    JoinPart *Parts;
+    int Side;                   //正在分区的表，0:构建表; 1:探测表
+    int Swapped;                //内连接时交换了构建表和探测表，回调时再换回来
+}JoinContext;
+
+int ResolveJoinKey(CDBF *cDBF, char *fieldName, JoinKey *key);
+int NormalizeKey(JoinKey *key, const char *rec, char *out);
+unsigned int JoinPartOf(JoinContext *ctx, unsigned int hash);
+int TableAdd(JoinContext *ctx, const char *rec, int row);
+int TableFinish(JoinTable *table);
+void TableReset(JoinTable *table);
+int LoadBlock(const char *records, int firstRow, int count, int threadNo, void *userData);
+int ProbeBlock(const char *records, int firstRow, int count, int threadNo, void *userData);
+int ProbeOne(JoinContext *ctx, const char *rec, int row);
+int EmitJoin(JoinContext *ctx, const char *buildRec, int buildRow, const char *probeRec, int probeRow);
+int PartitionBlock(const char *records, int firstRow, int count, int threadNo, void *userData);
+int FlushParts(JoinContext *ctx);
+int FlushPart(JoinPart *part, int side);
+int JoinPartitions(JoinContext *ctx);
+
+
+/*******************************************************************************
+* Function   : HashJoin
+* Description: 两个DBF按关联列做Hash连接，匹配的记录对通过回调返回
+* Input      :
+    * build, 构建表，joinLeftOuter时应当是较小的表
+    * buildKey, 构建表的关联列名
+    * probe, 探测表
+    * probeKey, 探测表的关联列名
+    * mode, 连接方式，joinLeftOuter时保留探测表中没有匹配的记录
+    * memoryBudget, 构建表可以使用的内存字节数，超出时分区连接
+    * nThreads, 探测线程数
+    * callback, 连接回调
+    * userData, 传给回调的数据
+* Output     :
+* Return     : 是否连接成功, -1:连接失败、回调返回失败、数值关联列超出long long或记录数超过INT_MAX; 1:连接成功
+* Others     :
+    * 关联列一边是N、F列另一边不是时连接失败
+    * joinInner时自动用记录字节数较小的表做构建表，回调参数仍按调用时的build、probe
+    * 分区模式下按分区依次探测，不使用多线程
+    * 回调的顺序不确定
+*******************************************************************************/
+int HashJoin(CDBF *build, char *buildKey, CDBF *probe, char *probeKey, DBFJoinMode mode,
+    long memoryBudget, int nThreads, DBFJoinCallback callback, void *userData)
+{
+    JoinContext ctx;
+    memset(&ctx, '\0', sizeof(JoinContext));
+    //内连接两边对称，较大的表做构建表时交换；左外连接保留的是探测表，不能交换
+    if((joinInner == mode) && ((long long)build->Head->RecCount * build->Head->RecSize >
+        (long long)probe->Head->RecCount * probe->Head->RecSize)){
+        CDBF *table = build;
+        build = probe;
+        probe = table;
+        char *key = buildKey;
+        buildKey = probeKey;
+        probeKey = key;
+        ctx.Swapped = DBF_TRUE;
+    }
+    if((DBF_SUCCESS != ResolveJoinKey(build, buildKey, &ctx.Keys[0])) ||
+        (DBF_SUCCESS != ResolveJoinKey(probe, probeKey, &ctx.Keys[1]))){
+        return DBF_FAIL;
+    }
+    if(ctx.Keys[0].Numeric != ctx.Keys[1].Numeric){
+        #ifdef DEBUG
+        printf("Debug HashJoin Key Type Mismatch, buildKey = %s, probeKey = %s\n", buildKey, probeKey);
+        #endif
+        return DBF_FAIL;
+    }
+    //两边按较大的Scale放大，例如12.5和12.50相等
+    int scale = (ctx.Keys[0].Scale > ctx.Keys[1].Scale) ? ctx.Keys[0].Scale : ctx.Keys[1].Scale;
+    ctx.Keys[0].Scale = scale;
+    ctx.Keys[1].Scale = scale;
+    ctx.RecSize[0] = build->Head->RecSize;
+    ctx.RecSize[1] = probe->Head->RecSize;
+    ctx.Mode = mode;
+    ctx.Table.RecSize = build->Head->RecSize;
+    ctx.Callback = callback;
+    ctx.UserData = userData;
+    pthread_mutex_init(&ctx.Mutex, NULL);
+
+    int result = DBF_FAIL;
+    long long buildBytes = (long long)build->Head->RecCount * (build->Head->RecSize + JOIN_ENTRY_EXTRA);
+    if(buildBytes <= memoryBudget){
+        if((DBF_SUCCESS == ScanBlocks(build, 1, IntRecCount(build), 1, LoadBlock, &ctx)) &&
+            (DBF_SUCCESS == TableFinish(&ctx.Table))){
+            result = ScanBlocks(probe, 1, IntRecCount(probe), nThreads, ProbeBlock, &ctx);
+        }
+    }
+    else{
+        //分区数留一倍余量，避免键分布不均时单个分区超出预算
+        long long parts = 2 * (buildBytes / ((memoryBudget > 0) ? memoryBudget : 1) + 1);
+        ctx.PartCount = (parts > JOIN_MAXPARTS) ? JOIN_MAXPARTS : (int)parts;
+        ctx.Parts = calloc(ctx.PartCount, sizeof(JoinPart));
+        if(NULL != ctx.Parts){
+            int i = 0;
+            for(i=0; i<ctx.PartCount; i++){
+                ctx.Parts[i].Fd[0] = -1;
+                ctx.Parts[i].Fd[1] = -1;
+            }
+            for(i=0; i<ctx.PartCount; i++){
+                ctx.Parts[i].Fd[0] = CreateTempFile(build->Path);
+                ctx.Parts[i].Fd[1] = CreateTempFile(build->Path);
+                ctx.Parts[i].Buf = malloc(JOIN_PART_BUF);
+                if((ctx.Parts[i].Fd[0] < 0) || (ctx.Parts[i].Fd[1] < 0) || (NULL == ctx.Parts[i].Buf)){
+                    break;
+                }
+            }
+            //先把两个表都分区写到临时文件，再逐个分区连接
+            if(i == ctx.PartCount){
+                ctx.Side = 0;
+                if((DBF_SUCCESS == ScanBlocks(build, 1, IntRecCount(build), 1, PartitionBlock, &ctx)) &&
+                    (DBF_SUCCESS == FlushParts(&ctx))){
+                    ctx.Side = 1;
+                    if((DBF_SUCCESS == ScanBlocks(probe, 1, IntRecCount(probe), 1, PartitionBlock, &ctx)) &&
+                        (DBF_SUCCESS == FlushParts(&ctx))){
+                        result = JoinPartitions(&ctx);
+                    }
+                }
+            }
+            for(i=0; i<ctx.PartCount; i++){
+                if(ctx.Parts[i].Fd[0] >= 0){
+                    close(ctx.Parts[i].Fd[0]);
+                }
+                if(ctx.Parts[i].Fd[1] >= 0){
+                    close(ctx.Parts[i].Fd[1]);
+                }
+                free(ctx.Parts[i].Buf);
+            }
+            free(ctx.Parts);
+        }
+    }
+    TableReset(&ctx.Table);
+    pthread_mutex_destroy(&ctx.Mutex);
+    return result;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : ResolveJoinKey
+* Description: 按列名找到关联列
+----------------------------------------------------------------------------*/
+int ResolveJoinKey(CDBF *cDBF, char *fieldName, JoinKey *key)
+{
+    int index = GetIndexByName(cDBF, fieldName);
+    if(index < 0){
+        #ifdef DEBUG
+        printf("Debug ResolveJoinKey FieldName Not Exists, FieldName = %s\n", fieldName);
+        #endif
+        return DBF_FAIL;
+    }
+    key->Field = &cDBF->Fields[index];
+    key->Offset = cDBF->FieldOffsets[index];
+    key->Numeric = (TYPE_NUMERIC == key->Field->FieldType) || (TYPE_FLOAT == key->Field->FieldType);
+    key->Scale = key->Field->Scale;
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : NormalizeKey
+* Description: 规范化关联列，返回规范化后的长度，JOIN_KEY_NULL表示空值，JOIN_KEY_OVERFLOW表示溢出
+----------------------------------------------------------------------------*/
+int NormalizeKey(JoinKey *key, const char *rec, char *out)
+{
+    const char *p = rec + key->Offset;
+    int width = key->Field->Width;
+    if(key->Numeric){
+        long long value = 0;
+        int ret = DecodeScaled(p, width, key->Scale, &value);
+        if(DBF_TRUE != ret){
+            return (DBF_FAIL == ret) ? JOIN_KEY_OVERFLOW : JOIN_KEY_NULL;
+        }
+        memcpy(out, &value, sizeof(value));
+        return sizeof(value);
+    }
+    int start = 0;
+    while((start < width) && (SPACE == p[start])){
+        start ++;
+    }
+    int end = width;
+    while((end > start) && (SPACE == p[end - 1])){
+        end --;
+    }
+    if(end == start){
+        return JOIN_KEY_NULL;
+    }
+    memcpy(out, p + start, end - start);
+    return end - start;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : JoinPartOf
+* Description: 按散列值的高位选择分区
+----------------------------------------------------------------------------*/
+unsigned int JoinPartOf(JoinContext *ctx, unsigned int hash)
+{
+    return ((hash * 2654435761u) >> 16) % ctx->PartCount;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : TableAdd
+* Description: 一条构建表记录拷贝到Hash表，已删除和关联列为空的记录跳过
+----------------------------------------------------------------------------*/
+int TableAdd(JoinContext *ctx, const char *rec, int row)
+{
+    JoinTable *table = &ctx->Table;
+    char key[VALUE_BUF_LEN];
+    if(DELETED == rec[0]){
+        return DBF_SUCCESS;
+    }
+    int keyLen = NormalizeKey(&ctx->Keys[0], rec, key);
+    if(JOIN_KEY_OVERFLOW == keyLen){
+        return DBF_FAIL;
+    }
+    if(keyLen < 0){
+        return DBF_SUCCESS;
+    }
+    if(table->Count == table->Cap){
+        int cap = (table->Cap > 0) ? table->Cap * 2 : 1024;
+        char *records = realloc(table->Records, (long)cap * table->RecSize);
+        if(NULL == records){
+            return DBF_FAIL;
+        }
+        table->Records = records;
+        int *rows = realloc(table->Rows, sizeof(int) * cap);
+        if(NULL == rows){
+            return DBF_FAIL;
+        }
+        table->Rows = rows;
+        unsigned int *hashes = realloc(table->Hashes, sizeof(unsigned int) * cap);
+        if(NULL == hashes){
+            return DBF_FAIL;
+        }
+        table->Hashes = hashes;
+        table->Cap = cap;
+    }
+    memcpy(table->Records + ((long)table->Count * table->RecSize), rec, table->RecSize);
+    table->Rows[table->Count] = row;
+    table->Hashes[table->Count] = HashBytes(key, keyLen);
+    table->Count ++;
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : TableFinish
+* Description: 记录全部加入后建桶和链表
+----------------------------------------------------------------------------*/
+int TableFinish(JoinTable *table)
+{
+    unsigned int buckets = 16;
+    while(buckets < (unsigned int)table->Count){
+        buckets = buckets * 2;
+    }
+    free(table->Buckets);
+    free(table->Next);
+    table->Buckets = malloc(sizeof(int) * buckets);
+    table->Next = malloc(sizeof(int) * (table->Count + 1));
+    if((NULL == table->Buckets) || (NULL == table->Next)){
+        return DBF_FAIL;
+    }
+    table->Mask = buckets - 1;
+    memset(table->Buckets, 0xFF, sizeof(int) * buckets);
+    //倒序插入，链表中的记录保持原来的先后顺序
+    int i = 0;
+    for(i=table->Count-1; i>=0; i--){
+        unsigned int b = table->Hashes[i] & table->Mask;
+        table->Next[i] = table->Buckets[b];
+        table->Buckets[b] = i;
+    }
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : TableReset
+* Description: 释放Hash表的内存，分区模式下每个分区之间调用
+----------------------------------------------------------------------------*/
+void TableReset(JoinTable *table)
+{
+    free(table->Records);
+    free(table->Rows);
+    free(table->Hashes);
+    free(table->Next);
+    free(table->Buckets);
+    int recSize = table->RecSize;
+    memset(table, '\0', sizeof(JoinTable));
+    table->RecSize = recSize;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : LoadBlock
+* Description: ScanBlocks的块回调，构建表的一块记录加入Hash表
+----------------------------------------------------------------------------*/
+int LoadBlock(const char *records, int firstRow, int count, int threadNo, void *userData)
+{
+    JoinContext *ctx = (JoinContext *)userData;
+    int i = 0;
+    for(i=0; i<count; i++){
+        if(DBF_SUCCESS != TableAdd(ctx, records + ((long)i * ctx->RecSize[0]), firstRow + i)){
+            return DBF_FAIL;
+        }
+    }
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : ProbeBlock
+* Description: ScanBlocks的块回调，探测表的一块记录逐条探测
+----------------------------------------------------------------------------*/
+int ProbeBlock(const char *records, int firstRow, int count, int threadNo, void *userData)
+{
+    JoinContext *ctx = (JoinContext *)userData;
+    int i = 0;
+    for(i=0; i<count; i++){
+        if(DBF_SUCCESS != ProbeOne(ctx, records + ((long)i * ctx->RecSize[1]), firstRow + i)){
+            return DBF_FAIL;
+        }
+    }
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : ProbeOne
+* Description: 一条探测表记录在Hash表中查找所有匹配的记录并回调
+----------------------------------------------------------------------------*/
+int ProbeOne(JoinContext *ctx, const char *rec, int row)
+{
+    JoinTable *table = &ctx->Table;
+    char key[VALUE_BUF_LEN];
+    char other[VALUE_BUF_LEN];
+    if(DELETED == rec[0]){
+        return DBF_SUCCESS;
+    }
+    int matched = DBF_FALSE;
+    int keyLen = NormalizeKey(&ctx->Keys[1], rec, key);
+    if(JOIN_KEY_OVERFLOW == keyLen){
+        return DBF_FAIL;
+    }
+    if((keyLen >= 0) && (table->Count > 0)){
+        unsigned int hash = HashBytes(key, keyLen);
+        int i = table->Buckets[hash & table->Mask];
+        for(; i>=0; i=table->Next[i]){
+            if(hash != table->Hashes[i]){
+                continue;
+            }
+            const char *buildRec = table->Records + ((long)i * table->RecSize);
+            int otherLen = NormalizeKey(&ctx->Keys[0], buildRec, other);
+            if((otherLen != keyLen) || (0 != memcmp(key, other, keyLen))){
+                continue;
+            }
+            matched = DBF_TRUE;
+            if(DBF_SUCCESS != EmitJoin(ctx, buildRec, table->Rows[i], rec, row)){
+                return DBF_FAIL;
+            }
+        }
+    }
+    if((DBF_FALSE == matched) && (joinLeftOuter == ctx->Mode)){
+        return EmitJoin(ctx, NULL, 0, rec, row);
+    }
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : EmitJoin
+* Description: 加锁调用连接回调，交换过构建表和探测表时按调用方的顺序传参
+----------------------------------------------------------------------------*/
+int EmitJoin(JoinContext *ctx, const char *buildRec, int buildRow, const char *probeRec, int probeRow)
+{
+    pthread_mutex_lock(&ctx->Mutex);
+    int ret = DBF_SUCCESS;
+    if(ctx->Swapped){
+        ret = ctx->Callback(probeRec, probeRow, buildRec, buildRow, ctx->UserData);
+    }
+    else{
+        ret = ctx->Callback(buildRec, buildRow, probeRec, probeRow, ctx->UserData);
+    }
+    pthread_mutex_unlock(&ctx->Mutex);
+    return (DBF_FAIL == ret) ? DBF_FAIL : DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : PartitionBlock
+* Description: ScanBlocks的块回调，按关联列的散列值把记录写到分区的写缓存
+----------------------------------------------------------------------------*/
+int PartitionBlock(const char *records, int firstRow, int count, int threadNo, void *userData)
+{
+    JoinContext *ctx = (JoinContext *)userData;
+    int side = ctx->Side;
+    int recSize = ctx->RecSize[side];
+    int entrySize = sizeof(int) + recSize;
+    char key[VALUE_BUF_LEN];
+    int i = 0;
+    for(i=0; i<count; i++){
+        const char *rec = records + ((long)i * recSize);
+        int row = firstRow + i;
+        if(DELETED == rec[0]){
+            continue;
+        }
+        int keyLen = NormalizeKey(&ctx->Keys[side], rec, key);
+        if(JOIN_KEY_OVERFLOW == keyLen){
+            return DBF_FAIL;
+        }
+        if(keyLen < 0){
+            //关联列为空的记录不会匹配，左外连接时探测表的这些记录直接回调
+            if((1 == side) && (joinLeftOuter == ctx->Mode)){
+                if(DBF_SUCCESS != EmitJoin(ctx, NULL, 0, rec, row)){
+                    return DBF_FAIL;
+                }
+            }
+            continue;
+        }
+        JoinPart *part = &ctx->Parts[JoinPartOf(ctx, HashBytes(key, keyLen))];
+        if(part->BufLen + entrySize > JOIN_PART_BUF){
+            if(DBF_SUCCESS != FlushPart(part, side)){
+                return DBF_FAIL;
+            }
+        }
+        memcpy(part->Buf + part->BufLen, &row, sizeof(int));
+        memcpy(part->Buf + part->BufLen + sizeof(int), rec, recSize);
+        part->BufLen = part->BufLen + entrySize;
+    }
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : FlushParts
+* Description: 一个表分区完后，把所有分区的写缓存写到临时文件
+----------------------------------------------------------------------------*/
+int FlushParts(JoinContext *ctx)
+{
+    int i = 0;
+    for(i=0; i<ctx->PartCount; i++){
+        if(DBF_SUCCESS != FlushPart(&ctx->Parts[i], ctx->Side)){
+            return DBF_FAIL;
+        }
+    }
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : FlushPart
+* Description: 一个分区的写缓存追加到该分区的临时文件
+----------------------------------------------------------------------------*/
+int FlushPart(JoinPart *part, int side)
+{
+    if(0 == part->BufLen){
+        return DBF_SUCCESS;
+    }
+    if(DBF_SUCCESS != WriteFull(part->Fd[side], part->Buf, part->BufLen, part->Size[side])){
+        return DBF_FAIL;
+    }
+    part->Size[side] = part->Size[side] + part->BufLen;
+    part->BufLen = 0;
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : JoinPartitions
+* Description: 逐个分区：构建表的分区读入Hash表，再用探测表的同一分区探测
+----------------------------------------------------------------------------*/
+int JoinPartitions(JoinContext *ctx)
+{
+    char *buf = malloc(JOIN_READ_CHUNK + sizeof(int) + ctx->RecSize[0] + ctx->RecSize[1]);
+    if(NULL == buf){
+        return DBF_FAIL;
+    }
+    int result = DBF_SUCCESS;
+    int p = 0;
+    int side = 0;
+    for(p=0; (p<ctx->PartCount) && (DBF_SUCCESS == result); p++){
+        JoinPart *part = &ctx->Parts[p];
+        TableReset(&ctx->Table);
+        if(0 == part->Size[1]){
+            continue;
+        }
+        for(side=0; (side<2) && (DBF_SUCCESS == result); side++){
+            int entrySize = sizeof(int) + ctx->RecSize[side];
+            int chunk = (JOIN_READ_CHUNK / entrySize + 1) * entrySize;
+            long long offset = 0;
+            while((offset < part->Size[side]) && (DBF_SUCCESS == result)){
+                int size = (part->Size[side] - offset > chunk) ? chunk : (int)(part->Size[side] - offset);
+                if(DBF_SUCCESS != ReadFull(part->Fd[side], buf, size, offset)){
+                    result = DBF_FAIL;
+                    break;
+                }
+                int pos = 0;
+                for(pos=0; pos<size; pos=pos+entrySize){
+                    int row = 0;
+                    memcpy(&row, buf + pos, sizeof(int));
+                    const char *rec = buf + pos + sizeof(int);
+                    int ret = (0 == side) ? TableAdd(ctx, rec, row) : ProbeOne(ctx, rec, row);
+                    if(DBF_SUCCESS != ret){
+                        result = DBF_FAIL;
+                        break;
+                    }
+                }
+                offset = offset + size;
+            }
+            if((0 == side) && (DBF_SUCCESS == result)){
+                result = TableFinish(&ctx->Table);
+            }
+        }
+    }
+    free(buf);
+    return result;
+}
@@ -0,0 +1,41 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cJoin.h
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-13
+ * Description  : 两个DBF按关联列做Hash连接
+     1.内连接时用较小的表做构建表(左外连接由调用方选择)，关联列的原始字节建Hash表，另一个表按记录块并行探测
+     2.匹配的记录对直接以原始记录的指针回调，不拷贝、不解析列
+     3.构建表超出内存预算时，两个表都按关联列的散列值分区写到临时文件，逐个分区连接
+     4.两边都是N、F列时按数值相等连接，否则去掉前后空格后按字节相等连接
+     5.已删除的记录和关联列为空的记录不参与匹配
+**********************************************************************************/
+#ifndef CJOIN_H
+#define CJOIN_H
+
+#include "cDBFStruct.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//连接方式
+typedef enum TDBFJoinMode
+{
+    joinInner,                  //只回调匹配的记录对
+    joinLeftOuter               //探测表中没有匹配的记录也回调一次，buildRec为NULL
+}DBFJoinMode;
+
+//连接回调，buildRec、probeRec是原始记录(第0个字节是删除标记)，只在回调期间有效
+//回调在多个探测线程之间串行执行，返回DBF_FAIL时停止连接
+typedef int (*DBFJoinCallback)(const char *buildRec, int buildRow, const char *probeRec, int probeRow, void *userData);
+
+int HashJoin(CDBF *build, char *buildKey, CDBF *probe, char *probeKey, DBFJoinMode mode,
+    long memoryBudget, int nThreads, DBFJoinCallback callback, void *userData);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
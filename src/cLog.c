@@ -0,0 +1,621 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cLog.c
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-20
+ * Description  : 变更日志实现
+     1.日志文件: 32字节的文件头(标识、版本、本段的起始序号、DBF的DataOffset和RecSize)，
+       后面是一条条日志
+     2.每条日志: 24字节的日志头(序号、行号、行内偏移、字节数、类型)，后面紧跟新的字节
+       行号为0表示文件头区，这时行内偏移就是文件偏移；截断日志的行号是截断后保留的记录数
+     3.日志只追加，打开已有的日志段时丢弃异常退出时写了一半的最后一条
+     4.重放时映射整个日志段，同一块内存中重叠、相接的写合并为一次pwrite，
+       文件头区的写(每次Post都会写)合并到最后只写一次，副本落盘后才更新已应用的序号
+**********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cDBF.h"
+#include "cLog.h"
+#include "cDBFInner.h"
+
+#pragma pack(1)
+
+//日志文件头
+typedef struct TLogFileHead
+{
+    char Magic[4];              //"DBFL"
+    int Version;                //布局版本
+    unsigned long long BaseSeq; //本段第一条日志之前的序号
+    unsigned short DataOffset;  //DBF的DataOffset、RecSize，重放时按行号计算文件偏移
+    unsigned short RecSize;
+    char Reserved[12];
+}LogFileHead;
+
+//日志头，后面紧跟Size字节新的内容
+typedef struct TLogEntry
+{
+    unsigned long long Seq;     //序号，从1开始连续
+    unsigned int RowNo;         //行号，0表示文件头区
+    unsigned int Start;         //行内偏移，行号为0时是文件偏移
+    unsigned int Size;          //新内容的字节数
+    unsigned char Type;         //LOG_WRITE、LOG_TRUNCATE
+    char Reserved[3];
+}LogEntry;
+
+#pragma pack()
+
+//写方句柄的日志状态
+typedef struct TDBFLog
+{
+    int Fd;
+    long long Size;             //日志文件中已写出的字节数
+    unsigned long long Seq;     //最后一条日志的序号
+    int Used;                   //Buf中还没有写出的字节数
+    char Buf[DBF_LOG_BUFSIZE];
+}DBFLog;
+
+//重放时正在合并的一段连续的写
+typedef struct TLogRun
+{
+    int Fd;                     //副本文件
+    off_t Start;
+    long long Len;
+    char *Buf;                  //DBF_LOG_COALESCE字节
+    int Writes;                 //pwrite次数
+}LogRun;
+
+#define LOG_MAGIC "DBFL"
+#define LOG_VERSION 1
+#define LOG_WRITE 1
+#define LOG_TRUNCATE 2
+
+const LogEntry *NextEntry(const char *map, long long size, long long pos, unsigned long long prevSeq);
+int ScanLogEnd(int fd, long long size, unsigned long long baseSeq, long long *end, unsigned long long *lastSeq);
+int AppendEntry(DBFLog *log, LogEntry *entry, const void *data);
+int RunWrite(LogRun *run, off_t offset, const char *data, long long size);
+int FlushRun(LogRun *run);
+void SeqPath(char *replicaPath, char *path, int size);
+int ReadAppliedSeq(char *replicaPath, unsigned long long *seq);
+int WriteAppliedSeq(char *replicaPath, unsigned long long seq);
+
+
+/*******************************************************************************
+* Function   : OpenChangeLog
+* Description: 开始把cDBF的写记录到日志logPath
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+    * logPath, 日志文件，不存在时新建，已存在时接着写
+* Output     :
+* Return     : 是否打开成功, -1:打开失败或日志不是同结构DBF的; 1:打开成功
+* Others     :
+    * cDBF已有日志时先写出并关闭旧的日志段，新的日志段序号接着旧的编
+    * 之后每次写DBF都追加日志，CloseDBF时关闭日志
+*******************************************************************************/
+int OpenChangeLog(CDBF *cDBF, char *logPath)
+{
+    if((DBF_OPEN_STREAM | DBF_OPEN_SHM) & cDBF->OpenFlags){
+        return DBF_FAIL;
+    }
+    //切换日志段
+    unsigned long long baseSeq = 0;
+    if(NULL != cDBF->Log){
+        baseSeq = cDBF->Log->Seq;
+        if(DBF_SUCCESS != CloseChangeLog(cDBF)){
+            return DBF_FAIL;
+        }
+    }
+    int fd = open(logPath, O_RDWR | O_CREAT, 0644);
+    if(fd < 0){
+        return DBF_FAIL;
+    }
+    DBFLog *log = malloc(sizeof(DBFLog));
+    struct stat st;
+    if((NULL == log) || (0 != fstat(fd, &st))){
+        free(log);
+        close(fd);
+        return DBF_FAIL;
+    }
+    memset(log, '\0', sizeof(DBFLog));
+    log->Fd = fd;
+    LogFileHead head;
+    int ret = DBF_SUCCESS;
+    if(st.st_size < (off_t)sizeof(LogFileHead)){
+        //新的日志段
+        memset(&head, '\0', sizeof(LogFileHead));
+        memcpy(head.Magic, LOG_MAGIC, 4);
+        head.Version = LOG_VERSION;
+        head.BaseSeq = baseSeq;
+        head.DataOffset = cDBF->Head->DataOffset;
+        head.RecSize = cDBF->Head->RecSize;
+        if((0 != ftruncate(fd, 0)) || (DBF_SUCCESS != WriteFull(fd, (char *)&head, sizeof(LogFileHead), 0))){
+            ret = DBF_FAIL;
+        }
+        log->Size = sizeof(LogFileHead);
+        log->Seq = baseSeq;
+    }
+    else if((DBF_SUCCESS != ReadFull(fd, (char *)&head, sizeof(LogFileHead), 0))
+        || (0 != memcmp(head.Magic, LOG_MAGIC, 4)) || (LOG_VERSION != head.Version)
+        || (head.DataOffset != cDBF->Head->DataOffset) || (head.RecSize != cDBF->Head->RecSize)){
+        ret = DBF_FAIL;
+    }
+    else{
+        //已有的日志段接着写，丢弃写了一半的最后一条
+        if((DBF_SUCCESS != ScanLogEnd(fd, st.st_size, head.BaseSeq, &log->Size, &log->Seq))
+            || (0 != ftruncate(fd, log->Size))){
+            ret = DBF_FAIL;
+        }
+    }
+    if(DBF_SUCCESS != ret){
+        #ifdef DEBUG
+        printf("Debug OpenChangeLog Error, logPath = %s\n", logPath);
+        #endif
+        free(log);
+        close(fd);
+        return DBF_FAIL;
+    }
+    cDBF->Log = log;
+    return DBF_SUCCESS;
+}
+
+
+/*******************************************************************************
+* Function   : CloseChangeLog
+* Description: 写出未写的日志并停止记录
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+* Output     :
+* Return     : 是否写出成功, -1:写出失败; 1:写出成功或没有日志
+* Others     : CloseDBF时调用
+*******************************************************************************/
+int CloseChangeLog(CDBF *cDBF)
+{
+    DBFLog *log = cDBF->Log;
+    if(NULL == log){
+        return DBF_SUCCESS;
+    }
+    int ret = FlushChangeLog(cDBF);
+    close(log->Fd);
+    free(log);
+    cDBF->Log = NULL;
+    return ret;
+}
+
+
+/*******************************************************************************
+* Function   : FlushChangeLog
+* Description: 把内存中攒的日志写到日志文件
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+* Output     :
+* Return     : 是否写出成功, -1:写出失败; 1:写出成功或没有日志
+* Others     : 写DBF的地方在数据可能到达文件之前调用，FlushDBF在写出stdio缓存中的记录之前再调用一次
+*******************************************************************************/
+int FlushChangeLog(CDBF *cDBF)
+{
+    DBFLog *log = cDBF->Log;
+    if((NULL == log) || (0 == log->Used)){
+        return DBF_SUCCESS;
+    }
+    if(DBF_SUCCESS != WriteFull(log->Fd, log->Buf, log->Used, log->Size)){
+        #ifdef DEBUG
+        printf("Debug FlushChangeLog pwrite Error\n");
+        #endif
+        return DBF_FAIL;
+    }
+    log->Size = log->Size + log->Used;
+    log->Used = 0;
+    return DBF_SUCCESS;
+}
+
+
+/*******************************************************************************
+* Function   : GetChangeLogSeq
+* Description: 获取最后一条日志的序号
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+* Output     :
+* Return     : 最后一条日志的序号, 0:没有日志
+* Others     : 包括还没有写出的日志
+*******************************************************************************/
+unsigned long long GetChangeLogSeq(CDBF *cDBF)
+{
+    return (NULL == cDBF->Log) ? 0 : cDBF->Log->Seq;
+}
+
+
+/*******************************************************************************
+* Function   : ApplyChangeLog
+* Description: 把日志段logPath中还没有应用的日志重放到副本replicaPath上
+* Input      :
+    * logPath, 日志文件
+    * replicaPath, 副本DBF文件，不存在时新建
+* Output     :
+* Return     : 本次应用的日志条数(>=0); -1:应用失败，或副本缺少本段之前的日志
+* Others     :
+    * 已应用的序号保存在"<副本文件名>.seq"中，序号不大于它的日志跳过
+    * 日志末尾写了一半的一条不应用，写方写完后再次调用时应用
+    * 写是绝对位置的覆盖，中途失败后重新应用结果相同
+*******************************************************************************/
+int ApplyChangeLog(char *logPath, char *replicaPath)
+{
+    unsigned long long applied = 0;
+    if(DBF_SUCCESS != ReadAppliedSeq(replicaPath, &applied)){
+        return DBF_FAIL;
+    }
+    int logFd = open(logPath, O_RDONLY);
+    if(logFd < 0){
+        return DBF_FAIL;
+    }
+    struct stat st;
+    if((0 != fstat(logFd, &st)) || (st.st_size < (off_t)sizeof(LogFileHead))){
+        close(logFd);
+        return DBF_FAIL;
+    }
+    long long size = st.st_size;
+    char *map = mmap(NULL, size, PROT_READ, MAP_SHARED, logFd, 0);
+    close(logFd);
+    if(MAP_FAILED == map){
+        return DBF_FAIL;
+    }
+    LogFileHead *head = (LogFileHead *)map;
+    //副本还没有应用到本段的起始序号，中间缺了日志段
+    if((0 != memcmp(head->Magic, LOG_MAGIC, 4)) || (LOG_VERSION != head->Version) || (applied < head->BaseSeq)){
+        munmap(map, size);
+        return DBF_FAIL;
+    }
+    int fd = open(replicaPath, O_RDWR | O_CREAT, 0644);
+    LogRun run;
+    memset(&run, '\0', sizeof(LogRun));
+    run.Fd = fd;
+    run.Buf = malloc(DBF_LOG_COALESCE);
+    //文件头区先读入副本现在的内容，各条日志改在这里，最后写一次
+    int headSize = head->DataOffset;
+    char *headBuf = malloc(headSize);
+    if((fd < 0) || (NULL == run.Buf) || (NULL == headBuf)){
+        if(fd >= 0){
+            close(fd);
+        }
+        free(run.Buf);
+        free(headBuf);
+        munmap(map, size);
+        return DBF_FAIL;
+    }
+    memset(headBuf, '\0', headSize);
+    if(pread(fd, headBuf, headSize, 0) < 0){
+        memset(headBuf, '\0', headSize);
+    }
+    int headLow = headSize;
+    int headHigh = 0;
+    int count = 0;
+    int ret = DBF_SUCCESS;
+    unsigned long long seq = head->BaseSeq;
+    long long pos = sizeof(LogFileHead);
+    const LogEntry *entry = NULL;
+    while((DBF_SUCCESS == ret) && (NULL != (entry = NextEntry(map, size, pos, seq)))){
+        const char *data = (const char *)(entry + 1);
+        pos = pos + sizeof(LogEntry) + entry->Size;
+        seq = entry->Seq;
+        if(seq <= applied){
+            continue;
+        }
+        if(LOG_TRUNCATE == entry->Type){
+            ret = FlushRun(&run);
+            if((DBF_SUCCESS == ret) && (0 != ftruncate(fd, head->DataOffset + (off_t)head->RecSize * entry->RowNo))){
+                ret = DBF_FAIL;
+            }
+        }
+        else if((0 == entry->RowNo) && (entry->Start + entry->Size <= (unsigned int)headSize)){
+            memcpy(headBuf + entry->Start, data, entry->Size);
+            if((int)entry->Start < headLow){
+                headLow = entry->Start;
+            }
+            if((int)(entry->Start + entry->Size) > headHigh){
+                headHigh = entry->Start + entry->Size;
+            }
+        }
+        else if(0 == entry->RowNo){
+            ret = RunWrite(&run, entry->Start, data, entry->Size);
+        }
+        else{
+            off_t offset = head->DataOffset + (off_t)head->RecSize * (entry->RowNo - 1) + entry->Start;
+            ret = RunWrite(&run, offset, data, entry->Size);
+        }
+        count ++;
+    }
+    if(DBF_SUCCESS == ret){
+        ret = FlushRun(&run);
+    }
+    if((DBF_SUCCESS == ret) && (headLow < headHigh)){
+        ret = WriteFull(fd, headBuf + headLow, headHigh - headLow, headLow);
+        run.Writes ++;
+    }
+    //副本落盘后才记录已应用的序号
+    if((DBF_SUCCESS == ret) && (count > 0)){
+        if(0 != fdatasync(fd)){
+            ret = DBF_FAIL;
+        }
+        else{
+            ret = WriteAppliedSeq(replicaPath, seq);
+        }
+    }
+    #ifdef DEBUG
+    printf("Debug ApplyChangeLog entries = %d, pwrite = %d, seq = %llu\n", count, run.Writes, seq);
+    #endif
+    close(fd);
+    free(run.Buf);
+    free(headBuf);
+    munmap(map, size);
+    if(DBF_SUCCESS != ret){
+        return DBF_FAIL;
+    }
+    return count;
+}
+
+
+/*******************************************************************************
+* Function   : GetAppliedSeq
+* Description: 获取副本已应用的最后一条日志的序号
+* Input      :
+    * replicaPath, 副本DBF文件
+* Output     :
+* Return     : 已应用的序号, 0:还没有应用过或读取失败
+* Others     : 复制中断后从这个序号之后的日志继续
+*******************************************************************************/
+unsigned long long GetAppliedSeq(char *replicaPath)
+{
+    unsigned long long seq = 0;
+    if(DBF_SUCCESS != ReadAppliedSeq(replicaPath, &seq)){
+        return 0;
+    }
+    return seq;
+}
+
+
+/*******************************************************************************
+* Function   : LogWrite
+* Description: 记录一次对DBF文件的写
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+    * offset, 写的文件偏移
+    * buf, 写入的内容
+    * size, 字节数
+* Output     :
+* Return     : 是否记录成功, -1:记录失败; 1:记录成功或没有日志
+* Others     :
+    * WriteAt、UpdateWhere、多进程追加在写数据之前调用，失败时不写数据
+    * 日志只攒在内存中(缓存满时才写出)，调用方在数据写到DBF文件之前调用FlushChangeLog
+*******************************************************************************/
+int LogWrite(CDBF *cDBF, off_t offset, const void *buf, int size)
+{
+    if((NULL == cDBF->Log) || (size <= 0)){
+        return DBF_SUCCESS;
+    }
+    LogEntry entry;
+    memset(&entry, '\0', sizeof(LogEntry));
+    entry.Type = LOG_WRITE;
+    entry.Size = size;
+    if(offset < cDBF->Head->DataOffset){
+        entry.RowNo = 0;
+        entry.Start = offset;
+    }
+    else{
+        off_t rel = offset - cDBF->Head->DataOffset;
+        entry.RowNo = rel / cDBF->Head->RecSize + 1;
+        entry.Start = rel % cDBF->Head->RecSize;
+    }
+    return AppendEntry(cDBF->Log, &entry, buf);
+}
+
+
+/*******************************************************************************
+* Function   : LogTruncate
+* Description: 记录一次截断，截断后保留recCount条记录
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+    * recCount, 保留的记录数
+* Output     :
+* Return     : 是否记录成功, -1:记录失败; 1:记录成功或没有日志
+* Others     : Zap在截断文件之前调用，返回时日志已写到日志文件
+*******************************************************************************/
+int LogTruncate(CDBF *cDBF, unsigned int recCount)
+{
+    if(NULL == cDBF->Log){
+        return DBF_SUCCESS;
+    }
+    LogEntry entry;
+    memset(&entry, '\0', sizeof(LogEntry));
+    entry.Type = LOG_TRUNCATE;
+    entry.RowNo = recCount;
+    return AppendEntry(cDBF->Log, &entry, NULL);
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : NextEntry
+* Description: 取pos处的一条完整日志，写了一半或序号不接着prevSeq时返回NULL
+----------------------------------------------------------------------------*/
+const LogEntry *NextEntry(const char *map, long long size, long long pos, unsigned long long prevSeq)
+{
+    if(pos + (long long)sizeof(LogEntry) > size){
+        return NULL;
+    }
+    const LogEntry *entry = (const LogEntry *)(map + pos);
+    if((entry->Seq != prevSeq + 1) || ((LOG_WRITE != entry->Type) && (LOG_TRUNCATE != entry->Type))
+        || (pos + (long long)sizeof(LogEntry) + entry->Size > size)){
+        return NULL;
+    }
+    return entry;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : ScanLogEnd
+* Description: 找到已有日志段中最后一条完整日志的结尾和序号
+----------------------------------------------------------------------------*/
+int ScanLogEnd(int fd, long long size, unsigned long long baseSeq, long long *end, unsigned long long *lastSeq)
+{
+    char *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if(MAP_FAILED == map){
+        return DBF_FAIL;
+    }
+    long long pos = sizeof(LogFileHead);
+    unsigned long long seq = baseSeq;
+    const LogEntry *entry = NULL;
+    while(NULL != (entry = NextEntry(map, size, pos, seq))){
+        pos = pos + sizeof(LogEntry) + entry->Size;
+        seq = entry->Seq;
+    }
+    munmap(map, size);
+    *end = pos;
+    *lastSeq = seq;
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : AppendEntry
+* Description: 给日志编号后放到内存中攒着，放不下时先写出，超过缓存的直接写
+----------------------------------------------------------------------------*/
+int AppendEntry(DBFLog *log, LogEntry *entry, const void *data)
+{
+    int total = sizeof(LogEntry) + entry->Size;
+    entry->Seq = log->Seq + 1;
+    if(log->Used + total > DBF_LOG_BUFSIZE){
+        if(DBF_SUCCESS != WriteFull(log->Fd, log->Buf, log->Used, log->Size)){
+            return DBF_FAIL;
+        }
+        log->Size = log->Size + log->Used;
+        log->Used = 0;
+    }
+    if(total > DBF_LOG_BUFSIZE){
+        if((DBF_SUCCESS != WriteFull(log->Fd, (char *)entry, sizeof(LogEntry), log->Size))
+            || (DBF_SUCCESS != WriteFull(log->Fd, (const char *)data, entry->Size, log->Size + sizeof(LogEntry)))){
+            #ifdef DEBUG
+            printf("Debug AppendEntry pwrite Error, seq = %llu\n", entry->Seq);
+            #endif
+            return DBF_FAIL;
+        }
+        log->Size = log->Size + total;
+    }
+    else{
+        memcpy(log->Buf + log->Used, entry, sizeof(LogEntry));
+        if(entry->Size > 0){
+            memcpy(log->Buf + log->Used + sizeof(LogEntry), data, entry->Size);
+        }
+        log->Used = log->Used + total;
+    }
+    log->Seq = entry->Seq;
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : RunWrite
+* Description: 和正在合并的一段重叠或相接时并入，否则写出这一段后重新开始
+----------------------------------------------------------------------------*/
+int RunWrite(LogRun *run, off_t offset, const char *data, long long size)
+{
+    if((run->Len > 0) && (offset >= run->Start) && (offset <= run->Start + run->Len)
+        && (offset + size - run->Start <= DBF_LOG_COALESCE)){
+        memcpy(run->Buf + (offset - run->Start), data, size);
+        if(offset + size > run->Start + run->Len){
+            run->Len = offset + size - run->Start;
+        }
+        return DBF_SUCCESS;
+    }
+    if(DBF_SUCCESS != FlushRun(run)){
+        return DBF_FAIL;
+    }
+    if(size > DBF_LOG_COALESCE){
+        run->Writes ++;
+        return WriteFull(run->Fd, data, size, offset);
+    }
+    memcpy(run->Buf, data, size);
+    run->Start = offset;
+    run->Len = size;
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : FlushRun
+* Description: 把正在合并的一段pwrite到副本
+----------------------------------------------------------------------------*/
+int FlushRun(LogRun *run)
+{
+    if(0 == run->Len){
+        return DBF_SUCCESS;
+    }
+    run->Writes ++;
+    if(DBF_SUCCESS != WriteFull(run->Fd, run->Buf, run->Len, run->Start)){
+        #ifdef DEBUG
+        printf("Debug FlushRun pwrite Error, offset = %lld\n", (long long)run->Start);
+        #endif
+        return DBF_FAIL;
+    }
+    run->Len = 0;
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : SeqPath
+* Description: 已应用序号文件名，副本文件名后加".seq"
+----------------------------------------------------------------------------*/
+void SeqPath(char *replicaPath, char *path, int size)
+{
+    snprintf(path, size, "%s.seq", replicaPath);
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : ReadAppliedSeq
+* Description: 读已应用的序号，还没有序号文件时为0
+----------------------------------------------------------------------------*/
+int ReadAppliedSeq(char *replicaPath, unsigned long long *seq)
+{
+    char path[strlen(replicaPath) + 8];
+    SeqPath(replicaPath, path, sizeof(path));
+    *seq = 0;
+    int fd = open(path, O_RDONLY);
+    if(fd < 0){
+        return (ENOENT == errno) ? DBF_SUCCESS : DBF_FAIL;
+    }
+    int ret = ReadFull(fd, (char *)seq, sizeof(unsigned long long), 0);
+    close(fd);
+    return ret;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : WriteAppliedSeq
+* Description: 写临时文件后rename，中途退出时旧的序号仍然完整
+----------------------------------------------------------------------------*/
+int WriteAppliedSeq(char *replicaPath, unsigned long long seq)
+{
+    char path[strlen(replicaPath) + 8];
+    char tmpPath[strlen(replicaPath) + 12];
+    SeqPath(replicaPath, path, sizeof(path));
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+    int fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0){
+        return DBF_FAIL;
+    }
+    int ret = WriteFull(fd, (char *)&seq, sizeof(unsigned long long), 0);
+    if((DBF_SUCCESS == ret) && (0 != fsync(fd))){
+        ret = DBF_FAIL;
+    }
+    close(fd);
+    if((DBF_SUCCESS != ret) || (0 != rename(tmpPath, path))){
+        unlink(tmpPath);
+        return DBF_FAIL;
+    }
+    return DBF_SUCCESS;
+}
@@ -0,0 +1,50 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cLog.h
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-20
+ * Description  : 变更日志，把DBF的写增量复制到备机上的副本
+     1.OpenChangeLog之后，句柄对DBF文件的每次写(Post、Delete、AppendRecords、Zap、
+       UpdateWhere、文件头)都追加一条日志：序号、行号、行内偏移、新的字节
+     2.日志先于它描述的数据写出(预写)：LogWrite只把日志攒在内存中，写DBF的地方在数据
+       可能到达文件之前调用FlushChangeLog，异常退出后DBF中已有的修改在日志中一定有记录。
+       经过stdio的写在fseeko、fwrite时随时可能写到文件，每次WriteAt都要写出；
+       UpdateWhere一块中的多个写、多进程追加的记录和文件头在一次写出后再提交
+     3.句柄已有日志时再OpenChangeLog是切换到新的日志段，序号接着编；旧的段可以传给备机
+     4.备机ApplyChangeLog把一个日志段按顺序重放到副本上，相邻、重叠的写合并后再pwrite，
+       已应用的序号保存在副本旁边的"<副本文件名>.seq"中，重复应用、中断后重新应用都从下一条开始
+     5.副本初始时和主文件开始记日志时的内容一致，例如同一时刻的拷贝或都由CreateDBFLike新建
+     6.一个日志只由一个句柄写；以DBF_OPEN_SHARED_APPEND打开时只记录本句柄追加的记录
+**********************************************************************************/
+#ifndef CLOG_H
+#define CLOG_H
+
+#include <sys/types.h>
+#include "cDBFStruct.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//攒日志的缓存字节数，超过时先写出已攒的日志
+#define DBF_LOG_BUFSIZE (64 * 1024)
+//重放时一次pwrite合并的最大字节数
+#define DBF_LOG_COALESCE (4 * 1024 * 1024)
+
+int OpenChangeLog(CDBF *cDBF, char *logPath);
+int CloseChangeLog(CDBF *cDBF);
+int FlushChangeLog(CDBF *cDBF);
+unsigned long long GetChangeLogSeq(CDBF *cDBF);
+int ApplyChangeLog(char *logPath, char *replicaPath);
+unsigned long long GetAppliedSeq(char *replicaPath);
+
+//以下供cDBF内部调用
+int LogWrite(CDBF *cDBF, off_t offset, const void *buf, int size);
+int LogTruncate(CDBF *cDBF, unsigned int recCount);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
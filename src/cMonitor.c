@@ -0,0 +1,645 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cMonitor.c
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-21
+ * Description  : 单线程监控大量DBF文件实现
+     1.事件线程: epoll等待inotify和唤醒用的eventfd，按(目录监控, 文件名)在Hash表中找到文件，
+       记下合并窗口的结束时刻；epoll_wait的超时取最早结束的窗口
+     2.窗口结束时stat文件、pread文件头，和上次的快照比较判断变化类型，放入工作队列
+     3.工作线程从队列取文件，Fresh或重新打开句柄后回调；文件在队列中或正在回调时
+       新的变化只合并到Event，回调返回后再放回队列，所以队列容量等于文件个数上限
+     4.一把锁保护队列和各文件的状态，回调、Fresh、重新打开、stat和读文件头都不持有锁；
+       读文件头期间文件标记为Checking，UnwatchDBF等它结束后才释放
+**********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include "cDBF.h"
+#include "cMonitor.h"
+#include "cHash.h"
+#include "cStats.h"
+#include "cDBFInner.h"
+
+//监控目录时关心的事件：写和截断、rename到这个名字、新建
+//不关心IN_CLOSE_WRITE，否则关闭以读写方式打开的句柄(包括重写后关闭旧句柄)也会产生事件
+#define MONITOR_MASK (IN_MODIFY | IN_MOVED_TO | IN_CREATE)
+//一次读inotify事件的缓存
+#define MONITOR_BUFSIZE 16384
+
+//一个监控的文件
+typedef struct TMonitorFile
+{
+    int Used;
+    CDBF *DBF;                  //当前句柄，重写后换成重新打开的句柄，只由工作线程和UnwatchDBF访问
+    DBFMonitorCallback Callback;
+    void *UserData;
+    char *Path;                 //文件路径，判断变化时使用
+    char *Key;                  //目录监控 + 文件名，Hash表的键
+    int KeyLen;
+    int Wd;                     //所在目录的监控
+    DBFHead Head;               //上次判断时的文件头
+    long long Size;             //上次判断时的文件长度
+    dev_t Dev;
+    ino_t Ino;
+    unsigned long long Deadline;    //合并窗口结束的时刻(纳秒)，0表示没有未处理的事件
+    int Event;                  //待回调的变化，0表示没有
+    int Queued;                 //在工作队列中或正在回调
+    int Checking;               //事件线程正在不持锁读文件头
+    int Closing;                //UnwatchDBF正在取回，或回调要求停止
+}MonitorFile;
+
+//监控器
+struct TDBFMonitor
+{
+    int Inotify;
+    int Epoll;
+    int WakeFd;                 //CloseDBFMonitor唤醒事件线程
+    unsigned long long Coalesce;    //合并窗口(纳秒)
+    int MaxFiles;
+    MonitorFile *Files;
+    HashTable *Keys;            //目录监控 + 文件名 -> MonitorFile
+    int *Queue;                 //工作队列，环形，容量MaxFiles
+    int QueueHead;
+    int QueueCount;
+    int Stop;
+    pthread_mutex_t Mutex;      //保护以上各字段和各文件的状态
+    pthread_cond_t WorkCond;    //队列非空或停止
+    pthread_cond_t IdleCond;    //某个文件的回调或读文件头结束
+    pthread_t Loop;
+    int WorkerCount;
+    pthread_t Workers[DBF_MONITOR_MAXWORKERS];
+};
+
+void FreeMonitor(DBFMonitor *monitor);
+void StopMonitor(DBFMonitor *monitor, int loopStarted);
+void *MonitorLoop(void *arg);
+void *MonitorWorker(void *arg);
+int NextTimeout(DBFMonitor *monitor);
+void ReadEvents(DBFMonitor *monitor, char *buf);
+void DispatchDue(DBFMonitor *monitor);
+int ClassifyChange(MonitorFile *file, DBFHead *head, struct stat *st);
+int ReadSnapshot(char *path, DBFHead *head, struct stat *st);
+int RunCallback(MonitorFile *file, int event);
+void RemoveFile(DBFMonitor *monitor, MonitorFile *file);
+
+
+/*******************************************************************************
+* Function   : CreateDBFMonitor
+* Description: 创建监控器，启动事件线程和工作线程
+* Input      :
+    * maxFiles, 最多监控的文件个数
+    * nWorkers, 工作线程个数，1~DBF_MONITOR_MAXWORKERS
+    * coalesceMs, 合并窗口(毫秒)，0表示收到事件就判断
+* Output     :
+* Return     : 监控器指针; NULL表示参数错误或创建失败
+* Others     : 用CloseDBFMonitor释放
+*******************************************************************************/
+DBFMonitor *CreateDBFMonitor(int maxFiles, int nWorkers, int coalesceMs)
+{
+    if((maxFiles < 1) || (nWorkers < 1) || (nWorkers > DBF_MONITOR_MAXWORKERS) || (coalesceMs < 0)){
+        return NULL;
+    }
+    DBFMonitor *monitor = malloc(sizeof(DBFMonitor));
+    if(NULL == monitor){
+        return NULL;
+    }
+    memset(monitor, '\0', sizeof(DBFMonitor));
+    monitor->MaxFiles = maxFiles;
+    monitor->Coalesce = (unsigned long long)coalesceMs * 1000000ULL;
+    monitor->Inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    monitor->Epoll = epoll_create1(EPOLL_CLOEXEC);
+    monitor->WakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    monitor->Files = malloc(sizeof(MonitorFile) * maxFiles);
+    monitor->Queue = malloc(sizeof(int) * maxFiles);
+    monitor->Keys = CreateHash(64);
+    pthread_mutex_init(&monitor->Mutex, NULL);
+    pthread_cond_init(&monitor->WorkCond, NULL);
+    pthread_cond_init(&monitor->IdleCond, NULL);
+    if((monitor->Inotify < 0) || (monitor->Epoll < 0) || (monitor->WakeFd < 0)
+        || (NULL == monitor->Files) || (NULL == monitor->Queue) || (NULL == monitor->Keys)){
+        FreeMonitor(monitor);
+        return NULL;
+    }
+    memset(monitor->Files, '\0', sizeof(MonitorFile) * maxFiles);
+    struct epoll_event ev;
+    memset(&ev, '\0', sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = monitor->Inotify;
+    int ret = epoll_ctl(monitor->Epoll, EPOLL_CTL_ADD, monitor->Inotify, &ev);
+    ev.data.fd = monitor->WakeFd;
+    if((0 != ret) || (0 != epoll_ctl(monitor->Epoll, EPOLL_CTL_ADD, monitor->WakeFd, &ev))){
+        FreeMonitor(monitor);
+        return NULL;
+    }
+    int i = 0;
+    for(i=0; i<nWorkers; i++){
+        if(0 != pthread_create(&monitor->Workers[i], NULL, MonitorWorker, monitor)){
+            break;
+        }
+        monitor->WorkerCount ++;
+    }
+    if((monitor->WorkerCount < nWorkers) || (0 != pthread_create(&monitor->Loop, NULL, MonitorLoop, monitor))){
+        #ifdef DEBUG
+        printf("Debug CreateDBFMonitor pthread_create Error, workers = %d\n", monitor->WorkerCount);
+        #endif
+        StopMonitor(monitor, DBF_FALSE);
+        FreeMonitor(monitor);
+        return NULL;
+    }
+    return monitor;
+}
+
+
+/*******************************************************************************
+* Function   : WatchDBF
+* Description: 开始监控cDBF对应的文件，文件变化时在工作线程中回调
+* Input      :
+    * monitor, CreateDBFMonitor返回的监控器
+    * cDBF, OpenDBF、OpenDBFEx返回的CDBF结构体指针，之后归monitor所有
+    * callback, 变化回调
+    * userData, 传给回调的数据
+* Output     :
+* Return     : 监控编号(>=0)，UnwatchDBF时使用; -1:监控失败，句柄仍归调用方
+* Others     :
+    * 流句柄、共享内存句柄、从句柄缓存获取的句柄不能监控
+    * 同一个文件只能监控一次
+*******************************************************************************/
+int WatchDBF(DBFMonitor *monitor, CDBF *cDBF, DBFMonitorCallback callback, void *userData)
+{
+    if((NULL == monitor) || (NULL == cDBF) || (NULL == callback) || (NULL == cDBF->Path)
+        || ((DBF_OPEN_STREAM | DBF_OPEN_SHM) & cDBF->OpenFlags) || (NULL != cDBF->CacheEntry)){
+        return DBF_FAIL;
+    }
+    //监控文件所在的目录，rename替换文件后仍然能收到事件
+    char *path = cDBF->Path;
+    char *slash = strrchr(path, '/');
+    char *name = (NULL == slash) ? path : slash + 1;
+    int dirLen = (NULL == slash) ? 1 : ((slash == path) ? 1 : (int)(slash - path));
+    if((0 == name[0]) || (dirLen >= PATH_MAX)){
+        return DBF_FAIL;
+    }
+    char dir[PATH_MAX];
+    memcpy(dir, (NULL == slash) ? "." : path, dirLen);
+    dir[dirLen] = '\0';
+    DBFHead head;
+    struct stat st;
+    if(DBF_SUCCESS != ReadSnapshot(path, &head, &st)){
+        return DBF_FAIL;
+    }
+    int nameLen = strlen(name);
+    int keyLen = sizeof(int) + nameLen;
+    char *key = malloc(keyLen);
+    char *pathCopy = malloc(strlen(path) + 1);
+    if((NULL == key) || (NULL == pathCopy)){
+        free(key);
+        free(pathCopy);
+        return DBF_FAIL;
+    }
+    strcpy(pathCopy, path);
+    pthread_mutex_lock(&monitor->Mutex);
+    int id = 0;
+    while((id < monitor->MaxFiles) && monitor->Files[id].Used){
+        id ++;
+    }
+    //同一目录再次添加返回同一个监控
+    int wd = (id < monitor->MaxFiles) ? inotify_add_watch(monitor->Inotify, dir, MONITOR_MASK) : -1;
+    if(wd >= 0){
+        memcpy(key, &wd, sizeof(int));
+        memcpy(key + sizeof(int), name, nameLen);
+    }
+    if((wd < 0) || (NULL != HashGet(monitor->Keys, key, keyLen))){
+        pthread_mutex_unlock(&monitor->Mutex);
+        #ifdef DEBUG
+        printf("Debug WatchDBF Error, path = %s, wd = %d\n", path, wd);
+        #endif
+        free(key);
+        free(pathCopy);
+        return DBF_FAIL;
+    }
+    MonitorFile *file = &monitor->Files[id];
+    memset(file, '\0', sizeof(MonitorFile));
+    file->DBF = cDBF;
+    file->Callback = callback;
+    file->UserData = userData;
+    file->Path = pathCopy;
+    file->Key = key;
+    file->KeyLen = keyLen;
+    file->Wd = wd;
+    file->Head = head;
+    file->Size = st.st_size;
+    file->Dev = st.st_dev;
+    file->Ino = st.st_ino;
+    if(DBF_SUCCESS != HashPut(monitor->Keys, key, keyLen, file)){
+        pthread_mutex_unlock(&monitor->Mutex);
+        free(key);
+        free(pathCopy);
+        memset(file, '\0', sizeof(MonitorFile));
+        return DBF_FAIL;
+    }
+    file->Used = DBF_TRUE;
+    pthread_mutex_unlock(&monitor->Mutex);
+    return id;
+}
+
+
+/*******************************************************************************
+* Function   : UnwatchDBF
+* Description: 停止监控并取回句柄
+* Input      :
+    * monitor, CreateDBFMonitor返回的监控器
+    * id, WatchDBF返回的监控编号
+* Output     :
+* Return     : 当前句柄，重写后是重新打开的句柄，由调用方关闭; NULL表示编号无效
+* Others     : 正在回调时等回调返回，不能在回调中调用
+*******************************************************************************/
+CDBF *UnwatchDBF(DBFMonitor *monitor, int id)
+{
+    if((NULL == monitor) || (id < 0) || (id >= monitor->MaxFiles)){
+        return NULL;
+    }
+    pthread_mutex_lock(&monitor->Mutex);
+    MonitorFile *file = &monitor->Files[id];
+    if(!file->Used){
+        pthread_mutex_unlock(&monitor->Mutex);
+        return NULL;
+    }
+    file->Closing = DBF_TRUE;
+    file->Deadline = 0;
+    file->Event = 0;
+    while(file->Queued || file->Checking){
+        pthread_cond_wait(&monitor->IdleCond, &monitor->Mutex);
+    }
+    CDBF *cDBF = file->DBF;
+    RemoveFile(monitor, file);
+    pthread_mutex_unlock(&monitor->Mutex);
+    return cDBF;
+}
+
+
+/*******************************************************************************
+* Function   : CloseDBFMonitor
+* Description: 停止事件线程和工作线程，关闭还在监控的句柄，释放监控器
+* Input      :
+    * monitor, CreateDBFMonitor返回的监控器
+* Output     :
+* Return     :
+* Others     : 正在执行的回调返回后才停止，队列中还没有回调的变化丢弃
+*******************************************************************************/
+void CloseDBFMonitor(DBFMonitor *monitor)
+{
+    if(NULL == monitor){
+        return;
+    }
+    StopMonitor(monitor, DBF_TRUE);
+    int i = 0;
+    for(i=0; i<monitor->MaxFiles; i++){
+        MonitorFile *file = &monitor->Files[i];
+        if(file->Used){
+            CloseDBF(file->DBF);
+            RemoveFile(monitor, file);
+        }
+    }
+    FreeMonitor(monitor);
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : FreeMonitor
+* Description: 释放监控器的文件描述符和内存，线程已经停止
+----------------------------------------------------------------------------*/
+void FreeMonitor(DBFMonitor *monitor)
+{
+    if(monitor->Inotify >= 0){
+        close(monitor->Inotify);
+    }
+    if(monitor->Epoll >= 0){
+        close(monitor->Epoll);
+    }
+    if(monitor->WakeFd >= 0){
+        close(monitor->WakeFd);
+    }
+    if(NULL != monitor->Keys){
+        FreeHash(monitor->Keys);
+    }
+    pthread_mutex_destroy(&monitor->Mutex);
+    pthread_cond_destroy(&monitor->WorkCond);
+    pthread_cond_destroy(&monitor->IdleCond);
+    free(monitor->Files);
+    free(monitor->Queue);
+    free(monitor);
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : StopMonitor
+* Description: 通知各线程停止并等待退出，loopStarted表示事件线程是否已启动
+----------------------------------------------------------------------------*/
+void StopMonitor(DBFMonitor *monitor, int loopStarted)
+{
+    pthread_mutex_lock(&monitor->Mutex);
+    monitor->Stop = DBF_TRUE;
+    pthread_cond_broadcast(&monitor->WorkCond);
+    pthread_mutex_unlock(&monitor->Mutex);
+    if(loopStarted){
+        unsigned long long one = 1;
+        if(sizeof(one) != write(monitor->WakeFd, &one, sizeof(one))){
+            #ifdef DEBUG
+            printf("Debug StopMonitor eventfd write Error\n");
+            #endif
+        }
+        pthread_join(monitor->Loop, NULL);
+    }
+    int i = 0;
+    for(i=0; i<monitor->WorkerCount; i++){
+        pthread_join(monitor->Workers[i], NULL);
+    }
+    monitor->WorkerCount = 0;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : MonitorLoop
+* Description: 事件线程，等待inotify事件或最早的合并窗口结束
+----------------------------------------------------------------------------*/
+void *MonitorLoop(void *arg)
+{
+    DBFMonitor *monitor = (DBFMonitor *)arg;
+    char buf[MONITOR_BUFSIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct epoll_event events[2];
+    while(DBF_TRUE){
+        int n = epoll_wait(monitor->Epoll, events, 2, NextTimeout(monitor));
+        pthread_mutex_lock(&monitor->Mutex);
+        int stop = monitor->Stop;
+        pthread_mutex_unlock(&monitor->Mutex);
+        if(stop){
+            break;
+        }
+        int i = 0;
+        for(i=0; i<n; i++){
+            if(events[i].data.fd == monitor->Inotify){
+                ReadEvents(monitor, buf);
+            }
+        }
+        DispatchDue(monitor);
+    }
+    return NULL;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : MonitorWorker
+* Description: 工作线程，从队列取文件回调，同一文件的新变化在回调返回后再放回队列
+----------------------------------------------------------------------------*/
+void *MonitorWorker(void *arg)
+{
+    DBFMonitor *monitor = (DBFMonitor *)arg;
+    pthread_mutex_lock(&monitor->Mutex);
+    while(DBF_TRUE){
+        while((!monitor->Stop) && (0 == monitor->QueueCount)){
+            pthread_cond_wait(&monitor->WorkCond, &monitor->Mutex);
+        }
+        if(monitor->Stop){
+            break;
+        }
+        MonitorFile *file = &monitor->Files[monitor->Queue[monitor->QueueHead]];
+        monitor->QueueHead = (monitor->QueueHead + 1) % monitor->MaxFiles;
+        monitor->QueueCount --;
+        int event = file->Event;
+        file->Event = 0;
+        if((!file->Closing) && (0 != event)){
+            pthread_mutex_unlock(&monitor->Mutex);
+            int ret = RunCallback(file, event);
+            pthread_mutex_lock(&monitor->Mutex);
+            if(DBF_SUCCESS != ret){
+                file->Closing = DBF_TRUE;
+            }
+        }
+        if((!file->Closing) && (0 != file->Event)){
+            monitor->Queue[(monitor->QueueHead + monitor->QueueCount) % monitor->MaxFiles] = file - monitor->Files;
+            monitor->QueueCount ++;
+            pthread_cond_signal(&monitor->WorkCond);
+        }
+        else{
+            file->Queued = DBF_FALSE;
+            pthread_cond_broadcast(&monitor->IdleCond);
+        }
+    }
+    pthread_mutex_unlock(&monitor->Mutex);
+    return NULL;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : NextTimeout
+* Description: 距最早结束的合并窗口的毫秒数，没有未处理的事件时为-1
+----------------------------------------------------------------------------*/
+int NextTimeout(DBFMonitor *monitor)
+{
+    unsigned long long earliest = 0;
+    pthread_mutex_lock(&monitor->Mutex);
+    int i = 0;
+    for(i=0; i<monitor->MaxFiles; i++){
+        unsigned long long deadline = monitor->Files[i].Deadline;
+        if((0 != deadline) && ((0 == earliest) || (deadline < earliest))){
+            earliest = deadline;
+        }
+    }
+    pthread_mutex_unlock(&monitor->Mutex);
+    if(0 == earliest){
+        return -1;
+    }
+    unsigned long long now = StatsNow();
+    if(earliest <= now){
+        return 0;
+    }
+    return (int)((earliest - now + 999999ULL) / 1000000ULL);
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : ReadEvents
+* Description: 读完inotify事件，给对应的文件开始合并窗口；事件队列溢出时所有文件都判断一次
+----------------------------------------------------------------------------*/
+void ReadEvents(DBFMonitor *monitor, char *buf)
+{
+    char key[sizeof(int) + NAME_MAX];
+    unsigned long long now = StatsNow();
+    unsigned long long deadline = now + monitor->Coalesce;
+    ssize_t len = 0;
+    pthread_mutex_lock(&monitor->Mutex);
+    while((len = read(monitor->Inotify, buf, MONITOR_BUFSIZE)) > 0){
+        char *p = buf;
+        while(p < buf + len){
+            struct inotify_event *ev = (struct inotify_event *)p;
+            p = p + sizeof(struct inotify_event) + ev->len;
+            MonitorFile *file = NULL;
+            if(IN_Q_OVERFLOW & ev->mask){
+                int i = 0;
+                for(i=0; i<monitor->MaxFiles; i++){
+                    file = &monitor->Files[i];
+                    if(file->Used && (0 == file->Deadline)){
+                        file->Deadline = deadline;
+                    }
+                }
+                continue;
+            }
+            if(0 == ev->len){
+                continue;
+            }
+            int nameLen = strlen(ev->name);
+            memcpy(key, &ev->wd, sizeof(int));
+            memcpy(key + sizeof(int), ev->name, nameLen);
+            file = (MonitorFile *)HashGet(monitor->Keys, key, sizeof(int) + nameLen);
+            //窗口从第一个事件开始计，持续写入时最多延迟一个窗口
+            if((NULL != file) && (0 == file->Deadline)){
+                file->Deadline = deadline;
+            }
+        }
+    }
+    pthread_mutex_unlock(&monitor->Mutex);
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : DispatchDue
+* Description: 合并窗口结束的文件判断变化类型，放入工作队列
+----------------------------------------------------------------------------*/
+void DispatchDue(DBFMonitor *monitor)
+{
+    unsigned long long now = StatsNow();
+    pthread_mutex_lock(&monitor->Mutex);
+    int i = 0;
+    for(i=0; i<monitor->MaxFiles; i++){
+        MonitorFile *file = &monitor->Files[i];
+        if((!file->Used) || (0 == file->Deadline) || (file->Deadline > now)){
+            continue;
+        }
+        file->Deadline = 0;
+        if(file->Closing){
+            continue;
+        }
+        //stat、读文件头时不持有锁，不阻塞工作线程和WatchDBF
+        file->Checking = DBF_TRUE;
+        pthread_mutex_unlock(&monitor->Mutex);
+        DBFHead head;
+        struct stat st;
+        int snapped = ReadSnapshot(file->Path, &head, &st);
+        pthread_mutex_lock(&monitor->Mutex);
+        file->Checking = DBF_FALSE;
+        pthread_cond_broadcast(&monitor->IdleCond);
+        //正在替换、文件头还没写完，等下一个事件
+        if((DBF_SUCCESS != snapped) || file->Closing){
+            continue;
+        }
+        int event = ClassifyChange(file, &head, &st);
+        if(event > file->Event){
+            file->Event = event;
+        }
+        if((0 != file->Event) && (!file->Queued)){
+            monitor->Queue[(monitor->QueueHead + monitor->QueueCount) % monitor->MaxFiles] = i;
+            monitor->QueueCount ++;
+            file->Queued = DBF_TRUE;
+            pthread_cond_signal(&monitor->WorkCond);
+        }
+    }
+    pthread_mutex_unlock(&monitor->Mutex);
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : ClassifyChange
+* Description: 和上次的快照比较判断变化类型并更新快照，持有锁时调用
+----------------------------------------------------------------------------*/
+int ClassifyChange(MonitorFile *file, DBFHead *head, struct stat *st)
+{
+    int event = DBF_EVENT_UPDATE;
+    if((st->st_dev != file->Dev) || (st->st_ino != file->Ino)
+        || (head->DataOffset != file->Head.DataOffset) || (head->RecSize != file->Head.RecSize)
+        || (head->RecCount < file->Head.RecCount) || (st->st_size < file->Size)){
+        event = DBF_EVENT_REWRITE;
+    }
+    else if(head->RecCount > file->Head.RecCount){
+        event = DBF_EVENT_APPEND;
+    }
+    file->Head = *head;
+    file->Size = st->st_size;
+    file->Dev = st->st_dev;
+    file->Ino = st->st_ino;
+    return event;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : ReadSnapshot
+* Description: stat文件并读文件头
+----------------------------------------------------------------------------*/
+int ReadSnapshot(char *path, DBFHead *head, struct stat *st)
+{
+    int fd = open(path, O_RDONLY);
+    if(fd < 0){
+        return DBF_FAIL;
+    }
+    int ret = DBF_FAIL;
+    if((0 == fstat(fd, st)) && (st->st_size >= (off_t)sizeof(DBFHead))){
+        ret = ReadFull(fd, (char *)head, sizeof(DBFHead), 0);
+    }
+    close(fd);
+    return ret;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : RunCallback
+* Description: 追加、修改时Fresh句柄，重写时按原来的选项重新打开，然后回调
+----------------------------------------------------------------------------*/
+int RunCallback(MonitorFile *file, int event)
+{
+    CDBF *cDBF = file->DBF;
+    CDBF *reopened = NULL;
+    if(DBF_EVENT_REWRITE == event){
+        reopened = OpenDBFEx(cDBF->Path, cDBF->OpenFlags);
+    }
+    if(NULL != reopened){
+        CloseDBF(cDBF);
+        cDBF = reopened;
+        file->DBF = cDBF;
+    }
+    else{
+        Fresh(cDBF);
+    }
+    return file->Callback(cDBF, event, file->UserData);
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : RemoveFile
+* Description: 从Hash表中去掉文件，目录下没有其他监控的文件时去掉目录监控
+----------------------------------------------------------------------------*/
+void RemoveFile(DBFMonitor *monitor, MonitorFile *file)
+{
+    HashRemove(monitor->Keys, file->Key, file->KeyLen);
+    int shared = DBF_FALSE;
+    int i = 0;
+    for(i=0; i<monitor->MaxFiles; i++){
+        if(monitor->Files[i].Used && (&monitor->Files[i] != file) && (monitor->Files[i].Wd == file->Wd)){
+            shared = DBF_TRUE;
+            break;
+        }
+    }
+    if(!shared){
+        inotify_rm_watch(monitor->Inotify, file->Wd);
+    }
+    free(file->Key);
+    free(file->Path);
+    memset(file, '\0', sizeof(MonitorFile));
+}
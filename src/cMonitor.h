@@ -0,0 +1,50 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cMonitor.h
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-21
+ * Description  : 单线程监控大量DBF文件的变化，按文件回调
+     1.一个事件线程通过epoll等待inotify事件，监控的是文件所在的目录，
+       文件被原位修改、截断、rename替换都能收到事件，几百个文件通常只有几个目录监控
+     2.同一文件的一串事件在coalesceMs的窗口内合并为一次，窗口从第一个事件开始计
+     3.窗口结束时读文件头、stat文件判断变化类型：记录数增加是追加；文件被替换、变短、
+       记录数减少、表结构变化是重写；其他是原位修改
+     4.回调在固定个数的工作线程中执行，同一文件的回调不会并发，回调期间的新变化在回调返回后再派发
+     5.WatchDBF之后句柄归monitor所有：追加、修改时先Fresh再回调；重写时用原来的选项重新打开，
+       回调拿到新句柄并关闭旧句柄；UnwatchDBF取回当前句柄，CloseDBFMonitor关闭还在监控的句柄
+     6.流句柄、共享内存句柄不能监控；通过映射的文件头发布的记录数(多进程追加)不产生事件，
+       在同时写入的记录产生的事件中一起判断
+**********************************************************************************/
+#ifndef CMONITOR_H
+#define CMONITOR_H
+
+#include "cDBFStruct.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//变化类型，合并时取较大的
+#define DBF_EVENT_UPDATE 1      //原位修改：记录数、表结构不变
+#define DBF_EVENT_APPEND 2      //追加：表结构不变，记录数增加
+#define DBF_EVENT_REWRITE 3     //重写：文件被替换、变短、记录数减少或表结构变化
+
+//工作线程个数上限
+#define DBF_MONITOR_MAXWORKERS 64
+
+//文件变化的回调，在工作线程中执行，返回DBF_SUCCESS继续监控，否则不再回调该文件
+typedef int (*DBFMonitorCallback)(CDBF *cDBF, int event, void *userData);
+
+typedef struct TDBFMonitor DBFMonitor;
+
+DBFMonitor *CreateDBFMonitor(int maxFiles, int nWorkers, int coalesceMs);
+int WatchDBF(DBFMonitor *monitor, CDBF *cDBF, DBFMonitorCallback callback, void *userData);
+CDBF *UnwatchDBF(DBFMonitor *monitor, int id);
+void CloseDBFMonitor(DBFMonitor *monitor);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
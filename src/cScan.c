@@ -0,0 +1,194 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cScan.c
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-12
+ * Description  : 按记录块扫描DBF实现
+     1.直接pread文件描述符，多个线程可以同时读同一个文件，不共享文件位置
+     2.开始扫描前先fflush，保证stdio缓存中未写的记录对pread可见
+     3.以DBF_OPEN_OPTIMISTIC打开时，每块读完后用序号校验，读到写了一半的数据时重读该块
+     4.OpenDBFStream打开的流句柄交给ScanStream按顺序读，AttachSharedDBF的句柄交给ScanShared
+**********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "cDBF.h"
+#include "cScan.h"
+#include "cStats.h"
+#include "cSeqLock.h"
+#include "cStream.h"
+#include "cShm.h"
+#include "cDBFInner.h"
+
+//扫描的共享状态
+typedef struct TScanState
+{
+    CDBF *DBF;
+    int Fd;
+    int FirstRow;
+    int LastRow;
+    int BlockRecs;              //每块的记录数
+    int NextBlock;              //下一个待领取的块号，原子递增
+    int Stop;                   //回调失败或读失败时置1
+    DBFBlockCallback Callback;
+    void *UserData;
+}ScanState;
+
+//扫描线程的参数
+typedef struct TScanWorker
+{
+    ScanState *State;
+    int ThreadNo;
+}ScanWorker;
+
+void *ScanThread(void *arg);
+
+
+/*******************************************************************************
+* Function   : ScanBlocks
+* Description: 按块扫描[firstRow, lastRow]范围内的记录
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+    * firstRow, 起始行号，从1开始
+    * lastRow, 结束行号，包含
+    * nThreads, 扫描线程数，1表示在当前线程扫描
+    * callback, 块回调
+    * userData, 传给回调的数据
+* Output     :
+* Return     : 是否扫描成功, -1:读失败、回调返回失败或记录数超过INT_MAX; 1:扫描成功
+* Others     :
+    * 多线程时块的回调顺序不确定，单线程时按行号顺序回调
+    * 已删除的记录也会回调，由调用方根据记录第0个字节判断
+    * 行号按int传递，记录数超过INT_MAX时不截断，直接返回失败
+*******************************************************************************/
+int ScanBlocks(CDBF *cDBF, int firstRow, int lastRow, int nThreads, DBFBlockCallback callback, void *userData)
+{
+    int recCount = IntRecCount(cDBF);
+    if(recCount < 0){
+        return DBF_FAIL;
+    }
+    if(firstRow < 1){
+        firstRow = 1;
+    }
+    if(lastRow > recCount){
+        lastRow = recCount;
+    }
+    if(firstRow > lastRow){
+        return DBF_SUCCESS;
+    }
+    //流句柄不能定位，在当前线程按顺序读
+    if(NULL != cDBF->Stream){
+        return ScanStream(cDBF, firstRow, lastRow, callback, userData);
+    }
+    //共享内存句柄直接在映射的记录上回调
+    if(NULL != cDBF->Shm){
+        return ScanShared(cDBF, firstRow, lastRow, callback, userData);
+    }
+    if(nThreads < 1){
+        nThreads = 1;
+    }
+    if(nThreads > DBF_SCAN_MAXTHREADS){
+        nThreads = DBF_SCAN_MAXTHREADS;
+    }
+    fflush(cDBF->FHandle);
+    ScanState state;
+    memset(&state, '\0', sizeof(ScanState));
+    state.DBF = cDBF;
+    state.Fd = fileno(cDBF->FHandle);
+    state.FirstRow = firstRow;
+    state.LastRow = lastRow;
+    state.BlockRecs = DBF_SCAN_BLOCK / cDBF->Head->RecSize;
+    if(state.BlockRecs < 1){
+        state.BlockRecs = 1;
+    }
+    state.Callback = callback;
+    state.UserData = userData;
+    //块数比线程数少时少开线程
+    int blocks = (lastRow - firstRow) / state.BlockRecs + 1;
+    if(nThreads > blocks){
+        nThreads = blocks;
+    }
+
+    pthread_t threads[nThreads];
+    ScanWorker workers[nThreads];
+    int started = 0;
+    int i = 0;
+    for(i=0; i<nThreads; i++){
+        workers[i].State = &state;
+        workers[i].ThreadNo = i;
+    }
+    //第0个线程就是当前线程
+    for(i=1; i<nThreads; i++){
+        if(0 != pthread_create(&threads[i], NULL, ScanThread, &workers[i])){
+            break;
+        }
+        started ++;
+    }
+    ScanThread(&workers[0]);
+    for(i=1; i<=started; i++){
+        pthread_join(threads[i], NULL);
+    }
+    return state.Stop ? DBF_FAIL : DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : ScanThread
+* Description: 扫描线程，循环领取下一块、读入、回调，直到扫描完或停止
+----------------------------------------------------------------------------*/
+void *ScanThread(void *arg)
+{
+    ScanWorker *worker = (ScanWorker *)arg;
+    ScanState *state = worker->State;
+    CDBF *cDBF = state->DBF;
+    int recSize = cDBF->Head->RecSize;
+    char *buf = malloc((long)state->BlockRecs * recSize);
+    if(NULL == buf){
+        __atomic_store_n(&state->Stop, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    while(0 == __atomic_load_n(&state->Stop, __ATOMIC_RELAXED)){
+        int block = __atomic_fetch_add(&state->NextBlock, 1, __ATOMIC_RELAXED);
+        long first = state->FirstRow + (long)block * state->BlockRecs;
+        if(first > state->LastRow){
+            break;
+        }
+        int count = (state->LastRow - first + 1 > state->BlockRecs) ? state->BlockRecs : (int)(state->LastRow - first + 1);
+        long size = (long)count * recSize;
+        long long offset = cDBF->Head->DataOffset + (long long)(first - 1) * recSize;
+        //乐观读时整块读完后校验序号，读的过程中有写就重读这一块
+        int optimistic = (NULL != cDBF->Seq) && (0 == cDBF->WriteDepth);
+        int ret = DBF_FAIL;
+        while(DBF_TRUE){
+            unsigned int seq = 0;
+            if(optimistic && (DBF_SUCCESS != SeqReadBegin(cDBF, &seq))){
+                ret = DBF_FAIL;
+                break;
+            }
+            ret = ReadFull(state->Fd, buf, size, offset);
+            STATS_ADD(cDBF, siReadCalls, 1);
+            if(!optimistic || (DBF_TRUE != SeqReadRetry(cDBF, seq))){
+                break;
+            }
+            STATS_ADD(cDBF, siSeqRetries, 1);
+        }
+        if(DBF_SUCCESS != ret){
+            #ifdef DEBUG
+            printf("Debug ScanThread pread Error, offset = %lld\n", offset);
+            #endif
+            __atomic_store_n(&state->Stop, 1, __ATOMIC_RELAXED);
+            break;
+        }
+        STATS_ADD(cDBF, siBytesRead, size);
+        STATS_ADD(cDBF, siRecordsRead, count);
+        if(DBF_SUCCESS != state->Callback(buf, first, count, worker->ThreadNo, state->UserData)){
+            __atomic_store_n(&state->Stop, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    free(buf);
+    return NULL;
+}
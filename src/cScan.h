@@ -0,0 +1,36 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cScan.h
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-12
+ * Description  : 按记录块扫描DBF
+     1.每次pread读入一大块原始记录，回调处理整块，不经过Go和ValueBuf
+     2.多线程扫描时各线程按块号轮流领取下一块，回调可能在多个线程中同时执行
+     3.回调通过threadNo区分线程，各线程使用自己的局部状态，最后由调用方合并
+**********************************************************************************/
+#ifndef CSCAN_H
+#define CSCAN_H
+
+#include "cDBFStruct.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//扫描线程数上限
+#define DBF_SCAN_MAXTHREADS 64
+//每块的字节数，实际按整条记录取整
+#define DBF_SCAN_BLOCK (1024 * 1024)
+
+//块回调，records是count条连续的原始记录，第一条的行号是firstRow
+//返回DBF_FAIL时停止扫描
+typedef int (*DBFBlockCallback)(const char *records, int firstRow, int count, int threadNo, void *userData);
+
+int ScanBlocks(CDBF *cDBF, int firstRow, int lastRow, int nThreads, DBFBlockCallback callback, void *userData);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,178 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cSchema.c
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-08
+ * Description  : DBF表结构的共享实现
+     1.登记表使用cHash，键为DataOffset + RecSize + 列信息的原始字节
+     2.登记表是进程级的，通过互斥锁保护
+**********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "cSchema.h"
+#include "cHash.h"
+
+static HashTable *SchemaTable = NULL;
+static pthread_mutex_t SchemaMutex = PTHREAD_MUTEX_INITIALIZER;
+
+int BuildSchemaKey(DBFHead *head, DBFField *fields, int fieldCount, char *key);
+
+
+/*******************************************************************************
+* Function   : BuildFieldOffsets
+* Description: 计算各列在记录中的偏移，第0个字节是删除标记
+* Input      :
+    * fields, 列信息
+    * fieldCount, 列个数
+    * recSize, 记录长度
+* Output     :
+    * offsets, 各列的偏移
+* Return     : -1:各列宽度之和超过记录长度; 1:计算成功
+* Others     :
+*******************************************************************************/
+int BuildFieldOffsets(DBFField *fields, int fieldCount, int recSize, int *offsets)
+{
+    int i = 0;
+    int offset = 1;
+    for(i=0; i<fieldCount; i++){
+        offsets[i] = offset;
+        offset = offset + fields[i].Width;
+    }
+    if(offset > recSize){
+        return DBF_FAIL;
+    }
+    return DBF_SUCCESS;
+}
+
+
+/*******************************************************************************
+* Function   : AcquireSchema
+* Description: 获取结构相同的表结构，没有则新建
+* Input      :
+    * head, 文件头
+    * fields, 列信息
+    * fieldCount, 列个数
+* Output     :
+* Return     : 表结构指针, NULL表示失败
+* Others     : 使用完后调用ReleaseSchema释放
+*******************************************************************************/
+DBFSchema *AcquireSchema(DBFHead *head, DBFField *fields, int fieldCount)
+{
+    char key[sizeof(unsigned short) * 2 + sizeof(DBFField) * MAX_FIELD_COUNT];
+    int keyLen = BuildSchemaKey(head, fields, fieldCount, key);
+    DBFSchema *schema = NULL;
+    pthread_mutex_lock(&SchemaMutex);
+    if(NULL == SchemaTable){
+        SchemaTable = CreateHash(64);
+        if(NULL == SchemaTable){
+            pthread_mutex_unlock(&SchemaMutex);
+            return NULL;
+        }
+    }
+    void **slot = HashSlot(SchemaTable, key, keyLen);
+    if(NULL == slot){
+        pthread_mutex_unlock(&SchemaMutex);
+        return NULL;
+    }
+    if(NULL != *slot){
+        schema = *slot;
+        schema->RefCount ++;
+        pthread_mutex_unlock(&SchemaMutex);
+        return schema;
+    }
+    //表结构、列信息、列偏移一次申请
+    int size = sizeof(DBFSchema) + sizeof(DBFField) * fieldCount + sizeof(int) * fieldCount;
+    schema = malloc(size);
+    if(NULL == schema){
+        HashRemove(SchemaTable, key, keyLen);
+        pthread_mutex_unlock(&SchemaMutex);
+        return NULL;
+    }
+    schema->RefCount = 1;
+    schema->Size = size;
+    schema->FieldCount = fieldCount;
+    schema->DataOffset = head->DataOffset;
+    schema->RecSize = head->RecSize;
+    schema->Fields = (DBFField *)(schema + 1);
+    schema->FieldOffsets = (int *)(schema->Fields + fieldCount);
+    memcpy(schema->Fields, fields, sizeof(DBFField) * fieldCount);
+    if(DBF_SUCCESS != BuildFieldOffsets(schema->Fields, fieldCount, head->RecSize, schema->FieldOffsets)){
+        free(schema);
+        HashRemove(SchemaTable, key, keyLen);
+        pthread_mutex_unlock(&SchemaMutex);
+        return NULL;
+    }
+    *slot = schema;
+    pthread_mutex_unlock(&SchemaMutex);
+    return schema;
+}
+
+
+/*******************************************************************************
+* Function   : RetainSchema
+* Description: 增加对表结构的引用
+* Input      :
+    * schema, AcquireSchema返回的表结构指针
+* Output     :
+* Return     :
+* Others     : 已持有引用的一方才能调用
+*******************************************************************************/
+void RetainSchema(DBFSchema *schema)
+{
+    pthread_mutex_lock(&SchemaMutex);
+    schema->RefCount ++;
+    pthread_mutex_unlock(&SchemaMutex);
+}
+
+
+/*******************************************************************************
+* Function   : ReleaseSchema
+* Description: 释放对表结构的引用，没有句柄引用时从登记表删除并释放内存
+* Input      :
+    * schema, AcquireSchema返回的表结构指针
+* Output     :
+* Return     :
+* Others     :
+*******************************************************************************/
+void ReleaseSchema(DBFSchema *schema)
+{
+    if(NULL == schema){
+        return;
+    }
+    pthread_mutex_lock(&SchemaMutex);
+    schema->RefCount --;
+    if(0 == schema->RefCount){
+        char key[sizeof(unsigned short) * 2 + sizeof(DBFField) * MAX_FIELD_COUNT];
+        DBFHead head;
+        head.DataOffset = schema->DataOffset;
+        head.RecSize = schema->RecSize;
+        int keyLen = BuildSchemaKey(&head, schema->Fields, schema->FieldCount, key);
+        HashRemove(SchemaTable, key, keyLen);
+        free(schema);
+    }
+    pthread_mutex_unlock(&SchemaMutex);
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : BuildSchemaKey
+* Description: 生成表结构在登记表中的键
+* Input      :
+    * head, 文件头，只使用DataOffset、RecSize
+    * fields, 列信息
+    * fieldCount, 列个数
+* Output     :
+    * key, 键
+* Return     : 键的长度
+* Others     :
+----------------------------------------------------------------------------*/
+int BuildSchemaKey(DBFHead *head, DBFField *fields, int fieldCount, char *key)
+{
+    memcpy(key, &head->DataOffset, sizeof(unsigned short));
+    memcpy(key + sizeof(unsigned short), &head->RecSize, sizeof(unsigned short));
+    memcpy(key + sizeof(unsigned short) * 2, fields, sizeof(DBFField) * fieldCount);
+    return sizeof(unsigned short) * 2 + sizeof(DBFField) * fieldCount;
+}
@@ -0,0 +1,22 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cSchema.h
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-08
+ * Description  : DBF表结构的共享
+     1.进程内按文件头长度、记录长度、列信息登记表结构
+     2.结构相同的紧凑句柄共享同一个DBFSchema，引用计数为0时释放
+**********************************************************************************/
+#ifndef CSCHEMA_H
+#define CSCHEMA_H
+
+#include <stdio.h>
+#include "cDBFStruct.h"
+
+int BuildFieldOffsets(DBFField *fields, int fieldCount, int recSize, int *offsets);
+DBFSchema *AcquireSchema(DBFHead *head, DBFField *fields, int fieldCount);
+void RetainSchema(DBFSchema *schema);
+void ReleaseSchema(DBFSchema *schema);
+
+#endif
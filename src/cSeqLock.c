@@ -0,0 +1,225 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cSeqLock.c
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-14
+ * Description  : 乐观读实现
+     1.写方的记录在stdio缓存中，EndWriteBatch必须先fflush再把序号变为偶数
+     2.写方在一批写的过程中写文件头时，先把当前序号拷贝到Head，避免覆盖
+     3.OFD锁属于打开的文件，同一进程的多个句柄之间也互斥
+     4.写方退出时OFD锁随文件关闭释放，序号可能停在奇数，读方和下一个写方加锁后修复
+**********************************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "cDBF.h"
+#include "cSeqLock.h"
+#include "cStats.h"
+
+int LockSeq(CDBF *cDBF, int type);
+
+
+/*******************************************************************************
+* Function   : OpenHeadMap
+* Description: 把文件头所在页映射到内存，按打开选项开启乐观读
+* Input      :
+    * cDBF, 已打开文件的CDBF结构体指针
+* Output     :
+* Return     : 是否映射成功, -1:映射失败; 1:映射成功
+* Others     : OpenDBFEx以DBF_OPEN_OPTIMISTIC或DBF_OPEN_SHARED_APPEND打开时调用
+*******************************************************************************/
+int OpenHeadMap(CDBF *cDBF)
+{
+    long pageSize = sysconf(_SC_PAGESIZE);
+    void *map = mmap(NULL, pageSize, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(cDBF->FHandle), 0);
+    if(MAP_FAILED == map){
+        #ifdef DEBUG
+        printf("Debug OpenHeadMap mmap Error, path = %s\n", cDBF->Path);
+        #endif
+        return DBF_FAIL;
+    }
+    cDBF->HeadMap = (DBFHead *)map;
+    if(DBF_OPEN_OPTIMISTIC & cDBF->OpenFlags){
+        cDBF->Seq = (unsigned int *)((char *)map + DBF_SEQ_OFFSET);
+    }
+    return DBF_SUCCESS;
+}
+
+
+/*******************************************************************************
+* Function   : CloseHeadMap
+* Description: 结束未完成的一批写，解除文件头的映射
+* Input      :
+    * cDBF, CDBF结构体指针
+* Output     :
+* Return     :
+* Others     :
+*******************************************************************************/
+void CloseHeadMap(CDBF *cDBF)
+{
+    if(NULL == cDBF->HeadMap){
+        return;
+    }
+    if(cDBF->WriteDepth > 0){
+        cDBF->WriteDepth = 1;
+        EndWriteBatch(cDBF);
+    }
+    munmap(cDBF->HeadMap, sysconf(_SC_PAGESIZE));
+    cDBF->HeadMap = NULL;
+    cDBF->Seq = NULL;
+}
+
+
+/*******************************************************************************
+* Function   : BeginWriteBatch
+* Description: 开始一批写，乐观读的读方在EndWriteBatch之前会等待或重读
+* Input      :
+    * cDBF, OpenDBFEx返回的CDBF结构体指针
+* Output     :
+* Return     : 是否开始成功, -1:加锁失败; 1:开始成功
+* Others     :
+    * 可以嵌套，最外层的EndWriteBatch才结束这一批写
+    * Post、AppendRecords、Zap、FlushDBF不在批中时自动作为一批
+    * 没有以DBF_OPEN_OPTIMISTIC打开时直接返回成功
+*******************************************************************************/
+int BeginWriteBatch(CDBF *cDBF)
+{
+    if(NULL == cDBF->Seq){
+        return DBF_SUCCESS;
+    }
+    if(cDBF->WriteDepth > 0){
+        cDBF->WriteDepth ++;
+        return DBF_SUCCESS;
+    }
+    if(DBF_SUCCESS != LockSeq(cDBF, F_WRLCK)){
+        return DBF_FAIL;
+    }
+    //上一个写方中途退出时序号停在奇数，先修复为偶数
+    if(__atomic_load_n(cDBF->Seq, __ATOMIC_RELAXED) & 1){
+        __atomic_fetch_add(cDBF->Seq, 1, __ATOMIC_SEQ_CST);
+    }
+    __atomic_fetch_add(cDBF->Seq, 1, __ATOMIC_SEQ_CST);
+    cDBF->WriteDepth = 1;
+    return DBF_SUCCESS;
+}
+
+
+/*******************************************************************************
+* Function   : EndWriteBatch
+* Description: 结束一批写，写的数据对乐观读可见
+* Input      :
+    * cDBF, OpenDBFEx返回的CDBF结构体指针
+* Output     :
+* Return     : 是否结束成功, -1:写入失败; 1:结束成功
+* Others     : fflush失败时仍然结束这一批写，避免读方一直等待
+*******************************************************************************/
+int EndWriteBatch(CDBF *cDBF)
+{
+    if((NULL == cDBF->Seq) || (0 == cDBF->WriteDepth)){
+        return DBF_SUCCESS;
+    }
+    if(--cDBF->WriteDepth > 0){
+        return DBF_SUCCESS;
+    }
+    int ret = (0 == fflush(cDBF->FHandle)) ? DBF_SUCCESS : DBF_FAIL;
+    __atomic_fetch_add(cDBF->Seq, 1, __ATOMIC_RELEASE);
+    LockSeq(cDBF, F_UNLCK);
+    return ret;
+}
+
+
+/*******************************************************************************
+* Function   : SeqSyncHead
+* Description: 写文件头之前把当前序号拷贝到Head，避免写文件头时覆盖序号
+* Input      :
+    * cDBF, CDBF结构体指针
+* Output     :
+* Return     :
+* Others     :
+*******************************************************************************/
+void SeqSyncHead(CDBF *cDBF)
+{
+    if(NULL != cDBF->Seq){
+        unsigned int seq = __atomic_load_n(cDBF->Seq, __ATOMIC_RELAXED);
+        memcpy((char *)cDBF->Head + DBF_SEQ_OFFSET, &seq, sizeof(seq));
+    }
+}
+
+
+/*******************************************************************************
+* Function   : SeqRecover
+* Description: 序号长时间是奇数时检查写方是否还在，写方已退出时把序号修复为偶数
+* Input      :
+    * cDBF, 以DBF_OPEN_OPTIMISTIC打开的CDBF结构体指针
+* Output     :
+* Return     : -1:无法检查写锁; 1:写方还在，或序号已修复
+* Others     :
+    * F_OFD_GETLK检查没有冲突后，再用不等待的F_OFD_SETLK加锁修复，避免和新的写方竞争
+    * SeqReadBegin调用，读方自己不在一批写中
+*******************************************************************************/
+int SeqRecover(CDBF *cDBF)
+{
+    int fd = fileno(cDBF->FHandle);
+    struct flock lock;
+    memset(&lock, '\0', sizeof(lock));
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = DBF_SEQ_OFFSET;
+    lock.l_len = sizeof(unsigned int);
+    if(0 != fcntl(fd, F_OFD_GETLK, &lock)){
+        #ifdef DEBUG
+        printf("Debug SeqRecover F_OFD_GETLK Error, path = %s\n", cDBF->Path);
+        #endif
+        return DBF_FAIL;
+    }
+    if(F_UNLCK != lock.l_type){
+        return DBF_SUCCESS;
+    }
+    lock.l_type = F_WRLCK;
+    lock.l_start = DBF_SEQ_OFFSET;
+    lock.l_len = sizeof(unsigned int);
+    if(0 != fcntl(fd, F_OFD_SETLK, &lock)){
+        //新的写方刚加上锁，继续等待
+        return ((EAGAIN == errno) || (EACCES == errno)) ? DBF_SUCCESS : DBF_FAIL;
+    }
+    if(__atomic_load_n(cDBF->Seq, __ATOMIC_RELAXED) & 1){
+        #ifdef DEBUG
+        printf("Debug SeqRecover writer exited in a batch, path = %s\n", cDBF->Path);
+        #endif
+        __atomic_fetch_add(cDBF->Seq, 1, __ATOMIC_SEQ_CST);
+    }
+    LockSeq(cDBF, F_UNLCK);
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : LockSeq
+* Description: 对文件头序号字节加OFD写锁或解锁，写方之间互斥
+----------------------------------------------------------------------------*/
+int LockSeq(CDBF *cDBF, int type)
+{
+    STATS_BEGIN(start);
+    struct flock lock;
+    memset(&lock, '\0', sizeof(lock));
+    lock.l_type = type;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = DBF_SEQ_OFFSET;
+    lock.l_len = sizeof(unsigned int);
+    if(0 != fcntl(fileno(cDBF->FHandle), F_OFD_SETLKW, &lock)){
+        #ifdef DEBUG
+        printf("Debug LockSeq fcntl Error, type = %d\n", type);
+        #endif
+        return DBF_FAIL;
+    }
+    if(F_UNLCK != type){
+        STATS_ADD(cDBF, siLockCount, 1);
+        STATS_ADD(cDBF, siLockWaitNs, StatsNow() - start);
+    }
+    return DBF_SUCCESS;
+}
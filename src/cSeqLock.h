@@ -0,0 +1,68 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cSeqLock.h
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-14
+ * Description  : 乐观读，读记录时不加锁，通过序号检测读到写了一半的数据
+     1.序号保存在文件头保留字节中(文件偏移16)，打开时把文件头所在页mmap到内存，
+       多个进程看到的是同一个页缓存
+     2.写方开始一批写之前序号加1变为奇数，写完并fflush后再加1变为偶数
+     3.读方读之前取序号，是奇数说明正在写，稍后重试；读完后序号变了说明读的过程中有写，重读
+       长时间是奇数时用F_OFD_GETLK检查写锁，没有写方持有说明写方中途退出，把序号修复为偶数
+     4.多个写方之间用文件头序号字节上的OFD写锁互斥，读方完全不调用加锁的系统调用
+     5.所有写方都要以DBF_OPEN_OPTIMISTIC打开，否则普通句柄写文件头时会覆盖序号
+     6.文件头页的映射和DBF_OPEN_SHARED_APPEND共用，见cAppend.h
+**********************************************************************************/
+#ifndef CSEQLOCK_H
+#define CSEQLOCK_H
+
+#include <sched.h>
+#include "cDBFStruct.h"
+
+//序号在文件中的偏移，对应DBFHead.Reserved[4]
+#define DBF_SEQ_OFFSET 16
+//序号为奇数时自旋等待的次数，超过后让出CPU
+#define DBF_SEQ_SPIN 100
+//序号为奇数时让出CPU的次数，超过后检查写方是否还持有锁
+#define DBF_SEQ_PROBE 1000
+
+int OpenHeadMap(CDBF *cDBF);
+void CloseHeadMap(CDBF *cDBF);
+void SeqSyncHead(CDBF *cDBF);
+int SeqRecover(CDBF *cDBF);
+
+/*----------------------------------------------------------------------------
+* Function   : SeqReadBegin
+* Description: 开始一次乐观读，等到没有写方在写时取当前序号，无法检查写方时返回DBF_FAIL
+----------------------------------------------------------------------------*/
+static inline int SeqReadBegin(CDBF *cDBF, unsigned int *seq)
+{
+    int spin = 0;
+    int yields = 0;
+    *seq = __atomic_load_n(cDBF->Seq, __ATOMIC_ACQUIRE);
+    while(*seq & 1){
+        if(++spin > DBF_SEQ_SPIN){
+            spin = 0;
+            if((++yields > DBF_SEQ_PROBE) && (DBF_SUCCESS != SeqRecover(cDBF))){
+                return DBF_FAIL;
+            }
+            yields = (yields > DBF_SEQ_PROBE) ? 0 : yields;
+            sched_yield();
+        }
+        *seq = __atomic_load_n(cDBF->Seq, __ATOMIC_ACQUIRE);
+    }
+    return DBF_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------
+* Function   : SeqReadRetry
+* Description: 结束一次乐观读，读的过程中序号变了返回DBF_TRUE，需要重读
+----------------------------------------------------------------------------*/
+static inline int SeqReadRetry(CDBF *cDBF, unsigned int seq)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return (__atomic_load_n(cDBF->Seq, __ATOMIC_RELAXED) != seq) ? DBF_TRUE : DBF_FALSE;
+}
+
+#endif
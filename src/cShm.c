@@ -0,0 +1,536 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cShm.c
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-19
+ * Description  : 通过POSIX共享内存发布DBF实现
+     1.控制段: 标识、布局版本、当前版本号、当前槽；版本号为0表示还没有发布过
+     2.数据段: 64字节的段头(标识、版本号、映像长度)，后面是DBF文件的映像
+     3.发布方写完数据段后先在段头中写版本号，再切换当前槽，最后写控制段的版本号
+     4.读方按控制段的版本号映射当前槽，段头中的版本号不一致说明正在重新发布，重试
+     5.多个发布方之间用控制段上的flock互斥
+**********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cDBF.h"
+#include "cShm.h"
+#include "cSchema.h"
+#include "cStats.h"
+#include "cDBFInner.h"
+
+//控制段
+typedef struct TShmControl
+{
+    char Magic[4];              //"DBFS"
+    int Version;                //布局版本
+    unsigned int Gen;           //当前版本号，0表示还没有发布
+    int Active;                 //当前版本所在的槽，0或1
+}ShmControl;
+
+//数据段头，后面是DBF文件的映像
+typedef struct TShmImage
+{
+    char Magic[4];              //"DBFD"
+    unsigned int Gen;           //映像的版本号，写完映像后才写入
+    long long Size;             //映像的字节数
+    char Reserved[48];
+}ShmImage;
+
+//读方句柄的共享内存状态
+typedef struct TDBFShm
+{
+    char Name[DBF_SHM_NAMELEN + 1];     //控制段名
+    ShmControl *Control;        //只读映射的控制段
+    char *Map;                  //当前版本数据段的映射
+    long long MapSize;
+    unsigned int Gen;           //当前映射的版本号
+    const char *Records;        //第一条记录
+}DBFShm;
+
+#define SHM_LAYOUT_VERSION 1
+
+int ShmName(char *name, int slot, char *out);
+int MapImage(DBFShm *shm, char **map, long long *mapSize, unsigned int *gen);
+int LoadImage(CDBF *cDBF, char *map, long long mapSize, unsigned int gen);
+
+
+/*******************************************************************************
+* Function   : PublishSharedDBF
+* Description: 把cDBF的当前内容发布为共享内存name的一个新版本
+* Input      :
+    * name, 共享内存名，不需要以'/'开头
+    * cDBF, OpenDBF返回的CDBF结构体指针，必须是文件句柄
+* Output     :
+* Return     : 新版本号(>0); -1:发布失败
+* Others     :
+    * 先FlushDBF，发布的是磁盘上的文件头、列信息和前RecCount条记录
+    * 已经映射旧版本的读方Fresh后才看到新版本
+*******************************************************************************/
+int PublishSharedDBF(char *name, CDBF *cDBF)
+{
+    char ctrlName[DBF_SHM_NAMELEN + 8];
+    char dataName[DBF_SHM_NAMELEN + 8];
+    if((NULL == cDBF->FHandle) || (DBF_SUCCESS != ShmName(name, -1, ctrlName))){
+        return DBF_FAIL;
+    }
+    if(DBF_SUCCESS != FlushDBF(cDBF)){
+        return DBF_FAIL;
+    }
+    long long size = cDBF->Head->DataOffset + (long long)cDBF->Head->RecSize * cDBF->Head->RecCount;
+    //打开控制段，发布方之间互斥
+    int fd = shm_open(ctrlName, O_CREAT | O_RDWR, 0644);
+    if(fd < 0){
+        return DBF_FAIL;
+    }
+    struct stat st;
+    if((0 != flock(fd, LOCK_EX)) || (0 != fstat(fd, &st))
+        || ((st.st_size < sizeof(ShmControl)) && (0 != ftruncate(fd, sizeof(ShmControl))))){
+        close(fd);
+        return DBF_FAIL;
+    }
+    ShmControl *ctrl = mmap(NULL, sizeof(ShmControl), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(MAP_FAILED == ctrl){
+        close(fd);
+        return DBF_FAIL;
+    }
+    if(0 != memcmp(ctrl->Magic, "DBFS", 4)){
+        memcpy(ctrl->Magic, "DBFS", 4);
+        ctrl->Version = SHM_LAYOUT_VERSION;
+    }
+    //写当前槽以外的槽，版本号跳过0
+    int slot = (0 == ctrl->Gen) ? 0 : (1 - ctrl->Active);
+    unsigned int gen = ctrl->Gen + 1;
+    if(0 == gen){
+        gen = 1;
+    }
+    int ret = DBF_FAIL;
+    ShmName(name, slot, dataName);
+    //旧的数据段先删除，已经映射它的读方不受影响
+    shm_unlink(dataName);
+    int dfd = shm_open(dataName, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if(dfd >= 0){
+        char *map = MAP_FAILED;
+        if(0 == ftruncate(dfd, sizeof(ShmImage) + size)){
+            map = mmap(NULL, sizeof(ShmImage) + size, PROT_READ | PROT_WRITE, MAP_SHARED, dfd, 0);
+        }
+        if(MAP_FAILED != map){
+            ShmImage *img = (ShmImage *)map;
+            memcpy(img->Magic, "DBFD", 4);
+            img->Size = size;
+            if(DBF_SUCCESS == ReadFull(fileno(cDBF->FHandle), map + sizeof(ShmImage), size, 0)){
+                //以内存中的文件头为准，记录数和发布的记录一致
+                memcpy(map + sizeof(ShmImage), cDBF->Head, sizeof(DBFHead));
+                __atomic_store_n(&img->Gen, gen, __ATOMIC_RELEASE);
+                ret = DBF_SUCCESS;
+            }
+            munmap(map, sizeof(ShmImage) + size);
+        }
+        close(dfd);
+    }
+    if(DBF_SUCCESS == ret){
+        __atomic_store_n(&ctrl->Active, slot, __ATOMIC_RELEASE);
+        __atomic_store_n(&ctrl->Gen, gen, __ATOMIC_RELEASE);
+    }
+    else{
+        shm_unlink(dataName);
+    }
+    munmap(ctrl, sizeof(ShmControl));
+    flock(fd, LOCK_UN);
+    close(fd);
+    #ifdef DEBUG
+    printf("Debug PublishSharedDBF name = %s, gen = %u, slot = %d, ret = %d\n", ctrlName, gen, slot, ret);
+    #endif
+    return (DBF_SUCCESS == ret) ? (int)gen : DBF_FAIL;
+}
+
+
+/*******************************************************************************
+* Function   : UnpublishSharedDBF
+* Description: 删除共享内存name的控制段和数据段
+* Input      :
+    * name, 共享内存名
+* Output     :
+* Return     : 是否删除成功, -1:删除失败; 1:删除成功
+* Others     : 已经映射的读方可以继续读，新的读方无法再Attach
+*******************************************************************************/
+int UnpublishSharedDBF(char *name)
+{
+    char shmName[DBF_SHM_NAMELEN + 8];
+    if(DBF_SUCCESS != ShmName(name, -1, shmName)){
+        return DBF_FAIL;
+    }
+    int ret = (0 == shm_unlink(shmName)) ? DBF_SUCCESS : DBF_FAIL;
+    int slot = 0;
+    for(slot=0; slot<2; slot++){
+        ShmName(name, slot, shmName);
+        shm_unlink(shmName);
+    }
+    return ret;
+}
+
+
+/*******************************************************************************
+* Function   : AttachSharedDBF
+* Description: 只读映射共享内存name的当前版本
+* Input      :
+    * name, 共享内存名
+* Output     :
+* Return     : CDBF结构体指针，已定位到第一行; 返回NULL表示没有发布或映射失败
+* Others     :
+    * Go、Next、GetFieldAs*从共享内存拷贝记录，没有系统调用
+    * ScanBlocks直接在共享内存上回调，不拷贝
+    * Fresh切换到最新的版本
+*******************************************************************************/
+CDBF *AttachSharedDBF(char *name)
+{
+    CDBF *cDBF = malloc(sizeof(CDBF));
+    if(NULL == cDBF){
+        return NULL;
+    }
+    memset(cDBF, '\0', sizeof(CDBF));
+    cDBF->status = dsBrowse;
+    cDBF->OpenFlags = DBF_OPEN_SHM;
+    cDBF->deleted = ' ';
+    #ifndef DBF_NO_STATS
+    cDBF->Stats = CreateStats();
+    if(NULL == cDBF->Stats){
+        CloseDBF(cDBF);
+        return NULL;
+    }
+    #endif
+    cDBF->Path = malloc(strlen(name) + 1);
+    if(NULL == cDBF->Path){
+        CloseDBF(cDBF);
+        return NULL;
+    }
+    strcpy(cDBF->Path, name);
+    DBFShm *shm = malloc(sizeof(DBFShm));
+    if(NULL == shm){
+        CloseDBF(cDBF);
+        return NULL;
+    }
+    memset(shm, '\0', sizeof(DBFShm));
+    cDBF->Shm = shm;
+    if(DBF_SUCCESS != ShmName(name, -1, shm->Name)){
+        CloseDBF(cDBF);
+        return NULL;
+    }
+    //控制段一直映射着，检查新版本不需要系统调用
+    int fd = shm_open(shm->Name, O_RDONLY, 0);
+    if(fd < 0){
+        CloseDBF(cDBF);
+        return NULL;
+    }
+    struct stat st;
+    if((0 == fstat(fd, &st)) && (st.st_size >= sizeof(ShmControl))){
+        void *ctrl = mmap(NULL, sizeof(ShmControl), PROT_READ, MAP_SHARED, fd, 0);
+        shm->Control = (MAP_FAILED == ctrl) ? NULL : ctrl;
+    }
+    close(fd);
+    if(NULL == shm->Control){
+        CloseDBF(cDBF);
+        return NULL;
+    }
+    char *map = NULL;
+    long long mapSize = 0;
+    unsigned int gen = 0;
+    if(DBF_SUCCESS != MapImage(shm, &map, &mapSize, &gen)){
+        CloseDBF(cDBF);
+        return NULL;
+    }
+    if(DBF_SUCCESS != LoadImage(cDBF, map, mapSize, gen)){
+        munmap(map, mapSize);
+        CloseDBF(cDBF);
+        return NULL;
+    }
+    cDBF->RecNo = 0;
+    if((cDBF->Head->RecCount > 0) && (DBF_SUCCESS != Go(cDBF, 1))){
+        CloseDBF(cDBF);
+        return NULL;
+    }
+    return cDBF;
+}
+
+
+/*******************************************************************************
+* Function   : IsSharedDBFStale
+* Description: 检查是否发布了比读方当前映射更新的版本
+* Input      :
+    * cDBF, AttachSharedDBF返回的CDBF结构体指针
+* Output     :
+* Return     : DBF_TRUE:有新版本，Fresh后切换; DBF_FALSE:没有新版本或不是共享内存句柄
+* Others     : 只读控制段，不调用系统调用
+*******************************************************************************/
+int IsSharedDBFStale(CDBF *cDBF)
+{
+    DBFShm *shm = cDBF->Shm;
+    if(NULL == shm){
+        return DBF_FALSE;
+    }
+    return (__atomic_load_n(&shm->Control->Gen, __ATOMIC_ACQUIRE) != shm->Gen) ? DBF_TRUE : DBF_FALSE;
+}
+
+
+/*******************************************************************************
+* Function   : SharedGo
+* Description: 共享内存句柄的Go，从映射的记录拷贝到行缓存
+* Input      :
+    * cDBF, AttachSharedDBF返回的CDBF结构体指针
+    * rowNo, 行号，Go已检查范围
+* Output     :
+* Return     : 切换后的行号
+* Others     : Go对共享内存句柄调用本方法
+*******************************************************************************/
+int SharedGo(CDBF *cDBF, unsigned int rowNo)
+{
+    int recSize = cDBF->Head->RecSize;
+    memcpy(cDBF->ValueBuf, cDBF->Shm->Records + (long long)(rowNo - 1) * recSize, recSize);
+    cDBF->deleted = cDBF->ValueBuf[0];
+    memset(cDBF->Decoded, 0, sizeof(cDBF->Decoded));
+    cDBF->RecNo = rowNo;
+    STATS_ADD(cDBF, siRecordsRead, 1);
+    return cDBF->RecNo;
+}
+
+
+/*******************************************************************************
+* Function   : SharedFresh
+* Description: 有新版本时映射新版本，释放旧版本
+* Input      :
+    * cDBF, AttachSharedDBF返回的CDBF结构体指针
+* Output     :
+* Return     : 是否刷新成功, -1:映射新版本失败，仍使用旧版本; 1:刷新成功
+* Others     :
+    * Fresh对共享内存句柄调用本方法
+    * 当前行号在新版本的范围内时重读该行，否则定位到第一行
+*******************************************************************************/
+int SharedFresh(CDBF *cDBF)
+{
+    DBFShm *shm = cDBF->Shm;
+    if(DBF_TRUE != IsSharedDBFStale(cDBF)){
+        return DBF_SUCCESS;
+    }
+    STATS_BEGIN(start);
+    char *map = NULL;
+    long long mapSize = 0;
+    unsigned int gen = 0;
+    if(DBF_SUCCESS != MapImage(shm, &map, &mapSize, &gen)){
+        return DBF_FAIL;
+    }
+    if(DBF_SUCCESS != LoadImage(cDBF, map, mapSize, gen)){
+        munmap(map, mapSize);
+        return DBF_FAIL;
+    }
+    if((cDBF->RecNo < 1) || (cDBF->RecNo > cDBF->Head->RecCount)){
+        cDBF->RecNo = (cDBF->Head->RecCount > 0) ? 1 : 0;
+    }
+    if(cDBF->RecNo > 0){
+        SharedGo(cDBF, cDBF->RecNo);
+    }
+    STATS_END(cDBF, hiFresh, start);
+    return DBF_SUCCESS;
+}
+
+
+/*******************************************************************************
+* Function   : ScanShared
+* Description: 直接在映射的记录上按块回调[firstRow, lastRow]
+* Input      :
+    * cDBF, AttachSharedDBF返回的CDBF结构体指针
+    * firstRow, lastRow, 行号范围，ScanBlocks已检查
+    * callback, 块回调，threadNo总是0
+    * userData, 传给回调的数据
+* Output     :
+* Return     : 是否扫描成功, -1:回调返回失败; 1:扫描成功
+* Others     : ScanBlocks对共享内存句柄调用本方法，记录已在内存中，不再分线程
+*******************************************************************************/
+int ScanShared(CDBF *cDBF, int firstRow, int lastRow, DBFBlockCallback callback, void *userData)
+{
+    int recSize = cDBF->Head->RecSize;
+    int blockRecs = DBF_SCAN_BLOCK / recSize;
+    if(blockRecs < 1){
+        blockRecs = 1;
+    }
+    int first = firstRow;
+    while(first <= lastRow){
+        int count = (lastRow - first + 1 > blockRecs) ? blockRecs : (lastRow - first + 1);
+        if(DBF_SUCCESS != callback(cDBF->Shm->Records + (long long)(first - 1) * recSize, first, count, 0, userData)){
+            return DBF_FAIL;
+        }
+        first = first + count;
+    }
+    return DBF_SUCCESS;
+}
+
+
+/*******************************************************************************
+* Function   : CloseShared
+* Description: 解除共享内存的映射
+* Input      :
+    * cDBF, AttachSharedDBF返回的CDBF结构体指针
+* Output     :
+* Return     :
+* Others     : CloseDBF调用，不是共享内存句柄时什么都不做
+*******************************************************************************/
+void CloseShared(CDBF *cDBF)
+{
+    DBFShm *shm = cDBF->Shm;
+    if(NULL == shm){
+        return;
+    }
+    if(NULL != shm->Map){
+        munmap(shm->Map, shm->MapSize);
+    }
+    if(NULL != shm->Control){
+        munmap(shm->Control, sizeof(ShmControl));
+    }
+    free(shm);
+    cDBF->Shm = NULL;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : ShmName
+* Description: 共享内存名，slot为-1时是控制段"/<name>"，否则是数据段"/<name>.<slot>"
+----------------------------------------------------------------------------*/
+int ShmName(char *name, int slot, char *out)
+{
+    if('/' == name[0]){
+        name ++;
+    }
+    if((0 == name[0]) || (strlen(name) + 1 > DBF_SHM_NAMELEN) || (NULL != strchr(name, '/'))){
+        return DBF_FAIL;
+    }
+    if(slot < 0){
+        snprintf(out, DBF_SHM_NAMELEN + 1, "/%s", name);
+    }
+    else{
+        snprintf(out, DBF_SHM_NAMELEN + 8, "/%s.%d", name, slot);
+    }
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : MapImage
+* Description: 按控制段映射当前版本的数据段，和发布方冲突时重试
+----------------------------------------------------------------------------*/
+int MapImage(DBFShm *shm, char **map, long long *mapSize, unsigned int *gen)
+{
+    char dataName[DBF_SHM_NAMELEN + 8];
+    char *name = shm->Name + 1;
+    int retry = 0;
+    for(retry=0; retry<DBF_SHM_RETRIES; retry++){
+        unsigned int curGen = __atomic_load_n(&shm->Control->Gen, __ATOMIC_ACQUIRE);
+        int slot = __atomic_load_n(&shm->Control->Active, __ATOMIC_ACQUIRE);
+        if(0 == curGen){
+            return DBF_FAIL;
+        }
+        ShmName(name, slot, dataName);
+        int fd = shm_open(dataName, O_RDONLY, 0);
+        if(fd < 0){
+            sched_yield();
+            continue;
+        }
+        struct stat st;
+        char *data = MAP_FAILED;
+        if((0 == fstat(fd, &st)) && (st.st_size >= sizeof(ShmImage))){
+            data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if(MAP_FAILED == data){
+            sched_yield();
+            continue;
+        }
+        //段头的版本号和控制段一致才是写完的当前版本
+        ShmImage *img = (ShmImage *)data;
+        if((0 == memcmp(img->Magic, "DBFD", 4)) && (__atomic_load_n(&img->Gen, __ATOMIC_ACQUIRE) == curGen)
+            && (img->Size >= sizeof(DBFHead)) && (sizeof(ShmImage) + img->Size <= st.st_size)){
+            *map = data;
+            *mapSize = st.st_size;
+            *gen = curGen;
+            return DBF_SUCCESS;
+        }
+        munmap(data, st.st_size);
+        sched_yield();
+    }
+    #ifdef DEBUG
+    printf("Debug MapImage retry Error, name = %s\n", shm->Name);
+    #endif
+    return DBF_FAIL;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : LoadImage
+* Description: 按映像重建文件头、列信息、行缓存，成功后替换旧的映射
+----------------------------------------------------------------------------*/
+int LoadImage(CDBF *cDBF, char *map, long long mapSize, unsigned int gen)
+{
+    ShmImage *img = (ShmImage *)map;
+    const char *base = map + sizeof(ShmImage);
+    const DBFHead *head = (const DBFHead *)base;
+    int fieldCount = (head->DataOffset - (int)sizeof(DBFHead)) / (int)sizeof(DBFField);
+    if((fieldCount < MIN_FIELD_COUNT) || (fieldCount > MAX_FIELD_COUNT) || (head->RecSize < 1)
+        || (head->DataOffset + (long long)head->RecSize * head->RecCount > img->Size)){
+        return DBF_FAIL;
+    }
+    DBFHead *newHead = malloc(sizeof(DBFHead));
+    DBFField *fields = malloc(sizeof(DBFField) * fieldCount);
+    char *valueBuf = malloc(head->RecSize);
+    int *offsets = malloc(sizeof(int) * fieldCount);
+    DBFValue *values = malloc(sizeof(DBFValue) * fieldCount);
+    if((NULL == newHead) || (NULL == fields) || (NULL == valueBuf) || (NULL == offsets) || (NULL == values)){
+        free(newHead);
+        free(fields);
+        free(valueBuf);
+        free(offsets);
+        free(values);
+        return DBF_FAIL;
+    }
+    memcpy(newHead, head, sizeof(DBFHead));
+    memcpy(fields, base + sizeof(DBFHead), sizeof(DBFField) * fieldCount);
+    memset(valueBuf, '\0', head->RecSize);
+    if(DBF_SUCCESS != BuildFieldOffsets(fields, fieldCount, head->RecSize, offsets)){
+        free(newHead);
+        free(fields);
+        free(valueBuf);
+        free(offsets);
+        free(values);
+        return DBF_FAIL;
+    }
+    int i = 0;
+    for(i=0; i<fieldCount; i++){
+        values[i].Field = &fields[i];
+    }
+    //新版本的表结构可能不同，整体替换
+    free(cDBF->Head);
+    free(cDBF->Fields);
+    free(cDBF->ValueBuf);
+    free(cDBF->FieldOffsets);
+    free(cDBF->Values);
+    cDBF->Head = newHead;
+    cDBF->Fields = fields;
+    cDBF->ValueBuf = valueBuf;
+    cDBF->FieldOffsets = offsets;
+    cDBF->Values = values;
+    cDBF->FieldCount = fieldCount;
+    memset(cDBF->Decoded, 0, sizeof(cDBF->Decoded));
+    DBFShm *shm = cDBF->Shm;
+    if(NULL != shm->Map){
+        munmap(shm->Map, shm->MapSize);
+    }
+    shm->Map = map;
+    shm->MapSize = mapSize;
+    shm->Gen = gen;
+    shm->Records = base + newHead->DataOffset;
+    return DBF_SUCCESS;
+}
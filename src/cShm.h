@@ -0,0 +1,46 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cShm.h
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-19
+ * Description  : 通过POSIX共享内存发布DBF，一个进程加载，多个进程只读
+     1.发布方把整个DBF(文件头、列信息、记录)拷贝到共享内存"/<name>.0"或"/<name>.1"，
+       控制段"/<name>"中记录当前版本号和当前版本所在的槽
+     2.重新发布时写另一个槽，写完后才切换控制段中的版本号，读方不会看到加载了一半的表
+     3.重写一个槽之前先shm_unlink旧的共享内存，已经映射旧版本的读方不受影响
+     4.读方AttachSharedDBF映射当前版本，Go、Next、GetFieldAs*照常使用，读记录没有系统调用
+     5.读方Fresh时切换到最新的版本，IsSharedDBFStale不调用系统调用检查是否有新版本
+     6.读方句柄只读，Post、AppendRecords、Zap、GoMany、UpdateWhere等返回失败
+**********************************************************************************/
+#ifndef CSHM_H
+#define CSHM_H
+
+#include "cDBFStruct.h"
+#include "cScan.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//共享内存名的最大长度
+#define DBF_SHM_NAMELEN 240
+//读方映射当前版本时和发布方冲突的最大重试次数
+#define DBF_SHM_RETRIES 100
+
+int PublishSharedDBF(char *name, CDBF *cDBF);
+int UnpublishSharedDBF(char *name);
+CDBF *AttachSharedDBF(char *name);
+int IsSharedDBFStale(CDBF *cDBF);
+
+//以下供cDBF内部调用
+int SharedGo(CDBF *cDBF, unsigned int rowNo);
+int SharedFresh(CDBF *cDBF);
+int ScanShared(CDBF *cDBF, int firstRow, int lastRow, DBFBlockCallback callback, void *userData);
+void CloseShared(CDBF *cDBF);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,597 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cSort.c
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-11
+ * Description  : DBF外部归并排序实现
+     1.生成有序段：读入一块记录，按线程数切成几片，各线程用qsort_r排序记录指针，
+       再把几片归并写到临时文件，整个文件一块就能放下时直接归并写到目标文件
+     2.临时文件建在目标文件所在目录，创建后立即unlink，进程退出时自动回收
+     3.有序段比归并路数多时，多趟归并到另一个临时文件，两个临时文件轮流使用
+     4.最后一趟归并通过AppendRecords批量写目标文件，最后FlushDBF写一次文件头
+     5.比较键相同时按来源的先后顺序，保证排序稳定
+**********************************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "cDBF.h"
+#include "cField.h"
+#include "cSort.h"
+#include "cDBFInner.h"
+
+//归并时每一路读缓存的最小字节数
+#define SORT_MIN_IOBUF (64 * 1024)
+//归并路数上限
+#define SORT_MAX_FANIN 128
+//输出缓存的最大字节数
+#define SORT_MAX_OUTBUF (4 * 1024 * 1024)
+//每个线程至少排序的记录数，太少时不值得开线程
+#define SORT_MIN_SLICE 4096
+//每次ReadAt读取的最大字节数
+#define SORT_READ_CHUNK (16 * 1024 * 1024)
+
+//解析后的排序键
+typedef struct TSortKeyDef
+{
+    DBFField *Field;
+    int Offset;                 //列在记录中的偏移
+    int Descending;
+}SortKeyDef;
+
+//排序上下文
+typedef struct TSortContext
+{
+    int RecSize;
+    int KeyCount;
+    SortKeyDef Keys[DBF_SORT_MAXKEYS];
+}SortContext;
+
+//临时文件中的一个有序段
+typedef struct TSortRun
+{
+    long long Offset;           //在临时文件中的偏移
+    long long Count;            //记录数
+}SortRun;
+
+//归并的一路输入，内存中排好序的记录指针或临时文件中的有序段
+typedef struct TSortSource
+{
+    char **Ptrs;                //内存输入
+    long long PtrPos;
+    long long PtrEnd;
+    int Fd;                     //文件输入，-1表示内存输入
+    long long FileOff;
+    long long Remain;           //文件中还没有读入缓存的记录数
+    char *Buf;
+    int BufCap;                 //缓存能放的记录数
+    int BufCount;
+    int BufPos;
+    char *Cur;                  //当前记录，NULL表示已读完
+}SortSource;
+
+//归并的输出，临时文件或目标DBF
+typedef struct TSortSink
+{
+    CDBF *Dst;                  //非NULL时写目标DBF
+    int Fd;
+    long long Offset;
+    char *Buf;
+    int Cap;                    //缓存能放的记录数
+    int Count;
+}SortSink;
+
+//排序线程的参数
+typedef struct TSortSlice
+{
+    SortContext *Ctx;
+    char **Ptrs;
+    long long Count;
+}SortSlice;
+
+int ResolveKeys(CDBF *src, DBFSortKey *keys, int keyCount, SortContext *ctx);
+int CompareRecord(SortContext *ctx, const char *a, const char *b);
+int ComparePtr(const void *a, const void *b, void *arg);
+void *SortSliceThread(void *arg);
+int SortChunk(SortContext *ctx, char **ptrs, long long count, int nThreads, SortSlice *slices);
+int SourceNext(SortContext *ctx, SortSource *source);
+int MergeSources(SortContext *ctx, SortSource *sources, int n, SortSink *sink);
+void SiftDown(SortContext *ctx, SortSource *sources, int *heap, int size, int p);
+int SourceLess(SortContext *ctx, SortSource *sources, int x, int y);
+int SinkPut(SortSink *sink, int recSize, const char *rec);
+int SinkFlush(SortSink *sink, int recSize);
+
+
+/*******************************************************************************
+* Function   : SortDBF
+* Description: 按排序键对DBF排序，输出到新的DBF文件
+* Input      :
+    * src, OpenDBF返回的CDBF结构体指针
+    * dstPath, 输出的DBF文件目录，已存在时覆盖
+    * keys, 排序键，先按keys[0]排序，相同时再按keys[1]，以此类推
+    * keyCount, 排序键个数，不超过DBF_SORT_MAXKEYS
+    * memoryBudget, 排序可以使用的内存字节数
+    * nThreads, 生成有序段时的排序线程数，超过DBF_SORT_MAXTHREADS时按DBF_SORT_MAXTHREADS
+* Output     :
+* Return     : 是否排序成功, -1:排序失败或src是流式、共享内存句柄; 1:排序成功
+* Others     :
+    * 按位置读源文件，流式、共享内存句柄没有文件，不支持
+    * 已删除的记录也参与排序，删除标记原样输出
+    * 临时文件最多占用两倍源文件的记录大小
+*******************************************************************************/
+int SortDBF(CDBF *src, char *dstPath, DBFSortKey *keys, int keyCount, long memoryBudget, int nThreads)
+{
+    if((DBF_OPEN_STREAM | DBF_OPEN_SHM) & src->OpenFlags){
+        return DBF_FAIL;
+    }
+    SortContext ctx;
+    if(DBF_SUCCESS != ResolveKeys(src, keys, keyCount, &ctx)){
+        return DBF_FAIL;
+    }
+    if(nThreads < 1){
+        nThreads = 1;
+    }
+    //slices在栈上，按上限截断
+    if(nThreads > DBF_SORT_MAXTHREADS){
+        nThreads = DBF_SORT_MAXTHREADS;
+    }
+    int recSize = ctx.RecSize;
+    long long total = src->Head->RecCount;
+    //一块记录、记录指针、输出缓存都从memoryBudget中分配
+    long outBytes = memoryBudget / 8;
+    if(outBytes > SORT_MAX_OUTBUF){
+        outBytes = SORT_MAX_OUTBUF;
+    }
+    if(outBytes < recSize){
+        outBytes = recSize;
+    }
+    long long chunkRecs = (memoryBudget - outBytes) / (recSize + (long)sizeof(char *));
+    if(chunkRecs < 2){
+        chunkRecs = 2;
+    }
+    if(chunkRecs > total){
+        chunkRecs = (total > 0) ? total : 1;
+    }
+
+    if(DBF_SUCCESS != CreateDBFLike(src, dstPath)){
+        return DBF_FAIL;
+    }
+    CDBF *dst = OpenDBF(dstPath);
+    if(NULL == dst){
+        return DBF_FAIL;
+    }
+    int result = DBF_FAIL;
+    char *records = NULL;
+    char **ptrs = NULL;
+    char *outBuf = NULL;
+    char *mergeBuf = NULL;
+    SortSource *sources = NULL;
+    SortRun *runs = NULL;
+    SortRun *nextRuns = NULL;
+    int fds[2] = {-1, -1};
+    SortSlice slices[nThreads];
+    SortSink sink;
+    memset(&sink, '\0', sizeof(SortSink));
+
+    records = malloc(chunkRecs * recSize);
+    ptrs = malloc(sizeof(char *) * chunkRecs);
+    outBuf = malloc(outBytes);
+    sources = malloc(sizeof(SortSource) * ((nThreads > SORT_MAX_FANIN) ? nThreads : SORT_MAX_FANIN));
+    if((NULL == records) || (NULL == ptrs) || (NULL == outBuf) || (NULL == sources)){
+        goto Done;
+    }
+    sink.Buf = outBuf;
+    sink.Cap = outBytes / recSize;
+
+    //生成有序段
+    long long runCount = (total + chunkRecs - 1) / chunkRecs;
+    if(runCount > 1){
+        runs = malloc(sizeof(SortRun) * runCount);
+        nextRuns = malloc(sizeof(SortRun) * runCount);
+        fds[0] = CreateTempFile(dstPath);
+        fds[1] = CreateTempFile(dstPath);
+        if((NULL == runs) || (NULL == nextRuns) || (fds[0] < 0) || (fds[1] < 0)){
+            goto Done;
+        }
+    }
+    long long done = 0;
+    long long r = 0;
+    for(r=0; r<runCount; r++){
+        long long count = (total - done > chunkRecs) ? chunkRecs : (total - done);
+        long long bytes = count * recSize;
+        long long pos = 0;
+        while(pos < bytes){
+            int size = (bytes - pos > SORT_READ_CHUNK) ? SORT_READ_CHUNK : (int)(bytes - pos);
+            if(DBF_SUCCESS != ReadAt(src, src->Head->DataOffset + (done * recSize) + pos, records + pos, size)){
+                goto Done;
+            }
+            pos = pos + size;
+        }
+        long long i = 0;
+        for(i=0; i<count; i++){
+            ptrs[i] = records + (i * recSize);
+        }
+        int sliceCount = SortChunk(&ctx, ptrs, count, nThreads, slices);
+        if(sliceCount < 0){
+            goto Done;
+        }
+        int s = 0;
+        for(s=0; s<sliceCount; s++){
+            memset(&sources[s], '\0', sizeof(SortSource));
+            sources[s].Fd = -1;
+            sources[s].Ptrs = slices[s].Ptrs;
+            sources[s].PtrEnd = slices[s].Count;
+        }
+        if(1 == runCount){
+            sink.Dst = dst;
+        }
+        else{
+            sink.Fd = fds[0];
+            runs[r].Offset = sink.Offset;
+            runs[r].Count = count;
+        }
+        if(DBF_SUCCESS != MergeSources(&ctx, sources, sliceCount, &sink)){
+            goto Done;
+        }
+        done = done + count;
+    }
+    //记录块不再需要，归并的读缓存复用这块内存
+    free(ptrs);
+    ptrs = NULL;
+    mergeBuf = records;
+    records = NULL;
+    long long mergeBytes = chunkRecs * recSize;
+
+    //多趟归并，直到剩下的有序段能一次归并完
+    int fanIn = mergeBytes / SORT_MIN_IOBUF;
+    if(fanIn > SORT_MAX_FANIN){
+        fanIn = SORT_MAX_FANIN;
+    }
+    if(fanIn > mergeBytes / recSize){
+        fanIn = mergeBytes / recSize;
+    }
+    if(fanIn < 2){
+        fanIn = 2;
+    }
+    int in = 0;
+    while(runCount > 1){
+        int last = (runCount <= fanIn);
+        long long outRuns = 0;
+        long long first = 0;
+        if(last){
+            sink.Dst = dst;
+        }
+        else{
+            sink.Fd = fds[1 - in];
+            sink.Offset = 0;
+        }
+        for(first=0; first<runCount; first=first+fanIn){
+            int n = (runCount - first > fanIn) ? fanIn : (int)(runCount - first);
+            int bufCap = (mergeBytes / n) / recSize;
+            int k = 0;
+            long long count = 0;
+            for(k=0; k<n; k++){
+                memset(&sources[k], '\0', sizeof(SortSource));
+                sources[k].Fd = fds[in];
+                sources[k].FileOff = runs[first + k].Offset;
+                sources[k].Remain = runs[first + k].Count;
+                sources[k].Buf = mergeBuf + ((long long)k * bufCap * recSize);
+                sources[k].BufCap = bufCap;
+                count = count + runs[first + k].Count;
+            }
+            if(!last){
+                nextRuns[outRuns].Offset = sink.Offset;
+                nextRuns[outRuns].Count = count;
+            }
+            if(DBF_SUCCESS != MergeSources(&ctx, sources, n, &sink)){
+                goto Done;
+            }
+            outRuns ++;
+        }
+        if(last){
+            break;
+        }
+        //输入的临时文件已经读完，截断后下一趟作为输出
+        if(0 != ftruncate(fds[in], 0)){
+            goto Done;
+        }
+        SortRun *tmp = runs;
+        runs = nextRuns;
+        nextRuns = tmp;
+        runCount = outRuns;
+        in = 1 - in;
+    }
+    if(DBF_SUCCESS != FlushDBF(dst)){
+        goto Done;
+    }
+    result = DBF_SUCCESS;
+
+Done:
+    #ifdef DEBUG
+    if(DBF_SUCCESS != result){
+        printf("Debug SortDBF Error, dstPath = %s\n", dstPath);
+    }
+    #endif
+    if(fds[0] >= 0){
+        close(fds[0]);
+    }
+    if(fds[1] >= 0){
+        close(fds[1]);
+    }
+    free(records);
+    free(ptrs);
+    free(outBuf);
+    free(mergeBuf);
+    free(sources);
+    free(runs);
+    free(nextRuns);
+    CloseDBF(dst);
+    return result;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : ResolveKeys
+* Description: 按列名找到排序键的列信息和偏移
+----------------------------------------------------------------------------*/
+int ResolveKeys(CDBF *src, DBFSortKey *keys, int keyCount, SortContext *ctx)
+{
+    if((keyCount <= 0) || (keyCount > DBF_SORT_MAXKEYS)){
+        return DBF_FAIL;
+    }
+    memset(ctx, '\0', sizeof(SortContext));
+    ctx->RecSize = src->Head->RecSize;
+    ctx->KeyCount = keyCount;
+    int i = 0;
+    for(i=0; i<keyCount; i++){
+        int j = GetIndexByName(src, keys[i].FieldName);
+        if(j < 0){
+            #ifdef DEBUG
+            printf("Debug ResolveKeys FieldName Not Exists, FieldName = %s\n", keys[i].FieldName);
+            #endif
+            return DBF_FAIL;
+        }
+        ctx->Keys[i].Field = &src->Fields[j];
+        ctx->Keys[i].Offset = src->FieldOffsets[j];
+        ctx->Keys[i].Descending = keys[i].Descending;
+    }
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : CompareRecord
+* Description: 按排序键比较两条记录
+----------------------------------------------------------------------------*/
+int CompareRecord(SortContext *ctx, const char *a, const char *b)
+{
+    int i = 0;
+    for(i=0; i<ctx->KeyCount; i++){
+        SortKeyDef *key = &ctx->Keys[i];
+        int c = CompareFieldBytes(key->Field, a + key->Offset, b + key->Offset);
+        if(0 != c){
+            return key->Descending ? -c : c;
+        }
+    }
+    return 0;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : ComparePtr
+* Description: qsort_r的比较函数，键相同时按记录在块中的位置，保证稳定
+----------------------------------------------------------------------------*/
+int ComparePtr(const void *a, const void *b, void *arg)
+{
+    const char *x = *(const char **)a;
+    const char *y = *(const char **)b;
+    int c = CompareRecord((SortContext *)arg, x, y);
+    if(0 != c){
+        return c;
+    }
+    return (x < y) ? -1 : ((x > y) ? 1 : 0);
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : SortSliceThread
+* Description: 排序线程，排序一片记录指针
+----------------------------------------------------------------------------*/
+void *SortSliceThread(void *arg)
+{
+    SortSlice *slice = (SortSlice *)arg;
+    qsort_r(slice->Ptrs, slice->Count, sizeof(char *), ComparePtr, slice->Ctx);
+    return NULL;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : SortChunk
+* Description: 把一块记录指针切成几片，多线程分别排序，返回片数，-1表示失败
+----------------------------------------------------------------------------*/
+int SortChunk(SortContext *ctx, char **ptrs, long long count, int nThreads, SortSlice *slices)
+{
+    int n = nThreads;
+    if(count / SORT_MIN_SLICE < n){
+        n = count / SORT_MIN_SLICE;
+    }
+    if(n < 1){
+        n = 1;
+    }
+    pthread_t threads[n];
+    long long start = 0;
+    int i = 0;
+    for(i=0; i<n; i++){
+        long long end = count * (i + 1) / n;
+        slices[i].Ctx = ctx;
+        slices[i].Ptrs = ptrs + start;
+        slices[i].Count = end - start;
+        start = end;
+    }
+    //第0片在当前线程排序
+    int started = 0;
+    for(i=1; i<n; i++){
+        if(0 != pthread_create(&threads[i], NULL, SortSliceThread, &slices[i])){
+            break;
+        }
+        started ++;
+    }
+    SortSliceThread(&slices[0]);
+    //线程创建失败的片也在当前线程排序
+    for(i=started+1; i<n; i++){
+        SortSliceThread(&slices[i]);
+    }
+    for(i=1; i<=started; i++){
+        pthread_join(threads[i], NULL);
+    }
+    return n;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : SourceNext
+* Description: 取一路输入的下一条记录到Cur，文件输入的缓存读完时再大块读入
+----------------------------------------------------------------------------*/
+int SourceNext(SortContext *ctx, SortSource *source)
+{
+    if(source->Fd < 0){
+        source->Cur = (source->PtrPos < source->PtrEnd) ? source->Ptrs[source->PtrPos++] : NULL;
+        return DBF_SUCCESS;
+    }
+    if(source->BufPos >= source->BufCount){
+        if(0 == source->Remain){
+            source->Cur = NULL;
+            return DBF_SUCCESS;
+        }
+        int count = (source->Remain > source->BufCap) ? source->BufCap : (int)source->Remain;
+        long long bytes = (long long)count * ctx->RecSize;
+        if(DBF_SUCCESS != ReadFull(source->Fd, source->Buf, bytes, source->FileOff)){
+            return DBF_FAIL;
+        }
+        source->FileOff = source->FileOff + bytes;
+        source->Remain = source->Remain - count;
+        source->BufCount = count;
+        source->BufPos = 0;
+    }
+    source->Cur = source->Buf + ((long long)source->BufPos * ctx->RecSize);
+    source->BufPos ++;
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : MergeSources
+* Description: 用小顶堆多路归并，结果写到sink
+----------------------------------------------------------------------------*/
+int MergeSources(SortContext *ctx, SortSource *sources, int n, SortSink *sink)
+{
+    int heap[n];
+    int size = 0;
+    int i = 0;
+    for(i=0; i<n; i++){
+        if(DBF_SUCCESS != SourceNext(ctx, &sources[i])){
+            return DBF_FAIL;
+        }
+        if(NULL != sources[i].Cur){
+            heap[size++] = i;
+        }
+    }
+    //建堆
+    int k = 0;
+    for(k=size/2-1; k>=0; k--){
+        SiftDown(ctx, sources, heap, size, k);
+    }
+    while(size > 0){
+        SortSource *top = &sources[heap[0]];
+        if(DBF_SUCCESS != SinkPut(sink, ctx->RecSize, top->Cur)){
+            return DBF_FAIL;
+        }
+        if(DBF_SUCCESS != SourceNext(ctx, top)){
+            return DBF_FAIL;
+        }
+        if(NULL == top->Cur){
+            heap[0] = heap[--size];
+        }
+        SiftDown(ctx, sources, heap, size, 0);
+    }
+    return SinkFlush(sink, ctx->RecSize);
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : SiftDown
+* Description: 堆顶下沉，键相同时序号小的输入在前
+----------------------------------------------------------------------------*/
+void SiftDown(SortContext *ctx, SortSource *sources, int *heap, int size, int p)
+{
+    while(2 * p + 1 < size){
+        int c = 2 * p + 1;
+        if((c + 1 < size) && (SourceLess(ctx, sources, heap[c + 1], heap[c]))){
+            c ++;
+        }
+        if(!SourceLess(ctx, sources, heap[c], heap[p])){
+            break;
+        }
+        int t = heap[c];
+        heap[c] = heap[p];
+        heap[p] = t;
+        p = c;
+    }
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : SourceLess
+* Description: 比较两路输入的当前记录
+----------------------------------------------------------------------------*/
+int SourceLess(SortContext *ctx, SortSource *sources, int x, int y)
+{
+    int c = CompareRecord(ctx, sources[x].Cur, sources[y].Cur);
+    return (c < 0) || ((0 == c) && (x < y));
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : SinkPut
+* Description: 一条记录放入输出缓存，缓存满时写出
+----------------------------------------------------------------------------*/
+int SinkPut(SortSink *sink, int recSize, const char *rec)
+{
+    if(sink->Count >= sink->Cap){
+        if(DBF_SUCCESS != SinkFlush(sink, recSize)){
+            return DBF_FAIL;
+        }
+    }
+    memcpy(sink->Buf + ((long long)sink->Count * recSize), rec, recSize);
+    sink->Count ++;
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : SinkFlush
+* Description: 输出缓存写到临时文件或通过AppendRecords写到目标DBF
+----------------------------------------------------------------------------*/
+int SinkFlush(SortSink *sink, int recSize)
+{
+    if(0 == sink->Count){
+        return DBF_SUCCESS;
+    }
+    long long bytes = (long long)sink->Count * recSize;
+    if(NULL != sink->Dst){
+        if(DBF_SUCCESS != AppendRecords(sink->Dst, sink->Buf, sink->Count)){
+            return DBF_FAIL;
+        }
+    }
+    else{
+        if(DBF_SUCCESS != WriteFull(sink->Fd, sink->Buf, bytes, sink->Offset)){
+            return DBF_FAIL;
+        }
+    }
+    sink->Offset = sink->Offset + bytes;
+    sink->Count = 0;
+    return DBF_SUCCESS;
+}
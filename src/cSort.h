@@ -0,0 +1,40 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cSort.h
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-11
+ * Description  : DBF外部归并排序
+     1.按一个或多个列排序，直接比较记录的原始字节，N、F列按数值比较
+     2.在memoryBudget内分块读入、多线程排序生成有序段，超出内存的部分写临时文件
+     3.多路归并输出到新的DBF，大块顺序读写，文件头只写一次
+     4.排序是稳定的，键相同的记录保持原来的先后顺序
+**********************************************************************************/
+#ifndef CSORT_H
+#define CSORT_H
+
+#include "cDBFStruct.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//排序键个数上限
+#define DBF_SORT_MAXKEYS 16
+//排序线程数上限
+#define DBF_SORT_MAXTHREADS 64
+
+//排序键
+typedef struct TDBFSortKey
+{
+    char *FieldName;            //列名
+    int Descending;             //0:升序; 1:降序
+}DBFSortKey;
+
+int SortDBF(CDBF *src, char *dstPath, DBFSortKey *keys, int keyCount, long memoryBudget, int nThreads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
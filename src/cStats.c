@@ -0,0 +1,136 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cStats.c
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-06
+ * Description  : DBF句柄的统计计数实现
+     1.计数时只写当前线程的计数槽，读取时把所有槽汇总
+     2.汇总时各计数独立读取，不保证多个计数之间是同一时刻的快照
+**********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cDBF.h"
+#include "cStats.h"
+
+__thread int StatsThreadSlot = -1;
+static int StatsSlotSeq = 0;
+
+
+/*----------------------------------------------------------------------------
+* Function   : CreateStats
+* Description: 申请统计块，OpenDBF时调用
+* Return     : 统计块指针, NULL表示申请失败
+----------------------------------------------------------------------------*/
+DBFStatsBlock *CreateStats(void)
+{
+    DBFStatsBlock *block = NULL;
+    if(0 != posix_memalign((void **)&block, 64, sizeof(DBFStatsBlock))){
+        return NULL;
+    }
+    memset(block, 0, sizeof(DBFStatsBlock));
+    return block;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : FreeStats
+* Description: 释放统计块，CloseDBF时调用
+----------------------------------------------------------------------------*/
+void FreeStats(DBFStatsBlock *block)
+{
+    if(NULL != block){
+        free(block);
+    }
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : StatsNextSlot
+* Description: 为新线程分配计数槽，线程轮流使用各个槽
+----------------------------------------------------------------------------*/
+int StatsNextSlot(void)
+{
+    return __atomic_fetch_add(&StatsSlotSeq, 1, __ATOMIC_RELAXED) & (DBF_STATS_SLOTS - 1);
+}
+
+
+/*******************************************************************************
+* Function   : GetDBFStats
+* Description: 获取DBF句柄的统计信息
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+* Output     :
+    * stats, 汇总后的统计信息
+* Return     : -1:获取失败(句柄未开启统计); 1:获取成功
+* Others     :
+*******************************************************************************/
+int GetDBFStats(CDBF *cDBF, DBFStats *stats)
+{
+    if((NULL == cDBF) || (NULL == cDBF->Stats) || (NULL == stats)){
+        return DBF_FAIL;
+    }
+    unsigned long long counters[siCount];
+    memset(counters, 0, sizeof(counters));
+    memset(stats, 0, sizeof(DBFStats));
+    int i = 0;
+    int j = 0;
+    int k = 0;
+    for(i=0; i<DBF_STATS_SLOTS; i++){
+        DBFStatsSlot *slot = &cDBF->Stats->Slots[i];
+        for(j=0; j<siCount; j++){
+            counters[j] += __atomic_load_n(&slot->Counters[j], __ATOMIC_RELAXED);
+        }
+        for(k=0; k<DBF_HIST_BUCKETS; k++){
+            stats->GoHist[k] += __atomic_load_n(&slot->Hist[hiGo][k], __ATOMIC_RELAXED);
+            stats->PostHist[k] += __atomic_load_n(&slot->Hist[hiPost][k], __ATOMIC_RELAXED);
+            stats->FreshHist[k] += __atomic_load_n(&slot->Hist[hiFresh][k], __ATOMIC_RELAXED);
+        }
+    }
+    stats->RecordsRead = counters[siRecordsRead];
+    stats->RecordsWritten = counters[siRecordsWritten];
+    stats->BytesRead = counters[siBytesRead];
+    stats->BytesWritten = counters[siBytesWritten];
+    stats->Seeks = counters[siSeeks];
+    stats->ReadCalls = counters[siReadCalls];
+    stats->WriteCalls = counters[siWriteCalls];
+    stats->HeadWrites = counters[siHeadWrites];
+    stats->LockCount = counters[siLockCount];
+    stats->LockWaitNs = counters[siLockWaitNs];
+    stats->SeqRetries = counters[siSeqRetries];
+    stats->ZoneSkips = counters[siZoneSkips];
+    return DBF_SUCCESS;
+}
+
+
+/*******************************************************************************
+* Function   : ResetDBFStats
+* Description: 清空DBF句柄的统计信息
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+* Output     :
+* Return     : -1:清空失败(句柄未开启统计); 1:清空成功
+* Others     : 与其他线程的计数并发时，清空期间的计数可能丢失
+*******************************************************************************/
+int ResetDBFStats(CDBF *cDBF)
+{
+    if((NULL == cDBF) || (NULL == cDBF->Stats)){
+        return DBF_FAIL;
+    }
+    int i = 0;
+    int j = 0;
+    int k = 0;
+    for(i=0; i<DBF_STATS_SLOTS; i++){
+        DBFStatsSlot *slot = &cDBF->Stats->Slots[i];
+        for(j=0; j<siCount; j++){
+            __atomic_store_n(&slot->Counters[j], 0, __ATOMIC_RELAXED);
+        }
+        for(j=0; j<hiCount; j++){
+            for(k=0; k<DBF_HIST_BUCKETS; k++){
+                __atomic_store_n(&slot->Hist[j][k], 0, __ATOMIC_RELAXED);
+            }
+        }
+    }
+    return DBF_SUCCESS;
+}
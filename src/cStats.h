@@ -0,0 +1,123 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cStats.h
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-06
+ * Description  : DBF句柄的统计计数
+     1.统计读写记录数、字节数、定位次数、读写调用次数、重写文件头次数、锁信息、乐观读重读次数
+     2.统计Go、Post、Fresh的耗时直方图，按2的幂分桶
+     3.每个句柄有DBF_STATS_SLOTS个计数槽，线程按槽分散计数，GetDBFStats时汇总
+     4.每个槽按缓存行对齐，避免多线程计数时的伪共享
+     5.编译时定义DBF_NO_STATS可以完全去掉统计代码
+**********************************************************************************/
+#ifndef CSTATS_H
+#define CSTATS_H
+
+#include <time.h>
+#include "cDBFStruct.h"
+
+//每个句柄的计数槽个数，必须是2的幂
+#define DBF_STATS_SLOTS 4
+
+//计数项，和DBFStats中的计数字段一一对应
+typedef enum TDBFStatItem
+{
+    siRecordsRead,
+    siRecordsWritten,
+    siBytesRead,
+    siBytesWritten,
+    siSeeks,
+    siReadCalls,
+    siWriteCalls,
+    siHeadWrites,
+    siLockCount,
+    siLockWaitNs,
+    siSeqRetries,
+    siZoneSkips,
+    siCount
+}DBFStatItem;
+
+//耗时直方图项
+typedef enum TDBFHistItem
+{
+    hiGo,
+    hiPost,
+    hiFresh,
+    hiCount
+}DBFHistItem;
+
+//计数槽，按缓存行对齐
+typedef struct TDBFStatsSlot
+{
+    unsigned long long Counters[siCount];
+    unsigned long long Hist[hiCount][DBF_HIST_BUCKETS];
+}__attribute__((aligned(64))) DBFStatsSlot;
+
+//句柄的统计块
+typedef struct TDBFStatsBlock
+{
+    DBFStatsSlot Slots[DBF_STATS_SLOTS];
+}DBFStatsBlock;
+
+//当前线程使用的计数槽序号，首次计数时分配
+extern __thread int StatsThreadSlot;
+
+struct TDBFStatsBlock *CreateStats(void);
+void FreeStats(struct TDBFStatsBlock *block);
+int StatsNextSlot(void);
+
+/*----------------------------------------------------------------------------
+* Function   : StatsNow
+* Description: 获取单调时钟的当前时间(纳秒)，用于计算耗时
+----------------------------------------------------------------------------*/
+static inline unsigned long long StatsNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*----------------------------------------------------------------------------
+* Function   : StatsAdd
+* Description: 在当前线程的计数槽上累加计数，槽内用relaxed原子操作，不会有锁
+----------------------------------------------------------------------------*/
+static inline void StatsAdd(DBFStatsBlock *block, DBFStatItem item, unsigned long long value)
+{
+    if(StatsThreadSlot < 0){
+        StatsThreadSlot = StatsNextSlot();
+    }
+    __atomic_fetch_add(&block->Slots[StatsThreadSlot].Counters[item], value, __ATOMIC_RELAXED);
+}
+
+/*----------------------------------------------------------------------------
+* Function   : StatsHist
+* Description: 将一次耗时计入直方图，桶序号为耗时的以2为底的对数
+----------------------------------------------------------------------------*/
+static inline void StatsHist(DBFStatsBlock *block, DBFHistItem item, unsigned long long ns)
+{
+    int bucket = 63 - __builtin_clzll(ns | 1);
+    if(bucket >= DBF_HIST_BUCKETS){
+        bucket = DBF_HIST_BUCKETS - 1;
+    }
+    if(StatsThreadSlot < 0){
+        StatsThreadSlot = StatsNextSlot();
+    }
+    __atomic_fetch_add(&block->Slots[StatsThreadSlot].Hist[item][bucket], 1, __ATOMIC_RELAXED);
+}
+
+//cDBF内部使用的统计宏，定义DBF_NO_STATS时展开为空
+#ifndef DBF_NO_STATS
+#define STATS_ADD(cDBF, item, value) \
+    do{ if(NULL != (cDBF)->Stats){ StatsAdd((cDBF)->Stats, (item), (value)); } }while(0)
+#define STATS_BEGIN(start) \
+    unsigned long long start = StatsNow()
+#define STATS_END(cDBF, item, start) \
+    do{ if(NULL != (cDBF)->Stats){ StatsHist((cDBF)->Stats, (item), StatsNow() - (start)); } }while(0)
+#else
+#define STATS_ADD(cDBF, item, value) do{}while(0)
+#define STATS_BEGIN(start) do{}while(0)
+#define STATS_END(cDBF, item, start) do{}while(0)
+#endif
+
+#endif
@@ -0,0 +1,527 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cStream.c
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-18
+ * Description  : 从不能定位的输入流读DBF实现
+     1.预读线程依次把DBF_STREAM_BUFS块缓存读满，读方用完一块后交还给预读线程
+     2.读方持有的块在下一次取块之前有效，NextStreamBatch返回的记录不需要拷贝
+     3.读够文件头中的记录数后不再读，后面的文件结束标记等数据不读
+     4.流提前结束时只交付完整的记录，最后不完整的一条丢弃
+     5.预读线程平时不响应取消，只在read期间响应，关闭时可以打断阻塞在管道上的read
+     6.文件描述符由调用方打开和关闭
+**********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include "cDBF.h"
+#include "cStream.h"
+#include "cSchema.h"
+#include "cStats.h"
+#include "cDBFInner.h"
+
+//流的读状态，Bufs之后的字段由Mutex保护
+typedef struct TDBFStream
+{
+    int Fd;
+    int RecSize;
+    int BatchRecs;              //每块的记录数
+    int Remaining;              //文件头中的记录数还没有读的条数，只由预读线程修改
+    char *Bufs[DBF_STREAM_BUFS];
+    int Counts[DBF_STREAM_BUFS];    //各块读到的记录数
+    int ReadIdx;                //读方下一个要取的块
+    int Filled;                 //已读满还没交还的块数，包括读方持有的块
+    int Eof;                    //预读线程已读到结尾
+    int Error;                  //预读线程读失败
+    int Stop;                   //关闭时置1
+    int Current;                //读方持有的块，-1表示没有
+    int Pos;                    //读方持有的块中下一条记录的序号
+    int CurFirstRow;            //读方持有的块中第一条记录的行号
+    int NextRow;                //读方下一次取到的块中第一条记录的行号
+    int ThreadStarted;
+    pthread_t Thread;
+    pthread_mutex_t Mutex;
+    pthread_cond_t Cond;
+}DBFStream;
+
+long long ReadStream(int fd, void *buf, long long size);
+int SkipStream(int fd, int size);
+int StartStream(CDBF *cDBF, int fd);
+void *StreamThread(void *arg);
+int AcquireBatch(DBFStream *stream);
+int TakeRecords(CDBF *cDBF, int maxCount, const char **records, int *firstRow);
+
+
+/*******************************************************************************
+* Function   : OpenDBFStream
+* Description: 从文件描述符以只读、只能向前的方式打开DBF
+* Input      :
+    * fd, 已打开的文件描述符，管道、标准输入、普通文件都可以
+    * flags, 打开选项，只支持DBF_OPEN_GBK，其他选项忽略
+* Output     :
+* Return     : CDBF结构体指针; 返回NULL表示读文件头失败或文件头不正确
+* Others     :
+    * 打开后还没有读记录，先调用First或Next切换到第一行
+    * Post、AppendRecords、Zap、Fresh、UpdateWhere、DeleteWhere等返回失败
+    * ScanBlocks只能从还没有读过的行开始扫描，在当前线程按顺序回调
+    * CloseDBF不关闭fd
+*******************************************************************************/
+CDBF *OpenDBFStream(int fd, int flags)
+{
+    if(fd < 0){
+        return NULL;
+    }
+    CDBF *cDBF = malloc(sizeof(CDBF));
+    if(NULL == cDBF){
+        return NULL;
+    }
+    memset(cDBF, '\0', sizeof(CDBF));
+    cDBF->status = dsBrowse;
+    cDBF->OpenFlags = (flags & DBF_OPEN_GBK) | DBF_OPEN_STREAM;
+    #ifndef DBF_NO_STATS
+    cDBF->Stats = CreateStats();
+    if(NULL == cDBF->Stats){
+        CloseDBF(cDBF);
+        return NULL;
+    }
+    #endif
+    //没有文件路径，用文件描述符标识
+    cDBF->Path = malloc(32);
+    if(NULL == cDBF->Path){
+        CloseDBF(cDBF);
+        return NULL;
+    }
+    snprintf(cDBF->Path, 32, "<fd %d>", fd);
+    //读文件头
+    cDBF->Head = malloc(sizeof(DBFHead));
+    if(NULL == cDBF->Head){
+        CloseDBF(cDBF);
+        return NULL;
+    }
+    if(sizeof(DBFHead) != ReadStream(fd, cDBF->Head, sizeof(DBFHead))){
+        #ifdef DEBUG
+        printf("Debug OpenDBFStream ReadHead Error, fd = %d\n", fd);
+        #endif
+        CloseDBF(cDBF);
+        return NULL;
+    }
+    STATS_ADD(cDBF, siReadCalls, 1);
+    STATS_ADD(cDBF, siBytesRead, sizeof(DBFHead));
+    cDBF->FieldCount = (cDBF->Head->DataOffset - sizeof(DBFHead)) / sizeof(DBFField);
+    if((cDBF->FieldCount < MIN_FIELD_COUNT) || (cDBF->FieldCount > MAX_FIELD_COUNT)){
+        CloseDBF(cDBF);
+        return NULL;
+    }
+    //读列信息，跳过头结束标记等剩余的文件头
+    int fieldsSize = sizeof(DBFField) * cDBF->FieldCount;
+    cDBF->Fields = malloc(fieldsSize);
+    if(NULL == cDBF->Fields){
+        CloseDBF(cDBF);
+        return NULL;
+    }
+    if(fieldsSize != ReadStream(fd, cDBF->Fields, fieldsSize)){
+        #ifdef DEBUG
+        printf("Debug OpenDBFStream ReadFields Error, FieldCount = %d\n", cDBF->FieldCount);
+        #endif
+        CloseDBF(cDBF);
+        return NULL;
+    }
+    STATS_ADD(cDBF, siReadCalls, 1);
+    STATS_ADD(cDBF, siBytesRead, fieldsSize);
+    if(DBF_SUCCESS != SkipStream(fd, cDBF->Head->DataOffset - sizeof(DBFHead) - fieldsSize)){
+        CloseDBF(cDBF);
+        return NULL;
+    }
+    //行缓存、列偏移、列值，同OpenDBFEx
+    cDBF->ValueBuf = malloc(cDBF->Head->RecSize);
+    if(NULL == cDBF->ValueBuf){
+        CloseDBF(cDBF);
+        return NULL;
+    }
+    cDBF->deleted = ' ';
+    memset(cDBF->ValueBuf, '\0', cDBF->Head->RecSize);
+    cDBF->FieldOffsets = malloc(sizeof(int) * cDBF->FieldCount);
+    if(NULL == cDBF->FieldOffsets){
+        CloseDBF(cDBF);
+        return NULL;
+    }
+    if(DBF_SUCCESS != BuildFieldOffsets(cDBF->Fields, cDBF->FieldCount, cDBF->Head->RecSize, cDBF->FieldOffsets)){
+        CloseDBF(cDBF);
+        return NULL;
+    }
+    cDBF->Values = malloc(sizeof(DBFValue) * cDBF->FieldCount);
+    if(NULL == cDBF->Values){
+        CloseDBF(cDBF);
+        return NULL;
+    }
+    int i = 0;
+    for(i=0; i<cDBF->FieldCount; i++){
+        cDBF->Values[i].Field = &cDBF->Fields[i];
+    }
+    //启动预读线程
+    if(DBF_SUCCESS != StartStream(cDBF, fd)){
+        CloseDBF(cDBF);
+        return NULL;
+    }
+    cDBF->RecNo = 0;
+    return cDBF;
+}
+
+
+/*******************************************************************************
+* Function   : NextStreamBatch
+* Description: 取当前行之后的一块原始记录
+* Input      :
+    * cDBF, OpenDBFStream返回的CDBF结构体指针
+* Output     :
+    * records, 连续的原始记录，每条Head->RecSize字节
+    * firstRow, 第一条记录的行号
+* Return     : 记录条数, 0:已读完; -1:不是流句柄或读失败
+* Others     :
+    * records在下一次NextStreamBatch、Next、Go之前有效
+    * 返回后当前行切换到本块的最后一条
+*******************************************************************************/
+int NextStreamBatch(CDBF *cDBF, const char **records, int *firstRow)
+{
+    if(NULL == cDBF->Stream){
+        return DBF_FAIL;
+    }
+    return TakeRecords(cDBF, INT_MAX, records, firstRow);
+}
+
+
+/*******************************************************************************
+* Function   : ScanStream
+* Description: 按块扫描流中[firstRow, lastRow]范围内的记录
+* Input      :
+    * cDBF, OpenDBFStream返回的CDBF结构体指针
+    * firstRow, 起始行号，必须在当前行之后
+    * lastRow, 结束行号，包含
+    * callback, 块回调，threadNo总是0
+    * userData, 传给回调的数据
+* Output     :
+* Return     : 是否扫描成功, -1:行已经读过、读失败、回调返回失败或记录数超过INT_MAX; 1:扫描成功
+* Others     :
+    * firstRow之前没有读过的记录被跳过
+    * 流提前结束时扫描到流结束为止
+    * ScanBlocks对流句柄调用本方法
+*******************************************************************************/
+int ScanStream(CDBF *cDBF, int firstRow, int lastRow, DBFBlockCallback callback, void *userData)
+{
+    if((NULL == cDBF->Stream) || (firstRow <= (int)cDBF->RecNo)){
+        return DBF_FAIL;
+    }
+    int recCount = IntRecCount(cDBF);
+    if(recCount < 0){
+        return DBF_FAIL;
+    }
+    if(lastRow > recCount){
+        lastRow = recCount;
+    }
+    const char *records = NULL;
+    int first = 0;
+    while((int)cDBF->RecNo < lastRow){
+        int count = TakeRecords(cDBF, lastRow - (int)cDBF->RecNo, &records, &first);
+        if(count < 0){
+            return DBF_FAIL;
+        }
+        if(0 == count){
+            break;
+        }
+        //跳过firstRow之前的记录
+        if(first + count <= firstRow){
+            continue;
+        }
+        if(first < firstRow){
+            records = records + (long)(firstRow - first) * cDBF->Head->RecSize;
+            count = count - (firstRow - first);
+            first = firstRow;
+        }
+        if(DBF_SUCCESS != callback(records, first, count, 0, userData)){
+            return DBF_FAIL;
+        }
+    }
+    return DBF_SUCCESS;
+}
+
+
+/*******************************************************************************
+* Function   : StreamGo
+* Description: 流句柄的Go，只能切换到当前行或下一行
+* Input      :
+    * cDBF, OpenDBFStream返回的CDBF结构体指针
+    * rowNo, 将要切换的记录的行号
+* Output     :
+* Return     : 当前指向记录的序号, -1:切换失败; >0:切换成功，返回切换后的序号
+* Others     : Go对流句柄调用本方法
+*******************************************************************************/
+int StreamGo(CDBF *cDBF, int rowNo)
+{
+    if((rowNo == cDBF->RecNo) && (rowNo > 0)){
+        return cDBF->RecNo;
+    }
+    if(rowNo != cDBF->RecNo + 1){
+        #ifdef DEBUG
+        printf("Debug StreamGo Error, RecNo = %u, rowNo = %d\n", cDBF->RecNo, rowNo);
+        #endif
+        return DBF_FAIL;
+    }
+    const char *records = NULL;
+    int first = 0;
+    if(1 != TakeRecords(cDBF, 1, &records, &first)){
+        return DBF_FAIL;
+    }
+    return cDBF->RecNo;
+}
+
+
+/*******************************************************************************
+* Function   : CloseStream
+* Description: 停止预读线程，释放预读的缓存
+* Input      :
+    * cDBF, OpenDBFStream返回的CDBF结构体指针
+* Output     :
+* Return     :
+* Others     : CloseDBF调用，不是流句柄时什么都不做
+*******************************************************************************/
+void CloseStream(CDBF *cDBF)
+{
+    DBFStream *stream = cDBF->Stream;
+    if(NULL == stream){
+        return;
+    }
+    if(stream->ThreadStarted){
+        pthread_mutex_lock(&stream->Mutex);
+        stream->Stop = DBF_TRUE;
+        pthread_cond_broadcast(&stream->Cond);
+        pthread_mutex_unlock(&stream->Mutex);
+        //预读线程可能阻塞在管道的read上
+        pthread_cancel(stream->Thread);
+        pthread_join(stream->Thread, NULL);
+    }
+    pthread_mutex_destroy(&stream->Mutex);
+    pthread_cond_destroy(&stream->Cond);
+    int i = 0;
+    for(i=0; i<DBF_STREAM_BUFS; i++){
+        if(NULL != stream->Bufs[i]){
+            free(stream->Bufs[i]);
+        }
+    }
+    free(stream);
+    cDBF->Stream = NULL;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : ReadStream
+* Description: 从fd读size字节，直到读满或读到结尾
+* Return     : 读到的字节数，小于size表示流已结束; -1:读失败
+----------------------------------------------------------------------------*/
+long long ReadStream(int fd, void *buf, long long size)
+{
+    long long done = 0;
+    while(done < size){
+        ssize_t n = read(fd, (char *)buf + done, size - done);
+        if(n < 0){
+            if(EINTR == errno){
+                continue;
+            }
+            return -1;
+        }
+        if(0 == n){
+            break;
+        }
+        done = done + n;
+    }
+    return done;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : SkipStream
+* Description: 从fd读掉size字节
+----------------------------------------------------------------------------*/
+int SkipStream(int fd, int size)
+{
+    char buf[1024];
+    while(size > 0){
+        int n = (size > sizeof(buf)) ? sizeof(buf) : size;
+        if(n != ReadStream(fd, buf, n)){
+            return DBF_FAIL;
+        }
+        size = size - n;
+    }
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : StartStream
+* Description: 申请预读的缓存，启动预读线程
+----------------------------------------------------------------------------*/
+int StartStream(CDBF *cDBF, int fd)
+{
+    //流按int行号计数，记录数超过INT_MAX时不能打开
+    if(IntRecCount(cDBF) < 0){
+        return DBF_FAIL;
+    }
+    DBFStream *stream = malloc(sizeof(DBFStream));
+    if(NULL == stream){
+        return DBF_FAIL;
+    }
+    memset(stream, '\0', sizeof(DBFStream));
+    pthread_mutex_init(&stream->Mutex, NULL);
+    pthread_cond_init(&stream->Cond, NULL);
+    stream->Fd = fd;
+    stream->RecSize = cDBF->Head->RecSize;
+    stream->Remaining = IntRecCount(cDBF);
+    stream->Current = -1;
+    stream->NextRow = 1;
+    cDBF->Stream = stream;
+    //每块按整条记录取整，记录数少时按实际记录数申请
+    stream->BatchRecs = DBF_STREAM_BLOCK / stream->RecSize;
+    if(stream->BatchRecs < 1){
+        stream->BatchRecs = 1;
+    }
+    if((stream->Remaining > 0) && (stream->BatchRecs > stream->Remaining)){
+        stream->BatchRecs = stream->Remaining;
+    }
+    int i = 0;
+    for(i=0; i<DBF_STREAM_BUFS; i++){
+        stream->Bufs[i] = malloc((long)stream->BatchRecs * stream->RecSize);
+        if(NULL == stream->Bufs[i]){
+            return DBF_FAIL;
+        }
+    }
+    if(0 != pthread_create(&stream->Thread, NULL, StreamThread, cDBF)){
+        return DBF_FAIL;
+    }
+    stream->ThreadStarted = DBF_TRUE;
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : StreamThread
+* Description: 预读线程，有空闲的块时读满一块交给读方
+----------------------------------------------------------------------------*/
+void *StreamThread(void *arg)
+{
+    CDBF *cDBF = arg;
+    DBFStream *stream = cDBF->Stream;
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    int idx = 0;
+    int done = DBF_FALSE;
+    while(!done){
+        pthread_mutex_lock(&stream->Mutex);
+        while((DBF_STREAM_BUFS == stream->Filled) && !stream->Stop){
+            pthread_cond_wait(&stream->Cond, &stream->Mutex);
+        }
+        int stop = stream->Stop;
+        pthread_mutex_unlock(&stream->Mutex);
+        if(stop){
+            break;
+        }
+        int want = (stream->Remaining > stream->BatchRecs) ? stream->BatchRecs : stream->Remaining;
+        long long got = 0;
+        if(want > 0){
+            pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+            got = ReadStream(stream->Fd, stream->Bufs[idx], (long long)want * stream->RecSize);
+            pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+            STATS_ADD(cDBF, siReadCalls, 1);
+        }
+        int recs = (got > 0) ? (int)(got / stream->RecSize) : 0;
+        STATS_ADD(cDBF, siBytesRead, (long long)recs * stream->RecSize);
+        stream->Remaining = stream->Remaining - recs;
+        pthread_mutex_lock(&stream->Mutex);
+        stream->Counts[idx] = recs;
+        if(recs > 0){
+            stream->Filled ++;
+        }
+        if(got < 0){
+            stream->Error = DBF_TRUE;
+        }
+        else if((recs < want) || (0 == stream->Remaining)){
+            stream->Eof = DBF_TRUE;
+        }
+        done = stream->Eof || stream->Error;
+        pthread_cond_broadcast(&stream->Cond);
+        pthread_mutex_unlock(&stream->Mutex);
+        if(recs > 0){
+            idx = (idx + 1) % DBF_STREAM_BUFS;
+        }
+    }
+    #ifdef DEBUG
+    printf("Debug StreamThread exit, Remaining = %d\n", stream->Remaining);
+    #endif
+    return NULL;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : AcquireBatch
+* Description: 交还读方持有的块，等下一块读满
+* Return     : 下一块的记录数, 0:已读完; -1:读失败
+----------------------------------------------------------------------------*/
+int AcquireBatch(DBFStream *stream)
+{
+    pthread_mutex_lock(&stream->Mutex);
+    if(stream->Current >= 0){
+        stream->ReadIdx = (stream->ReadIdx + 1) % DBF_STREAM_BUFS;
+        stream->Filled --;
+        stream->Current = -1;
+        pthread_cond_broadcast(&stream->Cond);
+    }
+    while((0 == stream->Filled) && !stream->Eof && !stream->Error){
+        pthread_cond_wait(&stream->Cond, &stream->Mutex);
+    }
+    //读失败之前读满的块照常交付
+    if(0 == stream->Filled){
+        int ret = stream->Error ? DBF_FAIL : 0;
+        pthread_mutex_unlock(&stream->Mutex);
+        return ret;
+    }
+    stream->Current = stream->ReadIdx;
+    int count = stream->Counts[stream->Current];
+    pthread_mutex_unlock(&stream->Mutex);
+    stream->Pos = 0;
+    stream->CurFirstRow = stream->NextRow;
+    stream->NextRow = stream->NextRow + count;
+    return count;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : TakeRecords
+* Description: 从当前行之后取最多maxCount条连续的记录，当前行切换到最后一条
+* Return     : 记录条数, 0:已读完; -1:读失败
+----------------------------------------------------------------------------*/
+int TakeRecords(CDBF *cDBF, int maxCount, const char **records, int *firstRow)
+{
+    DBFStream *stream = cDBF->Stream;
+    if((stream->Current < 0) || (stream->Pos >= stream->Counts[stream->Current])){
+        int ret = AcquireBatch(stream);
+        if(ret <= 0){
+            return ret;
+        }
+    }
+    int count = stream->Counts[stream->Current] - stream->Pos;
+    if(count > maxCount){
+        count = maxCount;
+    }
+    *records = stream->Bufs[stream->Current] + (long)stream->Pos * stream->RecSize;
+    *firstRow = stream->CurFirstRow + stream->Pos;
+    stream->Pos = stream->Pos + count;
+    //行缓存保存最后一条，各GetFieldAs*读的是这一条
+    memcpy(cDBF->ValueBuf, *records + (long)(count - 1) * stream->RecSize, stream->RecSize);
+    cDBF->deleted = cDBF->ValueBuf[0];
+    memset(cDBF->Decoded, 0, sizeof(cDBF->Decoded));
+    cDBF->RecNo = *firstRow + count - 1;
+    STATS_ADD(cDBF, siRecordsRead, count);
+    return count;
+}
@@ -0,0 +1,41 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cStream.h
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-18
+ * Description  : 从不能定位的输入流读DBF(管道、标准输入、解压程序的输出)
+     1.只读、只能向前，从文件描述符依次读文件头、列信息，然后按顺序读记录
+     2.后台线程预读，每次读入一大块整条记录，读方处理当前块时下一块已经在读
+     3.Go只能切换到当前行或下一行，Next、First(打开后)和各GetFieldAs*可以照常使用
+     4.NextStreamBatch、ScanStream按块取原始记录，和ScanBlocks的块回调通用
+     5.压缩文件由外部解压程序解到管道，例如 zstdcat x.dbf.zst | consumer
+**********************************************************************************/
+#ifndef CSTREAM_H
+#define CSTREAM_H
+
+#include "cDBFStruct.h"
+#include "cScan.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//预读的块数
+#define DBF_STREAM_BUFS 3
+//每块的字节数，实际按整条记录取整
+#define DBF_STREAM_BLOCK (4 * 1024 * 1024)
+
+CDBF *OpenDBFStream(int fd, int flags);
+int NextStreamBatch(CDBF *cDBF, const char **records, int *firstRow);
+int ScanStream(CDBF *cDBF, int firstRow, int lastRow, DBFBlockCallback callback, void *userData);
+
+//以下供cDBF内部调用
+int StreamGo(CDBF *cDBF, int rowNo);
+void CloseStream(CDBF *cDBF);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,407 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cWhere.c
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-16
+ * Description  : 按条件批量修改、删除记录实现
+     1.每块在BeginWriteBatch、EndWriteBatch之间读入和写回，乐观读不会读到改了一半的块
+     2.直接pread、通过cIO写文件描述符，开始前fflush写出stdio中未写的数据，
+       结束后再fflush丢弃stdio中的旧数据
+     3.赋值按列偏移排序，同一条记录中相邻的列、相邻记录首尾相接的列合并成一个写请求
+**********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cDBF.h"
+#include "cWhere.h"
+#include "cScan.h"
+#include "cIO.h"
+#include "cField.h"
+#include "cZone.h"
+#include "cStats.h"
+#include "cLog.h"
+#include "cDBFInner.h"
+
+//一块中同时提交的写请求个数
+#define WHERE_DEPTH 64
+
+//解析后的条件或赋值
+typedef struct TWhereTerm
+{
+    DBFField *Field;
+    int Offset;                 //列在记录中的偏移
+    DBFWhereOp Op;
+    char *Value;                //按列宽度写好的值
+}WhereTerm;
+
+//一次修改的上下文
+typedef struct TWhereCtx
+{
+    CDBF *DBF;
+    int TermCount;
+    WhereTerm Terms[DBF_WHERE_MAXTERMS];
+    int SetCount;
+    WhereTerm Sets[DBF_WHERE_MAXTERMS + 1];   //删除时只有删除标记一项
+    DBFField DeleteField;       //删除标记当作宽度为1的C列
+    char *Values;               //所有条件、赋值的值
+}WhereCtx;
+
+//块中要写回的字节范围
+typedef struct TWhereRange
+{
+    int Start;                  //在块中的偏移
+    int Len;
+}WhereRange;
+
+int PrepareWhere(WhereCtx *ctx, CDBF *cDBF, DBFWhere *where, int whereCount, DBFAssign *assigns, int assignCount);
+int ApplyWhere(WhereCtx *ctx);
+int MatchWhere(WhereCtx *ctx, const char *rec);
+int WriteRanges(WhereCtx *ctx, DBFIOQueue *queue, DBFIOReq *reqs, char *buf, long long offset, WhereRange *ranges, int rangeCount);
+int CompareSetOffset(const void *a, const void *b);
+
+
+/*******************************************************************************
+* Function   : UpdateWhere
+* Description: 把满足条件的记录的列改为指定的值
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+    * where, whereCount, 条件，whereCount为0时修改所有未删除的记录
+    * assigns, assignCount, 赋值，同一列出现多次时以最后一次为准
+* Output     :
+* Return     : 修改的记录条数, -1:列不存在、读写失败或记录数超过INT_MAX
+* Others     :
+    * 已删除的记录不修改
+    * 值没有变化的记录不写，也不计入修改的条数
+    * 失败时已写回的块不会回滚
+*******************************************************************************/
+int UpdateWhere(CDBF *cDBF, DBFWhere *where, int whereCount, DBFAssign *assigns, int assignCount)
+{
+    if((assignCount <= 0) || (assignCount > DBF_WHERE_MAXTERMS)){
+        return DBF_FAIL;
+    }
+    WhereCtx ctx;
+    if(DBF_SUCCESS != PrepareWhere(&ctx, cDBF, where, whereCount, assigns, assignCount)){
+        return DBF_FAIL;
+    }
+    int ret = ApplyWhere(&ctx);
+    free(ctx.Values);
+    return ret;
+}
+
+
+/*******************************************************************************
+* Function   : DeleteWhere
+* Description: 把满足条件的记录标记为删除
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+    * where, whereCount, 条件，whereCount为0时删除所有记录
+* Output     :
+* Return     : 删除的记录条数, -1:列不存在、读写失败或记录数超过INT_MAX
+* Others     : 每条记录只写删除标记一个字节，记录数不变，不写文件头
+*******************************************************************************/
+int DeleteWhere(CDBF *cDBF, DBFWhere *where, int whereCount)
+{
+    WhereCtx ctx;
+    if(DBF_SUCCESS != PrepareWhere(&ctx, cDBF, where, whereCount, NULL, 0)){
+        return DBF_FAIL;
+    }
+    //删除标记在记录的第0个字节
+    memset(&ctx.DeleteField, '\0', sizeof(DBFField));
+    ctx.DeleteField.FieldType = TYPE_CHAR;
+    ctx.DeleteField.Width = 1;
+    ctx.Sets[0].Field = &ctx.DeleteField;
+    ctx.Sets[0].Offset = 0;
+    ctx.Sets[0].Value = "*";
+    ctx.SetCount = 1;
+    int ret = ApplyWhere(&ctx);
+    free(ctx.Values);
+    return ret;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : PrepareWhere
+* Description: 查找条件、赋值的列，按列宽度写好值，赋值按列偏移排序
+----------------------------------------------------------------------------*/
+int PrepareWhere(WhereCtx *ctx, CDBF *cDBF, DBFWhere *where, int whereCount, DBFAssign *assigns, int assignCount)
+{
+    if((whereCount < 0) || (whereCount > DBF_WHERE_MAXTERMS)){
+        return DBF_FAIL;
+    }
+    memset(ctx, '\0', sizeof(WhereCtx));
+    ctx->DBF = cDBF;
+    int i = 0;
+    int total = 0;
+    int indexes[DBF_WHERE_MAXTERMS * 2];
+    for(i=0; i<whereCount+assignCount; i++){
+        char *name = (i < whereCount) ? where[i].FieldName : assigns[i - whereCount].FieldName;
+        indexes[i] = GetIndexByName(cDBF, name);
+        if(DBF_FAIL == indexes[i]){
+            #ifdef DEBUG
+            printf("Debug PrepareWhere Field Not Found, name = %s\n", name);
+            #endif
+            return DBF_FAIL;
+        }
+        total = total + cDBF->Fields[indexes[i]].Width;
+    }
+    ctx->Values = malloc(total + 1);
+    if(NULL == ctx->Values){
+        return DBF_FAIL;
+    }
+    char *p = ctx->Values;
+    for(i=0; i<whereCount+assignCount; i++){
+        char *value = (i < whereCount) ? where[i].Value : assigns[i - whereCount].Value;
+        DBFField *field = &cDBF->Fields[indexes[i]];
+        EncodeFieldBytes(field, value, p);
+        WhereTerm *term = NULL;
+        if(i < whereCount){
+            term = &ctx->Terms[ctx->TermCount ++];
+            term->Op = where[i].Op;
+        }
+        else{
+            //同一列赋值多次时覆盖前一次
+            int j = 0;
+            for(j=0; j<ctx->SetCount; j++){
+                if(ctx->Sets[j].Offset == cDBF->FieldOffsets[indexes[i]]){
+                    break;
+                }
+            }
+            term = &ctx->Sets[j];
+            if(j == ctx->SetCount){
+                ctx->SetCount ++;
+            }
+        }
+        term->Field = field;
+        term->Offset = cDBF->FieldOffsets[indexes[i]];
+        term->Value = p;
+        p = p + field->Width;
+    }
+    qsort(ctx->Sets, ctx->SetCount, sizeof(WhereTerm), CompareSetOffset);
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : ApplyWhere
+* Description: 逐块读入、修改，每块收集变化的字节范围一次写回
+----------------------------------------------------------------------------*/
+int ApplyWhere(WhereCtx *ctx)
+{
+    CDBF *cDBF = ctx->DBF;
+    if((DBF_OPEN_STREAM | DBF_OPEN_SHM) & cDBF->OpenFlags){
+        return DBF_FAIL;
+    }
+    int recCount = IntRecCount(cDBF);
+    if(recCount < 0){
+        return DBF_FAIL;
+    }
+    if(0 == recCount){
+        return 0;
+    }
+    int recSize = cDBF->Head->RecSize;
+    int blockRecs = DBF_SCAN_BLOCK / recSize;
+    if(blockRecs < 1){
+        blockRecs = 1;
+    }
+    //先写出stdio中未写的数据，后面直接读写文件描述符
+    if(0 != fflush(cDBF->FHandle)){
+        return DBF_FAIL;
+    }
+    int fd = fileno(cDBF->FHandle);
+    char *buf = malloc((long)blockRecs * recSize);
+    WhereRange *ranges = malloc(sizeof(WhereRange) * blockRecs * ctx->SetCount);
+    if((NULL == buf) || (NULL == ranges)){
+        free(buf);
+        free(ranges);
+        return DBF_FAIL;
+    }
+    DBFIOQueue queue;
+    if(DBF_SUCCESS != OpenIOQueue(&queue, fd, WHERE_DEPTH)){
+        free(buf);
+        free(ranges);
+        return DBF_FAIL;
+    }
+    DBFIOReq reqs[WHERE_DEPTH];
+    memset(reqs, '\0', sizeof(reqs));
+    int changed = 0;
+    int ret = DBF_SUCCESS;
+    int first = 1;
+    for(first=1; first<=recCount; first=first+blockRecs){
+        int count = (recCount - first + 1 > blockRecs) ? blockRecs : (recCount - first + 1);
+        long long offset = cDBF->Head->DataOffset + (long long)(first - 1) * recSize;
+        //读入和写回在同一批写中，其他写方不会在中间修改这一块
+        if(DBF_SUCCESS != BeginWriteBatch(cDBF)){
+            ret = DBF_FAIL;
+            break;
+        }
+        ret = ReadFull(fd, buf, (long long)count * recSize, offset);
+        STATS_ADD(cDBF, siReadCalls, 1);
+        if(DBF_SUCCESS != ret){
+            #ifdef DEBUG
+            printf("Debug ApplyWhere pread Error, offset = %lld\n", offset);
+            #endif
+            EndWriteBatch(cDBF);
+            break;
+        }
+        STATS_ADD(cDBF, siBytesRead, (long long)count * recSize);
+        int rangeCount = 0;
+        int i = 0;
+        for(i=0; i<count; i++){
+            char *rec = buf + (long)i * recSize;
+            if((DELETED == rec[0]) || (DBF_TRUE != MatchWhere(ctx, rec))){
+                continue;
+            }
+            int recChanged = DBF_FALSE;
+            int j = 0;
+            for(j=0; j<ctx->SetCount; j++){
+                WhereTerm *set = &ctx->Sets[j];
+                int width = set->Field->Width;
+                if(0 == memcmp(rec + set->Offset, set->Value, width)){
+                    continue;
+                }
+                memcpy(rec + set->Offset, set->Value, width);
+                recChanged = DBF_TRUE;
+                int start = i * recSize + set->Offset;
+                //和前一个范围首尾相接时合并
+                if((rangeCount > 0) && (ranges[rangeCount - 1].Start + ranges[rangeCount - 1].Len == start)){
+                    ranges[rangeCount - 1].Len = ranges[rangeCount - 1].Len + width;
+                }
+                else{
+                    ranges[rangeCount].Start = start;
+                    ranges[rangeCount].Len = width;
+                    rangeCount ++;
+                }
+            }
+            if(recChanged){
+                ZoneMapRecords(cDBF, first + i, rec, 1);
+                changed ++;
+            }
+        }
+        ret = WriteRanges(ctx, &queue, reqs, buf, offset, ranges, rangeCount);
+        if(DBF_SUCCESS != EndWriteBatch(cDBF)){
+            ret = DBF_FAIL;
+        }
+        if(DBF_SUCCESS != ret){
+            break;
+        }
+    }
+    //还有写请求没有完成时内核可能还在读buf，不能释放
+    if(DBF_SUCCESS != CloseIOQueue(&queue)){
+        free(ranges);
+        return DBF_FAIL;
+    }
+    free(buf);
+    free(ranges);
+    //丢弃stdio中的旧数据，当前行是浏览状态时重新读入
+    fflush(cDBF->FHandle);
+    if((dsBrowse == cDBF->status) && (cDBF->RecNo >= 1) && (cDBF->RecNo <= recCount)){
+        Go(cDBF, cDBF->RecNo);
+    }
+    if(DBF_SUCCESS != ret){
+        return DBF_FAIL;
+    }
+    STATS_ADD(cDBF, siRecordsWritten, changed);
+    return changed;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : MatchWhere
+* Description: 判断一条原始记录是否满足所有条件
+----------------------------------------------------------------------------*/
+int MatchWhere(WhereCtx *ctx, const char *rec)
+{
+    int i = 0;
+    for(i=0; i<ctx->TermCount; i++){
+        WhereTerm *term = &ctx->Terms[i];
+        int c = CompareFieldBytes(term->Field, rec + term->Offset, term->Value);
+        int match = DBF_FALSE;
+        switch(term->Op){
+            case whereEq: match = (0 == c); break;
+            case whereNe: match = (0 != c); break;
+            case whereLt: match = (c < 0); break;
+            case whereLe: match = (c <= 0); break;
+            case whereGt: match = (c > 0); break;
+            case whereGe: match = (c >= 0); break;
+        }
+        if(!match){
+            return DBF_FALSE;
+        }
+    }
+    return DBF_TRUE;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : WriteRanges
+* Description: 把一块中变化的字节范围提交写请求，队列满时等待一个完成后复用
+----------------------------------------------------------------------------*/
+int WriteRanges(WhereCtx *ctx, DBFIOQueue *queue, DBFIOReq *reqs, char *buf, long long offset, WhereRange *ranges, int rangeCount)
+{
+    CDBF *cDBF = ctx->DBF;
+    DBFIOReq *freeList[WHERE_DEPTH];
+    int freeCount = WHERE_DEPTH;
+    int ret = DBF_SUCCESS;
+    int i = 0;
+    for(i=0; i<WHERE_DEPTH; i++){
+        freeList[i] = &reqs[i];
+    }
+    i = 0;
+    while((i < rangeCount) || (queue->Inflight > 0)){
+        //队列有空位的部分先都记入变更日志，一次写出日志后再提交；记录失败时之前的照常提交，之后的不再提交
+        int end = i;
+        int logged = DBF_SUCCESS;
+        while((end < rangeCount) && (end - i < freeCount)){
+            logged = LogWrite(cDBF, offset + ranges[end].Start, buf + ranges[end].Start, ranges[end].Len);
+            if(DBF_SUCCESS != logged){
+                break;
+            }
+            end ++;
+        }
+        if((end > i) && (DBF_SUCCESS != FlushChangeLog(cDBF))){
+            logged = DBF_FAIL;
+            end = i;
+        }
+        for(; i<end; i++){
+            DBFIOReq *req = freeList[-- freeCount];
+            req->Write = 1;
+            req->Buf = buf + ranges[i].Start;
+            req->Len = ranges[i].Len;
+            req->Offset = offset + ranges[i].Start;
+            SubmitIOReq(queue, req);
+            STATS_ADD(cDBF, siWriteCalls, 1);
+        }
+        if(DBF_SUCCESS != logged){
+            ret = DBF_FAIL;
+            i = rangeCount;
+        }
+        if(0 == queue->Inflight){
+            break;
+        }
+        DBFIOReq *done = NULL;
+        if(DBF_SUCCESS != WaitIOReq(queue, &done)){
+            return DBF_FAIL;
+        }
+        freeList[freeCount ++] = done;
+        if(done->Result != done->Len){
+            #ifdef DEBUG
+            printf("Debug WriteRanges write Error, Result = %d, Len = %d\n", done->Result, done->Len);
+            #endif
+            ret = DBF_FAIL;
+            continue;
+        }
+        STATS_ADD(cDBF, siBytesWritten, done->Len);
+    }
+    return ret;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : CompareSetOffset
+* Description: qsort比较赋值的列偏移
+----------------------------------------------------------------------------*/
+int CompareSetOffset(const void *a, const void *b)
+{
+    return ((const WhereTerm *)a)->Offset - ((const WhereTerm *)b)->Offset;
+}
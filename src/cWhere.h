@@ -0,0 +1,58 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cWhere.h
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-16
+ * Description  : 按条件批量修改、删除记录
+     1.按记录块读入，直接在原始字节上判断条件、修改列值，不切换当前行、不解析列
+     2.只写回值有变化的列的字节范围，文件中相邻的范围合并成一个写请求
+     3.一块中的所有写请求通过cIO一次提交，不写文件头
+     4.多个条件之间是AND关系，没有条件时匹配所有未删除的记录
+**********************************************************************************/
+#ifndef CWHERE_H
+#define CWHERE_H
+
+#include "cDBFStruct.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//条件和赋值的个数上限
+#define DBF_WHERE_MAXTERMS 32
+
+//比较方式，N、F列按数值比较，其他列按字节比较
+typedef enum TDBFWhereOp
+{
+    whereEq,
+    whereNe,
+    whereLt,
+    whereLe,
+    whereGt,
+    whereGe
+}DBFWhereOp;
+
+//条件: FieldName列 Op Value
+typedef struct TDBFWhere
+{
+    char *FieldName;
+    DBFWhereOp Op;
+    char *Value;                //和SetFieldAsString一样写入列宽度，超长截断、不足补空格后比较
+}DBFWhere;
+
+//赋值: FieldName列 = Value
+typedef struct TDBFAssign
+{
+    char *FieldName;
+    char *Value;                //和SetFieldAsString一样写入列宽度
+}DBFAssign;
+
+int UpdateWhere(CDBF *cDBF, DBFWhere *where, int whereCount, DBFAssign *assigns, int assignCount);
+int DeleteWhere(CDBF *cDBF, DBFWhere *where, int whereCount);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
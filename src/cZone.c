@@ -0,0 +1,1135 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cZone.c
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-17
+ * Description  : 区块索引实现
+     1.文件格式: ZoneFileHead、各列列名(每个11字节)、各区块的统计，区块统计定长，
+       第b个区块在文件中的位置可以直接算出，只写回改过的区块
+     2.区块统计: ZoneEntry后面依次是各列的ZoneColStat、最小值、最大值的原始字节
+     3.加载时丢弃最后一个不满的区块，连同之后的记录一起重新读入，
+       避免写回区块和写文件头之间异常退出造成的不一致
+     4.覆盖的记录数比DBF多(Zap或文件被替换)或标记为不完整时全部重建
+     5.文件头记录写回时DBF的修改时间和大小，加载时不一致说明DBF被其他程序改过，全部重建
+     6.多个句柄修改同一个DBF时，写回区块前在区块索引文件的OFD锁内读入文件中的区块，
+       把其他句柄已写回的最小值、最大值合并进来，避免覆盖其他句柄扩大的范围
+     7.跳过区块之前比较区块索引文件的文件头、修改时间、大小和DBF的修改时间、大小，
+       有变化(或Fresh)时重新读入并合并其他句柄写回的范围；文件中的区块索引不完整
+       或和DBF不一致时无法确认是最新的，不跳过任何区块，直到本句柄写回
+**********************************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "cDBF.h"
+#include "cZone.h"
+#include "cField.h"
+#include "cStats.h"
+#include "cDBFInner.h"
+
+#define ZONE_MAGIC "DBFZ"
+#define ZONE_VERSION 2
+#define ZONE_NAME_LEN 11
+
+#pragma pack(1)
+
+//区块索引文件头
+typedef struct TZoneFileHead
+{
+    char Magic[4];              //"DBFZ"
+    int Version;
+    int BlockRecs;              //每个区块的记录数
+    int ColCount;               //列数
+    int Covered;                //覆盖的记录数
+    int Clean;                  //1:完整; 0:有修改没有写回，加载时重建
+    unsigned short DataOffset;  //DBF的DataOffset、RecSize，不一致时不加载
+    unsigned short RecSize;
+    long long DbfMTime;         //写文件头时DBF的修改时间(纳秒)和大小，不一致时重建
+    long long DbfSize;
+}ZoneFileHead;
+
+//一个区块的统计
+typedef struct TZoneEntry
+{
+    int Count;                  //区块中的记录数
+    int Deleted;                //已删除的记录数
+    int Dirty;                  //区块中有记录被修改过，Deleted和各列的Nulls不再准确
+}ZoneEntry;
+
+//一个区块中一列的统计，后面紧跟最小值、最大值的原始字节
+typedef struct TZoneColStat
+{
+    int Nulls;                  //空值个数
+    char HasValue;              //是否有非空值，没有时最小值、最大值无意义
+}ZoneColStat;
+
+#pragma pack()
+
+//区块索引中的一列
+typedef struct TZoneCol
+{
+    DBFField *Field;
+    int Offset;                 //列在记录中的偏移
+    int Pos;                    //ZoneColStat在区块统计中的偏移
+}ZoneCol;
+
+//区块索引
+typedef struct TDBFZoneMap
+{
+    int Fd;                     //区块索引文件
+    int BlockRecs;
+    int ColCount;
+    ZoneCol Cols[DBF_ZONE_MAXCOLS];
+    int EntrySize;              //每个区块统计的字节数
+    int BlockCount;
+    int Capacity;               //Entries能容纳的区块数
+    char *Entries;
+    unsigned char *Dirty;       //各区块是否有未写回的修改
+    int AnyDirty;
+    int Covered;                //覆盖的记录数，总是从第1条开始连续
+    int Clean;                  //文件中的完整标记
+    int HeadDirty;              //文件头需要写回
+    int Trusted;                //能确认包含其他句柄写回的范围，可以跳过区块
+    ZoneFileHead DiskHead;      //最近一次读入、写回时文件中的文件头
+    long long ZmpMTime;         //同时区块索引文件、DBF的修改时间和大小
+    long long ZmpSize;
+    long long DbfMTime;
+    long long DbfSize;
+}DBFZoneMap;
+
+//解析后的范围条件
+typedef struct TZoneRange
+{
+    DBFField *Field;
+    int Offset;
+    char *Low;                  //按列宽度写好的值，NULL表示不限
+    char *High;
+    int Col;                    //在区块索引中的列号，-1表示不在区块索引中
+}ZoneRange;
+
+//ExtractColumn的上下文
+typedef struct TZoneExtract
+{
+    ZoneRange *Ranges;
+    int RangeCount;
+    int RecSize;
+    int Offset;
+    int Width;
+    char *Values;
+    int *Rows;
+    int MaxCount;
+    int Count;
+    int Full;
+}ZoneExtract;
+
+#define ZONE_ENTRY(map, b) ((ZoneEntry *)((map)->Entries + (long)(b) * (map)->EntrySize))
+
+DBFZoneMap *CreateZoneMap(CDBF *cDBF, char names[][ZONE_NAME_LEN + 1], int colCount, int blockRecs);
+void FreeZoneMap(DBFZoneMap *map);
+void ZonePath(CDBF *cDBF, char *path, int size);
+int ZoneHeadSize(DBFZoneMap *map);
+int WriteZoneHead(CDBF *cDBF, int clean);
+int GrowZoneMap(DBFZoneMap *map, int blocks);
+void ZoneAdd(DBFZoneMap *map, ZoneEntry *entry, const char *rec, int widen);
+int ZoneCatchUp(CDBF *cDBF);
+int LockZoneFile(DBFZoneMap *map, int type);
+int ReadZoneHead(DBFZoneMap *map, ZoneFileHead *head);
+void MergeZoneEntries(DBFZoneMap *map, ZoneFileHead *diskHead, int first, int end);
+void ZoneDbfStat(CDBF *cDBF, long long *mtime, long long *size);
+void ZoneFdStat(int fd, long long *mtime, long long *size);
+void ZoneSnapshot(CDBF *cDBF);
+int PrepareRanges(CDBF *cDBF, DBFRange *ranges, int rangeCount, ZoneRange *out, char **values);
+int BlockMayMatch(DBFZoneMap *map, ZoneEntry *entry, ZoneRange *ranges, int rangeCount);
+int MatchRanges(ZoneRange *ranges, int rangeCount, const char *rec);
+int ScanZoneRanges(CDBF *cDBF, ZoneRange *ranges, int rangeCount, int nThreads, DBFBlockCallback callback, void *userData);
+int ExtractBlock(const char *records, int firstRow, int count, int threadNo, void *userData);
+
+
+/*******************************************************************************
+* Function   : BuildZoneMap
+* Description: 扫描一遍DBF，对选定的列建区块索引并写到"<文件名>.zmp"
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+    * fieldNames, fieldCount, 建索引的列
+    * blockRecs, 每个区块的记录数，<=0时使用DBF_ZONE_BLOCK
+* Output     :
+* Return     : 是否建立成功, -1:列不存在、读写失败或记录数超过INT_MAX; 1:建立成功
+* Others     :
+    * 已有的区块索引被替换
+    * 建立后cDBF的追加、修改自动更新区块索引，之后打开该文件时自动加载
+*******************************************************************************/
+int BuildZoneMap(CDBF *cDBF, char **fieldNames, int fieldCount, int blockRecs)
+{
+    if((fieldCount <= 0) || (fieldCount > DBF_ZONE_MAXCOLS) || ((DBF_OPEN_STREAM | DBF_OPEN_SHM) & cDBF->OpenFlags)){
+        return DBF_FAIL;
+    }
+    if(blockRecs <= 0){
+        blockRecs = DBF_ZONE_BLOCK;
+    }
+    char names[DBF_ZONE_MAXCOLS][ZONE_NAME_LEN + 1];
+    int i = 0;
+    for(i=0; i<fieldCount; i++){
+        snprintf(names[i], sizeof(names[i]), "%s", fieldNames[i]);
+    }
+    DBFZoneMap *map = CreateZoneMap(cDBF, names, fieldCount, blockRecs);
+    if(NULL == map){
+        return DBF_FAIL;
+    }
+    char path[strlen(cDBF->Path) + 8];
+    ZonePath(cDBF, path, sizeof(path));
+    map->Fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(map->Fd < 0){
+        #ifdef DEBUG
+        printf("Debug BuildZoneMap open Error, path = %s\n", path);
+        #endif
+        FreeZoneMap(map);
+        return DBF_FAIL;
+    }
+    //替换已有的区块索引，旧的不需要写回
+    FreeZoneMap(cDBF->ZoneMap);
+    cDBF->ZoneMap = map;
+    map->HeadDirty = DBF_TRUE;
+    //直接读文件描述符，先把stdio中未写的数据刷到文件
+    fflush(cDBF->FHandle);
+    if(DBF_SUCCESS != ZoneCatchUp(cDBF)){
+        CloseZoneMap(cDBF);
+        unlink(path);
+        return DBF_FAIL;
+    }
+    return FlushZoneMap(cDBF);
+}
+
+
+/*******************************************************************************
+* Function   : DropZoneMap
+* Description: 删除cDBF的区块索引文件
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+* Output     :
+* Return     : 是否删除成功, -1:删除失败; 1:删除成功或没有区块索引
+* Others     :
+*******************************************************************************/
+int DropZoneMap(CDBF *cDBF)
+{
+    FreeZoneMap(cDBF->ZoneMap);
+    cDBF->ZoneMap = NULL;
+    char path[strlen(cDBF->Path) + 8];
+    ZonePath(cDBF, path, sizeof(path));
+    if((0 != unlink(path)) && (access(path, F_OK) == 0)){
+        return DBF_FAIL;
+    }
+    return DBF_SUCCESS;
+}
+
+
+/*******************************************************************************
+* Function   : ScanZones
+* Description: 按块扫描可能满足范围条件的记录
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+    * ranges, rangeCount, 范围条件，AND关系
+    * nThreads, 扫描线程数
+    * callback, userData, 同ScanBlocks
+* Output     :
+* Return     : 是否扫描成功, -1:列不存在、读失败、回调返回失败或记录数超过INT_MAX; 1:扫描成功
+* Others     :
+    * 只跳过区块索引确定不满足条件的区块，回调的记录仍需调用方逐条判断
+    * 没有区块索引或条件列不在区块索引中时扫描所有记录
+    * 单线程时按行号顺序回调
+*******************************************************************************/
+int ScanZones(CDBF *cDBF, DBFRange *ranges, int rangeCount, int nThreads, DBFBlockCallback callback, void *userData)
+{
+    ZoneRange prepared[DBF_ZONE_MAXCOLS];
+    char *values = NULL;
+    if(DBF_SUCCESS != PrepareRanges(cDBF, ranges, rangeCount, prepared, &values)){
+        return DBF_FAIL;
+    }
+    int ret = ScanZoneRanges(cDBF, prepared, rangeCount, nThreads, callback, userData);
+    free(values);
+    return ret;
+}
+
+
+/*******************************************************************************
+* Function   : ExtractColumn
+* Description: 按行号顺序取出满足范围条件的记录的一列原始字节
+* Input      :
+    * cDBF, OpenDBF返回的CDBF结构体指针
+    * fieldName, 取出的列
+    * ranges, rangeCount, 范围条件，AND关系，rangeCount为0时取出所有未删除的记录
+    * maxCount, 最多取出的记录数
+* Output     :
+    * values, maxCount * 列宽度字节，依次保存列的原始字节，不以'\0'结尾
+    * rows, maxCount个行号，可以为NULL
+* Return     : 取出的记录数, -1:列不存在、读失败或记录数超过INT_MAX
+* Others     :
+    * 已删除的记录不取出
+    * 返回值等于maxCount时可能还有满足条件的记录没有取出
+*******************************************************************************/
+int ExtractColumn(CDBF *cDBF, char *fieldName, DBFRange *ranges, int rangeCount, char *values, int *rows, int maxCount)
+{
+    int index = GetIndexByName(cDBF, fieldName);
+    if((DBF_FAIL == index) || (maxCount <= 0)){
+        return (DBF_FAIL == index) ? DBF_FAIL : 0;
+    }
+    ZoneRange prepared[DBF_ZONE_MAXCOLS];
+    char *rangeValues = NULL;
+    if(DBF_SUCCESS != PrepareRanges(cDBF, ranges, rangeCount, prepared, &rangeValues)){
+        return DBF_FAIL;
+    }
+    ZoneExtract ctx;
+    memset(&ctx, '\0', sizeof(ZoneExtract));
+    ctx.Ranges = prepared;
+    ctx.RangeCount = rangeCount;
+    ctx.RecSize = cDBF->Head->RecSize;
+    ctx.Offset = cDBF->FieldOffsets[index];
+    ctx.Width = cDBF->Fields[index].Width;
+    ctx.Values = values;
+    ctx.Rows = rows;
+    ctx.MaxCount = maxCount;
+    int ret = ScanZoneRanges(cDBF, prepared, rangeCount, 1, ExtractBlock, &ctx);
+    free(rangeValues);
+    //取满后回调返回失败停止扫描，不是错误
+    if((DBF_SUCCESS != ret) && (DBF_TRUE != ctx.Full)){
+        return DBF_FAIL;
+    }
+    return ctx.Count;
+}
+
+
+/*******************************************************************************
+* Function   : LoadZoneMap
+* Description: 加载"<文件名>.zmp"，补上没有覆盖的记录
+* Input      :
+    * cDBF, 已读入文件头和列信息的CDBF结构体指针
+* Output     :
+* Return     : 是否加载成功, -1:没有区块索引或和DBF不一致; 1:加载成功
+* Others     : OpenDBFEx时调用，失败时cDBF->ZoneMap为NULL，不影响打开
+*******************************************************************************/
+int LoadZoneMap(CDBF *cDBF)
+{
+    //区块索引按int行号，记录数超过INT_MAX时不加载
+    if(IntRecCount(cDBF) < 0){
+        return DBF_FAIL;
+    }
+    char path[strlen(cDBF->Path) + 8];
+    ZonePath(cDBF, path, sizeof(path));
+    int fd = open(path, O_RDWR);
+    if(fd < 0){
+        return DBF_FAIL;
+    }
+    ZoneFileHead head;
+    char names[DBF_ZONE_MAXCOLS][ZONE_NAME_LEN + 1];
+    memset(names, '\0', sizeof(names));
+    int i = 0;
+    int ok = (DBF_SUCCESS == ReadFull(fd, (char *)&head, sizeof(ZoneFileHead), 0))
+        && (0 == memcmp(head.Magic, ZONE_MAGIC, 4)) && (ZONE_VERSION == head.Version)
+        && (head.DataOffset == cDBF->Head->DataOffset) && (head.RecSize == cDBF->Head->RecSize)
+        && (head.BlockRecs > 0) && (head.ColCount > 0) && (head.ColCount <= DBF_ZONE_MAXCOLS);
+    for(i=0; ok && (i<head.ColCount); i++){
+        ok = (DBF_SUCCESS == ReadFull(fd, names[i], ZONE_NAME_LEN, sizeof(ZoneFileHead) + i * ZONE_NAME_LEN));
+    }
+    DBFZoneMap *map = ok ? CreateZoneMap(cDBF, names, head.ColCount, head.BlockRecs) : NULL;
+    if(NULL == map){
+        #ifdef DEBUG
+        printf("Debug LoadZoneMap Invalid, path = %s\n", path);
+        #endif
+        close(fd);
+        return DBF_FAIL;
+    }
+    map->Fd = fd;
+    map->Clean = head.Clean;
+    //不完整、比DBF多或DBF被其他程序改过时全部重建，否则丢弃最后一个不满的区块
+    long long mtime = 0;
+    long long size = 0;
+    ZoneDbfStat(cDBF, &mtime, &size);
+    int covered = head.Covered;
+    if((DBF_TRUE != head.Clean) || (covered < 0) || (covered > IntRecCount(cDBF))
+        || (head.DbfMTime != mtime) || (head.DbfSize != size)){
+        #ifdef DEBUG
+        printf("Debug LoadZoneMap Rebuild, path = %s\n", path);
+        #endif
+        covered = 0;
+    }
+    int blocks = covered / map->BlockRecs;
+    if((blocks > 0) && ((DBF_SUCCESS != GrowZoneMap(map, blocks))
+        || (DBF_SUCCESS != ReadFull(fd, map->Entries, (long long)blocks * map->EntrySize, ZoneHeadSize(map))))){
+        FreeZoneMap(map);
+        return DBF_FAIL;
+    }
+    map->BlockCount = blocks;
+    map->Covered = blocks * map->BlockRecs;
+    map->HeadDirty = (map->Covered != head.Covered) || (0 == covered);
+    map->Trusted = DBF_TRUE;
+    cDBF->ZoneMap = map;
+    ZoneSnapshot(cDBF);
+    if(DBF_SUCCESS != ZoneCatchUp(cDBF)){
+        CloseZoneMap(cDBF);
+        return DBF_FAIL;
+    }
+    return DBF_SUCCESS;
+}
+
+
+/*******************************************************************************
+* Function   : ZoneMapRecords
+* Description: 追加、修改记录后更新区块索引
+* Input      :
+    * cDBF, CDBF结构体指针，没有区块索引时直接返回
+    * firstRow, 第一条记录的行号
+    * records, count条连续的原始记录
+    * count, 记录条数
+* Output     :
+* Return     :
+* Others     :
+    * 已覆盖的记录按修改处理，扩大最小值、最大值，区块标记为Dirty
+    * 紧接着覆盖范围的记录按追加处理，和覆盖范围之间有间隔时不处理，下次加载时补上
+*******************************************************************************/
+void ZoneMapRecords(CDBF *cDBF, int firstRow, const char *records, int count)
+{
+    DBFZoneMap *map = cDBF->ZoneMap;
+    if(NULL == map){
+        return;
+    }
+    int recSize = cDBF->Head->RecSize;
+    int i = 0;
+    for(i=0; i<count; i++){
+        int row = firstRow + i;
+        const char *rec = records + (long)i * recSize;
+        if(row > map->Covered + 1){
+            return;
+        }
+        int block = (row - 1) / map->BlockRecs;
+        if(row == map->Covered + 1){
+            if(block == map->BlockCount){
+                if(DBF_SUCCESS != GrowZoneMap(map, block + 1)){
+                    return;
+                }
+                memset(ZONE_ENTRY(map, block), '\0', map->EntrySize);
+                map->BlockCount ++;
+            }
+            ZONE_ENTRY(map, block)->Count ++;
+            ZoneAdd(map, ZONE_ENTRY(map, block), rec, DBF_FALSE);
+            map->Covered ++;
+            map->HeadDirty = DBF_TRUE;
+        }
+        else{
+            //修改已覆盖的记录前先标记为不完整，异常退出后下次加载时重建
+            if((DBF_TRUE == map->Clean) && (DBF_SUCCESS != WriteZoneHead(cDBF, DBF_FALSE))){
+                return;
+            }
+            ZONE_ENTRY(map, block)->Dirty = DBF_TRUE;
+            ZoneAdd(map, ZONE_ENTRY(map, block), rec, DBF_TRUE);
+        }
+        map->Dirty[block] = DBF_TRUE;
+        map->AnyDirty = DBF_TRUE;
+    }
+}
+
+
+/*******************************************************************************
+* Function   : ZoneMapReset
+* Description: Zap后清空区块索引
+* Input      :
+    * cDBF, CDBF结构体指针，没有区块索引时直接返回
+* Output     :
+* Return     :
+* Others     : 文件头在FlushZoneMap时写回
+*******************************************************************************/
+void ZoneMapReset(CDBF *cDBF)
+{
+    DBFZoneMap *map = cDBF->ZoneMap;
+    if(NULL == map){
+        return;
+    }
+    map->BlockCount = 0;
+    map->Covered = 0;
+    map->AnyDirty = DBF_FALSE;
+    memset(map->Dirty, '\0', map->Capacity);
+    map->HeadDirty = DBF_TRUE;
+}
+
+
+/*******************************************************************************
+* Function   : FlushZoneMap
+* Description: 把改过的区块和文件头写回区块索引文件
+* Input      :
+    * cDBF, CDBF结构体指针，没有区块索引时直接返回成功
+* Output     :
+* Return     : 是否写回成功, -1:写回失败; 1:写回成功
+* Others     :
+    * FlushDBF时调用，连续的改过的区块一次写回
+    * 写回前合并文件中其他句柄写回的区块，整个过程持有区块索引文件的OFD写锁
+*******************************************************************************/
+int FlushZoneMap(CDBF *cDBF)
+{
+    DBFZoneMap *map = cDBF->ZoneMap;
+    if((NULL == map) || ((DBF_TRUE != map->AnyDirty) && (DBF_TRUE != map->HeadDirty) && (DBF_TRUE == map->Clean))){
+        return DBF_SUCCESS;
+    }
+    if(DBF_SUCCESS != LockZoneFile(map, F_WRLCK)){
+        return DBF_FAIL;
+    }
+    //其他句柄写回的范围先合并到内存中，改过的区块带着它们写回
+    ZoneFileHead diskHead;
+    if(DBF_SUCCESS == ReadZoneHead(map, &diskHead)){
+        MergeZoneEntries(map, &diskHead, 0, map->BlockCount);
+    }
+    int headSize = ZoneHeadSize(map);
+    int b = 0;
+    while(map->AnyDirty && (b < map->BlockCount)){
+        if(!map->Dirty[b]){
+            b ++;
+            continue;
+        }
+        int end = b;
+        while((end < map->BlockCount) && map->Dirty[end]){
+            map->Dirty[end] = DBF_FALSE;
+            end ++;
+        }
+        long long size = (long long)(end - b) * map->EntrySize;
+        if(DBF_SUCCESS != WriteFull(map->Fd, (char *)ZONE_ENTRY(map, b), size, headSize + (long long)b * map->EntrySize)){
+            #ifdef DEBUG
+            printf("Debug FlushZoneMap pwrite Error, block = %d\n", b);
+            #endif
+            map->Dirty[b] = DBF_TRUE;
+            LockZoneFile(map, F_UNLCK);
+            return DBF_FAIL;
+        }
+        b = end;
+    }
+    map->AnyDirty = DBF_FALSE;
+    int ret = WriteZoneHead(cDBF, DBF_TRUE);
+    if(DBF_SUCCESS == ret){
+        map->HeadDirty = DBF_FALSE;
+        map->Trusted = DBF_TRUE;
+        ZoneSnapshot(cDBF);
+    }
+    LockZoneFile(map, F_UNLCK);
+    return ret;
+}
+
+
+/*******************************************************************************
+* Function   : ZoneMapRefresh
+* Description: 文件中的区块索引或DBF有变化时重新读入，合并其他句柄写回的范围
+* Input      :
+    * cDBF, CDBF结构体指针，没有区块索引时直接返回
+    * force, 为DBF_TRUE时不比较，总是重新读入
+* Output     :
+* Return     :
+* Others     :
+    * Fresh和每次按区块索引跳过之前调用
+    * 读不到文件头、不完整或记录的DBF修改时间、大小和现在不一致时，不再跳过区块
+*******************************************************************************/
+void ZoneMapRefresh(CDBF *cDBF, int force)
+{
+    DBFZoneMap *map = cDBF->ZoneMap;
+    if(NULL == map){
+        return;
+    }
+    long long zmpMTime = 0;
+    long long zmpSize = 0;
+    long long dbfMTime = 0;
+    long long dbfSize = 0;
+    ZoneFileHead head;
+    if(DBF_TRUE != force){
+        ZoneFdStat(map->Fd, &zmpMTime, &zmpSize);
+        ZoneDbfStat(cDBF, &dbfMTime, &dbfSize);
+        if((zmpMTime == map->ZmpMTime) && (zmpSize == map->ZmpSize) && (dbfMTime == map->DbfMTime) && (dbfSize == map->DbfSize)
+            && (DBF_SUCCESS == ReadFull(map->Fd, (char *)&head, sizeof(ZoneFileHead), 0))
+            && (0 == memcmp(&head, &map->DiskHead, sizeof(ZoneFileHead)))){
+            return;
+        }
+    }
+    #ifdef DEBUG
+    printf("Debug ZoneMapRefresh Reload, force = %d\n", force);
+    #endif
+    //读锁保证读到的是其他句柄完整写回的区块
+    if(DBF_SUCCESS != LockZoneFile(map, F_RDLCK)){
+        map->Trusted = DBF_FALSE;
+        return;
+    }
+    int valid = (DBF_SUCCESS == ReadZoneHead(map, &head));
+    if(valid){
+        MergeZoneEntries(map, &head, 0, map->BlockCount);
+    }
+    ZoneDbfStat(cDBF, &dbfMTime, &dbfSize);
+    map->Trusted = valid && (DBF_TRUE == head.Clean) && (head.DbfMTime == dbfMTime) && (head.DbfSize == dbfSize);
+    ZoneSnapshot(cDBF);
+    LockZoneFile(map, F_UNLCK);
+}
+
+
+/*******************************************************************************
+* Function   : CloseZoneMap
+* Description: 释放区块索引，不写回
+* Input      :
+    * cDBF, CDBF结构体指针
+* Output     :
+* Return     :
+* Others     : CloseDBF在FlushDBF之后调用
+*******************************************************************************/
+void CloseZoneMap(CDBF *cDBF)
+{
+    FreeZoneMap(cDBF->ZoneMap);
+    cDBF->ZoneMap = NULL;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : CreateZoneMap
+* Description: 按列名创建空的区块索引，列不存在时返回NULL
+----------------------------------------------------------------------------*/
+DBFZoneMap *CreateZoneMap(CDBF *cDBF, char names[][ZONE_NAME_LEN + 1], int colCount, int blockRecs)
+{
+    DBFZoneMap *map = malloc(sizeof(DBFZoneMap));
+    if(NULL == map){
+        return NULL;
+    }
+    memset(map, '\0', sizeof(DBFZoneMap));
+    map->Fd = -1;
+    map->BlockRecs = blockRecs;
+    map->ColCount = colCount;
+    map->EntrySize = sizeof(ZoneEntry);
+    int i = 0;
+    for(i=0; i<colCount; i++){
+        int index = GetIndexByName(cDBF, names[i]);
+        if(DBF_FAIL == index){
+            #ifdef DEBUG
+            printf("Debug CreateZoneMap Field Not Found, name = %s\n", names[i]);
+            #endif
+            free(map);
+            return NULL;
+        }
+        map->Cols[i].Field = &cDBF->Fields[index];
+        map->Cols[i].Offset = cDBF->FieldOffsets[index];
+        map->Cols[i].Pos = map->EntrySize;
+        map->EntrySize = map->EntrySize + sizeof(ZoneColStat) + 2 * cDBF->Fields[index].Width;
+    }
+    return map;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : FreeZoneMap
+* Description: 关闭区块索引文件并释放内存
+----------------------------------------------------------------------------*/
+void FreeZoneMap(DBFZoneMap *map)
+{
+    if(NULL == map){
+        return;
+    }
+    if(map->Fd >= 0){
+        close(map->Fd);
+    }
+    free(map->Entries);
+    free(map->Dirty);
+    free(map);
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : ZonePath
+* Description: 区块索引文件名，DBF文件名后加".zmp"
+----------------------------------------------------------------------------*/
+void ZonePath(CDBF *cDBF, char *path, int size)
+{
+    snprintf(path, size, "%s.zmp", cDBF->Path);
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : ZoneHeadSize
+* Description: 区块索引文件头和列名的字节数，即第0个区块在文件中的位置
+----------------------------------------------------------------------------*/
+int ZoneHeadSize(DBFZoneMap *map)
+{
+    return sizeof(ZoneFileHead) + map->ColCount * ZONE_NAME_LEN;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : WriteZoneHead
+* Description: 写区块索引文件头和列名，clean为完整标记
+----------------------------------------------------------------------------*/
+int WriteZoneHead(CDBF *cDBF, int clean)
+{
+    DBFZoneMap *map = cDBF->ZoneMap;
+    int size = ZoneHeadSize(map);
+    char buf[size];
+    ZoneFileHead *head = (ZoneFileHead *)buf;
+    memcpy(head->Magic, ZONE_MAGIC, 4);
+    head->Version = ZONE_VERSION;
+    head->BlockRecs = map->BlockRecs;
+    head->ColCount = map->ColCount;
+    head->Covered = map->Covered;
+    head->Clean = clean;
+    head->DataOffset = cDBF->Head->DataOffset;
+    head->RecSize = cDBF->Head->RecSize;
+    ZoneDbfStat(cDBF, &head->DbfMTime, &head->DbfSize);
+    int i = 0;
+    for(i=0; i<map->ColCount; i++){
+        memcpy(buf + sizeof(ZoneFileHead) + i * ZONE_NAME_LEN, map->Cols[i].Field->FieldName, ZONE_NAME_LEN);
+    }
+    if(DBF_SUCCESS != WriteFull(map->Fd, buf, size, 0)){
+        #ifdef DEBUG
+        printf("Debug WriteZoneHead pwrite Error\n");
+        #endif
+        return DBF_FAIL;
+    }
+    map->Clean = clean;
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : GrowZoneMap
+* Description: 保证能容纳blocks个区块，按2倍扩容
+----------------------------------------------------------------------------*/
+int GrowZoneMap(DBFZoneMap *map, int blocks)
+{
+    if(blocks <= map->Capacity){
+        return DBF_SUCCESS;
+    }
+    int capacity = (map->Capacity > 0) ? map->Capacity : 16;
+    while(capacity < blocks){
+        capacity = capacity * 2;
+    }
+    char *entries = realloc(map->Entries, (long)capacity * map->EntrySize);
+    if(NULL == entries){
+        return DBF_FAIL;
+    }
+    map->Entries = entries;
+    unsigned char *dirty = realloc(map->Dirty, capacity);
+    if(NULL == dirty){
+        return DBF_FAIL;
+    }
+    memset(dirty + map->Capacity, '\0', capacity - map->Capacity);
+    map->Dirty = dirty;
+    map->Capacity = capacity;
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : ZoneAdd
+* Description: 把一条记录计入区块统计，widen时只扩大最小值、最大值，不计数
+----------------------------------------------------------------------------*/
+void ZoneAdd(DBFZoneMap *map, ZoneEntry *entry, const char *rec, int widen)
+{
+    if(DELETED == rec[0]){
+        if(!widen){
+            entry->Deleted ++;
+        }
+        return;
+    }
+    int i = 0;
+    for(i=0; i<map->ColCount; i++){
+        ZoneCol *col = &map->Cols[i];
+        ZoneColStat *stat = (ZoneColStat *)((char *)entry + col->Pos);
+        const char *p = rec + col->Offset;
+        int width = col->Field->Width;
+        if(IsBlankField(p, width)){
+            if(!widen){
+                stat->Nulls ++;
+            }
+            continue;
+        }
+        char *min = (char *)(stat + 1);
+        char *max = min + width;
+        if(!stat->HasValue){
+            memcpy(min, p, width);
+            memcpy(max, p, width);
+            stat->HasValue = DBF_TRUE;
+            continue;
+        }
+        if(CompareFieldBytes(col->Field, p, min) < 0){
+            memcpy(min, p, width);
+        }
+        if(CompareFieldBytes(col->Field, p, max) > 0){
+            memcpy(max, p, width);
+        }
+    }
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : ZoneCatchUp
+* Description: 读入覆盖范围之后的记录，按追加计入区块索引
+----------------------------------------------------------------------------*/
+int ZoneCatchUp(CDBF *cDBF)
+{
+    DBFZoneMap *map = cDBF->ZoneMap;
+    int recCount = IntRecCount(cDBF);
+    if(recCount < 0){
+        return DBF_FAIL;
+    }
+    if(map->Covered >= recCount){
+        return DBF_SUCCESS;
+    }
+    int recSize = cDBF->Head->RecSize;
+    int chunk = DBF_SCAN_BLOCK / recSize;
+    if(chunk < map->BlockRecs){
+        chunk = map->BlockRecs;
+    }
+    char *buf = malloc((long)chunk * recSize);
+    if(NULL == buf){
+        return DBF_FAIL;
+    }
+    int fd = fileno(cDBF->FHandle);
+    while(map->Covered < recCount){
+        int first = map->Covered + 1;
+        int count = (recCount - first + 1 > chunk) ? chunk : (recCount - first + 1);
+        long long offset = cDBF->Head->DataOffset + (long long)(first - 1) * recSize;
+        if(DBF_SUCCESS != ReadFull(fd, buf, (long long)count * recSize, offset)){
+            #ifdef DEBUG
+            printf("Debug ZoneCatchUp pread Error, offset = %lld\n", offset);
+            #endif
+            free(buf);
+            return DBF_FAIL;
+        }
+        STATS_ADD(cDBF, siReadCalls, 1);
+        STATS_ADD(cDBF, siBytesRead, (long long)count * recSize);
+        ZoneMapRecords(cDBF, first, buf, count);
+        if(map->Covered != first + count - 1){
+            free(buf);
+            return DBF_FAIL;
+        }
+    }
+    free(buf);
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : LockZoneFile
+* Description: 对整个区块索引文件加OFD锁或解锁，type为F_WRLCK或F_UNLCK
+----------------------------------------------------------------------------*/
+int LockZoneFile(DBFZoneMap *map, int type)
+{
+    struct flock lock;
+    memset(&lock, '\0', sizeof(lock));
+    lock.l_type = type;
+    lock.l_whence = SEEK_SET;
+    if(0 != fcntl(map->Fd, (F_UNLCK == type) ? F_OFD_SETLK : F_OFD_SETLKW, &lock)){
+        #ifdef DEBUG
+        printf("Debug LockZoneFile fcntl Error, type = %d\n", type);
+        #endif
+        return DBF_FAIL;
+    }
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : ReadZoneHead
+* Description: 读入文件中的区块索引文件头，和map的区块大小、列数不一致时返回失败
+----------------------------------------------------------------------------*/
+int ReadZoneHead(DBFZoneMap *map, ZoneFileHead *head)
+{
+    if(DBF_SUCCESS != ReadFull(map->Fd, (char *)head, sizeof(ZoneFileHead), 0)){
+        return DBF_FAIL;
+    }
+    if((0 != memcmp(head->Magic, ZONE_MAGIC, 4)) || (ZONE_VERSION != head->Version)
+        || (head->BlockRecs != map->BlockRecs) || (head->ColCount != map->ColCount) || (head->Covered <= 0)){
+        return DBF_FAIL;
+    }
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : MergeZoneEntries
+* Description: 读入文件中[first, end)区块的统计，把其他句柄写回的最小值、最大值
+    合并到map中，文件中的区块修改过时map中的区块也标记为修改过
+----------------------------------------------------------------------------*/
+void MergeZoneEntries(DBFZoneMap *map, ZoneFileHead *diskHead, int first, int end)
+{
+    int diskBlocks = (diskHead->Covered + map->BlockRecs - 1) / map->BlockRecs;
+    if(end > diskBlocks){
+        end = diskBlocks;
+    }
+    if(first >= end){
+        return;
+    }
+    long long size = (long long)(end - first) * map->EntrySize;
+    char *buf = malloc(size);
+    if((NULL == buf) || (DBF_SUCCESS != ReadFull(map->Fd, buf, size, ZoneHeadSize(map) + (long long)first * map->EntrySize))){
+        free(buf);
+        return;
+    }
+    int b = 0;
+    int i = 0;
+    for(b=first; b<end; b++){
+        ZoneEntry *entry = ZONE_ENTRY(map, b);
+        ZoneEntry *disk = (ZoneEntry *)(buf + (long)(b - first) * map->EntrySize);
+        if(DBF_TRUE == disk->Dirty){
+            entry->Dirty = DBF_TRUE;
+        }
+        for(i=0; i<map->ColCount; i++){
+            ZoneCol *col = &map->Cols[i];
+            ZoneColStat *stat = (ZoneColStat *)((char *)entry + col->Pos);
+            ZoneColStat *diskStat = (ZoneColStat *)((char *)disk + col->Pos);
+            if(!diskStat->HasValue){
+                continue;
+            }
+            int width = col->Field->Width;
+            char *min = (char *)(stat + 1);
+            char *max = min + width;
+            char *diskMin = (char *)(diskStat + 1);
+            char *diskMax = diskMin + width;
+            if(!stat->HasValue){
+                memcpy(min, diskMin, width);
+                memcpy(max, diskMax, width);
+                stat->HasValue = DBF_TRUE;
+                continue;
+            }
+            if(CompareFieldBytes(col->Field, diskMin, min) < 0){
+                memcpy(min, diskMin, width);
+            }
+            if(CompareFieldBytes(col->Field, diskMax, max) > 0){
+                memcpy(max, diskMax, width);
+            }
+        }
+    }
+    free(buf);
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : ZoneDbfStat
+* Description: DBF文件的修改时间(纳秒)和大小，取不到时都为0
+----------------------------------------------------------------------------*/
+void ZoneDbfStat(CDBF *cDBF, long long *mtime, long long *size)
+{
+    *mtime = 0;
+    *size = 0;
+    if(NULL != cDBF->FHandle){
+        ZoneFdStat(fileno(cDBF->FHandle), mtime, size);
+    }
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : ZoneFdStat
+* Description: 文件的修改时间(纳秒)和大小，取不到时都为0
+----------------------------------------------------------------------------*/
+void ZoneFdStat(int fd, long long *mtime, long long *size)
+{
+    struct stat st;
+    *mtime = 0;
+    *size = 0;
+    if(0 == fstat(fd, &st)){
+        *mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+        *size = st.st_size;
+    }
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : ZoneSnapshot
+* Description: 记下文件中的区块索引文件头和两个文件的修改时间、大小，ZoneMapRefresh据此判断有没有变化
+----------------------------------------------------------------------------*/
+void ZoneSnapshot(CDBF *cDBF)
+{
+    DBFZoneMap *map = cDBF->ZoneMap;
+    if(DBF_SUCCESS != ReadFull(map->Fd, (char *)&map->DiskHead, sizeof(ZoneFileHead), 0)){
+        memset(&map->DiskHead, '\0', sizeof(ZoneFileHead));
+    }
+    ZoneFdStat(map->Fd, &map->ZmpMTime, &map->ZmpSize);
+    ZoneDbfStat(cDBF, &map->DbfMTime, &map->DbfSize);
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : PrepareRanges
+* Description: 查找范围条件的列，按列宽度写好上下限，values是写好的值，调用方释放
+----------------------------------------------------------------------------*/
+int PrepareRanges(CDBF *cDBF, DBFRange *ranges, int rangeCount, ZoneRange *out, char **values)
+{
+    *values = NULL;
+    if((rangeCount < 0) || (rangeCount > DBF_ZONE_MAXCOLS)){
+        return DBF_FAIL;
+    }
+    int indexes[DBF_ZONE_MAXCOLS];
+    int total = 0;
+    int i = 0;
+    for(i=0; i<rangeCount; i++){
+        indexes[i] = GetIndexByName(cDBF, ranges[i].FieldName);
+        if(DBF_FAIL == indexes[i]){
+            return DBF_FAIL;
+        }
+        total = total + 2 * cDBF->Fields[indexes[i]].Width;
+    }
+    *values = malloc(total + 1);
+    if(NULL == *values){
+        return DBF_FAIL;
+    }
+    char *p = *values;
+    DBFZoneMap *map = cDBF->ZoneMap;
+    for(i=0; i<rangeCount; i++){
+        DBFField *field = &cDBF->Fields[indexes[i]];
+        out[i].Field = field;
+        out[i].Offset = cDBF->FieldOffsets[indexes[i]];
+        out[i].Low = NULL;
+        out[i].High = NULL;
+        if(NULL != ranges[i].Low){
+            out[i].Low = p;
+            EncodeFieldBytes(field, ranges[i].Low, p);
+            p = p + field->Width;
+        }
+        if(NULL != ranges[i].High){
+            out[i].High = p;
+            EncodeFieldBytes(field, ranges[i].High, p);
+            p = p + field->Width;
+        }
+        out[i].Col = -1;
+        int j = 0;
+        for(j=0; (NULL != map) && (j<map->ColCount); j++){
+            if(map->Cols[j].Offset == out[i].Offset){
+                out[i].Col = j;
+                break;
+            }
+        }
+    }
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : BlockMayMatch
+* Description: 根据区块统计判断区块中是否可能有满足范围条件的记录
+----------------------------------------------------------------------------*/
+int BlockMayMatch(DBFZoneMap *map, ZoneEntry *entry, ZoneRange *ranges, int rangeCount)
+{
+    if((DBF_TRUE != entry->Dirty) && (entry->Deleted == entry->Count)){
+        return DBF_FALSE;
+    }
+    int i = 0;
+    for(i=0; i<rangeCount; i++){
+        ZoneRange *range = &ranges[i];
+        if(range->Col < 0){
+            continue;
+        }
+        ZoneColStat *stat = (ZoneColStat *)((char *)entry + map->Cols[range->Col].Pos);
+        //没有非空值时，修改过的记录也已经扩大到最小值、最大值中
+        if(!stat->HasValue){
+            return DBF_FALSE;
+        }
+        char *min = (char *)(stat + 1);
+        char *max = min + range->Field->Width;
+        if((NULL != range->Low) && (CompareFieldBytes(range->Field, max, range->Low) < 0)){
+            return DBF_FALSE;
+        }
+        if((NULL != range->High) && (CompareFieldBytes(range->Field, min, range->High) > 0)){
+            return DBF_FALSE;
+        }
+    }
+    return DBF_TRUE;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : MatchRanges
+* Description: 判断一条原始记录是否满足所有范围条件
+----------------------------------------------------------------------------*/
+int MatchRanges(ZoneRange *ranges, int rangeCount, const char *rec)
+{
+    int i = 0;
+    for(i=0; i<rangeCount; i++){
+        ZoneRange *range = &ranges[i];
+        const char *p = rec + range->Offset;
+        if(IsBlankField(p, range->Field->Width)){
+            return DBF_FALSE;
+        }
+        if((NULL != range->Low) && (CompareFieldBytes(range->Field, p, range->Low) < 0)){
+            return DBF_FALSE;
+        }
+        if((NULL != range->High) && (CompareFieldBytes(range->Field, p, range->High) > 0)){
+            return DBF_FALSE;
+        }
+    }
+    return DBF_TRUE;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : ScanZoneRanges
+* Description: 跳过不可能匹配的区块，连续的候选区块合并成一次ScanBlocks
+----------------------------------------------------------------------------*/
+int ScanZoneRanges(CDBF *cDBF, ZoneRange *ranges, int rangeCount, int nThreads, DBFBlockCallback callback, void *userData)
+{
+    DBFZoneMap *map = cDBF->ZoneMap;
+    int recCount = IntRecCount(cDBF);
+    if(recCount < 0){
+        return DBF_FAIL;
+    }
+    ZoneMapRefresh(cDBF, DBF_FALSE);
+    if((NULL == map) || (0 == rangeCount) || (DBF_TRUE != map->Trusted)){
+        return ScanBlocks(cDBF, 1, recCount, nThreads, callback, userData);
+    }
+    int runFirst = 0;
+    int b = 0;
+    for(b=0; b<map->BlockCount; b++){
+        int first = b * map->BlockRecs + 1;
+        if(first > recCount){
+            break;
+        }
+        int last = first + map->BlockRecs - 1;
+        if(last > recCount){
+            last = recCount;
+        }
+        //区块中有没覆盖的记录时不能跳过
+        if((last > map->Covered) || BlockMayMatch(map, ZONE_ENTRY(map, b), ranges, rangeCount)){
+            if(0 == runFirst){
+                runFirst = first;
+            }
+            continue;
+        }
+        STATS_ADD(cDBF, siZoneSkips, 1);
+        if((0 != runFirst) && (DBF_SUCCESS != ScanBlocks(cDBF, runFirst, first - 1, nThreads, callback, userData))){
+            return DBF_FAIL;
+        }
+        runFirst = 0;
+    }
+    //区块索引之后的记录都要扫描
+    if(0 == runFirst){
+        runFirst = map->BlockCount * map->BlockRecs + 1;
+    }
+    if(runFirst <= recCount){
+        return ScanBlocks(cDBF, runFirst, recCount, nThreads, callback, userData);
+    }
+    return DBF_SUCCESS;
+}
+
+
+/*----------------------------------------------------------------------------
+* Function   : ExtractBlock
+* Description: ExtractColumn的块回调，取出满足条件的记录的列值，取满时返回失败停止
+----------------------------------------------------------------------------*/
+int ExtractBlock(const char *records, int firstRow, int count, int threadNo, void *userData)
+{
+    ZoneExtract *ctx = (ZoneExtract *)userData;
+    int i = 0;
+    for(i=0; i<count; i++){
+        const char *rec = records + (long)i * ctx->RecSize;
+        if((DELETED == rec[0]) || (DBF_TRUE != MatchRanges(ctx->Ranges, ctx->RangeCount, rec))){
+            continue;
+        }
+        if(ctx->Count >= ctx->MaxCount){
+            ctx->Full = DBF_TRUE;
+            return DBF_FAIL;
+        }
+        memcpy(ctx->Values + (long)ctx->Count * ctx->Width, rec + ctx->Offset, ctx->Width);
+        if(NULL != ctx->Rows){
+            ctx->Rows[ctx->Count] = firstRow + i;
+        }
+        ctx->Count ++;
+    }
+    return DBF_SUCCESS;
+}
@@ -0,0 +1,60 @@
+/*********************************************************************************
+ * Copyright(C), xumenger
+ * FileName     : cZone.h
+ * Author       : xumenger
+ * Version      : V1.0.0
+ * Date         : 2018-10-17
+ * Description  : 区块索引(zone map)，按范围扫描时跳过不可能匹配的记录块
+     1.每BlockRecs条记录为一个区块，对选定的列记录区块内的最小值、最大值和空值个数，
+       以及区块内已删除的记录数
+     2.区块索引保存在DBF文件旁边的"<文件名>.zmp"中，打开DBF时如果存在就自动加载，
+       追加、修改记录时更新，FlushDBF、CloseDBF时写回改过的区块
+     3.加载时区块索引覆盖的记录数比DBF少(其他程序追加过)时，读入剩余的记录补上
+     4.修改记录只扩大最小值、最大值的范围，不减小；空值、删除个数不再准确，不用于跳过
+     5.修改过的区块写回之前区块索引标记为不完整，异常退出后下次加载时重建
+     6.以DBF_OPEN_SHARED_APPEND追加的记录不更新区块索引，下次加载时补上
+     7.DBF的修改时间、大小和写回时不一致(被其他程序修改)时，加载时重建
+     8.多个句柄修改同一个DBF时，写回区块前合并其他句柄已写回的最小值、最大值
+**********************************************************************************/
+#ifndef CZONE_H
+#define CZONE_H
+
+#include "cDBFStruct.h"
+#include "cScan.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//区块索引的列数上限
+#define DBF_ZONE_MAXCOLS 16
+//缺省每个区块的记录数
+#define DBF_ZONE_BLOCK 1024
+
+//范围条件: Low <= FieldName列 <= High，Low或High为NULL表示不限
+//值和SetFieldAsString一样写入列宽度后比较，N、F列按数值比较，空值不满足任何范围
+typedef struct TDBFRange
+{
+    char *FieldName;
+    char *Low;
+    char *High;
+}DBFRange;
+
+int BuildZoneMap(CDBF *cDBF, char **fieldNames, int fieldCount, int blockRecs);
+int DropZoneMap(CDBF *cDBF);
+int ScanZones(CDBF *cDBF, DBFRange *ranges, int rangeCount, int nThreads, DBFBlockCallback callback, void *userData);
+int ExtractColumn(CDBF *cDBF, char *fieldName, DBFRange *ranges, int rangeCount, char *values, int *rows, int maxCount);
+
+//以下供cDBF内部调用
+int LoadZoneMap(CDBF *cDBF);
+void ZoneMapRecords(CDBF *cDBF, int firstRow, const char *records, int count);
+void ZoneMapReset(CDBF *cDBF);
+int FlushZoneMap(CDBF *cDBF);
+void ZoneMapRefresh(CDBF *cDBF, int force);
+void CloseZoneMap(CDBF *cDBF);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
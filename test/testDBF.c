@@ -1,11 +1,122 @@
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <sys/wait.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include "../src/cDBF.h"
+#include "../src/cCache.h"
+#include "../src/cSort.h"
+#include "../src/cAgg.h"
+#include "../src/cJoin.h"
+#include "../src/cWhere.h"
+#include "../src/cZone.h"
+#include "../src/cCodec.h"
+#include "../src/cStream.h"
+#include "../src/cShm.h"
+#include "../src/cLog.h"
+#include "../src/cMonitor.h"
 
 #define ONE_SECOND 1000000
 
+//GoMany的回调，累加age列
+int SumAge(CDBF *cDBF, int rowNo, void *userData)
+{
+    *(long *)userData += GetFieldAsInteger(cDBF, "age");
+    return DBF_SUCCESS;
+}
+
+//GoMany的回调，统计name、job首字母不一致(读到写了一半)的记录
+int CountTorn(CDBF *cDBF, int rowNo, void *userData)
+{
+    char first = GetFieldAsString(cDBF, "name")[0];
+    *(int *)userData += (first != GetFieldAsString(cDBF, "job")[0]);
+    return DBF_SUCCESS;
+}
+
+//HashJoin的回调，统计匹配的记录对和行号相同的记录对
+int CountJoin(const char *buildRec, int buildRow, const char *probeRec, int probeRow, void *userData)
+{
+    int *counts = (int *)userData;
+    counts[0] ++;
+    if(buildRow == probeRow){
+        counts[1] ++;
+    }
+    return DBF_SUCCESS;
+}
+
+//HashJoin的回调，统计匹配的记录对和探测表行号不超过3的记录对
+int CountSmallProbe(const char *buildRec, int buildRow, const char *probeRec, int probeRow, void *userData)
+{
+    int *counts = (int *)userData;
+    counts[0] ++;
+    if(probeRow <= 3){
+        counts[1] ++;
+    }
+    return DBF_SUCCESS;
+}
+
+//子进程把文件写到管道，返回管道的读端，模拟解压程序的输出
+int PipeDBF(char *filePath)
+{
+    int fds[2];
+    if(0 != pipe(fds)){
+        return -1;
+    }
+    //子进程继承stdio缓存，fork前先写出，避免输出重复
+    fflush(stdout);
+    if(0 == fork()){
+        close(fds[0]);
+        FILE *fh = fopen(filePath, "rb");
+        char buf[4096];
+        int n = 0;
+        while((NULL != fh) && ((n = fread(buf, 1, sizeof(buf), fh)) > 0)){
+            if(n != write(fds[1], buf, n)){
+                break;
+            }
+        }
+        _exit(0);
+    }
+    close(fds[1]);
+    return fds[0];
+}
+
+//两个文件内容是否相同
+int SameContent(char *path1, char *path2)
+{
+    FILE *fh1 = fopen(path1, "rb");
+    FILE *fh2 = fopen(path2, "rb");
+    int same = (NULL != fh1) && (NULL != fh2);
+    char buf1[4096];
+    char buf2[4096];
+    while(same){
+        int n1 = fread(buf1, 1, sizeof(buf1), fh1);
+        int n2 = fread(buf2, 1, sizeof(buf2), fh2);
+        same = (n1 == n2) && (0 == memcmp(buf1, buf2, n1));
+        if(n1 <= 0){
+            break;
+        }
+    }
+    if(NULL != fh1){
+        fclose(fh1);
+    }
+    if(NULL != fh2){
+        fclose(fh2);
+    }
+    return same;
+}
+
+//监控的回调，按变化类型计数，counts[0]记录回调时的记录数
+int CountChange(CDBF *cDBF, int event, void *userData)
+{
+    unsigned int *counts = (unsigned int *)userData;
+    counts[event] ++;
+    counts[0] = GetRecCount(cDBF);
+    return DBF_SUCCESS;
+}
+
 int main()
 {
     int i = 0;
@@ -29,6 +140,8 @@ int main()
 
     printf("\n[get Data Message]\n");
     Go(cDBF, 1);
+    //Go只读入原始记录，直接访问Values前需要先解码
+    FetchValues(cDBF);
     for(i=0; i<cDBF->FieldCount; i++){
         printf("filed = %d, name = %s, value = %s\n", i, cDBF->Values[i].Field->FieldName, cDBF->Values[i].ValueBuf);
     }
@@ -90,6 +203,29 @@ int main()
     printf("\n[test Zap]\n");
     Zap(cDBF);
 
+    printf("\n[test StoreValues]\n");
+    //老代码直接修改Values后StoreValues：追加时其他列为空，Set过的列不被覆盖
+    Append(cDBF);
+    SetFieldAsString(cDBF, "name", "first");
+    Post(cDBF);
+    Append(cDBF);
+    strcpy(cDBF->Values[1].ValueBuf, "55");
+    StoreValues(cDBF);
+    Post(cDBF);
+    Go(cDBF, 1);
+    FetchValues(cDBF);
+    SetFieldAsString(cDBF, "job", "stored");
+    Edit(cDBF);
+    StoreValues(cDBF);
+    Post(cDBF);
+    Go(cDBF, 2);
+    char storeName[32];
+    strcpy(storeName, GetFieldAsString(cDBF, "name"));
+    int storeAge = GetFieldAsInteger(cDBF, "age");
+    Go(cDBF, 1);
+    printf("appended name = [%s], age = %d, row 1 job = %s\n", storeName, storeAge, GetFieldAsString(cDBF, "job"));
+    Zap(cDBF);
+
     printf("\n[test Speed]\n");
     struct timeval tvStart, tvEnd;
     gettimeofday(&tvStart, NULL);
@@ -106,6 +242,655 @@ int main()
     int useTime = tvEnd.tv_sec * ONE_SECOND + tvEnd.tv_usec - (tvStart.tv_sec * ONE_SECOND + tvStart.tv_usec); 
     printf("Append 1000 use %d us\n", useTime);   
 
+    printf("\n[test Stats]\n");
+    DBFStats stats;
+    ResetDBFStats(cDBF);
+    for(i=1; i<=1000; i++){
+        Go(cDBF, i);
+    }
+    Fresh(cDBF);
+    if(DBF_SUCCESS == GetDBFStats(cDBF, &stats)){
+        printf("RecordsRead = %llu, BytesRead = %llu, Seeks = %llu, ReadCalls = %llu\n",
+            stats.RecordsRead, stats.BytesRead, stats.Seeks, stats.ReadCalls);
+        for(i=0; i<DBF_HIST_BUCKETS; i++){
+            if(0 != stats.GoHist[i]){
+                printf("Go [%lluns, %lluns) : %llu\n", 1ULL << i, 1ULL << (i + 1), stats.GoHist[i]);
+            }
+        }
+    }
+
+    printf("\n[test GoMany]\n");
+    int rows[1000];
+    for(i=0; i<1000; i++){
+        rows[i] = 1000 - i;
+    }
+    long sumAge = 0;
+    gettimeofday(&tvStart, NULL);
+    int manyCount = GoMany(cDBF, rows, 1000, SumAge, &sumAge);
+    gettimeofday(&tvEnd, NULL);
+    useTime = tvEnd.tv_sec * ONE_SECOND + tvEnd.tv_usec - (tvStart.tv_sec * ONE_SECOND + tvStart.tv_usec);
+    printf("GoMany 1000 use %d us, count = %d, sum age = %ld\n", useTime, manyCount, sumAge);
+
+    printf("\n[test Memory]\n");
+    CDBF *compact1 = OpenDBFEx("./testDbf-dBaseIII.dbf", DBF_OPEN_COMPACT);
+    CDBF *compact2 = OpenDBFEx("./testDbf-dBaseIII.dbf", DBF_OPEN_COMPACT);
+    if((NULL == compact1) || (NULL == compact2)){
+        printf("OpenDBFEx Error\n");
+        return -1;
+    }
+    Go(compact1, 1000);
+    //紧凑句柄各列解码到同一个缓存，先取出再打印
+    char compactName[32];
+    strcpy(compactName, GetFieldAsString(compact1, "name"));
+    int compactAge = GetFieldAsInteger(compact1, "age");
+    printf("compact record 1000, name = %s, age = %d\n", compactName, compactAge);
+    printf("default handle = %d bytes, compact handle = %d bytes, saved = %d bytes per handle\n",
+        GetDBFMemSize(cDBF), GetDBFMemSize(compact1), GetDBFMemSize(cDBF) - GetDBFMemSize(compact1));
+    printf("shared schema = %d bytes, refcount = %d\n", compact1->Schema->Size, compact1->Schema->RefCount);
+    CloseDBF(compact1);
+    CloseDBF(compact2);
+
+    printf("\n[test Cache]\n");
+    gettimeofday(&tvStart, NULL);
+    for(i=0; i<1000; i++){
+        CDBF *opened = OpenDBF("./testDbf-dBaseIII.dbf");
+        CloseDBF(opened);
+    }
+    gettimeofday(&tvEnd, NULL);
+    useTime = tvEnd.tv_sec * ONE_SECOND + tvEnd.tv_usec - (tvStart.tv_sec * ONE_SECOND + tvStart.tv_usec);
+    printf("OpenDBF/CloseDBF 1000 use %d us\n", useTime);
+    gettimeofday(&tvStart, NULL);
+    for(i=0; i<1000; i++){
+        CDBF *cached = OpenCachedDBF("./testDbf-dBaseIII.dbf");
+        if(NULL == cached){
+            printf("OpenCachedDBF Error\n");
+            return -1;
+        }
+        ReleaseCachedDBF(cached);
+    }
+    gettimeofday(&tvEnd, NULL);
+    useTime = tvEnd.tv_sec * ONE_SECOND + tvEnd.tv_usec - (tvStart.tv_sec * ONE_SECOND + tvStart.tv_usec);
+    printf("OpenCachedDBF/ReleaseCachedDBF 1000 use %d us, cache = %ld bytes\n", useTime, GetDBFCacheMemSize());
+    CDBF *cached = OpenCachedDBF("./testDbf-dBaseIII.dbf");
+    printf("cached record 1, name = %s\n", GetFieldAsString(cached, "name"));
+    ReleaseCachedDBF(cached);
+    ClearDBFCache();
+
+    printf("\n[test Sort]\n");
+    for(i=1; i<=1000; i++){
+        Go(cDBF, i);
+        Edit(cDBF);
+        SetFieldAsInteger(cDBF, "age", (i * 37) % 1000 - 500);
+        Post(cDBF);
+    }
+    DBFSortKey sortKeys[2] = {{"age", 0}, {"name", 1}};
+    gettimeofday(&tvStart, NULL);
+    //内存预算只有8KB，强制写临时文件并多趟归并
+    int sortResult = SortDBF(cDBF, "./testSort.dbf", sortKeys, 2, 8 * 1024, 2);
+    gettimeofday(&tvEnd, NULL);
+    useTime = tvEnd.tv_sec * ONE_SECOND + tvEnd.tv_usec - (tvStart.tv_sec * ONE_SECOND + tvStart.tv_usec);
+    CDBF *sorted = OpenDBF("./testSort.dbf");
+    if((DBF_SUCCESS != sortResult) || (NULL == sorted)){
+        printf("SortDBF Error\n");
+        return -1;
+    }
+    int ordered = DBF_TRUE;
+    int prevAge = -1000;
+    for(i=1; i<=sorted->Head->RecCount; i++){
+        Go(sorted, i);
+        if(GetFieldAsInteger(sorted, "age") < prevAge){
+            ordered = DBF_FALSE;
+        }
+        prevAge = GetFieldAsInteger(sorted, "age");
+    }
+    Go(sorted, 1);
+    printf("SortDBF 1000 use %d us, count = %d, ordered = %d, first age = %d\n",
+        useTime, sorted->Head->RecCount, ordered, GetFieldAsInteger(sorted, "age"));
+    CloseDBF(sorted);
+    remove("./testSort.dbf");
+
+    printf("\n[test Aggregate]\n");
+    DBFAggSpec aggSpecs[5] = {{aggCount, NULL}, {aggSum, "age"}, {aggMin, "age"}, {aggMax, "age"}, {aggAvg, "float"}};
+    gettimeofday(&tvStart, NULL);
+    DBFAggResult *agg = AggregateDBF(cDBF, NULL, 0, aggSpecs, 5, 4);
+    gettimeofday(&tvEnd, NULL);
+    useTime = tvEnd.tv_sec * ONE_SECOND + tvEnd.tv_usec - (tvStart.tv_sec * ONE_SECOND + tvStart.tv_usec);
+    if(NULL == agg){
+        printf("AggregateDBF Error\n");
+        return -1;
+    }
+    DBFAggValue *aggValues = agg->Rows[0].Values;
+    printf("AggregateDBF use %d us, count = %lld, sum age = %lld, min age = %s, max age = %s, avg float = %.2f\n",
+        useTime, aggValues[0].Count, aggValues[1].Sum, aggValues[2].Raw, aggValues[3].Raw, aggValues[4].Value);
+    FreeAggResult(agg);
+    char *groupBy[1] = {"age"};
+    agg = AggregateDBF(cDBF, groupBy, 1, aggSpecs, 2, 2);
+    if(NULL == agg){
+        printf("AggregateDBF Error\n");
+        return -1;
+    }
+    printf("group by age, groups = %d, first key = [%s], last key = [%s]\n",
+        agg->RowCount, agg->Rows[0].Key, agg->Rows[agg->RowCount - 1].Key);
+    FreeAggResult(agg);
+
+    printf("\n[test HashJoin]\n");
+    int joinCounts[2] = {0, 0};
+    gettimeofday(&tvStart, NULL);
+    int joinResult = HashJoin(cDBF, "age", cDBF, "age", joinInner, 1024 * 1024, 2, CountJoin, joinCounts);
+    gettimeofday(&tvEnd, NULL);
+    useTime = tvEnd.tv_sec * ONE_SECOND + tvEnd.tv_usec - (tvStart.tv_sec * ONE_SECOND + tvStart.tv_usec);
+    printf("HashJoin in memory use %d us, result = %d, matched = %d, same row = %d\n", useTime, joinResult, joinCounts[0], joinCounts[1]);
+    joinCounts[0] = 0;
+    joinCounts[1] = 0;
+    //内存预算只有16KB，强制分区连接
+    joinResult = HashJoin(cDBF, "age", cDBF, "age", joinLeftOuter, 16 * 1024, 2, CountJoin, joinCounts);
+    printf("HashJoin partitioned result = %d, matched = %d, same row = %d\n", joinResult, joinCounts[0], joinCounts[1]);
+    //构建表较大时内部交换，回调参数仍按调用时的顺序
+    CreateDBFLike(cDBF, "./testJoinSmall.dbf");
+    CDBF *smallDBF = OpenDBF("./testJoinSmall.dbf");
+    for(i=1; i<=3; i++){
+        Go(cDBF, i);
+        AppendRecords(smallDBF, cDBF->ValueBuf, 1);
+    }
+    FlushDBF(smallDBF);
+    joinCounts[0] = 0;
+    joinCounts[1] = 0;
+    joinResult = HashJoin(cDBF, "age", smallDBF, "age", joinInner, 1024 * 1024, 2, CountSmallProbe, joinCounts);
+    printf("HashJoin larger build result = %d, matched = %d, probe rows in small table = %d\n", joinResult, joinCounts[0], joinCounts[1]);
+    CloseDBF(smallDBF);
+    remove("./testJoinSmall.dbf");
+
+    printf("\n[test Optimistic Read]\n");
+    CDBF *reader = OpenDBFEx("./testDbf-dBaseIII.dbf", DBF_OPEN_OPTIMISTIC);
+    if(NULL == reader){
+        printf("OpenDBFEx Optimistic Error\n");
+        return -1;
+    }
+    Go(reader, 1);
+    Edit(reader);
+    SetFieldAsString(reader, "name", "AAAAAAAAAA");
+    SetFieldAsString(reader, "job", "AAAAAAAAAA");
+    Post(reader);
+    fflush(stdout);
+    pid_t writerPid = fork();
+    if(0 == writerPid){
+        //子进程不停地把第1行的name、job同时改为全A或全B
+        CDBF *writer = OpenDBFEx("./testDbf-dBaseIII.dbf", DBF_OPEN_OPTIMISTIC);
+        for(i=0; i<2000; i++){
+            Go(writer, 1);
+            Edit(writer);
+            SetFieldAsString(writer, "name", (i % 2) ? "BBBBBBBBBB" : "AAAAAAAAAA");
+            SetFieldAsString(writer, "job", (i % 2) ? "BBBBBBBBBB" : "AAAAAAAAAA");
+            Post(writer);
+        }
+        CloseDBF(writer);
+        _exit(0);
+    }
+    int torn = 0;
+    int reads = 0;
+    while(0 == waitpid(writerPid, NULL, WNOHANG)){
+        Go(reader, 1);
+        char first = GetFieldAsString(reader, "name")[0];
+        if(first != GetFieldAsString(reader, "job")[0]){
+            torn ++;
+        }
+        int tornRow = 1;
+        if(1 != GoMany(reader, &tornRow, 1, CountTorn, &torn)){
+            torn ++;
+        }
+        reads ++;
+    }
+    Fresh(reader);
+    printf("optimistic reads done = %d, torn = %d, reccount = %d\n", reads > 0, torn, reader->Head->RecCount);
+    CloseDBF(reader);
+    //写方在一批写中退出，序号停在奇数，读方检查写锁后修复
+    fflush(stdout);
+    writerPid = fork();
+    if(0 == writerPid){
+        CDBF *writer = OpenDBFEx("./testDbf-dBaseIII.dbf", DBF_OPEN_OPTIMISTIC);
+        BeginWriteBatch(writer);
+        _exit(0);
+    }
+    waitpid(writerPid, NULL, 0);
+    reader = OpenDBFEx("./testDbf-dBaseIII.dbf", DBF_OPEN_OPTIMISTIC);
+    int goRet = (NULL != reader) ? Go(reader, 1) : DBF_FAIL;
+    printf("after writer exited in a batch: open = %d, go = %d, seq even = %d\n",
+        NULL != reader, goRet, (NULL != reader) && (0 == (*reader->Seq & 1)));
+    CloseDBF(reader);
+
+    printf("\n[test Shared Append]\n");
+    Fresh(cDBF);
+    int before = cDBF->Head->RecCount;
+    pid_t appenders[4];
+    fflush(stdout);
+    for(i=0; i<4; i++){
+        appenders[i] = fork();
+        if(0 == appenders[i]){
+            //每个子进程逐条追加50条、再批量追加50条，job列写进程序号
+            char job[16];
+            sprintf(job, "proc%d", i);
+            CDBF *appender = OpenDBFEx("./testDbf-dBaseIII.dbf", DBF_OPEN_SHARED_APPEND);
+            int j = 0;
+            for(j=0; j<50; j++){
+                Append(appender);
+                SetFieldAsString(appender, "job", job);
+                Post(appender);
+            }
+            //Post后行缓存仍是刚追加的记录，复制50份批量追加
+            int recSize = appender->Head->RecSize;
+            char batch[50 * recSize];
+            for(j=0; j<50; j++){
+                memcpy(batch + j * recSize, appender->ValueBuf, recSize);
+            }
+            AppendRecords(appender, batch, 50);
+            CloseDBF(appender);
+            _exit(0);
+        }
+    }
+    for(i=0; i<4; i++){
+        waitpid(appenders[i], NULL, 0);
+    }
+    Fresh(cDBF);
+    int perProc[4] = {0, 0, 0, 0};
+    for(i=before+1; i<=cDBF->Head->RecCount; i++){
+        Go(cDBF, i);
+        char *job = GetFieldAsString(cDBF, "job");
+        if((0 == strncmp(job, "proc", 4)) && (job[4] >= '0') && (job[4] <= '3')){
+            perProc[job[4] - '0'] ++;
+        }
+    }
+    printf("shared append added = %d, per process = %d %d %d %d\n", cDBF->Head->RecCount - before,
+        perProc[0], perProc[1], perProc[2], perProc[3]);
+
+    printf("\n[test Shared Append Recover]\n");
+    //预留计数多出3个位置且没有追加方持有，模拟分配后异常退出的追加方
+    CreateDBFLike(cDBF, "./testAppendRecover.dbf");
+    CDBF *recover = OpenDBFEx("./testAppendRecover.dbf", DBF_OPEN_SHARED_APPEND);
+    unsigned int abandoned = 3;
+    int recoverFd = open("./testAppendRecover.dbf", O_RDWR);
+    pwrite(recoverFd, &abandoned, sizeof(abandoned), 20);
+    close(recoverFd);
+    Go(cDBF, 1);
+    int recoverRet = AppendRecords(recover, cDBF->ValueBuf, 1);
+    int recoverDeleted = 0;
+    for(i=1; i<=recover->Head->RecCount; i++){
+        Go(recover, i);
+        recoverDeleted = recoverDeleted + (DELETED == recover->deleted);
+    }
+    printf("append after abandoned slots = %d, reccount = %d, deleted = %d\n", recoverRet, recover->Head->RecCount, recoverDeleted);
+    CloseDBF(recover);
+    remove("./testAppendRecover.dbf");
+
+    printf("\n[test UpdateWhere]\n");
+    int expectUpdate = 0;
+    int expectDelete = 0;
+    for(i=1; i<=cDBF->Head->RecCount; i++){
+        Go(cDBF, i);
+        int age = GetFieldAsInteger(cDBF, "age");
+        if((DELETED != cDBF->deleted) && (age >= 400)){
+            expectUpdate ++;
+            expectDelete = expectDelete + (age > 450);
+        }
+    }
+    DBFWhere ageWhere[1] = {{"age", whereGe, "400"}};
+    DBFAssign jobAssign[1] = {{"job", "repriced"}};
+    int updated = UpdateWhere(cDBF, ageWhere, 1, jobAssign, 1);
+    DBFWhere jobWhere[2] = {{"job", whereEq, "repriced"}, {"age", whereGt, "450"}};
+    int deleted = DeleteWhere(cDBF, jobWhere, 2);
+    int repriced = 0;
+    int marked = 0;
+    for(i=1; i<=cDBF->Head->RecCount; i++){
+        Go(cDBF, i);
+        repriced = repriced + (0 == strcmp(GetFieldAsString(cDBF, "job"), "repriced"));
+        marked = marked + (DELETED == cDBF->deleted);
+    }
+    printf("UpdateWhere updated = %d/%d, repriced = %d, DeleteWhere deleted = %d/%d, marked = %d\n",
+        updated, expectUpdate, repriced, deleted, expectDelete, marked);
+    printf("UpdateWhere again updated = %d\n", UpdateWhere(cDBF, ageWhere, 1, jobAssign, 1));
+
+    printf("\n[test Zone Map]\n");
+    char *zoneFields[1] = {"age"};
+    BuildZoneMap(cDBF, zoneFields, 1, 64);
+    int expectZone = 0;
+    for(i=1; i<=cDBF->Head->RecCount; i++){
+        Go(cDBF, i);
+        int age = GetFieldAsInteger(cDBF, "age");
+        expectZone = expectZone + ((DELETED != cDBF->deleted) && (age >= 400) && (age <= 499));
+    }
+    DBFRange ageRange[1] = {{"age", "400", "499"}};
+    char ages[1500 * 3];
+    int ageRows[1500];
+    ResetDBFStats(cDBF);
+    int extracted = ExtractColumn(cDBF, "age", ageRange, 1, ages, ageRows, 1500);
+    GetDBFStats(cDBF, &stats);
+    printf("ExtractColumn 400~499 extracted = %d/%d, skipped blocks = %llu\n", extracted, expectZone, stats.ZoneSkips);
+    //追加、修改后区块索引随之更新
+    Append(cDBF);
+    SetFieldAsInteger(cDBF, "age", 999);
+    Post(cDBF);
+    Go(cDBF, 5);
+    Edit(cDBF);
+    SetFieldAsInteger(cDBF, "age", 950);
+    Post(cDBF);
+    //本句柄的修改写回前文件中的区块索引和DBF不一致，不跳过区块
+    FlushDBF(cDBF);
+    DBFRange highRange[1] = {{"age", "900", NULL}};
+    ResetDBFStats(cDBF);
+    extracted = ExtractColumn(cDBF, "age", highRange, 1, ages, ageRows, 1500);
+    GetDBFStats(cDBF, &stats);
+    printf("ExtractColumn >=900 extracted = %d, first row = %d, skipped blocks = %llu\n", extracted, ageRows[0], stats.ZoneSkips);
+    CDBF *zoneDBF = OpenDBF("./testDbf-dBaseIII.dbf");
+    printf("reopen ExtractColumn >=900 extracted = %d\n", ExtractColumn(zoneDBF, "age", highRange, 1, ages, ageRows, 1500));
+    //两个句柄修改同一个区块，后写回的合并先写回的范围
+    Go(zoneDBF, 70);
+    Edit(zoneDBF);
+    SetFieldAsInteger(zoneDBF, "age", 998);
+    Post(zoneDBF);
+    FlushDBF(zoneDBF);
+    //另一个句柄写回后，Fresh重新读入区块索引，不会跳过被扩大范围的区块
+    DBFRange mergeRange[1] = {{"age", "998", "998"}};
+    Fresh(cDBF);
+    printf("other handle flushed, Fresh age = 998 extracted = %d\n", ExtractColumn(cDBF, "age", mergeRange, 1, ages, ageRows, 1500));
+    Go(cDBF, 75);
+    Edit(cDBF);
+    SetFieldAsInteger(cDBF, "age", 100);
+    Post(cDBF);
+    FlushDBF(cDBF);
+    CDBF *mergeDBF = OpenDBF("./testDbf-dBaseIII.dbf");
+    printf("two handles flushed, age = 998 extracted = %d, reopen extracted = %d\n",
+        ExtractColumn(cDBF, "age", mergeRange, 1, ages, ageRows, 1500), ExtractColumn(mergeDBF, "age", mergeRange, 1, ages, ageRows, 1500));
+    CloseDBF(mergeDBF);
+    DropZoneMap(zoneDBF);
+    CloseDBF(zoneDBF);
+    DropZoneMap(cDBF);
+
+    printf("\n[test GBK UTF-8]\n");
+    CDBF *gbkDBF = OpenDBFEx("./testDbf-dBaseIII.dbf", DBF_OPEN_GBK);
+    Go(gbkDBF, 2);
+    Edit(gbkDBF);
+    SetFieldAsUTF8(gbkDBF, "name", "张三abc");
+    Post(gbkDBF);
+    Go(gbkDBF, 2);
+    char *gbkRaw = gbkDBF->ValueBuf + gbkDBF->FieldOffsets[0];
+    printf("SetFieldAsUTF8 gbk bytes = %d, GetFieldAsUTF8 = %s\n",
+        0 == memcmp(gbkRaw, "\xD5\xC5\xC8\xFD" "abc", 7), GetFieldAsUTF8(gbkDBF, "name"));
+    char names[3 * 256];
+    char arena[3 * 256 * 3];
+    char *utf8Names[3];
+    DBFRange rowRange[1] = {{"name", NULL, NULL}};
+    int nameCount = ExtractColumn(gbkDBF, "name", rowRange, 1, names, NULL, 3);
+    ColumnToUTF8(gbkDBF, names, nameCount, gbkDBF->Fields[0].Width, arena, sizeof(arena), utf8Names);
+    printf("ColumnToUTF8 count = %d, second = %s\n", nameCount, utf8Names[1]);
+    //码表中没有的四字节字符走iconv，反复转换复用同一个描述符
+    char emoji[1000 * 4];
+    char emojiGBK[1000 * 4];
+    char emojiBack[1000 * 4];
+    for(i=0; i<1000; i++){
+        memcpy(emoji + i * 4, "\xF0\x9F\x98\x80", 4);
+    }
+    int emojiLen = UTF8ToGBK(emoji, sizeof(emoji), emojiGBK, sizeof(emojiGBK));
+    int backLen = GBKToUTF8(emojiGBK, emojiLen, emojiBack, sizeof(emojiBack));
+    printf("GB18030 4-byte x1000: gb18030 = %d, round trip = %d\n",
+        (emojiLen == sizeof(emojiGBK)) && (0 == memcmp(emojiGBK + 3996, "\x94\x39\xFC\x36", 4)),
+        (backLen == sizeof(emoji)) && (0 == memcmp(emoji, emojiBack, sizeof(emoji))));
+    CloseDBF(gbkDBF);
+
+    printf("\n[test Stream]\n");
+    FlushDBF(cDBF);
+    long fileAge = 0;
+    for(i=1; i<=cDBF->Head->RecCount; i++){
+        Go(cDBF, i);
+        fileAge = fileAge + GetFieldAsInteger(cDBF, "age");
+    }
+    int streamFd = PipeDBF("./testDbf-dBaseIII.dbf");
+    CDBF *streamDBF = OpenDBFStream(streamFd, DBF_OPEN_DEFAULT);
+    long streamAge = 0;
+    int streamRows = 0;
+    for(i=First(streamDBF); i>0; i=Next(streamDBF)){
+        streamAge = streamAge + GetFieldAsInteger(streamDBF, "age");
+        streamRows ++;
+    }
+    printf("stream Next rows = %d/%d, sum age = %ld/%ld, Go back = %d\n",
+        streamRows, cDBF->Head->RecCount, streamAge, fileAge, Go(streamDBF, 1));
+    CloseDBF(streamDBF);
+    close(streamFd);
+    wait(NULL);
+    streamFd = PipeDBF("./testDbf-dBaseIII.dbf");
+    streamDBF = OpenDBFStream(streamFd, DBF_OPEN_DEFAULT);
+    agg = AggregateDBF(cDBF, NULL, 0, aggSpecs, 2, 4);
+    DBFAggResult *streamAgg = AggregateDBF(streamDBF, NULL, 0, aggSpecs, 2, 4);
+    printf("stream AggregateDBF count = %lld/%lld, sum age = %lld/%lld, Post = %d\n",
+        streamAgg->Rows[0].Values[0].Count, agg->Rows[0].Values[0].Count,
+        streamAgg->Rows[0].Values[1].Sum, agg->Rows[0].Values[1].Sum, Post(streamDBF));
+    FreeAggResult(streamAgg);
+    FreeAggResult(agg);
+    CloseDBF(streamDBF);
+    close(streamFd);
+    wait(NULL);
+    //提前关闭，预读线程阻塞在管道上也能退出
+    streamFd = PipeDBF("./testDbf-dBaseIII.dbf");
+    streamDBF = OpenDBFStream(streamFd, DBF_OPEN_DEFAULT);
+    const char *streamRecs = NULL;
+    int streamFirst = 0;
+    int batchCount = NextStreamBatch(streamDBF, &streamRecs, &streamFirst);
+    printf("NextStreamBatch first row = %d, count = %d, RecNo = %d, SortDBF = %d\n", streamFirst, batchCount, streamDBF->RecNo,
+        SortDBF(streamDBF, "./testSort.dbf", sortKeys, 2, 8 * 1024, 2));
+    CloseDBF(streamDBF);
+    close(streamFd);
+    wait(NULL);
+
+    printf("\n[test Shared Memory]\n");
+    int shmGen = PublishSharedDBF("testDBF_shm", cDBF);
+    CDBF *shmDBF = AttachSharedDBF("testDBF_shm");
+    long shmAge = 0;
+    for(i=First(shmDBF); i>0; i=Next(shmDBF)){
+        shmAge = shmAge + GetFieldAsInteger(shmDBF, "age");
+    }
+    printf("publish gen = %d, attach rows = %d/%d, sum age = %ld/%ld, Post = %d\n",
+        shmGen, shmDBF->Head->RecCount, cDBF->Head->RecCount, shmAge, fileAge, Post(shmDBF));
+    //重新发布后读方Fresh才切换到新版本
+    Append(cDBF);
+    SetFieldAsInteger(cDBF, "age", 77);
+    Post(cDBF);
+    shmGen = PublishSharedDBF("testDBF_shm", cDBF);
+    int staleRows = shmDBF->Head->RecCount;
+    int stale = IsSharedDBFStale(shmDBF);
+    Fresh(shmDBF);
+    Last(shmDBF);
+    printf("republish gen = %d, stale = %d, rows before Fresh = %d, after = %d, last age = %d\n",
+        shmGen, stale, staleRows, shmDBF->Head->RecCount, GetFieldAsInteger(shmDBF, "age"));
+    CloseDBF(shmDBF);
+    UnpublishSharedDBF("testDBF_shm");
+
+    printf("\n[test Change Log]\n");
+    //主文件和副本都由CreateDBFLike新建，之后副本只通过日志更新
+    CreateDBFLike(cDBF, "./testPrimary.dbf");
+    CreateDBFLike(cDBF, "./testReplica.dbf");
+    unlink("./testReplica.dbf.seq");
+    CDBF *primary = OpenDBF("./testPrimary.dbf");
+    OpenChangeLog(primary, "./testPrimary.log1");
+    for(i=1; i<=300; i++){
+        Go(cDBF, i);
+        AppendRecords(primary, cDBF->ValueBuf, 1);
+    }
+    Zap(primary);
+    for(i=1; i<=200; i++){
+        Go(cDBF, i);
+        AppendRecords(primary, cDBF->ValueBuf, 1);
+    }
+    Go(primary, 10);
+    Edit(primary);
+    SetFieldAsString(primary, "job", "replicated");
+    Post(primary);
+    Go(primary, 11);
+    Delete(primary);
+    Post(primary);
+    UpdateWhere(primary, ageWhere, 1, jobAssign, 1);
+    //切换日志段，序号接着编
+    OpenChangeLog(primary, "./testPrimary.log2");
+    Append(primary);
+    SetFieldAsInteger(primary, "age", 321);
+    Post(primary);
+    //日志先于记录写出，FlushDBF之前日志文件中已经有这次追加
+    struct stat logStat;
+    stat("./testPrimary.log2", &logStat);
+    int logAhead = (logStat.st_size > 32);
+    FlushDBF(primary);
+    unsigned long long logSeq = GetChangeLogSeq(primary);
+    CloseDBF(primary);
+    int early = ApplyChangeLog("./testPrimary.log2", "./testReplica.dbf");
+    int applied1 = ApplyChangeLog("./testPrimary.log1", "./testReplica.dbf");
+    int applied2 = ApplyChangeLog("./testPrimary.log2", "./testReplica.dbf");
+    int again = ApplyChangeLog("./testPrimary.log1", "./testReplica.dbf");
+    printf("log seq = %llu, log2 first = %d, applied = %d + %d, again = %d, replica seq = %llu, same file = %d, log before flush = %d\n",
+        logSeq, early, applied1, applied2, again, GetAppliedSeq("./testReplica.dbf"),
+        SameContent("./testPrimary.dbf", "./testReplica.dbf"), logAhead);
+    remove("./testPrimary.dbf");
+    remove("./testPrimary.log1");
+    remove("./testPrimary.log2");
+    remove("./testReplica.dbf");
+    remove("./testReplica.dbf.seq");
+
+    printf("\n[test Large File]\n");
+    //稀疏文件：记录数超过INT_MAX，数据区约264GB，只有写过的记录占用磁盘
+    unsigned int bigCount = 3000000000U;
+    CreateDBFLike(cDBF, "./testLarge.dbf");
+    FILE *bigFh = fopen("./testLarge.dbf", "r+b");
+    fseeko(bigFh, 4, SEEK_SET);
+    fwrite(&bigCount, sizeof(bigCount), 1, bigFh);
+    fflush(bigFh);
+    ftruncate(fileno(bigFh), cDBF->Head->DataOffset + (off_t)cDBF->Head->RecSize * bigCount);
+    fclose(bigFh);
+    CDBF *bigDBF = OpenDBF("./testLarge.dbf");
+    //int行号的方法不截断，直接失败；超过INT_MAX的行通过GoRow访问
+    int lastRet = Last(bigDBF);
+    int bigManyRow = 1;
+    int bigMany = GoMany(bigDBF, &bigManyRow, 1, SumAge, &sumAge);
+    int bigScan = ScanZones(bigDBF, NULL, 0, 1, NULL, NULL);
+    GoRow(bigDBF, bigCount);
+    Edit(bigDBF);
+    SetFieldAsInteger(bigDBF, "age", 4321);
+    Post(bigDBF);
+    GoRow(bigDBF, 2500000000U);
+    Edit(bigDBF);
+    SetFieldAsInteger(bigDBF, "age", 2500);
+    Post(bigDBF);
+    Append(bigDBF);
+    SetFieldAsInteger(bigDBF, "age", 1);
+    Post(bigDBF);
+    CloseDBF(bigDBF);
+    bigDBF = OpenDBF("./testLarge.dbf");
+    GoRow(bigDBF, 2500000000U);
+    int midAge = GetFieldAsInteger(bigDBF, "age");
+    GoRow(bigDBF, GetRecCount(bigDBF) - 1);
+    int priorRet = Prior(bigDBF);
+    int priorAge = GetFieldAsInteger(bigDBF, "age");
+    printf("Last = %d, GoMany = %d, ScanZones = %d, RecCount = %u, row 2500000000 age = %d, Prior = %d, GetRecNo = %u, age = %d\n",
+        lastRet, bigMany, bigScan, GetRecCount(bigDBF), midAge, priorRet, GetRecNo(bigDBF), priorAge);
+    CloseDBF(bigDBF);
+    remove("./testLarge.dbf");
+    //空文件没有当前行，Edit、Delete、Post都失败，不会写到回绕的偏移
+    CreateDBFLike(cDBF, "./testEmpty.dbf");
+    CDBF *emptyDBF = OpenDBF("./testEmpty.dbf");
+    int emptyEdit = Edit(emptyDBF);
+    SetFieldAsString(emptyDBF, "name", "none");
+    int emptyPost = Post(emptyDBF);
+    int emptyDelete = Delete(emptyDBF);
+    CloseDBF(emptyDBF);
+    FILE *emptyFh = fopen("./testEmpty.dbf", "rb");
+    fseeko(emptyFh, 0, SEEK_END);
+    printf("empty file Edit = %d, Post = %d, Delete = %d, size = data offset: %d\n",
+        emptyEdit, emptyPost, emptyDelete, ftello(emptyFh) <= cDBF->Head->DataOffset + 1);
+    fclose(emptyFh);
+    remove("./testEmpty.dbf");
+
+    printf("\n[test Monitor]\n");
+    //三个文件分别追加、原位修改、rename替换，各阶段之间留出合并窗口
+    char *watchPaths[3] = {"./testWatch1.dbf", "./testWatch2.dbf", "./testWatch3.dbf"};
+    unsigned int watchCounts[3][4];
+    memset(watchCounts, '\0', sizeof(watchCounts));
+    CDBF *writers[3];
+    DBFMonitor *monitor = CreateDBFMonitor(16, 2, 20);
+    int watchIds[3];
+    for(i=0; i<3; i++){
+        CreateDBFLike(cDBF, watchPaths[i]);
+        writers[i] = OpenDBF(watchPaths[i]);
+        int j = 0;
+        for(j=1; j<=5; j++){
+            Go(cDBF, j);
+            AppendRecords(writers[i], cDBF->ValueBuf, 1);
+        }
+        FlushDBF(writers[i]);
+    }
+    for(i=0; i<3; i++){
+        watchIds[i] = WatchDBF(monitor, OpenDBF(watchPaths[i]), CountChange, watchCounts[i]);
+    }
+    for(i=1; i<=100; i++){
+        Go(cDBF, i);
+        AppendRecords(writers[0], cDBF->ValueBuf, 1);
+    }
+    FlushDBF(writers[0]);
+    usleep(ONE_SECOND / 10);
+    Go(writers[1], 3);
+    Edit(writers[1]);
+    SetFieldAsString(writers[1], "job", "watched");
+    Post(writers[1]);
+    FlushDBF(writers[1]);
+    usleep(ONE_SECOND / 10);
+    CreateDBFLike(cDBF, "./testWatch3.tmp");
+    rename("./testWatch3.tmp", watchPaths[2]);
+    usleep(ONE_SECOND / 10);
+    CDBF *unwatched = UnwatchDBF(monitor, watchIds[1]);
+    printf("ids = %d %d %d, append = %u (rec %u), update = %u (rec %u), rewrite = %u (rec %u), others = %u, unwatch = %d\n",
+        watchIds[0], watchIds[1], watchIds[2],
+        watchCounts[0][DBF_EVENT_APPEND], watchCounts[0][0],
+        watchCounts[1][DBF_EVENT_UPDATE], watchCounts[1][0],
+        watchCounts[2][DBF_EVENT_REWRITE], watchCounts[2][0],
+        watchCounts[0][DBF_EVENT_UPDATE] + watchCounts[0][DBF_EVENT_REWRITE] + watchCounts[1][DBF_EVENT_APPEND]
+            + watchCounts[1][DBF_EVENT_REWRITE] + watchCounts[2][DBF_EVENT_UPDATE] + watchCounts[2][DBF_EVENT_APPEND],
+        NULL != unwatched);
+    CloseDBF(unwatched);
+    CloseDBFMonitor(monitor);
+    for(i=0; i<3; i++){
+        CloseDBF(writers[i]);
+        remove(watchPaths[i]);
+    }
+
+    printf("\n[test Dirty Post]\n");
+    //修改只写Set过的列，删除只写删除标记，文件头推迟到FlushDBF
+    CreateDBFLike(cDBF, "./testDirty.dbf");
+    CDBF *dirtyDBF = OpenDBF("./testDirty.dbf");
+    for(i=1; i<=3; i++){
+        Go(cDBF, i);
+        AppendRecords(dirtyDBF, cDBF->ValueBuf, 1);
+    }
+    FlushDBF(dirtyDBF);
+    Go(dirtyDBF, 2);
+    ResetDBFStats(dirtyDBF);
+    Edit(dirtyDBF);
+    SetFieldAsInteger(dirtyDBF, "age", 77);
+    SetFieldAsString(dirtyDBF, "job", "dirty");
+    Post(dirtyDBF);
+    GetDBFStats(dirtyDBF, &stats);
+    printf("edit age, job: bytes = %llu, writes = %llu, head writes = %llu\n", stats.BytesWritten, stats.WriteCalls, stats.HeadWrites);
+    Go(dirtyDBF, 3);
+    ResetDBFStats(dirtyDBF);
+    Delete(dirtyDBF);
+    Post(dirtyDBF);
+    FlushDBF(dirtyDBF);
+    GetDBFStats(dirtyDBF, &stats);
+    printf("delete: bytes = %llu, head writes after flush = %llu\n", stats.BytesWritten - sizeof(DBFHead), stats.HeadWrites);
+    CDBF *checkDBF = OpenDBF("./testDirty.dbf");
+    Go(checkDBF, 2);
+    int dirtyAge = GetFieldAsInteger(checkDBF, "age");
+    char *dirtyJob = GetFieldAsString(checkDBF, "job");
+    printf("reopen row 2 age = %d, job = %s, ", dirtyAge, dirtyJob);
+    Go(checkDBF, 3);
+    printf("row 3 deleted = %d\n", DELETED == checkDBF->deleted);
+    CloseDBF(checkDBF);
+    CloseDBF(dirtyDBF);
+    remove("./testDirty.dbf");
+
     printf("\n[start CloseDBF]\n");
     CloseDBF(cDBF);
 
@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <string.h>
+#include "../src/cDBF.hpp"
+#include "../src/cScan.h"
+
+//testDbf-dBaseIII.dbf的表结构
+DBF_FIELD(Name, "name", 'C', 20, 0);
+DBF_FIELD(Age, "age", 'N', 8, 0);
+DBF_FIELD(Birthday, "birthday", 'D', 8, 0);
+DBF_FIELD(Job, "job", 'C', 20, 0);
+DBF_FIELD(Bool, "bool", 'L', 1, 0);
+DBF_FIELD(Float, "float", 'N', 10, 5);
+DBF_FIELD(Other, "other", 'C', 20, 0);
+typedef cdbf::Schema<Name, Age, Birthday, Job, Bool, Float, Other> Person;
+
+//和Person的Age宽度不同
+DBF_FIELD(ShortAge, "age", 'N', 3, 0);
+typedef cdbf::Schema<Name, ShortAge, Birthday, Job, Bool, Float, Other> BadPerson;
+
+//ScanBlocks的回调，按表结构直接读原始记录累加age列
+int SumAges(const char *records, int firstRow, int count, int threadNo, void *userData)
+{
+    for(int i=0; i<count; i++){
+        cdbf::ConstRecord<Person> rec(records + (long)i * Person::RecSize);
+        *(long long *)userData += rec.Get<Age>();
+    }
+    return DBF_SUCCESS;
+}
+
+int main()
+{
+    printf("[test Start]\n");
+
+    printf("\n[test Schema Binding]\n");
+    cdbf::Table<Person> table;
+    cdbf::Table<BadPerson> badTable;
+    printf("RecSize = %d, float offset = %d, open = %d, bad schema open = %d\n",
+        Person::RecSize, Person::Pos<Float>::Offset, table.Open("./testDbf-dBaseIII.dbf"), badTable.Open("./testDbf-dBaseIII.dbf"));
+    long long typedAge = 0;
+    long long cAge = 0;
+    int same = 0;
+    for(int i=table.First(); i>0; i=table.Next()){
+        typedAge = typedAge + table.Get<Age>();
+        cAge = cAge + GetFieldAsInteger(table.Handle(), (char *)"age");
+        same = same + (table.Get<Name>() == GetFieldAsString(table.Handle(), (char *)"name"));
+    }
+    long long scanAge = 0;
+    ScanBlocks(table.Handle(), 1, (int)table.RecCount(), 2, SumAges, &scanAge);
+    printf("sum age typed = %lld, GetFieldAsInteger = %lld, ScanBlocks = %lld, same name = %d/%u\n",
+        typedAge, cAge, scanAge, same, table.RecCount());
+
+    table.Go(2);
+    table.Edit();
+    int overflow = table.Set<Age>(123456789LL);
+    table.Set<Age>(-42);
+    table.Set<Float>(3.14159);
+    table.Set<Birthday>(20181019);
+    table.Set<Bool>(true);
+    table.Set<Job>("typed");
+    table.Post();
+    table.Go(2);
+    printf("overflow set = %d, age = %lld/%d, float = %.5f/%.5f, birthday = %d, bool = %d, job = %s\n",
+        overflow, table.Get<Age>(), GetFieldAsInteger(table.Handle(), (char *)"age"),
+        table.Get<Float>(), GetFieldAsFloat(table.Handle(), (char *)"float"),
+        table.Get<Birthday>(), table.Get<Bool>(), table.Get<Job>().c_str());
+    //类型化的Set和C的Set方法混用，Post时两列都写回
+    table.Go(1);
+    table.Edit();
+    table.Set<Age>(77);
+    SetFieldAsString(table.Handle(), (char *)"job", (char *)"mixed");
+    table.Post();
+    table.Close();
+    table.Open("./testDbf-dBaseIII.dbf");
+    table.Go(1);
+    printf("mixed set after reopen: age = %lld, job = %s\n", table.Get<Age>(), table.Get<Job>().c_str());
+    table.Close();
+
+    printf("\n[test Finish]\n\n");
+    return 0;
+}